@@ -0,0 +1,622 @@
+// Benchmarks: the layer passes (forward, backward, update) over a sweep of shapes, then end-to-end training
+// and inference on synthetic MNIST-shaped data, so no dataset is needed.
+//   ./nn_bench [--quick] [--threads <n>] [--json <file>] [--baseline <file>] [--threshold <fraction>]
+// --json writes the results (one per line); --baseline compares the medians with such a file and exits
+// with status 1 when a benchmark is slower than the baseline by more than the threshold (default 0.10).
+// The p99 is over individually timed operations; whole-epoch and whole-set results have none ("-", null in JSON).
+#include "nnLayer.h"
+#include "nnNetwork.h"
+#include "nnKernels.h"
+#include "nnTrain.h"
+#include "nnInference.h"
+#include "nnPlan.h"
+#include "nnOptimizer.h"
+#include "nnProfile.h"
+#include "nnDataset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define MAX_RESULTS 128
+#define MAX_SAMPLES 2000
+#define MIN_SAMPLE_SECONDS 50e-6 // every timed sample repeats the operation until it lasts at least this long
+#define TAIL_MIN_CALLS 300       // individually timed calls behind a p99, more when they fit in TAIL_SECONDS
+#define TAIL_SECONDS 0.25
+#define SYNTHETIC_DENSITY 0.19   // non-zero pixels of an MNIST digit, on average
+
+typedef struct BenchResult
+{
+    char name[32];
+    char shape[48];
+    double median_us; // per operation (per sample for the end-to-end benchmarks)
+    double p99_us;    // of individually timed operations, negative when the benchmark only measures throughput
+    double gflops;
+    double bytes_per_sample;
+    double samples_per_second;
+} BenchResult;
+
+typedef struct BenchShape
+{
+    int neurons;
+    int inputs;
+    int batch;
+} BenchShape;
+
+static const BenchShape shapes[] = {
+    {64, 784, 1}, {64, 784, 32}, {64, 784, 256}, {32, 64, 32}, {10, 32, 32},
+    {256, 256, 32}, {256, 256, 256}, {1024, 1024, 32},
+};
+
+// state of one layer benchmark, passed to the timed operations
+typedef struct BenchLayer
+{
+    nnLayer *layer;
+    int batch;
+    nnReal *input;
+    nnReal *output;
+    nnReal *delta;      // gradients from the next layer, restored before every backward pass
+    nnReal *delta_copy; // overwritten by the backward pass
+    nnReal *input_gradient;
+    nnReal *gradient;
+    nnOptimizer *optimizer;
+    long step;
+} BenchLayer;
+
+typedef void (*BenchOperation)(void *arg);
+
+static BenchResult results[MAX_RESULTS];
+static int result_count = 0;
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// sorts the samples, returns the median and stores the 99th percentile
+static double percentiles(double *samples, int count, double *p99)
+{
+    qsort(samples, count, sizeof(double), compare_doubles);
+    int index = (int)(0.99 * count + 0.5) - 1;
+    *p99 = samples[index < 0 ? 0 : (index >= count ? count - 1 : index)];
+    return samples[count / 2];
+}
+
+// times 'count' samples of the operation, each one repeated enough times to be measurable; returns their median in
+// seconds. With 'p99', also times at least TAIL_MIN_CALLS single calls and stores their 99th percentile.
+static double time_operation(BenchOperation operation, void *arg, int count, double *p99)
+{
+    double samples[MAX_SAMPLES];
+    if (count > MAX_SAMPLES)
+        count = MAX_SAMPLES;
+
+    // warm-up, then the repetitions per sample
+    double start = nnNowSeconds();
+    operation(arg);
+    int repeat = 1;
+    double once = nnNowSeconds() - start;
+    if (once < MIN_SAMPLE_SECONDS)
+        repeat = (int)(MIN_SAMPLE_SECONDS / (once > 1e-9 ? once : 1e-9)) + 1;
+
+    for (int s = 0; s < count; s++)
+    {
+        start = nnNowSeconds();
+        for (int r = 0; r < repeat; r++)
+            operation(arg);
+        samples[s] = (nnNowSeconds() - start) / repeat;
+    }
+    double unused;
+    double median = percentiles(samples, count, &unused);
+    if (p99 == NULL)
+        return median;
+
+    int calls = (int)(TAIL_SECONDS / (median > 1e-9 ? median : 1e-9));
+    calls = calls < TAIL_MIN_CALLS ? TAIL_MIN_CALLS : (calls > MAX_SAMPLES ? MAX_SAMPLES : calls);
+    for (int s = 0; s < calls; s++)
+    {
+        start = nnNowSeconds();
+        operation(arg);
+        samples[s] = nnNowSeconds() - start;
+    }
+    percentiles(samples, calls, p99);
+    return median;
+}
+
+static BenchResult *add_result(const char *name, const char *shape, double median, double p99, double flops, double bytes, int samples)
+{
+    if (result_count == MAX_RESULTS)
+    {
+        fprintf(stderr, "Too many benchmark results\n");
+        exit(1);
+    }
+    BenchResult *result = &results[result_count++];
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    snprintf(result->shape, sizeof(result->shape), "%s", shape);
+    result->median_us = median * 1e6;
+    result->p99_us = p99 >= 0.0 ? p99 * 1e6 : -1.0;
+    result->gflops = flops / median * 1e-9;
+    result->bytes_per_sample = bytes / samples;
+    result->samples_per_second = samples / median;
+    return result;
+}
+
+static void fill_random(nnReal *x, size_t count, double scale)
+{
+    for (size_t i = 0; i < count; i++)
+        x[i] = (nnReal)(((double)rand() / RAND_MAX - 0.5) * scale);
+}
+
+// training output (epoch statistics) is not part of the benchmark report
+static int quiet_stdout(void)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+    {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+}
+
+static void restore_stdout(int saved)
+{
+    fflush(stdout);
+    if (saved >= 0)
+    {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+// LAYER BENCHMARKS
+
+static void run_forward(void *arg)
+{
+    BenchLayer *b = (BenchLayer *)arg;
+    nnLayerForwardBatch(b->layer, b->input, b->output, b->batch);
+}
+
+// the same work as a training step: clear the gradient, then the backward pass of a hidden layer
+static void run_backward(void *arg)
+{
+    BenchLayer *b = (BenchLayer *)arg;
+    int out_stride = nnPaddedCount(b->layer->neuron_count);
+    memcpy(b->delta_copy, b->delta, (size_t)b->batch * out_stride * sizeof(nnReal));
+    memset(b->gradient, 0, nnLayerParamCount(b->layer) * sizeof(nnReal));
+    nnLayerBackwardBatch(b->layer, b->input, b->output, b->delta_copy, b->input_gradient, b->gradient, b->batch);
+}
+
+static void run_update(void *arg)
+{
+    BenchLayer *b = (BenchLayer *)arg;
+    nnOptimizerUpdate(b->optimizer, b->layer, 0, b->gradient, 1e-6, (nnReal)1 / b->batch, ++b->step, 0, nnLayerParamCount(b->layer));
+}
+
+static void bench_layers(int quick)
+{
+    int samples = quick ? 21 : 101;
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        BenchShape shape = shapes[s];
+        BenchLayer b;
+        memset(&b, 0, sizeof(b));
+        b.layer = nnCreateLayer(shape.neurons, shape.inputs, ACTIVATION_SIGMOID);
+        if (b.layer == NULL)
+            exit(1);
+        init_layer_random(b.layer);
+        b.batch = shape.batch;
+        size_t in_size = (size_t)shape.batch * nnPaddedCount(shape.inputs);
+        size_t out_size = (size_t)shape.batch * nnPaddedCount(shape.neurons);
+        b.input = (nnReal *)nnAlignedAlloc(in_size * sizeof(nnReal));
+        b.output = (nnReal *)nnAlignedAlloc(out_size * sizeof(nnReal));
+        b.delta = (nnReal *)nnAlignedAlloc(out_size * sizeof(nnReal));
+        b.delta_copy = (nnReal *)nnAlignedAlloc(out_size * sizeof(nnReal));
+        b.input_gradient = (nnReal *)nnAlignedAlloc(in_size * sizeof(nnReal));
+        b.gradient = (nnReal *)nnAlignedAlloc(nnLayerParamCount(b.layer) * sizeof(nnReal));
+        if (!b.input || !b.output || !b.delta || !b.delta_copy || !b.input_gradient || !b.gradient)
+        {
+            fprintf(stderr, "Memory allocation failed for the %dx%d benchmark\n", shape.neurons, shape.inputs);
+            exit(1);
+        }
+        fill_random(b.input, in_size, 2.0);
+        fill_random(b.delta, out_size, 0.2);
+        nnLayerForwardBatch(b.layer, b.input, b.output, b.batch);
+
+        char name[48];
+        snprintf(name, sizeof(name), "%dx%dx%d", shape.neurons, shape.inputs, shape.batch);
+        double p99, median, flops, bytes;
+
+        median = time_operation(run_forward, &b, samples, &p99);
+        nnProfileLayerWork(b.layer, 1, NN_PROFILE_FORWARD, b.batch, sizeof(nnReal), &flops, &bytes);
+        add_result("forward", name, median, p99, flops, bytes, b.batch);
+
+        median = time_operation(run_backward, &b, samples, &p99);
+        nnProfileLayerWork(b.layer, 1, NN_PROFILE_BACKWARD, b.batch, sizeof(nnReal), &flops, &bytes);
+        add_result("backward", name, median, p99, flops, bytes, b.batch);
+
+        // the updates only need a gradient, the one left by the backward benchmark
+        nnOptimizerType types[3] = {NN_OPTIMIZER_SGD, NN_OPTIMIZER_MOMENTUM, NN_OPTIMIZER_ADAM};
+        nnNetwork single; // the optimizers only need the layer shapes
+        memset(&single, 0, sizeof(single));
+        single.layers[0] = b.layer;
+        single.layer_count = 1;
+        for (int t = 0; t < 3; t++)
+        {
+            nnOptimizerConfig config = nnDefaultOptimizerConfig(types[t]);
+            b.optimizer = nnCreateOptimizer(&single, &config);
+            if (b.optimizer == NULL)
+                exit(1);
+            b.step = 0;
+            char update_name[32];
+            snprintf(update_name, sizeof(update_name), "update-%s", nnOptimizerName(types[t]));
+            median = time_operation(run_update, &b, samples, &p99);
+            nnProfileUpdateWork(nnLayerParamCount(b.layer), b.optimizer->arrays, 1, &flops, &bytes);
+            add_result(update_name, name, median, p99, flops, bytes, b.batch);
+            nnFreeOptimizer(b.optimizer);
+        }
+
+        nnAlignedFree(b.input);
+        nnAlignedFree(b.output);
+        nnAlignedFree(b.delta);
+        nnAlignedFree(b.delta_copy);
+        nnAlignedFree(b.input_gradient);
+        nnAlignedFree(b.gradient);
+        nnFreeLayer(b.layer);
+    }
+}
+
+// END-TO-END BENCHMARKS
+
+// MNIST-shaped samples: 28x28 pixels, about SYNTHETIC_DENSITY of them non-zero, 10 random labels
+static nnDataset *synthetic_dataset(int count)
+{
+    nnDataset *dataset = (nnDataset *)calloc(1, sizeof(nnDataset));
+    if (dataset == NULL)
+        return NULL;
+    dataset->count = count;
+    dataset->rows = 28;
+    dataset->cols = 28;
+    dataset->input_count = 28 * 28;
+    dataset->label_count = 10;
+    size_t pixel_bytes = (size_t)count * dataset->input_count;
+    uint8_t *buffer = (uint8_t *)nnAlignedAlloc(pixel_bytes + count);
+    if (buffer == NULL)
+    {
+        free(dataset);
+        return NULL;
+    }
+    for (size_t i = 0; i < pixel_bytes; i++)
+        buffer[i] = (double)rand() / RAND_MAX < SYNTHETIC_DENSITY ? (uint8_t)(1 + rand() % 255) : 0;
+    for (int i = 0; i < count; i++)
+        buffer[pixel_bytes + i] = (uint8_t)(rand() % 10);
+    dataset->pixels = buffer;
+    dataset->labels = buffer + pixel_bytes;
+    dataset->buffer = buffer;
+    return dataset;
+}
+
+// the network of main.c: 784 -> 64 (sparse input) -> 32 -> 10 softmax
+static nnNetwork *mnist_network(void)
+{
+    nnNetwork *network = nnCreateNetwork();
+    nnLayer *hidden = nnCreateLayer(64, 784, ACTIVATION_SIGMOID);
+    nnLayer *hidden_2 = nnCreateLayer(32, 64, ACTIVATION_SIGMOID);
+    nnLayer *output = nnCreateLayer(10, 32, ACTIVATION_SOFTMAX);
+    if (network == NULL || hidden == NULL || hidden_2 == NULL || output == NULL)
+        exit(1);
+    init_layer_random(hidden);
+    init_layer_random(hidden_2);
+    init_layer_random(output);
+    nnSetSparseInput(hidden, 1);
+    addLayerToNetwork(network, hidden);
+    addLayerToNetwork(network, hidden_2);
+    addLayerToNetwork(network, output);
+    return network;
+}
+
+// work of one sample through the network, forward only or a whole training step (batch_size samples per update)
+static void network_work(const nnNetwork *network, int training, int batch_size, int optimizer_arrays, double *flops, double *bytes)
+{
+    *flops = 0;
+    *bytes = 0;
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        double f, b;
+        nnProfileLayerWork(network->layers[l], l, NN_PROFILE_FORWARD, batch_size, sizeof(nnReal), &f, &b);
+        *flops += f / batch_size;
+        *bytes += b / batch_size;
+        if (!training)
+            continue;
+        nnProfileLayerWork(network->layers[l], l, NN_PROFILE_BACKWARD, batch_size, sizeof(nnReal), &f, &b);
+        *flops += f / batch_size;
+        *bytes += b / batch_size;
+        nnProfileUpdateWork(nnLayerParamCount(network->layers[l]), optimizer_arrays, 1, &f, &b);
+        *flops += f / batch_size;
+        *bytes += b / batch_size;
+    }
+}
+
+typedef struct BenchPredict
+{
+    const nnNetwork *network;
+    nnInferenceContext *context;
+    nnPlan *plan;
+    const nnReal *inputs;
+    nnReal *outputs;
+    int count;
+} BenchPredict;
+
+static void run_predict_batch(void *arg)
+{
+    BenchPredict *p = (BenchPredict *)arg;
+    predictBatchWithContext(p->network, p->context, p->inputs, p->count, p->outputs);
+}
+
+static void run_plan_batch(void *arg)
+{
+    BenchPredict *p = (BenchPredict *)arg;
+    nnPlanPredictBatch(p->plan, p->inputs, p->count, p->outputs);
+}
+
+static void bench_end_to_end(int quick, int threads)
+{
+    int count = quick ? 4096 : 16384;
+    int batch_size = 32;
+    nnDataset *dataset = synthetic_dataset(count);
+    nnNetwork *network = mnist_network();
+    if (dataset == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the synthetic dataset\n");
+        exit(1);
+    }
+    char shape[48];
+    double flops, bytes, p99, median;
+
+    // training: one epoch per sample, the time per training sample; whole epochs say nothing of the tail of one step
+    nnTrainConfig config = nnDefaultTrainConfig();
+    config.learning_rate = 0.005;
+    config.optimizer = nnDefaultOptimizerConfig(NN_OPTIMIZER_ADAM);
+    config.loss = NN_LOSS_CROSS_ENTROPY;
+    config.epochs = 1;
+    config.batch_size = batch_size;
+    config.threads = threads;
+    int repetitions = quick ? 3 : 7;
+    double epochs[MAX_SAMPLES];
+    for (int r = 0; r <= repetitions; r++)
+    {
+        int saved = quiet_stdout();
+        double start = nnNowSeconds();
+        trainDatasetWithConfig(network, dataset, &config);
+        double seconds = nnNowSeconds() - start;
+        restore_stdout(saved);
+        if (r > 0) // the first epoch is a warm-up
+            epochs[r - 1] = seconds / count;
+    }
+    median = percentiles(epochs, repetitions, &p99);
+    network_work(network, 1, batch_size, nnOptimizerArrays(config.optimizer.type), &flops, &bytes);
+    snprintf(shape, sizeof(shape), "mnist-b%d-t%d", batch_size, threads);
+    add_result("train-adam", shape, median, -1.0, flops, bytes, 1);
+
+    // batched inference over the whole set, the time per sample (throughput only, the single-sample runs below have the p99)
+    BenchPredict p;
+    p.network = network;
+    p.count = count;
+    p.context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    nnReal *inputs = (nnReal *)malloc((size_t)count * 784 * sizeof(nnReal));
+    p.outputs = (nnReal *)malloc((size_t)count * 10 * sizeof(nnReal));
+    if (p.context == NULL || inputs == NULL || p.outputs == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the inference benchmark\n");
+        exit(1);
+    }
+    nnDatasetGatherInputs(dataset, 0, count, inputs, 784);
+    p.inputs = inputs;
+    median = time_operation(run_predict_batch, &p, quick ? 5 : 21, NULL);
+    network_work(network, 0, p.context->max_batch, 0, &flops, &bytes);
+    snprintf(shape, sizeof(shape), "mnist-tile%d", p.context->max_batch);
+    add_result("predict-batch", shape, median / count, -1.0, flops, bytes, 1);
+
+    // the same through a compiled execution plan with the same tile
+    p.plan = nnCompilePlan(network, p.context->max_batch);
+    if (p.plan == NULL)
+        exit(1);
+    median = time_operation(run_plan_batch, &p, quick ? 5 : 21, NULL);
+    add_result("plan-batch", shape, median / count, -1.0, flops, bytes, 1);
+
+    // single-sample latency: every prediction timed on its own
+    nnInferenceContext *single = nnCreateInferenceContext(network);
+    if (single == NULL)
+        exit(1);
+    int latency_count = count < MAX_SAMPLES ? count : MAX_SAMPLES;
+    double latencies[MAX_SAMPLES];
+    for (int i = 0; i < latency_count; i++)
+    {
+        double start = nnNowSeconds();
+        predictWithContext(network, single, inputs + (size_t)i * 784, p.outputs);
+        latencies[i] = nnNowSeconds() - start;
+    }
+    median = percentiles(latencies, latency_count, &p99);
+    network_work(network, 0, 1, 0, &flops, &bytes);
+    add_result("predict-single", "mnist", median, p99, flops, bytes, 1);
+
+    nnPlan *single_plan = nnCompilePlan(network, 1);
+    if (single_plan == NULL)
+        exit(1);
+    for (int i = 0; i < latency_count; i++)
+    {
+        double start = nnNowSeconds();
+        nnPlanPredict(single_plan, inputs + (size_t)i * 784, p.outputs);
+        latencies[i] = nnNowSeconds() - start;
+    }
+    median = percentiles(latencies, latency_count, &p99);
+    add_result("plan-single", "mnist", median, p99, flops, bytes, 1);
+
+    nnFreePlan(single_plan);
+    nnFreePlan(p.plan);
+    nnFreeInferenceContext(single);
+    nnFreeInferenceContext(p.context);
+    free(inputs);
+    free(p.outputs);
+    nnFreeNetwork(network);
+    nnFreeDataset(dataset);
+}
+
+// REPORT
+
+static const char *precision_name(void)
+{
+    return sizeof(nnReal) == sizeof(float) ? "float" : "double";
+}
+
+static int write_json(const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to create %s\n", filename);
+        return 1;
+    }
+    fprintf(file, "{\"precision\": \"%s\", \"kernels\": \"%s\", \"results\": [\n", precision_name(), nnKernelLevelName(nnGetKernelLevel()));
+    for (int i = 0; i < result_count; i++)
+    {
+        const BenchResult *r = &results[i];
+        char p99[32];
+        if (r->p99_us >= 0.0)
+            snprintf(p99, sizeof(p99), "%.4f", r->p99_us);
+        else
+            snprintf(p99, sizeof(p99), "null");
+        fprintf(file, "  {\"name\": \"%s\", \"shape\": \"%s\", \"median_us\": %.4f, \"p99_us\": %s, \"gflops\": %.4f, "
+                      "\"bytes_per_sample\": %.1f, \"samples_per_second\": %.1f}%s\n",
+                r->name, r->shape, r->median_us, p99, r->gflops, r->bytes_per_sample, r->samples_per_second,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "]}\n");
+    fclose(file);
+    return 0;
+}
+
+// Reads the medians of a file written by write_json (one result per line). Returns the number of
+// results read, -1 when the file cannot be opened.
+static int read_baseline(const char *filename, BenchResult *baseline, int max)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Unable to open the baseline %s\n", filename);
+        return -1;
+    }
+    char line[512];
+    int count = 0;
+    while (count < max && fgets(line, sizeof(line), file) != NULL)
+    {
+        BenchResult *r = &baseline[count];
+        if (sscanf(line, " {\"name\": \"%31[^\"]\", \"shape\": \"%47[^\"]\", \"median_us\": %lf", r->name, r->shape, &r->median_us) == 3)
+            count++;
+        else if (strstr(line, "\"precision\"") != NULL && strstr(line, precision_name()) == NULL)
+            fprintf(stderr, "The baseline was built with another precision\n");
+    }
+    fclose(file);
+    return count;
+}
+
+static const BenchResult *find_result(const BenchResult *list, int count, const BenchResult *key)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(list[i].name, key->name) == 0 && strcmp(list[i].shape, key->shape) == 0)
+            return &list[i];
+    }
+    return NULL;
+}
+
+// prints the table, against the baseline when there is one; returns the number of regressions
+static int print_results(const BenchResult *baseline, int baseline_count, double threshold)
+{
+    printf("\n%-16s %-18s %12s %12s %10s %14s %14s %s\n", "benchmark", "shape", "median us", "p99 us", "GFLOP/s",
+           "bytes/sample", "samples/s", baseline != NULL ? "vs baseline" : "");
+    int regressions = 0;
+    for (int i = 0; i < result_count; i++)
+    {
+        const BenchResult *r = &results[i];
+        char p99[32];
+        if (r->p99_us >= 0.0)
+            snprintf(p99, sizeof(p99), "%.3f", r->p99_us);
+        else
+            snprintf(p99, sizeof(p99), "-");
+        printf("%-16s %-18s %12.3f %12s %10.2f %14.0f %14.0f", r->name, r->shape, r->median_us, p99, r->gflops,
+               r->bytes_per_sample, r->samples_per_second);
+        const BenchResult *base = baseline != NULL ? find_result(baseline, baseline_count, r) : NULL;
+        if (base != NULL && base->median_us > 0)
+        {
+            double change = r->median_us / base->median_us - 1.0;
+            int regression = change > threshold;
+            regressions += regression;
+            printf(" %+7.1f%%%s", change * 100.0, regression ? " REGRESSION" : "");
+        }
+        else if (baseline != NULL)
+        {
+            printf("     (new)");
+        }
+        printf("\n");
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv)
+{
+    int quick = 0;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *json = NULL;
+    const char *baseline_file = NULL;
+    double threshold = 0.10;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = 1;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            json = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baseline_file = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--quick] [--threads <n>] [--json <file>] [--baseline <file>] [--threshold <fraction>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1)
+        threads = 1;
+
+    // the same inputs and weights on every run
+    srand(1);
+    printf("Benchmarks (%s, %s kernels, %d training threads)%s\n", precision_name(), nnKernelLevelName(nnGetKernelLevel()), threads,
+           quick ? ", quick" : "");
+    bench_layers(quick);
+    bench_end_to_end(quick, threads);
+
+    static BenchResult baseline[MAX_RESULTS];
+    int baseline_count = 0;
+    if (baseline_file != NULL)
+    {
+        baseline_count = read_baseline(baseline_file, baseline, MAX_RESULTS);
+        if (baseline_count < 0)
+            return 2;
+    }
+    int regressions = print_results(baseline_file != NULL ? baseline : NULL, baseline_count, threshold);
+    if (json != NULL && write_json(json) != 0)
+        return 2;
+    if (regressions > 0)
+    {
+        printf("%d benchmark(s) slower than the baseline by more than %.0f%%\n", regressions, threshold * 100.0);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,257 @@
+// Ahead-of-time compiler: turns a model written by nnDumpNetwork into a standalone C source file (nnCodegen.h).
+//   ./nn_codegen <model> <output.c> [--prefix <name>] [--float | --double]
+//   ./nn_codegen --verify <model> <generated.c> <dataset> [--prefix <name>] [--tolerance <t>] [--cc <compiler>]
+// --verify builds the generated file as a shared object, runs it on every sample of the dataset (a binary
+// .nnds file or a CSV, see nnDataset.h) and compares its outputs with predict. It exits with status 1 when
+// an output differs by more than the tolerance (default 1e-9 for double, 1e-4 when float is involved).
+#include "nnNetwork.h"
+#include "nnCodegen.h"
+#include "nnDataset.h"
+#include <dlfcn.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MODEL_BAK "trained_network.bin"
+
+typedef void (*GeneratedPredict)(const void *input, void *output);
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s <model> <output.c> [--prefix <name>] [--float | --double]\n", program);
+    fprintf(stderr, "       %s --verify <model> <generated.c> <dataset> [--prefix <name>] [--tolerance <t>] [--cc <compiler>]\n", program);
+}
+
+static nnDataset *load_dataset(const char *filename, int input_count, int label_count)
+{
+    size_t length = strlen(filename);
+    if (length > 4 && strcmp(filename + length - 4, ".csv") == 0)
+        return nnLoadCsvDataset(filename, 1, input_count, label_count, 0);
+    return nnMapDataset(filename);
+}
+
+static int index_of_max(const nnReal *values, int n)
+{
+    int best = 0;
+    for (int i = 1; i < n; i++)
+    {
+        if (values[i] > values[best])
+            best = i;
+    }
+    return best;
+}
+
+// compiles 'source' into a temporary shared object and loads it, the file is removed once loaded
+static void *load_generated(const char *source, const char *compiler)
+{
+    char library[] = "/tmp/nn_codegen_XXXXXX";
+    int fd = mkstemp(library);
+    if (fd < 0)
+    {
+        perror("mkstemp");
+        return NULL;
+    }
+    close(fd);
+
+    char command[4096];
+    snprintf(command, sizeof(command), "%s -O2 -shared -fPIC -o '%s' '%s' -lm", compiler, library, source);
+    printf("%s\n", command);
+    if (system(command) != 0)
+    {
+        fprintf(stderr, "Compilation of %s failed\n", source);
+        unlink(library);
+        return NULL;
+    }
+    void *handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+        fprintf(stderr, "Cannot load the generated model: %s\n", dlerror());
+    unlink(library);
+    return handle;
+}
+
+static void *find_symbol(void *handle, const char *prefix, const char *name)
+{
+    char symbol[256];
+    snprintf(symbol, sizeof(symbol), "%s_%s", prefix, name);
+    void *address = dlsym(handle, symbol);
+    if (address == NULL)
+        fprintf(stderr, "Symbol %s not found in the generated model\n", symbol);
+    return address;
+}
+
+static int verify(const char *model, const char *source, const char *dataset_file, const char *prefix, double tolerance,
+                  const char *compiler)
+{
+    nnNetwork *network = nnLoadNetwork(model);
+    if (network == NULL)
+    {
+        return 1;
+    }
+    int input_count = network->layers[0]->input_count;
+    int output_count = network->layers[network->layer_count - 1]->neuron_count;
+    void *handle = load_generated(source, compiler);
+    nnDataset *dataset = handle != NULL ? load_dataset(dataset_file, input_count, output_count) : NULL;
+    if (dataset == NULL || dataset->input_count != input_count)
+    {
+        if (dataset != NULL)
+            fprintf(stderr, "The dataset has %d inputs per sample, the model %d\n", dataset->input_count, input_count);
+        nnFreeDataset(dataset);
+        if (handle != NULL)
+            dlclose(handle);
+        nnFreeNetwork(network);
+        return 1;
+    }
+
+    GeneratedPredict generated = (GeneratedPredict)find_symbol(handle, prefix, "predict");
+    const int *inputs_symbol = (const int *)find_symbol(handle, prefix, "input_count");
+    const int *outputs_symbol = (const int *)find_symbol(handle, prefix, "output_count");
+    const int *size_symbol = (const int *)find_symbol(handle, prefix, "real_size");
+    int status = 1;
+    if (generated == NULL || inputs_symbol == NULL || outputs_symbol == NULL || size_symbol == NULL)
+        goto done;
+    if (*inputs_symbol != input_count || *outputs_symbol != output_count ||
+        (*size_symbol != (int)sizeof(float) && *size_symbol != (int)sizeof(double)))
+    {
+        fprintf(stderr, "The generated model (%d -> %d) does not match %s (%d -> %d)\n", *inputs_symbol, *outputs_symbol, model,
+                input_count, output_count);
+        goto done;
+    }
+    if (tolerance < 0)
+        tolerance = *size_symbol == (int)sizeof(double) && sizeof(nnReal) == sizeof(double) ? 1e-9 : 1e-4;
+
+    // the generated model may use another element type than this build, its inputs and outputs are converted
+    nnReal *input = (nnReal *)malloc(input_count * sizeof(nnReal));
+    nnReal *expected = (nnReal *)malloc(output_count * sizeof(nnReal));
+    nnReal *actual = (nnReal *)malloc(output_count * sizeof(nnReal));
+    double *generated_input = (double *)malloc(input_count * sizeof(double));
+    double *generated_output = (double *)malloc(output_count * sizeof(double));
+    if (input == NULL || expected == NULL || actual == NULL || generated_input == NULL || generated_output == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the verification\n");
+        goto release;
+    }
+
+    double max_error = 0;
+    int worst = 0, beyond = 0, disagreements = 0;
+    for (int s = 0; s < dataset->count; s++)
+    {
+        nnDatasetGatherInputs(dataset, s, 1, input, input_count);
+        predict(network, input, expected);
+
+        for (int i = 0; i < input_count; i++)
+        {
+            if (*size_symbol == (int)sizeof(float))
+                ((float *)generated_input)[i] = (float)input[i];
+            else
+                generated_input[i] = (double)input[i];
+        }
+        generated(generated_input, generated_output);
+        for (int i = 0; i < output_count; i++)
+            actual[i] = *size_symbol == (int)sizeof(float) ? (nnReal)((float *)generated_output)[i] : (nnReal)generated_output[i];
+
+        double error = 0;
+        for (int i = 0; i < output_count; i++)
+            error = fmax(error, fabs((double)actual[i] - (double)expected[i]));
+        if (error > max_error)
+        {
+            max_error = error;
+            worst = s;
+        }
+        beyond += error > tolerance;
+        disagreements += index_of_max(actual, output_count) != index_of_max(expected, output_count);
+    }
+    printf("%d samples: max difference %.3g (sample %d), %d beyond the tolerance %.3g, %d different predicted classes\n",
+           dataset->count, max_error, worst, beyond, tolerance, disagreements);
+    status = beyond > 0 ? 1 : 0;
+    printf(status == 0 ? "Verification passed\n" : "Verification FAILED\n");
+
+release:
+    free(input);
+    free(expected);
+    free(actual);
+    free(generated_input);
+    free(generated_output);
+done:
+    nnFreeDataset(dataset);
+    dlclose(handle);
+    nnFreeNetwork(network);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    nnCodegenConfig config = nnDefaultCodegenConfig();
+    const char *paths[3] = {NULL, NULL, NULL};
+    int path_count = 0;
+    int verify_mode = 0;
+    double tolerance = -1;
+    const char *compiler = getenv("CC") != NULL ? getenv("CC") : "cc";
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--verify") == 0)
+        {
+            verify_mode = 1;
+        }
+        else if (strcmp(argv[i], "--prefix") == 0 && i + 1 < argc)
+        {
+            config.prefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "--float") == 0)
+        {
+            config.element_size = sizeof(float);
+        }
+        else if (strcmp(argv[i], "--double") == 0)
+        {
+            config.element_size = sizeof(double);
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cc") == 0 && i + 1 < argc)
+        {
+            compiler = argv[++i];
+        }
+        else if (argv[i][0] != '-' && path_count < 3)
+        {
+            paths[path_count++] = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (verify_mode)
+    {
+        if (path_count != 3)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return verify(paths[0], paths[1], paths[2], config.prefix, tolerance, compiler);
+    }
+
+    if (path_count == 1)
+    {
+        // only the output: the model written by simple_nn
+        paths[1] = paths[0];
+        paths[0] = MODEL_BAK;
+    }
+    else if (path_count != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    nnNetwork *network = nnLoadNetwork(paths[0]);
+    if (network == NULL)
+    {
+        return 1;
+    }
+    int status = nnGenerateSource(network, paths[1], &config);
+    nnFreeNetwork(network);
+    return status;
+}
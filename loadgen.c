@@ -0,0 +1,259 @@
+// Load generator for nn_server: every connection sends a prediction, waits for its answer and sends the
+// next one (closed loop), so the offered load grows with the number of connections.
+//   ./nn_loadgen [--socket <path>] [--connections <n>] [--seconds <s> | --requests <n>] [--stats]
+// Prints the throughput and the client-side latency percentiles; --stats also prints the server stats
+// (its own latency and batch size histograms). The inputs are synthetic MNIST-shaped samples.
+#include "nnServer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SYNTHETIC_SAMPLES 256
+#define SYNTHETIC_DENSITY 0.19 // non-zero pixels of an MNIST digit, on average
+#define STATS_CAPACITY 16384
+
+typedef struct LoadgenConfig
+{
+    const char *socket_path;
+    int connections;
+    double seconds; // duration of the run, used when requests is 0
+    long requests;  // per connection
+} LoadgenConfig;
+
+typedef struct LoadgenThread
+{
+    const LoadgenConfig *config;
+    const float *samples; // SYNTHETIC_SAMPLES x input_count
+    int input_count;
+    int output_count;
+    double deadline;
+    unsigned int seed;
+    double *latencies; // seconds, one per answered request
+    long count;
+    long capacity;
+    int failed;
+    pthread_t thread;
+} LoadgenThread;
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int record(LoadgenThread *thread, double latency)
+{
+    if (thread->count == thread->capacity)
+    {
+        long capacity = thread->capacity ? thread->capacity * 2 : 4096;
+        double *latencies = (double *)realloc(thread->latencies, (size_t)capacity * sizeof(double));
+        if (latencies == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed for the latencies\n");
+            return -1;
+        }
+        thread->latencies = latencies;
+        thread->capacity = capacity;
+    }
+    thread->latencies[thread->count++] = latency;
+    return 0;
+}
+
+static void *connection_main(void *arg)
+{
+    LoadgenThread *thread = (LoadgenThread *)arg;
+    const LoadgenConfig *config = thread->config;
+    float *outputs = (float *)malloc((size_t)thread->output_count * sizeof(float));
+    int fd = nnServerConnect(config->socket_path);
+    if (fd < 0 || outputs == NULL)
+    {
+        thread->failed = 1;
+        free(outputs);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    uint32_t length = (uint32_t)(thread->input_count * sizeof(float));
+    uint32_t capacity = (uint32_t)(thread->output_count * sizeof(float));
+    for (long id = 0;; id++)
+    {
+        if (config->requests > 0 ? id >= config->requests : nnNowSeconds() >= thread->deadline)
+            break;
+        const float *sample = thread->samples + (size_t)(rand_r(&thread->seed) % SYNTHETIC_SAMPLES) * thread->input_count;
+        nnServerHeader answer;
+        double start = nnNowSeconds();
+        if (nnServerCall(fd, NN_SERVER_PREDICT, (uint32_t)id, sample, length, &answer, outputs, capacity) != 0 ||
+            answer.id != (uint32_t)id || answer.length != capacity)
+        {
+            thread->failed = 1;
+            break;
+        }
+        if (record(thread, nnNowSeconds() - start) != 0)
+        {
+            thread->failed = 1;
+            break;
+        }
+    }
+    close(fd);
+    free(outputs);
+    return NULL;
+}
+
+static double percentile(const double *sorted, long count, double quantile)
+{
+    long index = (long)(quantile * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+    LoadgenConfig config;
+    config.socket_path = nnDefaultServerConfig().socket_path;
+    config.connections = 8;
+    config.seconds = 5;
+    config.requests = 0;
+    int print_stats = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+        {
+            config.socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc)
+        {
+            config.connections = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+        {
+            config.seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc)
+        {
+            config.requests = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+            print_stats = 1;
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [--socket <path>] [--connections <n>] [--seconds <s> | --requests <n>] [--stats]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (config.connections < 1)
+    {
+        fprintf(stderr, "At least one connection is needed\n");
+        return 1;
+    }
+
+    // shapes of the served network
+    int fd = nnServerConnect(config.socket_path);
+    if (fd < 0)
+    {
+        return 1;
+    }
+    nnServerHeader answer;
+    nnServerInfo info;
+    int status = nnServerCall(fd, NN_SERVER_INFO, 0, NULL, 0, &answer, &info, sizeof(info)) != 0 || answer.length != sizeof(info);
+    // an idle connection would make the server wait for its requests before running partial batches
+    close(fd);
+    if (status != 0)
+    {
+        return 1;
+    }
+
+    int input_count = (int)info.input_count;
+    float *samples = (float *)malloc((size_t)SYNTHETIC_SAMPLES * input_count * sizeof(float));
+    LoadgenThread *threads = (LoadgenThread *)calloc((size_t)config.connections, sizeof(LoadgenThread));
+    if (samples == NULL || threads == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the load generator\n");
+        free(samples);
+        free(threads);
+        return 1;
+    }
+    unsigned int seed = 42;
+    for (size_t i = 0; i < (size_t)SYNTHETIC_SAMPLES * input_count; i++)
+    {
+        double u = (double)rand_r(&seed) / RAND_MAX;
+        samples[i] = u < SYNTHETIC_DENSITY ? (float)((double)rand_r(&seed) / RAND_MAX) : 0.0f;
+    }
+
+    printf("%d connections to %s (%u inputs, %u outputs, server: %u workers, batches of up to %u)\n", config.connections,
+           config.socket_path, info.input_count, info.output_count, info.workers, info.max_batch);
+    double start = nnNowSeconds();
+    int started = 0;
+    for (; started < config.connections; started++)
+    {
+        LoadgenThread *thread = &threads[started];
+        thread->config = &config;
+        thread->samples = samples;
+        thread->input_count = input_count;
+        thread->output_count = (int)info.output_count;
+        thread->deadline = start + config.seconds;
+        thread->seed = 1234u + (unsigned int)started;
+        if (pthread_create(&thread->thread, NULL, connection_main, thread) != 0)
+        {
+            fprintf(stderr, "Failed to start connection %d\n", started);
+            break;
+        }
+    }
+    long total = 0;
+    int failed = started < config.connections;
+    for (int t = 0; t < started; t++)
+    {
+        pthread_join(threads[t].thread, NULL);
+        total += threads[t].count;
+        failed |= threads[t].failed;
+    }
+    double elapsed = nnNowSeconds() - start;
+
+    status = failed ? 1 : 0;
+    double *latencies = (double *)malloc((size_t)(total > 0 ? total : 1) * sizeof(double));
+    if (latencies != NULL && total > 0)
+    {
+        long n = 0;
+        for (int t = 0; t < started; t++)
+        {
+            memcpy(latencies + n, threads[t].latencies, (size_t)threads[t].count * sizeof(double));
+            n += threads[t].count;
+        }
+        qsort(latencies, (size_t)total, sizeof(double), compare_doubles);
+        printf("%ld requests in %.2f s: %.0f requests/s\n", total, elapsed, total / elapsed);
+        printf("latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n", percentile(latencies, total, 0.50) * 1e6,
+               percentile(latencies, total, 0.90) * 1e6, percentile(latencies, total, 0.99) * 1e6, latencies[total - 1] * 1e6);
+    }
+    else
+    {
+        fprintf(stderr, "No request answered\n");
+        status = 1;
+    }
+
+    if (print_stats)
+    {
+        char *text = (char *)malloc(STATS_CAPACITY + 1);
+        fd = nnServerConnect(config.socket_path);
+        if (text != NULL && fd >= 0 && nnServerCall(fd, NN_SERVER_STATS, 1, NULL, 0, &answer, text, STATS_CAPACITY) == 0)
+        {
+            text[answer.length] = '\0';
+            printf("server stats: %s\n", text);
+        }
+        else
+        {
+            status = 1;
+        }
+        free(text);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    for (int t = 0; t < config.connections; t++)
+        free(threads[t].latencies);
+    free(threads);
+    free(samples);
+    free(latencies);
+    return status;
+}
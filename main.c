@@ -1,93 +1,65 @@
 #include "nnLayer.h"
 #include "nnNetwork.h"
+#include "nnTrain.h"
+#include "nnInference.h"
+#include "nnPlan.h"
+#include "nnQuant.h"
+#include "nnPrune.h"
+#include "nnDataset.h"
+#include "nnProfile.h"
+#include "nnEval.h"
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <unistd.h>
 
 
 #define MODEL_BAK "trained_network.bin"
+#define MODEL_CHECKPOINT "trained_network.ckpt" // progress of an unfinished training, resumed by the next run
+#define MODEL_INT8 "trained_network.int8.bin"     // int8-only copy of the model, for the int8 engine (nn_server --int8)
 #define TRAIN_SET "mnist_train.csv"
 #define TEST_SET "mnist_test.csv"
+#define TRAIN_BIN "mnist_train.nnds" // binary copies, created from the CSV files on the first run
+#define TEST_BIN "mnist_test.nnds"
 #define CUSTOM_PGM "6.pgm"
-#define TRAIN_SAMPLES 60000
-#define TEST_SAMPLES 10000
+#define CALIBRATION_SAMPLES 1000 // training samples used to pick the int8 activation ranges
+#define FINE_TUNE_EPOCHS 2       // training after pruning (NN_PRUNE=<sparsity>, e.g. 0.9)
+#define PROFILE_PATH_MAX 512     // NN_PROFILE=<prefix> writes <prefix>.json and <prefix>.csv (NN_PROFILE_COUNTERS=1 for perf)
 
+#define MNIST_ROWS 28
+#define MNIST_COLS 28
 #define MNIST_IMG_SIZE 784
 #define MNIST_LABELS 10
-#define MAX_LINE_LEN 8192 // Aumentato per sicurezza
+#define EVAL_CHUNK 1024 // samples read and scored together by an evaluation thread
+#define EVAL_TOP_K 3
 
-// Funzione per liberare la memoria di un dataset
-void free_data(double **inputs, double **targets, int samples)
+// Creates the binary copy of a dataset from its CSV file the first time
+void prepare_mnist_file(const char *csv_filename, const char *filename)
 {
-    for (int i = 0; i < samples; i++)
+    if (access(filename, R_OK) != 0 && nnConvertCsvDataset(csv_filename, filename, MNIST_ROWS, MNIST_COLS, MNIST_LABELS))
     {
-        free(inputs[i]);
-        free(targets[i]);
+        exit(1);
     }
-    free(inputs);
-    free(targets);
-    printf("Dataset memory freed.\n");
 }
 
-void load_mnist_data(const char *filename, int samples, double ***inputs, double ***targets)
+// Maps the binary copy of a dataset, converting the CSV file the first time
+nnDataset *load_mnist_dataset(const char *csv_filename, const char *filename)
 {
-    FILE *file = fopen(filename, "r");
-    if (!file)
+    prepare_mnist_file(csv_filename, filename);
+    nnDataset *dataset = nnMapDataset(filename);
+    if (dataset == NULL)
     {
-        fprintf(stderr, "Error: Unable to open file %s\n", filename);
         exit(1);
     }
-
-    *inputs = (double **)malloc(samples * sizeof(double *));
-    *targets = (double **)malloc(samples * sizeof(double *));
-
-    char buffer[MAX_LINE_LEN];
-    int count = 0;
-
-    printf("Loading %d samples from %s...\n", samples, filename);
-
-    while (fgets(buffer, MAX_LINE_LEN, file) && count < samples)
-    {
-        (*inputs)[count] = (double *)malloc(MNIST_IMG_SIZE * sizeof(double));
-        (*targets)[count] = (double *)malloc(MNIST_LABELS * sizeof(double));
-
-        for (int k = 0; k < MNIST_LABELS; k++)
-            (*targets)[count][k] = 0.0;
-
-        char *token = strtok(buffer, ",");
-        if (token != NULL)
-        {
-            int label = atoi(token);
-            if (label >= 0 && label < MNIST_LABELS)
-            {
-                (*targets)[count][label] = 1.0;
-            }
-        }
-
-        for (int i = 0; i < MNIST_IMG_SIZE; i++)
-        {
-            token = strtok(NULL, ",");
-            if (token != NULL)
-            {
-                (*inputs)[count][i] = (double)atoi(token) / 255.0;
-            }
-            else
-            {
-                (*inputs)[count][i] = 0.0;
-            }
-        }
-        count++;
-    }
-    fclose(file);
-    printf("Loading completed.\n");
+    return dataset;
 }
 
-int get_predicted_digit(double *output_array, int size, double *percentage)
+int get_predicted_digit(nnReal *output_array, int size, nnReal *percentage)
 {
     int max_index = 0;
-    double max_val = output_array[0];
+    nnReal max_val = output_array[0];
     for (int i = 1; i < size; i++)
     {
         if (output_array[i] > max_val)
@@ -103,37 +75,30 @@ int get_predicted_digit(double *output_array, int size, double *percentage)
     return max_index;
 }
 
-void evaluate_accuracy(nnNetwork *network, double **inputs, double **targets, int samples, const char *name)
+// Scores a dataset on every core: 'dataset' when it is already in memory, otherwise the samples are
+// streamed from 'filename' in chunks
+void evaluate_accuracy(nnNetwork *network, const nnDataset *dataset, const char *filename, const char *name, int quantized)
 {
-    printf("\n--- ACCURACY ON %s DATASET ---\n", name);
-    int correct = 0;
-
-    for (int i = 0; i < samples; i++)
+    printf("\n--- ACCURACY ON %s DATASET%s ---\n", name, quantized ? " (INT8)" : "");
+    nnEvalConfig config = nnDefaultEvalConfig();
+    config.chunk_samples = EVAL_CHUNK;
+    config.top_k = EVAL_TOP_K;
+    config.quantized = quantized;
+    nnEvalResult *result = dataset != NULL ? nnEvaluateDataset(network, dataset, &config) : nnEvaluateFile(network, filename, &config);
+    if (result == NULL)
     {
-        double p_out[10];
-        predict(network, inputs[i], p_out);
-        double percentage;
-
-        int p = get_predicted_digit(p_out, 10, &percentage);
-        int t = get_predicted_digit(targets[i], 10, NULL);
-
-        if (p == t)
-            correct++;
-
-        // Show some data for a visual output
-        if (i % 1000 == 0)
-        {
-            printf("Sample %4d: Pred: %d (Confidence: %.2f%%) | Real: %d %s\n", i, p, percentage * 100.0, t, (p == t) ? "(OK)" : "(FAIL)");
-        }
+        fprintf(stderr, "Unable to run the %s dataset\n", name);
+        return;
     }
-    double acc = (double)correct / samples * 100.0;
-    printf(">>> Result: %.2f%% (%d/%d correct)\n", acc, correct, samples);
+    nnProfileReport(quantized ? "predict-int8" : "predict", 0, result->count, result->seconds);
+    nnPrintEvalResult(result, name);
+    nnFreeEvalResult(result);
 }
 
 /*
-Load a PGM image from file into a normalized double array, values [0..1], optionally inverted.
+Load a PGM image from file into a normalized array, values [0..1], optionally inverted.
 */
-int load_pgm(const char *file_name, double **image, int *width, int *height, int invert)
+int load_pgm(const char *file_name, nnReal **image, int *width, int *height, int invert)
 {
     printf("opening %s\n", file_name);
     FILE *fp = fopen(file_name, "rb");
@@ -152,7 +117,7 @@ int load_pgm(const char *file_name, double **image, int *width, int *height, int
     fscanf(fp, "%d\n", &depth);
     printf("image size (%d, %d) with depth %d\n", w, h, depth);
 
-    *image = (double *)malloc(w * h * sizeof(double));
+    *image = (nnReal *)malloc(w * h * sizeof(nnReal));
 
     // start reading binary
     for (int y = 0; y < h; y++)
@@ -162,26 +127,47 @@ int load_pgm(const char *file_name, double **image, int *width, int *height, int
             unsigned char pix;
             fread(&pix, sizeof(unsigned char), 1, fp);
             if (!invert)
-                (*image)[y * w + x] = (double)pix / 255.0;
+                (*image)[y * w + x] = (nnReal)pix / 255.0;
             else
                 // invert the color linearly (black background)
-                (*image)[y * w + x] = 1.0 - ((double)pix / 255.0);
+                (*image)[y * w + x] = 1.0 - ((nnReal)pix / 255.0);
         }
     }
     fclose(fp);
     return 0;
 }
 
-void free_pgm(double *image)
+void free_pgm(nnReal *image)
 {
     free(image);
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    // ./simple_nn convert <source> <destination> [float|double]: rewrites a model file (v2) in the given precision
+    if (argc >= 4 && strcmp(argv[1], "convert") == 0)
+    {
+        size_t element_size = (argc >= 5 && strcmp(argv[4], "double") == 0) ? sizeof(double) : sizeof(float);
+        return nnConvertNetworkFile(argv[2], argv[3], element_size);
+    }
 
     srand(time(NULL));
-    nnNetwork *network = nnLoadNetwork(MODEL_BAK);
+
+    // optional per-layer profile of training and inference
+    const char *profile = getenv("NN_PROFILE");
+    char profile_json[PROFILE_PATH_MAX], profile_csv[PROFILE_PATH_MAX];
+    if (profile != NULL)
+    {
+        snprintf(profile_json, sizeof(profile_json), "%s.json", profile);
+        snprintf(profile_csv, sizeof(profile_csv), "%s.csv", profile);
+        const char *counters = getenv("NN_PROFILE_COUNTERS");
+        nnProfileConfig profile_config = {profile_json, profile_csv, counters != NULL && atoi(counters) != 0};
+        if (nnProfileStart(&profile_config) == 0)
+            printf("Profiling to %s and %s\n", profile_json, profile_csv);
+    }
+
+    // a saved model is only used for inference: its weights stay in the mapped file
+    nnNetwork *network = nnMapNetwork(MODEL_BAK);
 
     if (network)
     {
@@ -191,61 +177,114 @@ int main()
 
     network = nnCreateNetwork();
 
-    int EPOCHS = 100;
-    double LR = 0.2;
+    int EPOCHS = 25; // softmax + cross-entropy converges in a fraction of the epochs MSE needed (100)
+    int BATCH_SIZE = 32;
+    double LR = 0.005; // Adam step, applied to the gradient averaged over BATCH_SIZE samples
 
     // --- FASE 1: CARICAMENTO TRAINING SET ---
-    double **train_inputs = NULL;
-    double **train_targets = NULL;
-    load_mnist_data(TRAIN_SET, TRAIN_SAMPLES, &train_inputs, &train_targets);
+    nnDataset *train_set = load_mnist_dataset(TRAIN_SET, TRAIN_BIN);
 
     // Network Topology
     printf("Topology creation...\n");
     // 784 -> 64 -> 32 -> 10
     nnLayer *hidden = nnCreateLayer(64, MNIST_IMG_SIZE, ACTIVATION_SIGMOID);
     nnLayer *hidden_2 = nnCreateLayer(32, 64, ACTIVATION_SIGMOID);
-    nnLayer *output = nnCreateLayer(MNIST_LABELS, 32, ACTIVATION_SIGMOID);
+    nnLayer *output = nnCreateLayer(MNIST_LABELS, 32, ACTIVATION_SOFTMAX);
 
     init_layer_random(hidden);
     init_layer_random(hidden_2);
     init_layer_random(output);
+    // most MNIST pixels are exact zeros (background): the first layer only works on the non-zero ones
+    nnSetSparseInput(hidden, 1);
     addLayerToNetwork(network, hidden);
     addLayerToNetwork(network, hidden_2);
     addLayerToNetwork(network, output);
 
     // Training
-    printf("Starting training (%d epochs, LR %.2f)...\n", EPOCHS, LR);
-    train(network, train_inputs, train_targets, TRAIN_SAMPLES, LR, EPOCHS);
-    nnDumpNetwork(network, MODEL_BAK);
+    printf("Starting training (%d epochs, batch %d, LR %g)...\n", EPOCHS, BATCH_SIZE, LR);
+    nnTrainConfig config = nnDefaultTrainConfig();
+    config.learning_rate = LR;
+    config.optimizer = nnDefaultOptimizerConfig(NN_OPTIMIZER_ADAM);
+    config.epochs = EPOCHS;
+    config.batch_size = BATCH_SIZE;
+    config.loss = NN_LOSS_CROSS_ENTROPY;
+    config.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    config.shuffle = 1;       // batches are assembled in background, in a new order every epoch
+    config.input_threads = 1; // (augment_shift = 1 or 2 adds random shifts of the digits)
+    config.checkpoint_path = MODEL_CHECKPOINT;
+    config.checkpoint_epochs = 5;
+    config.checkpoint_seconds = 60.0;
+    config.resume = 1;
+    if (trainDatasetWithConfig(network, train_set, &config) != 0)
+    {
+        // nothing is saved: the checkpoint (if any) is kept for the next run
+        fprintf(stderr, "Training failed, the model is not saved\n");
+        nnFreeDataset(train_set);
+        nnFreeNetwork(network);
+        nnProfileStop();
+        return 1;
+    }
 
-    evaluate_accuracy(network, train_inputs, train_targets, TRAIN_SAMPLES, "TRAIN");
+    // optional magnitude pruning, fine-tuned with the pruned weights held at zero, then stored as CSR
+    const char *prune = getenv("NN_PRUNE");
+    if (prune != NULL && nnPruneNetwork(network, atof(prune)) == 0)
+    {
+        printf("Pruned to %.0f%% sparsity, fine-tuning (%d epochs)...\n", atof(prune) * 100.0, FINE_TUNE_EPOCHS);
+        config.epochs = FINE_TUNE_EPOCHS;
+        config.checkpoint_path = NULL;
+        config.resume = 0;
+        if (trainDatasetWithConfig(network, train_set, &config) != 0 || nnCompressNetwork(network) != 0)
+        {
+            fprintf(stderr, "Fine-tuning of the pruned network failed, the model is not saved\n");
+            nnFreeDataset(train_set);
+            nnFreeNetwork(network);
+            nnProfileStop();
+            return 1;
+        }
+        nnPrintPruneStats(network);
+    }
 
-    free_data(train_inputs, train_targets, TRAIN_SAMPLES);
-test:
-    double **test_inputs = NULL;
-    double **test_targets = NULL;
+    // int8 copy of the trained weights, saved in the same model file
+    int calibration_count = train_set->count < CALIBRATION_SAMPLES ? train_set->count : CALIBRATION_SAMPLES;
+    nnSampleSet *calibration = nnExpandDataset(train_set, 0, calibration_count);
+    if (calibration != NULL)
+    {
+        nnQuantizeNetwork(network, (const nnReal *const *)calibration->inputs, calibration->count);
+        nnFreeSampleSet(calibration);
+    }
+    if (nnDumpNetwork(network, MODEL_BAK) == 0)
+        remove(MODEL_CHECKPOINT); // superseded by the final model
+    if (nnIsQuantized(network))
+        nnDumpNetworkInt8(network, MODEL_INT8);
 
-    load_mnist_data(TEST_SET, TEST_SAMPLES, &test_inputs, &test_targets);
+    evaluate_accuracy(network, train_set, NULL, "TRAIN", 0);
+
+    nnFreeDataset(train_set);
+test:
+    // the test set is streamed from its file, never loaded as a whole
+    prepare_mnist_file(TEST_SET, TEST_BIN);
 
-    evaluate_accuracy(network, test_inputs, test_targets, TEST_SAMPLES, "TEST");
+    evaluate_accuracy(network, NULL, TEST_BIN, "TEST", 0);
+    if (nnIsQuantized(network))
+        evaluate_accuracy(network, NULL, TEST_BIN, "TEST", 1);
 
     // test on a custom image
-    double *image;
+    nnReal *image;
     int w;
     int h;
-    double percentage;
+    nnReal percentage;
     if (!load_pgm(CUSTOM_PGM, &image, &w, &h, 1))
     {
-        double o[10];
+        nnReal o[10];
         predict(network, image, o);
         int guess = get_predicted_digit(o, 10, &percentage);
         printf("Predicted digit: %d (Confidence: %.2f%%)\n", guess, percentage * 100.0);
     }
 
     // --- FINAL CLEANUP ---
-    free_data(test_inputs, test_targets, TEST_SAMPLES);
     free_pgm(image);
     nnFreeNetwork(network);
+    nnProfileStop();
 
     return 0;
 }
@@ -0,0 +1,45 @@
+#include "nnArena.h"
+#include <stdint.h>
+#include <stdio.h>
+
+void nnArenaMeasure(nnArena *arena)
+{
+    arena->base = NULL;
+    arena->size = SIZE_MAX;
+    arena->used = 0;
+}
+
+int nnArenaCreate(nnArena *arena, size_t size)
+{
+    arena->base = (unsigned char *)nnAlignedAlloc(size);
+    arena->size = size;
+    arena->used = 0;
+    if (arena->base == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for an arena of %zu bytes\n", size);
+        arena->size = 0;
+        return 1;
+    }
+    return 0;
+}
+
+void *nnArenaAlloc(nnArena *arena, size_t size)
+{
+    size = (size + NN_ALIGNMENT - 1) / NN_ALIGNMENT * NN_ALIGNMENT;
+    if (size > arena->size - arena->used)
+    {
+        return NULL;
+    }
+
+    void *block = arena->base != NULL ? arena->base + arena->used : NULL;
+    arena->used += size;
+    return block;
+}
+
+void nnArenaFree(nnArena *arena)
+{
+    nnAlignedFree(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
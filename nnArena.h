@@ -0,0 +1,25 @@
+// include guard
+#ifndef NNARENA_H
+#define NNARENA_H
+
+#include "nnLayer.h"
+
+// Bump allocator over one zeroed, NN_ALIGNMENT aligned slab: every block is carved in order and the
+// whole slab is released at once. The size is usually found with a measuring pass, running the same
+// carving code on an arena started with nnArenaMeasure:
+//   nnArenaMeasure(&arena); carve(&arena);   (only counts, every pointer is NULL)
+//   nnArenaCreate(&arena, arena.used); carve(&arena);
+typedef struct nnArena
+{
+    unsigned char *base; // NULL while measuring
+    size_t size;
+    size_t used;
+} nnArena;
+
+void nnArenaMeasure(nnArena *arena);
+int nnArenaCreate(nnArena *arena, size_t size);
+// next block of 'size' bytes, aligned to NN_ALIGNMENT; NULL while measuring or when the slab is full
+void *nnArenaAlloc(nnArena *arena, size_t size);
+void nnArenaFree(nnArena *arena);
+
+#endif // NNARENA_H
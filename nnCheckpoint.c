@@ -0,0 +1,236 @@
+#include "nnCheckpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Carves the buffers of one snapshot: the parameter blocks of every layer, then the optimizer arrays
+// (pointers in the same order as nnTrainState.optimizer_state, after the layer_count parameter blocks)
+static nnReal **carve_snapshot(const nnNetwork *network, int optimizer_arrays, nnArena *arena)
+{
+    int layer_count = network->layer_count;
+    nnReal **blocks = (nnReal **)nnArenaAlloc(arena, (size_t)(optimizer_arrays + 1) * layer_count * sizeof(nnReal *));
+    for (int a = 0; a <= optimizer_arrays; a++)
+    {
+        for (int l = 0; l < layer_count; l++)
+        {
+            nnReal *block = (nnReal *)nnArenaAlloc(arena, nnLayerParamCount(network->layers[l]) * sizeof(nnReal));
+            if (blocks != NULL)
+                blocks[a * layer_count + l] = block;
+        }
+    }
+    return blocks;
+}
+
+static void *checkpoint_writer(void *arg)
+{
+    nnCheckpointer *checkpointer = (nnCheckpointer *)arg;
+
+    pthread_mutex_lock(&checkpointer->mutex);
+    for (;;)
+    {
+        while (checkpointer->pending < 0 && !checkpointer->stop)
+            pthread_cond_wait(&checkpointer->ready, &checkpointer->mutex);
+        // the snapshot still waiting is written before stopping
+        if (checkpointer->pending < 0)
+            break;
+
+        int s = checkpointer->pending;
+        checkpointer->pending = -1;
+        checkpointer->writing = s;
+        pthread_mutex_unlock(&checkpointer->mutex);
+
+        double start = nnNowSeconds();
+        int result = nnWriteModelState(checkpointer->snapshots[s], checkpointer->filename, sizeof(nnReal), &checkpointer->states[s]);
+        double elapsed = nnNowSeconds() - start;
+
+        pthread_mutex_lock(&checkpointer->mutex);
+        checkpointer->writing = -1;
+        if (result == 0)
+        {
+            checkpointer->stats.written++;
+            checkpointer->stats.write_seconds += elapsed;
+            printf("Checkpoint: epoch %d saved to %s (%.1f ms)\n", checkpointer->states[s].epoch, checkpointer->filename, elapsed * 1000.0);
+        }
+        else
+        {
+            checkpointer->stats.failed++;
+        }
+    }
+    pthread_mutex_unlock(&checkpointer->mutex);
+    return NULL;
+}
+
+nnCheckpointer *nnCreateCheckpointer(const nnNetwork *network, int optimizer_arrays, const char *filename)
+{
+    if (network->layer_count == 0 || optimizer_arrays < 0 || filename == NULL)
+    {
+        fprintf(stderr, "Nothing to checkpoint\n");
+        return NULL;
+    }
+
+    nnCheckpointer *checkpointer = (nnCheckpointer *)calloc(1, sizeof(nnCheckpointer));
+    if (checkpointer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnCheckpointer\n");
+        return NULL;
+    }
+    pthread_mutex_init(&checkpointer->mutex, NULL);
+    pthread_cond_init(&checkpointer->ready, NULL);
+    checkpointer->pending = -1;
+    checkpointer->writing = -1;
+    checkpointer->optimizer_arrays = optimizer_arrays;
+    checkpointer->filename = strdup(filename);
+
+    // both snapshots in a single arena
+    nnArenaMeasure(&checkpointer->arena);
+    carve_snapshot(network, optimizer_arrays, &checkpointer->arena);
+    carve_snapshot(network, optimizer_arrays, &checkpointer->arena);
+    int ok = checkpointer->filename != NULL && nnArenaCreate(&checkpointer->arena, checkpointer->arena.used) == 0;
+    for (int s = 0; s < 2 && ok; s++)
+    {
+        nnReal **blocks = carve_snapshot(network, optimizer_arrays, &checkpointer->arena);
+        checkpointer->states[s].optimizer_arrays = optimizer_arrays;
+        checkpointer->states[s].optimizer_state = blocks + network->layer_count;
+
+        // layers that use the snapshot buffers, so that the model writer can save them as they are
+        checkpointer->snapshots[s] = nnCreateNetwork();
+        ok = checkpointer->snapshots[s] != NULL;
+        for (int l = 0; l < network->layer_count && ok; l++)
+        {
+            const nnLayer *layer = network->layers[l];
+            nnLayer *view = nnCreateLayerView(layer->neuron_count, layer->input_count, layer->activationFunction,
+                                              layer->sparse_input, blocks[l]);
+            ok = view != NULL && addLayerToNetwork(checkpointer->snapshots[s], view) == 0;
+        }
+    }
+    if (ok)
+    {
+        ok = pthread_create(&checkpointer->thread, NULL, checkpoint_writer, checkpointer) == 0;
+        checkpointer->started = ok;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Unable to set up the checkpoints of %s\n", filename);
+        nnFreeCheckpointer(checkpointer);
+        return NULL;
+    }
+    return checkpointer;
+}
+
+void nnCheckpointFinish(nnCheckpointer *checkpointer)
+{
+    if (checkpointer->started)
+    {
+        pthread_mutex_lock(&checkpointer->mutex);
+        checkpointer->stop = 1;
+        pthread_cond_signal(&checkpointer->ready);
+        pthread_mutex_unlock(&checkpointer->mutex);
+        pthread_join(checkpointer->thread, NULL);
+        checkpointer->started = 0;
+    }
+}
+
+void nnFreeCheckpointer(nnCheckpointer *checkpointer)
+{
+    if (!checkpointer)
+    {
+        return;
+    }
+
+    nnCheckpointFinish(checkpointer);
+    pthread_mutex_destroy(&checkpointer->mutex);
+    pthread_cond_destroy(&checkpointer->ready);
+
+    // the views do not free the buffers, the arena does
+    nnFreeNetwork(checkpointer->snapshots[0]);
+    nnFreeNetwork(checkpointer->snapshots[1]);
+    nnArenaFree(&checkpointer->arena);
+    free(checkpointer->filename);
+    free(checkpointer);
+}
+
+void nnCheckpointSnapshot(nnCheckpointer *checkpointer, const nnNetwork *network, const nnTrainState *state)
+{
+    if (state->optimizer_arrays != checkpointer->optimizer_arrays)
+    {
+        fprintf(stderr, "Checkpoint skipped: %d optimizer arrays instead of %d\n", state->optimizer_arrays, checkpointer->optimizer_arrays);
+        return;
+    }
+
+    // the buffer the writer is not using; a snapshot still waiting in it is replaced by this one
+    pthread_mutex_lock(&checkpointer->mutex);
+    int s = checkpointer->writing >= 0 ? 1 - checkpointer->writing : (checkpointer->pending >= 0 ? checkpointer->pending : 0);
+    if (checkpointer->pending >= 0)
+        checkpointer->stats.superseded++;
+    checkpointer->pending = -1; // not claimable while it is filled
+    pthread_mutex_unlock(&checkpointer->mutex);
+
+    nnNetwork *snapshot = checkpointer->snapshots[s];
+    nnTrainState *copy = &checkpointer->states[s];
+    int layer_count = network->layer_count;
+    for (int l = 0; l < layer_count; l++)
+    {
+        size_t bytes = nnLayerParamCount(network->layers[l]) * sizeof(nnReal);
+        memcpy(snapshot->layers[l]->weights, network->layers[l]->weights, bytes);
+        for (int a = 0; a < state->optimizer_arrays; a++)
+            memcpy(copy->optimizer_state[a * layer_count + l], state->optimizer_state[a * layer_count + l], bytes);
+    }
+    copy->epoch = state->epoch;
+    copy->seed = state->seed;
+    copy->learning_rate = state->learning_rate;
+
+    pthread_mutex_lock(&checkpointer->mutex);
+    checkpointer->pending = s;
+    checkpointer->stats.snapshots++;
+    pthread_cond_signal(&checkpointer->ready);
+    pthread_mutex_unlock(&checkpointer->mutex);
+}
+
+void nnCheckpointPrintStats(nnCheckpointer *checkpointer)
+{
+    pthread_mutex_lock(&checkpointer->mutex);
+    nnCheckpointStats stats = checkpointer->stats;
+    pthread_mutex_unlock(&checkpointer->mutex);
+    printf("Checkpoints: %ld snapshots, %ld written in background (%.2fs), %ld superseded, %ld failed\n",
+           stats.snapshots, stats.written, stats.write_seconds, stats.superseded, stats.failed);
+}
+
+int nnLoadCheckpoint(nnNetwork *network, const char *filename, nnTrainState *state)
+{
+    memset(state, 0, sizeof(*state));
+    if (access(filename, F_OK) != 0)
+    {
+        return -1;
+    }
+
+    nnNetwork *saved = nnReadModelState(filename, 0, state);
+    if (saved == NULL)
+    {
+        return 1;
+    }
+
+    int match = saved->layer_count == network->layer_count;
+    for (int l = 0; l < network->layer_count && match; l++)
+    {
+        const nnLayer *a = saved->layers[l];
+        const nnLayer *b = network->layers[l];
+        match = a->neuron_count == b->neuron_count && a->input_count == b->input_count && a->activationFunction == b->activationFunction &&
+                a->sparse_input == b->sparse_input;
+    }
+    if (!match)
+    {
+        fprintf(stderr, "The checkpoint %s does not match the network\n", filename);
+        nnFreeTrainState(state);
+        nnFreeNetwork(saved);
+        return 1;
+    }
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        memcpy(network->layers[l]->weights, saved->layers[l]->weights, nnLayerParamCount(network->layers[l]) * sizeof(nnReal));
+    }
+    nnFreeNetwork(saved);
+    printf("Resuming from checkpoint %s (%d epochs done)\n", filename, state->epoch);
+    return 0;
+}
@@ -0,0 +1,55 @@
+// include guard
+#ifndef NNCHECKPOINT_H
+#define NNCHECKPOINT_H
+
+#include "nnModelIO.h"
+#include "nnArena.h"
+#include <pthread.h>
+
+// Background checkpoints. A snapshot copies the parameters (and the optimizer state) into one of two
+// preallocated buffers and returns at once; a writer thread saves the latest snapshot as a v2 model file
+// with a training state section, through a temporary file renamed over the checkpoint (nnModelIO.h),
+// so the file on disk is always a complete checkpoint. When a snapshot arrives while the previous one
+// is still waiting to be written, the waiting one is replaced: the training loop never waits for the disk.
+
+typedef struct nnCheckpointStats
+{
+    long snapshots;
+    long written;
+    long superseded; // snapshots replaced by a newer one before being written
+    long failed;
+    double write_seconds;
+} nnCheckpointStats;
+
+typedef struct nnCheckpointer
+{
+    char *filename;
+    int optimizer_arrays;
+    nnNetwork *snapshots[2]; // layers are views of the buffers in the arena
+    nnTrainState states[2];  // their optimizer_state arrays are in the arena too
+    nnArena arena;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+    int pending; // snapshot waiting for the writer, -1 if none
+    int writing; // snapshot being written, -1 if none
+    int stop;
+    pthread_t thread;
+    int started;
+    nnCheckpointStats stats;
+} nnCheckpointer;
+
+// buffers for the shape of 'network' and 'optimizer_arrays' per-layer arrays of optimizer state
+nnCheckpointer *nnCreateCheckpointer(const nnNetwork *network, int optimizer_arrays, const char *filename);
+// copies the parameters and the state (its optimizer arrays must match the checkpointer) and queues them
+void nnCheckpointSnapshot(nnCheckpointer *checkpointer, const nnNetwork *network, const nnTrainState *state);
+// writes the snapshot still waiting, if any, then stops the writer (no snapshot can be taken afterwards)
+void nnCheckpointFinish(nnCheckpointer *checkpointer);
+void nnFreeCheckpointer(nnCheckpointer *checkpointer); // finishes first
+void nnCheckpointPrintStats(nnCheckpointer *checkpointer);
+
+// Restores a checkpoint into a network of the same shape and fills 'state' (nnFreeTrainState).
+// Returns 0 when restored, -1 when there is no checkpoint, 1 when it cannot be used.
+int nnLoadCheckpoint(nnNetwork *network, const char *filename, nnTrainState *state);
+
+#endif // NNCHECKPOINT_H
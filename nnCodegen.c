@@ -0,0 +1,261 @@
+#include "nnCodegen.h"
+#include "nnKernels.h"
+#include "nnQuant.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static const char *activation_name(nnActivationFunction func)
+{
+    switch (func)
+    {
+    case ACTIVATION_RELU:
+        return "relu";
+    case ACTIVATION_SIGMOID:
+        return "sigmoid";
+    case ACTIVATION_TANH:
+        return "tanh";
+    case ACTIVATION_LEAKYRELU:
+        return "leaky relu";
+    case ACTIVATION_SOFTMAX:
+        return "softmax";
+    default:
+        return "linear";
+    }
+}
+
+// every value keeps all its digits (9 significant for float, 17 for double), so the arrays are exact
+static void write_value(FILE *f, double value, int is_float)
+{
+    if (is_float)
+        fprintf(f, "%.8ef", (double)(float)value);
+    else
+        fprintf(f, "%.16e", value);
+}
+
+static void write_parameters(FILE *f, const nnLayer *layer, int l, const nnCodegenConfig *config, const char *type)
+{
+    int is_float = config->element_size == sizeof(float);
+    int neurons = layer->neuron_count;
+    int inputs = layer->input_count;
+
+    // input-major: row j holds the weights of input j for every neuron
+    fprintf(f, "static const _Alignas(64) %s %s_w%d[%d][%d] = {\n", type, config->prefix, l, inputs, neurons);
+    for (int j = 0; j < inputs; j++)
+    {
+        fputs("    {", f);
+        for (int i = 0; i < neurons; i++)
+        {
+            if (i > 0)
+                fputs(", ", f);
+            write_value(f, (double)NN_WEIGHT(layer, i, j), is_float);
+        }
+        fputs("},\n", f);
+    }
+    fputs("};\n", f);
+
+    fprintf(f, "static const _Alignas(64) %s %s_b%d[%d] = {", type, config->prefix, l, neurons);
+    for (int i = 0; i < neurons; i++)
+    {
+        fputs(i % 8 == 0 ? "\n    " : " ", f);
+        write_value(f, (double)layer->bias[i], is_float);
+        fputc(',', f);
+    }
+    fputs("\n};\n\n", f);
+}
+
+// Fast exp of nnKernels.c (same reduction, polynomial and clamp, so the same error bounds), written as a
+// scalar function the compiler can inline and vectorize in the activation loops
+static void write_fast_exp(FILE *f, const char *prefix, int is_float)
+{
+    static const double poly_double[] = {1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0,
+                                         1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0};
+    static const double poly_float[] = {1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0};
+    const double *poly = is_float ? poly_float : poly_double;
+    int terms = is_float ? 8 : 11;
+    const char *type = is_float ? "float" : "double";
+
+    fputs("// exp(x) = 2^k * exp(r), k = round(x / ln2), exp(r) by its Taylor polynomial\n", f);
+    fprintf(f, "static inline %s %s_exp(%s x)\n{\n", type, prefix, type);
+    fprintf(f, "    const %s limit = %s;\n", type, is_float ? "87.0f" : "708.0");
+    fputs("    x = x < -limit ? -limit : (x > limit ? limit : x);\n", f);
+    fprintf(f, "    %s k = %s(x * (%s)1.4426950408889634074);\n", type, is_float ? "nearbyintf" : "nearbyint", type);
+    fprintf(f, "    %s r = (x - k * (%s)6.93145751953125e-1) - k * (%s)1.42860682030941723212e-6;\n", type, type, type);
+    fprintf(f, "    %s p = ", type);
+    write_value(f, poly[0], is_float);
+    fputs(";\n", f);
+    for (int i = 1; i < terms; i++)
+    {
+        fputs("    p = p * r + ", f);
+        write_value(f, poly[i], is_float);
+        fputs(";\n", f);
+    }
+    // 2^k built directly in the exponent field
+    if (is_float)
+        fputs("    union\n    {\n        float f;\n        int i;\n    } scale;\n    scale.i = ((int)k + 127) << 23;\n", f);
+    else
+        fputs("    union\n    {\n        double f;\n        long long i;\n    } scale;\n    scale.i = ((long long)k + 1023) << 52;\n", f);
+    fputs("    return p * scale.f;\n}\n\n", f);
+}
+
+// y = activation(sum), the definitions of nnKernels.c: exp is the fast one, or libm with exact activations
+static void write_activation(FILE *f, nnActivationFunction func, int n, const char *type, const char *exp_name)
+{
+    switch (func)
+    {
+    case ACTIVATION_RELU:
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] = sum[i] > 0 ? sum[i] : 0;\n", n);
+        break;
+    case ACTIVATION_LEAKYRELU:
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] = sum[i] > 0 ? sum[i] : (%s)0.01 * sum[i];\n", n, type);
+        break;
+    case ACTIVATION_SIGMOID:
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] = (%s)(1 / (1 + %s(-sum[i])));\n", n, type, exp_name);
+        break;
+    case ACTIVATION_TANH:
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] = (%s)(1 - 2 / (%s(2 * sum[i]) + 1));\n", n, type, exp_name);
+        break;
+    case ACTIVATION_SOFTMAX:
+        fprintf(f, "    %s max = sum[0];\n", type);
+        fprintf(f, "    for (int i = 1; i < %d; i++)\n        max = sum[i] > max ? sum[i] : max;\n", n);
+        fprintf(f, "    %s total = 0;\n", type);
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n    {\n", n);
+        fprintf(f, "        y[i] = (%s)%s(sum[i] - max);\n        total += y[i];\n    }\n", type, exp_name);
+        fprintf(f, "    const %s inverse = 1 / total;\n", type);
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] *= inverse;\n", n);
+        break;
+    default:
+        fprintf(f, "    for (int i = 0; i < %d; i++)\n        y[i] = sum[i];\n", n);
+        break;
+    }
+}
+
+static void write_layer(FILE *f, const nnLayer *layer, int l, const nnCodegenConfig *config, const char *type, const char *exp_name)
+{
+    int neurons = layer->neuron_count;
+    int inputs = layer->input_count;
+    const char *prefix = config->prefix;
+
+    fprintf(f, "// layer %d: %d inputs, %d neurons, %s\n", l, inputs, neurons, activation_name(layer->activationFunction));
+    fprintf(f, "static void %s_layer%d(const %s *restrict x, %s *restrict y)\n{\n", prefix, l, type, type);
+    fprintf(f, "    %s sum[%d];\n", type, neurons);
+    fprintf(f, "    for (int i = 0; i < %d; i++)\n        sum[i] = %s_b%d[i];\n", neurons, prefix, l);
+    fprintf(f, "    for (int j = 0; j < %d; j++)\n    {\n", inputs);
+    fprintf(f, "        const %s xj = x[j];\n", type);
+    if (layer->sparse_input)
+        fputs("        if (xj == 0)\n            continue;\n", f);
+    fprintf(f, "        for (int i = 0; i < %d; i++)\n            sum[i] += %s_w%d[j][i] * xj;\n    }\n", neurons, prefix, l);
+    write_activation(f, layer->activationFunction, neurons, type, exp_name);
+    fputs("}\n\n", f);
+}
+
+static int valid_prefix(const char *prefix)
+{
+    if (prefix == NULL || !(isalpha((unsigned char)prefix[0]) || prefix[0] == '_'))
+    {
+        return 0;
+    }
+    for (const char *c = prefix; *c; c++)
+    {
+        if (!isalnum((unsigned char)*c) && *c != '_')
+            return 0;
+    }
+    return 1;
+}
+
+nnCodegenConfig nnDefaultCodegenConfig(void)
+{
+    nnCodegenConfig config;
+    config.prefix = "nn_model";
+    config.element_size = sizeof(nnReal);
+    return config;
+}
+
+int nnGenerateSource(const nnNetwork *network, const char *filename, const nnCodegenConfig *config)
+{
+    if (network == NULL || network->layer_count == 0)
+    {
+        fprintf(stderr, "Cannot generate the source of an empty network\n");
+        return 1;
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "Cannot generate the source of an int8-only network, it has no float weights\n");
+        return 1;
+    }
+    if (!valid_prefix(config->prefix))
+    {
+        fprintf(stderr, "Invalid symbol prefix: %s\n", config->prefix ? config->prefix : "(null)");
+        return 1;
+    }
+    if (config->element_size != sizeof(float) && config->element_size != sizeof(double))
+    {
+        fprintf(stderr, "Unsupported element size: %zu\n", config->element_size);
+        return 1;
+    }
+
+    FILE *f = fopen(filename, "w");
+    if (f == NULL)
+    {
+        perror("Error opening file for writing");
+        return 1;
+    }
+
+    const char *type = config->element_size == sizeof(float) ? "float" : "double";
+    const char *prefix = config->prefix;
+    int layer_count = network->layer_count;
+    int input_count = network->layers[0]->input_count;
+    int output_count = network->layers[layer_count - 1]->neuron_count;
+
+    fprintf(f, "// Generated by nn_codegen, do not edit: a trained network compiled in (%s).\n", type);
+    fputs("// Layers:", f);
+    for (int l = 0; l < layer_count; l++)
+        fprintf(f, " %s%d %s", l == 0 ? "" : "-> ", network->layers[l]->neuron_count, activation_name(network->layers[l]->activationFunction));
+    fprintf(f, "\n// Needs only <math.h> (link with -lm); every shape is constant, build it with optimizations, e.g. -O3 -march=native.\n");
+    fprintf(f, "//   void %s_predict(const %s *input, %s *output); // %d inputs, %d outputs, input and output must not overlap\n",
+            prefix, type, type, input_count, output_count);
+    fputs("#include <math.h>\n\n", f);
+    fprintf(f, "const int %s_input_count = %d;\nconst int %s_output_count = %d;\nconst int %s_real_size = %zu;\n\n", prefix, input_count,
+            prefix, output_count, prefix, config->element_size);
+
+    for (int l = 0; l < layer_count; l++)
+        write_parameters(f, network->layers[l], l, config, type);
+    // exp as computed by predict: the fast approximation, or libm when the activations are exact
+    char exp_name[80];
+    int is_float = config->element_size == sizeof(float);
+    if (nnGetActivationPrecision() == NN_ACTIVATION_EXACT)
+    {
+        snprintf(exp_name, sizeof(exp_name), "%s", is_float ? "expf" : "exp");
+    }
+    else
+    {
+        snprintf(exp_name, sizeof(exp_name), "%s_exp", prefix);
+        write_fast_exp(f, prefix, is_float);
+    }
+    for (int l = 0; l < layer_count; l++)
+        write_layer(f, network->layers[l], l, config, type, exp_name);
+
+    // the intermediate activations live on the stack
+    fprintf(f, "void %s_predict(const %s *input, %s *output)\n{\n", prefix, type, type);
+    for (int l = 0; l < layer_count - 1; l++)
+        fprintf(f, "    %s a%d[%d];\n", type, l, network->layers[l]->neuron_count);
+    for (int l = 0; l < layer_count; l++)
+    {
+        char source[16] = "input", destination[16] = "output";
+        if (l > 0)
+            snprintf(source, sizeof(source), "a%d", l - 1);
+        if (l < layer_count - 1)
+            snprintf(destination, sizeof(destination), "a%d", l);
+        fprintf(f, "    %s_layer%d(%s, %s);\n", prefix, l, source, destination);
+    }
+    fputs("}\n", f);
+
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed)
+    {
+        fprintf(stderr, "Error writing %s\n", filename);
+        return 1;
+    }
+    printf("Network compiled to %s (%s, %d layers)\n", filename, type, layer_count);
+    return 0;
+}
@@ -0,0 +1,29 @@
+// include guard
+#ifndef NNCODEGEN_H
+#define NNCODEGEN_H
+
+#include "nnNetwork.h"
+#include <stddef.h>
+
+// Ahead-of-time compilation of a trained network into a standalone C source file, for scoring with the
+// model built in: no file I/O, no heap, no dependency on this library (only <math.h>). The file holds
+// the parameters as aligned static const arrays and one forward function per layer whose loops all
+// have constant bounds. The weights are stored input-major, so the inner loop runs over the neurons:
+// every lane of a vector is an independent sum, and the compiler vectorizes it without reordering any
+// floating point addition (no -ffast-math needed). The file exports
+//   void <prefix>_predict(const <type> *input, <type> *output);
+//   const int <prefix>_input_count, <prefix>_output_count, <prefix>_real_size;
+// where <type> is float or double. The activations compute what predict computes: the fast exp of
+// nnKernels.c is emitted with them, or libm is used when the activation precision is exact (NN_ACTIVATION=exact).
+// Pruned layers are emitted dense (pruned weights are zero);
+// sparse-input layers skip the inputs equal to zero. The int8 engine is not emitted.
+typedef struct nnCodegenConfig
+{
+    const char *prefix;  // of every exported symbol, a C identifier
+    size_t element_size; // sizeof(float) or sizeof(double)
+} nnCodegenConfig;
+
+nnCodegenConfig nnDefaultCodegenConfig(void);
+int nnGenerateSource(const nnNetwork *network, const char *filename, const nnCodegenConfig *config);
+
+#endif // NNCODEGEN_H
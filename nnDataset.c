@@ -0,0 +1,577 @@
+#include "nnDataset.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NN_DATASET_MAGIC 0x53444E4E // "NNDS" on disk
+#define NN_DATASET_VERSION 1
+
+// WARNING: native endianness, like the model files
+typedef struct nnDatasetHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t label_count;
+    uint64_t pixels_offset;
+    uint64_t labels_offset;
+    uint8_t reserved[24]; // the pixels start on a 64 byte boundary
+} nnDatasetHeader;
+
+// ---------------------------------------------------------------------------
+// CSV parsing: the file is mapped and split into line aligned chunks, one per thread.
+// A first pass counts the samples of every chunk, so that each thread knows the first row it owns,
+// the second pass parses the chunks straight into the rows of one preallocated matrix.
+// ---------------------------------------------------------------------------
+
+typedef struct nnCsvChunk
+{
+    const char *begin;
+    const char *end;
+    int first_row;  // row of the first sample of the chunk
+    int rows;       // samples in the chunk
+    int bad_labels; // samples whose label is out of range
+    nnDataset *dataset;
+    pthread_t thread;
+} nnCsvChunk;
+
+static int is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// a line holds a sample when it starts with a digit (empty lines and a text header are skipped)
+static const char *next_line(const char *p, const char *end)
+{
+    const char *newline = (const char *)memchr(p, '\n', end - p);
+    return newline != NULL ? newline + 1 : end;
+}
+
+static void *count_chunk(void *arg)
+{
+    nnCsvChunk *chunk = (nnCsvChunk *)arg;
+    int rows = 0;
+    for (const char *p = chunk->begin; p < chunk->end; p = next_line(p, chunk->end))
+    {
+        rows += is_digit(*p);
+    }
+    chunk->rows = rows;
+    return NULL;
+}
+
+// reads the digits at p, values above 255 are returned as 256 (the accumulator never overflows)
+static int scan_byte(const char **p, const char *end)
+{
+    int value = 0;
+    const char *c = *p;
+    while (c < end && is_digit(*c))
+    {
+        value = value * 10 + (*c++ - '0');
+        if (value > 255)
+            value = 256;
+    }
+    *p = c;
+    return value;
+}
+
+// hand-rolled scanner: the label, then input_count unsigned integers separated by any non digit
+// (missing values are 0, values are clamped to a byte, extra values are ignored). An out-of-range
+// label is stored as NN_DATASET_NO_LABEL and counted.
+static void *parse_chunk(void *arg)
+{
+    nnCsvChunk *chunk = (nnCsvChunk *)arg;
+    nnDataset *dataset = chunk->dataset;
+    const int input_count = dataset->input_count;
+    uint8_t *pixels = (uint8_t *)dataset->pixels + (size_t)chunk->first_row * input_count;
+    uint8_t *labels = (uint8_t *)dataset->labels + chunk->first_row;
+
+    for (const char *p = chunk->begin; p < chunk->end;)
+    {
+        const char *line_end = next_line(p, chunk->end);
+        if (!is_digit(*p))
+        {
+            p = line_end;
+            continue;
+        }
+
+        int value = scan_byte(&p, line_end);
+        int valid = value < dataset->label_count;
+        *labels++ = (uint8_t)(valid ? value : NN_DATASET_NO_LABEL);
+        chunk->bad_labels += !valid;
+
+        for (int i = 0; i < input_count; i++)
+        {
+            while (p < line_end && !is_digit(*p) && *p != '\n')
+                p++;
+            value = scan_byte(&p, line_end);
+            pixels[i] = (uint8_t)(value > 255 ? 255 : value);
+        }
+        pixels += input_count;
+        p = line_end;
+    }
+    return NULL;
+}
+
+// runs 'body' on every chunk, chunk 0 on the calling thread
+static void run_chunks(nnCsvChunk *chunks, int count, void *(*body)(void *))
+{
+    int started = 1;
+    for (; started < count; started++)
+    {
+        if (pthread_create(&chunks[started].thread, NULL, body, &chunks[started]) != 0)
+            break;
+    }
+    // chunks without a thread run here
+    for (int c = started; c < count; c++)
+        body(&chunks[c]);
+    body(&chunks[0]);
+    for (int c = 1; c < started; c++)
+        pthread_join(chunks[c].thread, NULL);
+}
+
+// dataset owning a single heap block: pixels first, then the labels
+static nnDataset *create_dataset(int count, int rows, int cols, int label_count)
+{
+    nnDataset *dataset = (nnDataset *)malloc(sizeof(nnDataset));
+    if (dataset == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnDataset\n");
+        return NULL;
+    }
+
+    size_t pixel_bytes = (size_t)count * rows * cols;
+    dataset->buffer = nnAlignedAlloc(pixel_bytes + count + 1);
+    if (dataset->buffer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for a dataset of %d samples\n", count);
+        free(dataset);
+        return NULL;
+    }
+    dataset->count = count;
+    dataset->rows = rows;
+    dataset->cols = cols;
+    dataset->input_count = rows * cols;
+    dataset->label_count = label_count;
+    dataset->pixels = (const uint8_t *)dataset->buffer;
+    dataset->labels = (const uint8_t *)dataset->buffer + pixel_bytes;
+    dataset->mapping = NULL;
+    dataset->mapping_size = 0;
+    return dataset;
+}
+
+nnDataset *nnLoadCsvDataset(const char *csv_filename, int rows, int cols, int label_count, int threads)
+{
+    if (rows <= 0 || cols <= 0 || label_count <= 0 || label_count > NN_DATASET_NO_LABEL)
+    {
+        fprintf(stderr, "Invalid dataset shape %dx%d with %d labels\n", rows, cols, label_count);
+        return NULL;
+    }
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    int fd = open(csv_filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open file %s\n", csv_filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        fprintf(stderr, "Error: %s is empty\n", csv_filename);
+        close(fd);
+        return NULL;
+    }
+    const char *text = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map %s\n", csv_filename);
+        return NULL;
+    }
+    madvise((void *)text, st.st_size, MADV_SEQUENTIAL);
+
+    printf("Loading %s (%d threads)...\n", csv_filename, threads);
+    double start = nnNowSeconds();
+
+    nnCsvChunk *chunks = (nnCsvChunk *)calloc(threads, sizeof(nnCsvChunk));
+    if (chunks == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the CSV chunks\n");
+        munmap((void *)text, st.st_size);
+        return NULL;
+    }
+
+    // chunk boundaries are moved to the start of the next line
+    const char *text_end = text + st.st_size;
+    for (int c = 0; c < threads; c++)
+    {
+        const char *begin = text + (size_t)st.st_size / threads * c;
+        if (c > 0)
+            begin = next_line(begin - 1, text_end);
+        chunks[c].begin = begin;
+        if (c > 0)
+            chunks[c - 1].end = begin;
+    }
+    chunks[threads - 1].end = text_end;
+
+    run_chunks(chunks, threads, count_chunk);
+    int count = 0;
+    for (int c = 0; c < threads; c++)
+    {
+        chunks[c].first_row = count;
+        count += chunks[c].rows;
+    }
+
+    nnDataset *dataset = create_dataset(count, rows, cols, label_count);
+    if (dataset != NULL)
+    {
+        for (int c = 0; c < threads; c++)
+            chunks[c].dataset = dataset;
+        run_chunks(chunks, threads, parse_chunk);
+
+        int bad_labels = 0;
+        for (int c = 0; c < threads; c++)
+            bad_labels += chunks[c].bad_labels;
+        double elapsed = nnNowSeconds() - start;
+        printf("Loaded %d rows in %.3fs (%.0f rows/s, %.1f MB/s), %d with a label out of [0, %d)\n", count, elapsed,
+               count / (elapsed > 0.0 ? elapsed : 1e-9), st.st_size / 1e6 / (elapsed > 0.0 ? elapsed : 1e-9), bad_labels,
+               label_count);
+    }
+
+    free(chunks);
+    munmap((void *)text, st.st_size);
+    return dataset;
+}
+
+int nnWriteDataset(const nnDataset *dataset, const char *filename)
+{
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error opening file %s for writing\n", filename);
+        return 1;
+    }
+
+    nnDatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = NN_DATASET_MAGIC;
+    header.version = NN_DATASET_VERSION;
+    header.count = dataset->count;
+    header.rows = dataset->rows;
+    header.cols = dataset->cols;
+    header.label_count = dataset->label_count;
+    header.pixels_offset = sizeof(header);
+    header.labels_offset = sizeof(header) + (uint64_t)dataset->count * dataset->input_count;
+
+    size_t pixel_bytes = (size_t)dataset->count * dataset->input_count;
+    int result = fwrite(&header, sizeof(header), 1, f) != 1 ||
+                 fwrite(dataset->pixels, 1, pixel_bytes, f) != pixel_bytes ||
+                 fwrite(dataset->labels, 1, dataset->count, f) != (size_t)dataset->count;
+    if (fclose(f) != 0)
+        result = 1;
+    if (result != 0)
+    {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        remove(filename);
+    }
+    return result;
+}
+
+int nnConvertCsvDataset(const char *csv_filename, const char *filename, int rows, int cols, int label_count)
+{
+    nnDataset *dataset = nnLoadCsvDataset(csv_filename, rows, cols, label_count, 0);
+    if (dataset == NULL)
+    {
+        return 1;
+    }
+    int result = nnWriteDataset(dataset, filename);
+    if (result == 0)
+        printf("Converted %s to %s (%d samples).\n", csv_filename, filename, dataset->count);
+    nnFreeDataset(dataset);
+    return result;
+}
+
+// the pixels and the labels of every sample are inside a file of 'file_size' bytes
+static int valid_header(const nnDatasetHeader *header, uint64_t file_size)
+{
+    uint64_t input_count = (uint64_t)header->rows * header->cols;
+    return header->magic == NN_DATASET_MAGIC && header->version == NN_DATASET_VERSION && input_count != 0 &&
+           header->label_count != 0 && header->pixels_offset + (uint64_t)header->count * input_count <= file_size &&
+           header->labels_offset + header->count <= file_size;
+}
+
+nnDataset *nnMapDataset(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(nnDatasetHeader))
+    {
+        fprintf(stderr, "Invalid dataset file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (mapping == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map %s\n", filename);
+        return NULL;
+    }
+
+    const nnDatasetHeader *header = (const nnDatasetHeader *)mapping;
+    uint64_t input_count = (uint64_t)header->rows * header->cols;
+    if (!valid_header(header, (uint64_t)st.st_size))
+    {
+        fprintf(stderr, "Invalid dataset file %s\n", filename);
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+
+    nnDataset *dataset = (nnDataset *)malloc(sizeof(nnDataset));
+    if (dataset == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnDataset\n");
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+    dataset->count = (int)header->count;
+    dataset->rows = (int)header->rows;
+    dataset->cols = (int)header->cols;
+    dataset->input_count = (int)input_count;
+    dataset->label_count = (int)header->label_count;
+    dataset->pixels = (const uint8_t *)mapping + header->pixels_offset;
+    dataset->labels = (const uint8_t *)mapping + header->labels_offset;
+    dataset->mapping = mapping;
+    dataset->mapping_size = st.st_size;
+    dataset->buffer = NULL;
+
+    // every epoch reads the whole file, let the kernel start paging it in
+    madvise(mapping, st.st_size, MADV_WILLNEED);
+
+    printf("Dataset %s mapped: %d samples of %dx%d\n", filename, dataset->count, dataset->rows, dataset->cols);
+    return dataset;
+}
+
+void nnFreeDataset(nnDataset *dataset)
+{
+    if (!dataset)
+    {
+        return;
+    }
+
+    if (dataset->mapping != NULL)
+        munmap(dataset->mapping, dataset->mapping_size);
+    nnAlignedFree(dataset->buffer);
+    free(dataset);
+}
+
+nnDatasetReader *nnOpenDatasetReader(const char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error: Unable to open file %s\n", filename);
+        return NULL;
+    }
+
+    nnDatasetHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        !valid_header(&header, (uint64_t)st.st_size))
+    {
+        fprintf(stderr, "Invalid dataset file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    nnDatasetReader *reader = (nnDatasetReader *)malloc(sizeof(nnDatasetReader));
+    if (reader == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnDatasetReader\n");
+        close(fd);
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->count = (int)header.count;
+    reader->rows = (int)header.rows;
+    reader->cols = (int)header.cols;
+    reader->input_count = (int)(header.rows * header.cols);
+    reader->label_count = (int)header.label_count;
+    reader->pixels_offset = header.pixels_offset;
+    reader->labels_offset = header.labels_offset;
+
+    // the samples are read front to back: ask for a larger read-ahead
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return reader;
+}
+
+void nnCloseDatasetReader(nnDatasetReader *reader)
+{
+    if (!reader)
+    {
+        return;
+    }
+
+    close(reader->fd);
+    free(reader);
+}
+
+nnDataset *nnCreateReaderChunk(const nnDatasetReader *reader, int capacity)
+{
+    return create_dataset(capacity, reader->rows, reader->cols, reader->label_count);
+}
+
+// pread until 'size' bytes are in, it can return less than asked
+static int read_fully(int fd, void *buffer, size_t size, uint64_t offset)
+{
+    uint8_t *p = (uint8_t *)buffer;
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, p, size, (off_t)offset);
+        if (n <= 0)
+            return 1;
+        p += n;
+        size -= (size_t)n;
+        offset += (uint64_t)n;
+    }
+    return 0;
+}
+
+int nnDatasetRead(const nnDatasetReader *reader, int first, int count, nnDataset *chunk)
+{
+    if (first < 0 || count < 0 || first + count > reader->count)
+    {
+        fprintf(stderr, "Samples [%d, %d) are outside the dataset\n", first, first + count);
+        return 1;
+    }
+
+    uint8_t *pixels = (uint8_t *)chunk->pixels;
+    uint8_t *labels = (uint8_t *)chunk->labels;
+    if (read_fully(reader->fd, pixels, (size_t)count * reader->input_count,
+                   reader->pixels_offset + (uint64_t)first * reader->input_count) ||
+        read_fully(reader->fd, labels, (size_t)count, reader->labels_offset + (uint64_t)first))
+    {
+        fprintf(stderr, "Failed to read samples [%d, %d) of the dataset\n", first, first + count);
+        return 1;
+    }
+    chunk->count = count;
+    return 0;
+}
+
+void nnDatasetGatherInputs(const nnDataset *dataset, int first, int count, nnReal *inputs, int stride)
+{
+    for (int b = 0; b < count; b++)
+    {
+        const uint8_t *src = dataset->pixels + (size_t)(first + b) * dataset->input_count;
+        nnReal *dst = inputs + (size_t)b * stride;
+        for (int i = 0; i < dataset->input_count; i++)
+        {
+            dst[i] = (nnReal)(src[i] / 255.0);
+        }
+    }
+}
+
+void nnDatasetGatherTargets(const nnDataset *dataset, int first, int count, nnReal *targets, int stride)
+{
+    for (int b = 0; b < count; b++)
+    {
+        nnReal *dst = targets + (size_t)b * stride;
+        for (int k = 0; k < dataset->label_count; k++)
+            dst[k] = 0.0;
+        int label = dataset->labels[first + b];
+        if (label < dataset->label_count)
+            dst[label] = 1.0;
+    }
+}
+
+static void carve_sample_set(nnArena *arena, nnSampleSet *set)
+{
+    set->inputs = (nnReal **)nnArenaAlloc(arena, set->count * sizeof(nnReal *));
+    set->targets = (nnReal **)nnArenaAlloc(arena, set->count * sizeof(nnReal *));
+    nnReal *input_rows = (nnReal *)nnArenaAlloc(arena, (size_t)set->count * nnPaddedCount(set->input_count) * sizeof(nnReal));
+    nnReal *target_rows = (nnReal *)nnArenaAlloc(arena, (size_t)set->count * nnPaddedCount(set->output_count) * sizeof(nnReal));
+    if (arena->base == NULL)
+        return;
+
+    for (int i = 0; i < set->count; i++)
+    {
+        set->inputs[i] = input_rows + (size_t)i * nnPaddedCount(set->input_count);
+        set->targets[i] = target_rows + (size_t)i * nnPaddedCount(set->output_count);
+    }
+}
+
+nnSampleSet *nnCreateSampleSet(int count, int input_count, int output_count)
+{
+    if (count <= 0 || input_count <= 0 || output_count <= 0)
+    {
+        fprintf(stderr, "Invalid sample set %d x (%d, %d)\n", count, input_count, output_count);
+        return NULL;
+    }
+
+    // measuring pass, then the struct itself is the first block of its arena
+    nnSampleSet shape;
+    shape.count = count;
+    shape.input_count = input_count;
+    shape.output_count = output_count;
+    nnArena arena;
+    nnArenaMeasure(&arena);
+    nnArenaAlloc(&arena, sizeof(nnSampleSet));
+    carve_sample_set(&arena, &shape);
+    if (nnArenaCreate(&arena, arena.used))
+    {
+        return NULL;
+    }
+
+    nnSampleSet *set = (nnSampleSet *)nnArenaAlloc(&arena, sizeof(nnSampleSet));
+    *set = shape;
+    carve_sample_set(&arena, set);
+    set->arena = arena;
+    return set;
+}
+
+nnSampleSet *nnExpandDataset(const nnDataset *dataset, int first, int count)
+{
+    if (first < 0 || count <= 0 || first + count > dataset->count)
+    {
+        fprintf(stderr, "Samples [%d, %d) are outside the dataset\n", first, first + count);
+        return NULL;
+    }
+    nnSampleSet *set = nnCreateSampleSet(count, dataset->input_count, dataset->label_count);
+    if (set == NULL)
+    {
+        return NULL;
+    }
+
+    // the rows are consecutive: one gather over the whole block
+    nnDatasetGatherInputs(dataset, first, count, set->inputs[0], nnPaddedCount(set->input_count));
+    nnDatasetGatherTargets(dataset, first, count, set->targets[0], nnPaddedCount(set->output_count));
+    return set;
+}
+
+void nnFreeSampleSet(nnSampleSet *set)
+{
+    if (!set)
+    {
+        return;
+    }
+
+    // the arena owns the struct: copy it out before releasing
+    nnArena arena = set->arena;
+    nnArenaFree(&arena);
+}
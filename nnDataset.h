@@ -0,0 +1,87 @@
+// include guard
+#ifndef NNDATASET_H
+#define NNDATASET_H
+
+#include "nnLayer.h"
+#include "nnArena.h"
+#include <stdint.h>
+
+// Image classification dataset kept as raw uint8 pixels and labels, converted to nnReal only while
+// a batch is assembled (pixel / 255.0, the same values the CSV loader produced).
+// The binary file (IDX-like, native endianness) is:
+//   64 byte header: magic "NNDS", version, count, rows, cols, label_count, pixels offset, labels offset
+//   count x rows x cols pixels, then count labels
+// A label that is out of range in the source is stored as NN_DATASET_NO_LABEL: the sample gets an all-zero
+// target (nnDatasetGatherTargets) and the evaluation skips it.
+#define NN_DATASET_NO_LABEL 255 // so at most 255 classes
+// nnMapDataset maps it read-only: loading is a single mmap and the pages are shared between runs.
+typedef struct nnDataset
+{
+    int count;
+    int rows;
+    int cols;
+    int input_count; // rows * cols pixels per sample
+    int label_count; // classes, targets are one-hot vectors of label_count elements
+
+    const uint8_t *pixels; // count rows of input_count pixels
+    const uint8_t *labels; // count labels in [0, label_count), or NN_DATASET_NO_LABEL
+
+    void *mapping; // the mapped file (NULL when not mapped)
+    size_t mapping_size;
+    void *buffer; // heap block holding pixels and labels when loaded from CSV (NULL when mapped)
+} nnDataset;
+
+// Parses a CSV file ("label,p0,p1,...", one sample per line) on 'threads' threads (0: every core)
+// into a single contiguous block, and prints the rows/s
+nnDataset *nnLoadCsvDataset(const char *csv_filename, int rows, int cols, int label_count, int threads);
+int nnWriteDataset(const nnDataset *dataset, const char *filename);
+// one-time conversion of a CSV file into the binary format
+int nnConvertCsvDataset(const char *csv_filename, const char *filename, int rows, int cols, int label_count);
+nnDataset *nnMapDataset(const char *filename);
+void nnFreeDataset(nnDataset *dataset);
+
+// Streaming access to a binary dataset file without mapping it: every read is a pread of the requested
+// samples into a chunk (a heap dataset of 'capacity' samples), so the memory used is the chunks whatever
+// the file size. Reads only share the descriptor, any number of threads can read at the same time.
+typedef struct nnDatasetReader
+{
+    int fd;
+    int count;
+    int rows;
+    int cols;
+    int input_count;
+    int label_count;
+    uint64_t pixels_offset;
+    uint64_t labels_offset;
+} nnDatasetReader;
+
+nnDatasetReader *nnOpenDatasetReader(const char *filename);
+void nnCloseDatasetReader(nnDatasetReader *reader);
+nnDataset *nnCreateReaderChunk(const nnDatasetReader *reader, int capacity); // released by nnFreeDataset
+// samples [first, first + count) into 'chunk' (count <= its capacity), which then holds exactly them
+int nnDatasetRead(const nnDatasetReader *reader, int first, int count, nnDataset *chunk);
+
+// batch assembly: samples [first, first + count) as normalized inputs and one-hot targets,
+// one sample every 'stride' elements of the destination matrix
+void nnDatasetGatherInputs(const nnDataset *dataset, int first, int count, nnReal *inputs, int stride);
+void nnDatasetGatherTargets(const nnDataset *dataset, int first, int count, nnReal *targets, int stride);
+
+// Samples already in nnReal (inputs and targets), all in a single arena: the rows are padded, aligned and
+// consecutive, so an epoch is a linear scan. 'inputs' and 'targets' are row views that can be passed to
+// every API taking nnReal ** rows (trainWithConfig, nnPredictBatchRows, nnQuantizeNetwork, ...).
+typedef struct nnSampleSet
+{
+    int count;
+    int input_count;
+    int output_count;
+    nnReal **inputs;  // count row pointers into the arena
+    nnReal **targets; // count row pointers into the arena
+    nnArena arena;    // holds this struct, the row pointers and the rows
+} nnSampleSet;
+
+nnSampleSet *nnCreateSampleSet(int count, int input_count, int output_count);
+// normalized copy of samples [first, first + count) of a dataset, with one-hot targets
+nnSampleSet *nnExpandDataset(const nnDataset *dataset, int first, int count);
+void nnFreeSampleSet(nnSampleSet *set);
+
+#endif // NNDATASET_H
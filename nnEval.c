@@ -0,0 +1,332 @@
+#include "nnEval.h"
+#include "nnPlan.h"
+#include "nnInference.h"
+#include "nnQuant.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CONFUSION_PRINT_MAX 32 // wider matrices are not printed
+
+// State shared by the evaluation threads, the samples come from 'dataset' or 'reader'
+typedef struct nnEvalShared
+{
+    const nnNetwork *network;
+    const nnEvalConfig *config;
+    const nnDataset *dataset;
+    const nnDatasetReader *reader;
+    int count;
+    int input_count;
+    int class_count;
+
+    pthread_mutex_t mutex;
+    int next_first; // first sample of the next unclaimed chunk
+    int failed;     // a read failed, the workers stop
+} nnEvalShared;
+
+typedef struct nnEvalWorker
+{
+    nnEvalShared *shared;
+    pthread_t thread;
+    nnPlan *plan;                // float engine
+    nnInferenceContext *context; // int8 engine
+    nnDataset *chunk;            // samples read from the file (streaming only)
+    nnReal *inputs;              // chunk_samples normalized rows
+    nnReal *outputs;             // chunk_samples rows of class_count outputs
+    long *confusion;             // of this worker, summed at the end
+    long top_k_correct;
+} nnEvalWorker;
+
+nnEvalConfig nnDefaultEvalConfig(void)
+{
+    nnEvalConfig config;
+    config.threads = 0;
+    config.chunk_samples = 1024;
+    config.top_k = 3;
+    config.quantized = 0;
+    return config;
+}
+
+// predicted class and rank of the label: outputs above it, ties broken like the prediction (first index wins)
+static void score_chunk(nnEvalWorker *worker, const uint8_t *labels, int count)
+{
+    int class_count = worker->shared->class_count;
+    int top_k = worker->shared->config->top_k;
+    for (int b = 0; b < count; b++)
+    {
+        const nnReal *out = worker->outputs + (size_t)b * class_count;
+        int label = labels[b];
+        if (label >= class_count)
+            continue;
+
+        int predicted = 0;
+        int rank = 0;
+        for (int i = 0; i < class_count; i++)
+        {
+            if (out[i] > out[predicted])
+                predicted = i;
+            rank += out[i] > out[label] || (out[i] == out[label] && i < label);
+        }
+        worker->confusion[(size_t)label * class_count + predicted]++;
+        worker->top_k_correct += rank < top_k;
+    }
+}
+
+static void *evaluate_chunks(void *arg)
+{
+    nnEvalWorker *worker = (nnEvalWorker *)arg;
+    nnEvalShared *shared = worker->shared;
+    int chunk_samples = shared->config->chunk_samples;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&shared->mutex);
+        int first = shared->next_first;
+        int stop = first >= shared->count || shared->failed;
+        shared->next_first += chunk_samples;
+        pthread_mutex_unlock(&shared->mutex);
+        if (stop)
+            break;
+
+        int count = shared->count - first < chunk_samples ? shared->count - first : chunk_samples;
+        const nnDataset *source = shared->dataset;
+        int offset = first;
+        if (shared->reader != NULL)
+        {
+            if (nnDatasetRead(shared->reader, first, count, worker->chunk))
+            {
+                pthread_mutex_lock(&shared->mutex);
+                shared->failed = 1;
+                pthread_mutex_unlock(&shared->mutex);
+                break;
+            }
+            source = worker->chunk;
+            offset = 0;
+        }
+
+        nnDatasetGatherInputs(source, offset, count, worker->inputs, shared->input_count);
+        if (shared->config->quantized)
+            predictQuantizedBatchWithContext(shared->network, worker->context, worker->inputs, count, worker->outputs);
+        else
+            nnPlanPredictBatch(worker->plan, worker->inputs, count, worker->outputs);
+        score_chunk(worker, source->labels + offset, count);
+    }
+    return NULL;
+}
+
+static void free_workers(nnEvalWorker *workers, int count)
+{
+    for (int t = 0; t < count; t++)
+    {
+        nnFreePlan(workers[t].plan);
+        nnFreeInferenceContext(workers[t].context);
+        nnFreeDataset(workers[t].chunk);
+        free(workers[t].inputs);
+        free(workers[t].outputs);
+        free(workers[t].confusion);
+    }
+    free(workers);
+}
+
+static int create_worker(nnEvalWorker *worker, nnEvalShared *shared)
+{
+    const nnNetwork *network = shared->network;
+    int chunk_samples = shared->config->chunk_samples;
+    worker->shared = shared;
+    if (shared->config->quantized)
+        worker->context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    else
+        worker->plan = nnCompilePlan(network, nnDefaultBatchTile(network));
+    if (shared->reader != NULL)
+        worker->chunk = nnCreateReaderChunk(shared->reader, chunk_samples);
+    worker->inputs = (nnReal *)malloc((size_t)chunk_samples * shared->input_count * sizeof(nnReal));
+    worker->outputs = (nnReal *)malloc((size_t)chunk_samples * shared->class_count * sizeof(nnReal));
+    worker->confusion = (long *)calloc((size_t)shared->class_count * shared->class_count, sizeof(long));
+    return (worker->plan == NULL && worker->context == NULL) || (shared->reader != NULL && worker->chunk == NULL) ||
+           worker->inputs == NULL || worker->outputs == NULL || worker->confusion == NULL;
+}
+
+static nnEvalResult *evaluate(const nnNetwork *network, const nnDataset *dataset, const nnDatasetReader *reader,
+                              const nnEvalConfig *config)
+{
+    double start = nnNowSeconds();
+    int count = dataset != NULL ? dataset->count : reader->count;
+    int input_count = dataset != NULL ? dataset->input_count : reader->input_count;
+    int label_count = dataset != NULL ? dataset->label_count : reader->label_count;
+    if (network == NULL || network->layer_count == 0 || config->chunk_samples <= 0 || config->top_k <= 0)
+    {
+        fprintf(stderr, "Invalid evaluation of %d samples\n", count);
+        return NULL;
+    }
+    int class_count = network->layers[network->layer_count - 1]->neuron_count;
+    if (network->layers[0]->input_count != input_count || label_count > class_count)
+    {
+        fprintf(stderr, "The dataset (%d inputs, %d labels) does not match the network (%d inputs, %d outputs)\n", input_count,
+                label_count, network->layers[0]->input_count, class_count);
+        return NULL;
+    }
+    if (config->quantized && !nnIsQuantized(network))
+    {
+        fprintf(stderr, "The network is not quantized, the int8 engine cannot run\n");
+        return NULL;
+    }
+    if (!config->quantized && nnIsInt8Only(network))
+    {
+        fprintf(stderr, "The network only has int8 weights, evaluate it with the int8 engine\n");
+        return NULL;
+    }
+
+    int threads = config->threads > 0 ? config->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int chunk_count = (count + config->chunk_samples - 1) / config->chunk_samples;
+    if (threads > chunk_count)
+        threads = chunk_count;
+    if (threads <= 0)
+        threads = 1;
+
+    nnEvalShared shared;
+    shared.network = network;
+    shared.config = config;
+    shared.dataset = dataset;
+    shared.reader = reader;
+    shared.count = count;
+    shared.input_count = input_count;
+    shared.class_count = class_count;
+    shared.next_first = 0;
+    shared.failed = 0;
+
+    nnEvalResult *result = (nnEvalResult *)calloc(1, sizeof(nnEvalResult));
+    nnEvalWorker *workers = (nnEvalWorker *)calloc(threads, sizeof(nnEvalWorker));
+    if (result != NULL)
+        result->confusion = (long *)calloc((size_t)class_count * class_count, sizeof(long));
+    int failed = result == NULL || workers == NULL || result->confusion == NULL;
+    for (int t = 0; t < threads && !failed; t++)
+        failed = create_worker(&workers[t], &shared);
+    if (failed)
+    {
+        fprintf(stderr, "Memory allocation failed for the evaluation\n");
+        if (workers != NULL)
+            free_workers(workers, threads);
+        nnFreeEvalResult(result);
+        return NULL;
+    }
+
+    // worker 0 runs on the calling thread, the chunks of a thread that cannot start go to the others
+    pthread_mutex_init(&shared.mutex, NULL);
+    int started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&workers[started].thread, NULL, evaluate_chunks, &workers[started]) != 0)
+            break;
+    }
+    evaluate_chunks(&workers[0]);
+    for (int t = 1; t < started; t++)
+        pthread_join(workers[t].thread, NULL);
+    pthread_mutex_destroy(&shared.mutex);
+
+    result->class_count = class_count;
+    result->top_k = config->top_k;
+    result->threads = started;
+    for (int t = 0; t < threads; t++)
+    {
+        for (size_t i = 0; i < (size_t)class_count * class_count; i++)
+            result->confusion[i] += workers[t].confusion[i];
+        result->top_k_correct += workers[t].top_k_correct;
+    }
+    for (int c = 0; c < class_count; c++)
+    {
+        for (int p = 0; p < class_count; p++)
+            result->count += result->confusion[(size_t)c * class_count + p];
+        result->correct += result->confusion[(size_t)c * class_count + c];
+    }
+    free_workers(workers, threads);
+    result->seconds = nnNowSeconds() - start;
+
+    if (shared.failed)
+    {
+        nnFreeEvalResult(result);
+        return NULL;
+    }
+    return result;
+}
+
+nnEvalResult *nnEvaluateDataset(const nnNetwork *network, const nnDataset *dataset, const nnEvalConfig *config)
+{
+    return evaluate(network, dataset, NULL, config);
+}
+
+nnEvalResult *nnEvaluateFile(const nnNetwork *network, const char *filename, const nnEvalConfig *config)
+{
+    nnDatasetReader *reader = nnOpenDatasetReader(filename);
+    if (reader == NULL)
+    {
+        return NULL;
+    }
+    nnEvalResult *result = evaluate(network, NULL, reader, config);
+    nnCloseDatasetReader(reader);
+    return result;
+}
+
+static double ratio(long part, long whole)
+{
+    return whole > 0 ? (double)part / whole : 0.0;
+}
+
+void nnPrintEvalResult(const nnEvalResult *result, const char *name)
+{
+    int n = result->class_count;
+    printf(">>> Result: %.2f%% (%ld/%ld correct), top-%d %.2f%%\n", ratio(result->correct, result->count) * 100.0, result->correct,
+           result->count, result->top_k, ratio(result->top_k_correct, result->count) * 100.0);
+
+    // precision: of the samples predicted as c, the ones labeled c; recall: of the samples labeled c, the ones predicted c
+    printf("%s per class:\n  class  samples  precision  recall      F1\n", name);
+    double macro[3] = {0.0, 0.0, 0.0};
+    for (int c = 0; c < n; c++)
+    {
+        long labeled = 0, predicted = 0;
+        for (int i = 0; i < n; i++)
+        {
+            labeled += result->confusion[(size_t)c * n + i];
+            predicted += result->confusion[(size_t)i * n + c];
+        }
+        long hits = result->confusion[(size_t)c * n + c];
+        double precision = ratio(hits, predicted);
+        double recall = ratio(hits, labeled);
+        double f1 = precision + recall > 0.0 ? 2.0 * precision * recall / (precision + recall) : 0.0;
+        printf("  %5d  %7ld    %6.2f%%  %6.2f%%  %6.2f%%\n", c, labeled, precision * 100.0, recall * 100.0, f1 * 100.0);
+        macro[0] += precision;
+        macro[1] += recall;
+        macro[2] += f1;
+    }
+    printf("  macro  %7ld    %6.2f%%  %6.2f%%  %6.2f%%\n", result->count, macro[0] / n * 100.0, macro[1] / n * 100.0,
+           macro[2] / n * 100.0);
+
+    if (n <= CONFUSION_PRINT_MAX)
+    {
+        printf("Confusion matrix (rows: label, columns: predicted class):\n      ");
+        for (int p = 0; p < n; p++)
+            printf(" %6d", p);
+        printf("\n");
+        for (int c = 0; c < n; c++)
+        {
+            printf("  %4d", c);
+            for (int p = 0; p < n; p++)
+                printf(" %6ld", result->confusion[(size_t)c * n + p]);
+            printf("\n");
+        }
+    }
+    printf("Evaluated %ld samples in %.3fs (%.0f samples/s, %d threads)\n", result->count, result->seconds,
+           result->count / (result->seconds > 0.0 ? result->seconds : 1e-9), result->threads);
+}
+
+void nnFreeEvalResult(nnEvalResult *result)
+{
+    if (!result)
+    {
+        return;
+    }
+
+    free(result->confusion);
+    free(result);
+}
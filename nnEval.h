@@ -0,0 +1,40 @@
+// include guard
+#ifndef NNEVAL_H
+#define NNEVAL_H
+
+#include "nnNetwork.h"
+#include "nnDataset.h"
+
+// Parallel accuracy evaluation of a classifier. The samples are scored in chunks claimed by the worker
+// threads, each with its own execution plan (nnPlan.h) or int8 inference context and its own confusion
+// matrix; the matrices are summed at the end, so the result does not depend on the thread count.
+// nnEvaluateFile streams the samples from a binary dataset file (nnDatasetReader): the memory used is
+// one chunk per thread whatever the size of the file.
+typedef struct nnEvalConfig
+{
+    int threads;       // workers, 0 uses every core
+    int chunk_samples; // samples read and scored together by a worker
+    int top_k;         // a sample is a top-k hit when its label is among the k largest outputs
+    int quantized;     // run the int8 engine, the network must have been quantized (nnQuant.h); needed by an int8-only one
+} nnEvalConfig;
+
+typedef struct nnEvalResult
+{
+    int class_count; // outputs of the network
+    int top_k;
+    int threads; // workers that ran
+    long count;
+    long correct; // predicted class (the first largest output) equal to the label
+    long top_k_correct;
+    long *confusion; // class_count x class_count counts, row: label, column: predicted class
+    double seconds;  // wall time of the evaluation
+} nnEvalResult;
+
+nnEvalConfig nnDefaultEvalConfig(void);
+nnEvalResult *nnEvaluateDataset(const nnNetwork *network, const nnDataset *dataset, const nnEvalConfig *config);
+nnEvalResult *nnEvaluateFile(const nnNetwork *network, const char *filename, const nnEvalConfig *config);
+// accuracy, top-k accuracy, per-class precision / recall / F1 and the confusion matrix
+void nnPrintEvalResult(const nnEvalResult *result, const char *name);
+void nnFreeEvalResult(nnEvalResult *result);
+
+#endif // NNEVAL_H
@@ -0,0 +1,258 @@
+#include "nnInference.h"
+#include "nnQuant.h"
+#include "nnProfile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// L2 size assumed when the system does not report it
+#define NN_DEFAULT_L2_BYTES (256 * 1024)
+#define NN_MIN_BATCH_TILE 8
+#define NN_MAX_BATCH_TILE 1024
+
+// widest activation vector (padded) that a context for this network must hold
+static int network_max_width(const nnNetwork *network)
+{
+    int max_width = 0;
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        int width = nnPaddedCount(network->layers[l]->neuron_count);
+        if (width > max_width)
+            max_width = width;
+    }
+    return max_width;
+}
+
+// widest row of int8 input codes
+static int network_max_code_width(const nnNetwork *network)
+{
+    int max_width = 0;
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        int width = nnQuantInputStride(network->layers[l]);
+        if (width > max_width)
+            max_width = width;
+    }
+    return max_width;
+}
+
+// Number of samples per tile such that the activations of a tile (input tile and both
+// ping-pong buffers) take half of the L2 cache, the other half is left to the weights.
+int nnDefaultBatchTile(const nnNetwork *network)
+{
+    long l2_bytes = NN_DEFAULT_L2_BYTES;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long reported = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (reported > 0)
+        l2_bytes = reported;
+#endif
+
+    size_t sample_bytes = (nnPaddedCount(network->layers[0]->input_count) + 2 * (size_t)network_max_width(network)) * sizeof(nnReal);
+    long tile = (long)(l2_bytes / 2 / sample_bytes);
+    if (tile < NN_MIN_BATCH_TILE)
+        tile = NN_MIN_BATCH_TILE;
+    if (tile > NN_MAX_BATCH_TILE)
+        tile = NN_MAX_BATCH_TILE;
+    return (int)tile;
+}
+
+static void carve_context(nnInferenceContext *context, const nnNetwork *network)
+{
+    size_t input_stride = nnPaddedCount(network->layers[0]->input_count);
+    context->input = (nnReal *)nnArenaAlloc(&context->arena, context->max_batch * input_stride * sizeof(nnReal));
+    context->buffers[0] = (nnReal *)nnArenaAlloc(&context->arena, (size_t)context->max_batch * context->max_width * sizeof(nnReal));
+    context->buffers[1] = (nnReal *)nnArenaAlloc(&context->arena, (size_t)context->max_batch * context->max_width * sizeof(nnReal));
+    context->quantized = (uint8_t *)nnArenaAlloc(&context->arena, (size_t)context->max_batch * network_max_code_width(network));
+}
+
+nnInferenceContext *nnCreateInferenceContext(const nnNetwork *network)
+{
+    return nnCreateBatchInferenceContext(network, 1);
+}
+
+nnInferenceContext *nnCreateBatchInferenceContext(const nnNetwork *network, int max_batch)
+{
+    if (network == NULL || network->layer_count == 0 || max_batch <= 0)
+    {
+        fprintf(stderr, "Cannot create an inference context for an empty network\n");
+        return NULL;
+    }
+
+    nnInferenceContext *context = (nnInferenceContext *)malloc(sizeof(nnInferenceContext));
+    if (context == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnInferenceContext\n");
+        return NULL;
+    }
+
+    context->max_batch = max_batch;
+    context->max_width = network_max_width(network);
+
+    // every buffer of the context is carved from one arena
+    nnArenaMeasure(&context->arena);
+    carve_context(context, network);
+    if (nnArenaCreate(&context->arena, context->arena.used))
+    {
+        free(context);
+        return NULL;
+    }
+    carve_context(context, network);
+    return context;
+}
+
+void nnFreeInferenceContext(nnInferenceContext *context)
+{
+    if (!context)
+    {
+        return;
+    }
+
+    nnArenaFree(&context->arena);
+    free(context);
+}
+
+// runs 'count' samples already stored (with padded rows) in 'input', returns the matrix holding the outputs
+static const nnReal *forward_tile(const nnNetwork *network, nnInferenceContext *context, const nnReal *input, int count, int quantized)
+{
+    const nnReal *current_input = input;
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnReal *current_output = context->buffers[l % 2];
+        nnProfileMark mark;
+        nnProfileBegin(&mark);
+        if (quantized)
+            nnQuantLayerForwardBatch(network->layers[l], current_input, current_output, count, context->quantized);
+        else
+            nnLayerForwardBatch(network->layers[l], current_input, current_output, count);
+        nnProfileLayerEnd(&mark, l, network->layers[l], NN_PROFILE_FORWARD, count, quantized ? 1 : sizeof(nnReal));
+        current_input = current_output;
+    }
+    return current_input;
+}
+
+// the float passes need the float weights: an int8-only network (nnQuant.h) leaves 'n' zero outputs
+static int refuse_int8_only(const nnNetwork *network, nnReal *outputs, int n)
+{
+    if (!nnIsInt8Only(network))
+        return 0;
+    fprintf(stderr, "The network only has int8 weights, run it with the int8 engine\n");
+    memset(outputs, 0, (size_t)n * network->layers[network->layer_count - 1]->neuron_count * sizeof(nnReal));
+    return 1;
+}
+
+// Same as predict, but every intermediate result lives in the context: the network is not modified
+// and different threads can run it at the same time, each one with its own context.
+void predictWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *input, nnReal *output)
+{
+    if (refuse_int8_only(network, output, 1))
+        return;
+    // a single row needs no padding, the input is used as it is
+    const nnReal *final_output = forward_tile(network, context, input, 1, 0);
+
+    // copy the final output to the output given by the user
+    memcpy(output, final_output, network->layers[network->layer_count - 1]->neuron_count * sizeof(nnReal));
+}
+
+void predictQuantizedWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *input, nnReal *output)
+{
+    const nnReal *final_output = forward_tile(network, context, input, 1, 1);
+    memcpy(output, final_output, network->layers[network->layer_count - 1]->neuron_count * sizeof(nnReal));
+}
+
+// one of 'matrix' (contiguous rows) and 'rows' (row pointers) gives the inputs
+static void predict_batch(const nnNetwork *network, nnInferenceContext *context,
+                          const nnReal *matrix, const nnReal *const *rows, int n, nnReal *outputs, int quantized)
+{
+    int input_count = network->layers[0]->input_count;
+    int output_count = network->layers[network->layer_count - 1]->neuron_count;
+    int input_stride = nnPaddedCount(input_count);
+    int output_stride = nnPaddedCount(output_count);
+    if (!quantized && refuse_int8_only(network, outputs, n))
+        return;
+
+    for (int first = 0; first < n; first += context->max_batch)
+    {
+        int count = n - first < context->max_batch ? n - first : context->max_batch;
+
+        // tile assembly: copy the inputs into padded, aligned rows
+        for (int b = 0; b < count; b++)
+        {
+            const nnReal *src = rows != NULL ? rows[first + b] : matrix + (size_t)(first + b) * input_count;
+            memcpy(context->input + (size_t)b * input_stride, src, input_count * sizeof(nnReal));
+        }
+
+        const nnReal *final_output = forward_tile(network, context, context->input, count, quantized);
+        for (int b = 0; b < count; b++)
+        {
+            memcpy(outputs + (size_t)(first + b) * output_count, final_output + (size_t)b * output_stride, output_count * sizeof(nnReal));
+        }
+    }
+}
+
+void predictBatchWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *inputs, int n, nnReal *outputs)
+{
+    predict_batch(network, context, inputs, NULL, n, outputs, 0);
+}
+
+void predictBatchRowsWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *const *inputs, int n, nnReal *outputs)
+{
+    predict_batch(network, context, NULL, inputs, n, outputs, 0);
+}
+
+void predictQuantizedBatchWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *inputs, int n, nnReal *outputs)
+{
+    predict_batch(network, context, inputs, NULL, n, outputs, 1);
+}
+
+void predictQuantizedBatchRowsWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *const *inputs, int n, nnReal *outputs)
+{
+    predict_batch(network, context, NULL, inputs, n, outputs, 1);
+}
+
+// one-shot variants: the context is created with the default tile and released before returning
+int nnPredictBatch(const nnNetwork *network, const nnReal *inputs, int n, nnReal *outputs)
+{
+    if (refuse_int8_only(network, outputs, n))
+        return 1;
+    nnInferenceContext *context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    if (context == NULL)
+    {
+        return 1;
+    }
+    predictBatchWithContext(network, context, inputs, n, outputs);
+    nnFreeInferenceContext(context);
+    return 0;
+}
+
+int nnPredictBatchRows(const nnNetwork *network, const nnReal *const *inputs, int n, nnReal *outputs)
+{
+    if (refuse_int8_only(network, outputs, n))
+        return 1;
+    nnInferenceContext *context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    if (context == NULL)
+    {
+        return 1;
+    }
+    predictBatchRowsWithContext(network, context, inputs, n, outputs);
+    nnFreeInferenceContext(context);
+    return 0;
+}
+
+int nnPredictQuantizedBatchRows(const nnNetwork *network, const nnReal *const *inputs, int n, nnReal *outputs)
+{
+    if (!nnIsQuantized(network))
+    {
+        fprintf(stderr, "The network has not been quantized\n");
+        return 1;
+    }
+    nnInferenceContext *context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    if (context == NULL)
+    {
+        return 1;
+    }
+    predictQuantizedBatchRowsWithContext(network, context, inputs, n, outputs);
+    nnFreeInferenceContext(context);
+    return 0;
+}
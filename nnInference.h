@@ -0,0 +1,40 @@
+// include guard
+#ifndef NNINFERENCE_H
+#define NNINFERENCE_H
+
+#include "nnNetwork.h"
+#include "nnArena.h"
+#include <stdint.h>
+
+// Scratch memory for running a network, create one per thread.
+// The network itself is only read, so any number of contexts can share the same weights.
+typedef struct nnInferenceContext
+{
+    int max_batch;      // samples processed together (rows of every buffer)
+    int max_width;      // widest vector flowing through the network (padded)
+    nnReal *input;      // max_batch x padded input_count, used to assemble a tile of inputs
+    nnReal *buffers[2]; // ping-pong activations, max_batch x max_width elements each
+    uint8_t *quantized; // max_batch rows of int8 input codes, used by the quantized variants
+    nnArena arena;      // holds every buffer above
+} nnInferenceContext;
+
+nnInferenceContext *nnCreateInferenceContext(const nnNetwork *network);
+nnInferenceContext *nnCreateBatchInferenceContext(const nnNetwork *network, int max_batch);
+void nnFreeInferenceContext(nnInferenceContext *context);
+int nnDefaultBatchTile(const nnNetwork *network);
+void predictWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *input, nnReal *output);
+
+// Batched inference: 'inputs' is a contiguous n x input_count matrix (or n row pointers for the Rows variants),
+// 'outputs' a contiguous n x output_count matrix. The samples are processed in tiles of context->max_batch rows.
+void predictBatchWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *inputs, int n, nnReal *outputs);
+void predictBatchRowsWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *const *inputs, int n, nnReal *outputs);
+int nnPredictBatch(const nnNetwork *network, const nnReal *inputs, int n, nnReal *outputs);
+int nnPredictBatchRows(const nnNetwork *network, const nnReal *const *inputs, int n, nnReal *outputs);
+
+// Same entry points running the int8 engine, the network must have been quantized (nnQuant.h)
+void predictQuantizedWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *input, nnReal *output);
+void predictQuantizedBatchWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *inputs, int n, nnReal *outputs);
+void predictQuantizedBatchRowsWithContext(const nnNetwork *network, nnInferenceContext *context, const nnReal *const *inputs, int n, nnReal *outputs);
+int nnPredictQuantizedBatchRows(const nnNetwork *network, const nnReal *const *inputs, int n, nnReal *outputs);
+
+#endif // NNINFERENCE_H
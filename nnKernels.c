@@ -0,0 +1,1371 @@
+#include "nnKernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NN_HAVE_X86_KERNELS 1
+#endif
+
+// Cache blocking sizes (in elements). A K block of one row is at most 2 KB, a block of
+// NN_BLOCK_N rows of B at most 128 KB so it stays in L2 while it is reused for every row of A.
+#define NN_BLOCK_K 256
+#define NN_BLOCK_N 64
+// columns of C updated together in the axpy based products (at most 2 KB per row, kept in L1)
+#define NN_BLOCK_COLS 256
+
+typedef struct nnKernelTable
+{
+    nnKernelLevel level;
+    nnReal (*dot)(const nnReal *a, const nnReal *b, int n);
+    void (*dot4)(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out);
+    void (*axpy)(nnReal alpha, const nnReal *x, nnReal *y, int n);
+    void (*momentum_update)(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale, nnReal momentum,
+                            nnReal learning_rate);
+    void (*adam_update)(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale, nnReal beta1,
+                        nnReal beta2, nnReal step_size, nnReal epsilon);
+    void (*backprop_row)(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n);
+    void (*sparse_gemv)(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y);
+    void (*csr_gemv)(int rows, const int32_t *row_start, const int32_t *columns, const nnReal *values, const nnReal *x, nnReal *y);
+    void (*sigmoid)(nnReal *x, const nnReal *bias, int n); // fast approximations, x = f(x + bias)
+    void (*tanh)(nnReal *x, const nnReal *bias, int n);
+    void (*softmax)(nnReal *x, const nnReal *bias, int n);
+} nnKernelTable;
+
+// Fast exp: exp(x) = 2^k * exp(r) with k = round(x / ln2) and |r| <= ln2 / 2 (Cody-Waite reduction),
+// exp(r) is its Taylor polynomial.
+// double: degree 10, the truncation error is below 3.1e-13 (relative), so with rounding the result
+// is within 4e-13 of libm exp. x is clamped to [-708, 708], the range where 2^k is a normal double.
+// Derived bounds: sigmoid = 1 / (1 + exp(-x)) and tanh = 1 - 2 / (exp(2x) + 1) have an absolute
+// error below 1e-12 (tanh loses its relative accuracy only for |x| < 1e-4, where it is ~x).
+// float: degree 7, truncation below 3e-9, so the error is dominated by float rounding (a few ulp,
+// absolute error of sigmoid and tanh below 1e-6). x is clamped to [-87, 87].
+#define NN_LOG2E 1.4426950408889634074
+#define NN_LN2_HI 6.93145751953125e-1
+#define NN_LN2_LO 1.42860682030941723212e-6
+#ifdef NN_FLOAT32
+#define NN_EXP_MAX 87.0f
+#define NN_EXP_TERMS 8
+static const nnReal exp_poly[NN_EXP_TERMS] = {
+    1.0f / 5040.0f, 1.0f / 720.0f, 1.0f / 120.0f, 1.0f / 24.0f, 1.0f / 6.0f, 1.0f / 2.0f, 1.0f, 1.0f};
+#else
+#define NN_EXP_MAX 708.0
+#define NN_EXP_TERMS 11
+static const nnReal exp_poly[NN_EXP_TERMS] = {
+    1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0,
+    1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0};
+#endif
+
+static nnActivationPrecision activation_precision = NN_ACTIVATION_FAST;
+
+// SCALAR KERNELS (portable fallback)
+
+static nnReal dot_scalar(const nnReal *a, const nnReal *b, int n)
+{
+    // independent partial sums, so the additions do not wait on each other
+    nnReal s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; i++)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static void dot4_scalar(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out)
+{
+    nnReal s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int k = 0; k < n; k++)
+    {
+        s0 += a[k] * b0[k];
+        s1 += a[k] * b1[k];
+        s2 += a[k] * b2[k];
+        s3 += a[k] * b3[k];
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+static void axpy_scalar(nnReal alpha, const nnReal *x, nnReal *y, int n)
+{
+    for (int i = 0; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+// velocity = momentum * velocity + scale * gradient, params -= learning_rate * velocity
+static void momentum_update_scalar(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale, nnReal momentum,
+                                   nnReal learning_rate)
+{
+    for (int i = 0; i < n; i++)
+    {
+        velocity[i] = momentum * velocity[i] + scale * gradient[i];
+        params[i] -= learning_rate * velocity[i];
+    }
+}
+
+// g = scale * gradient, m = beta1 * m + (1 - beta1) * g, v = beta2 * v + (1 - beta2) * g^2,
+// params -= step_size * m / (sqrt(v) + epsilon) (step_size includes the bias correction)
+static void adam_update_scalar(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale, nnReal beta1,
+                               nnReal beta2, nnReal step_size, nnReal epsilon)
+{
+    for (int i = 0; i < n; i++)
+    {
+        nnReal g = scale * gradient[i];
+        m[i] = beta1 * m[i] + (1 - beta1) * g;
+        v[i] = beta2 * v[i] + (1 - beta2) * g * g;
+        params[i] -= step_size * m[i] / ((nnReal)sqrt((double)v[i]) + epsilon);
+    }
+}
+
+static void backprop_row_scalar(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        inputGradient[i] += delta * weights[i];
+        weights[i] -= step * input[i];
+    }
+}
+
+static void sparse_gemv_scalar(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y)
+{
+    if (!accumulate)
+        memset(y, 0, n * sizeof(nnReal));
+    for (int k = 0; k < nnz; k++)
+    {
+        const nnReal *row = A + (size_t)index[k] * lda;
+        for (int i = 0; i < n; i++)
+            y[i] += values[k] * row[i];
+    }
+}
+
+static void csr_gemv_scalar(int rows, const int32_t *row_start, const int32_t *columns, const nnReal *values, const nnReal *x, nnReal *y)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        nnReal sum = 0;
+        for (int32_t k = row_start[i]; k < row_start[i + 1]; k++)
+            sum += values[k] * x[columns[k]];
+        y[i] = sum;
+    }
+}
+
+static nnReal exp_fast_scalar(nnReal x)
+{
+    x = x < -NN_EXP_MAX ? -NN_EXP_MAX : (x > NN_EXP_MAX ? NN_EXP_MAX : x);
+    nnReal k = nearbyint(x * (nnReal)NN_LOG2E);
+    nnReal r = (x - k * (nnReal)NN_LN2_HI) - k * (nnReal)NN_LN2_LO;
+    nnReal p = exp_poly[0];
+    for (int i = 1; i < NN_EXP_TERMS; i++)
+        p = p * r + exp_poly[i];
+
+    // 2^k built directly in the exponent field
+#ifdef NN_FLOAT32
+    union
+    {
+        float f;
+        int i;
+    } scale;
+    scale.i = ((int)k + 127) << 23;
+    return p * scale.f;
+#else
+    union
+    {
+        double f;
+        long long i;
+    } scale;
+    scale.i = ((long long)k + 1023) << 52;
+    return p * scale.f;
+#endif
+}
+
+static void sigmoid_scalar(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+        x[i] = 1 / (1 + exp_fast_scalar(-(x[i] + bias[i])));
+}
+
+static void tanh_scalar(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+        x[i] = 1 - 2 / (exp_fast_scalar(2 * (x[i] + bias[i])) + 1);
+}
+
+// Softmax of the whole vector in its max-shifted (log-sum-exp) form: exp(v - max) / sum exp(v - max).
+// Every exponent is <= 0, so nothing overflows, and the largest term is exactly 1 so the sum is >= 1.
+static void softmax_scalar(nnReal *x, const nnReal *bias, int n)
+{
+    nnReal max = x[0] + bias[0];
+    for (int i = 0; i < n; i++)
+    {
+        x[i] += bias[i];
+        max = x[i] > max ? x[i] : max;
+    }
+    nnReal sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = exp_fast_scalar(x[i] - max);
+        sum += x[i];
+    }
+    nnReal inverse = 1 / sum;
+    for (int i = 0; i < n; i++)
+        x[i] *= inverse;
+}
+
+#ifdef NN_HAVE_X86_KERNELS
+
+// The SIMD kernels are written once over these wrappers, which map to the _ps (float32)
+// or the _pd (double) intrinsics. V256 is an AVX2 register, V512 an AVX-512 one.
+#ifdef NN_FLOAT32
+#define V256 __m256
+#define V256_LANES 8
+#define V256_LOAD _mm256_loadu_ps
+#define V256_STORE _mm256_storeu_ps
+#define V256_SET1 _mm256_set1_ps
+#define V256_ZERO _mm256_setzero_ps
+#define V256_ADD _mm256_add_ps
+#define V256_SUB _mm256_sub_ps
+#define V256_MUL _mm256_mul_ps
+#define V256_DIV _mm256_div_ps
+#define V256_SQRT _mm256_sqrt_ps
+#define V256_MIN _mm256_min_ps
+#define V256_MAX _mm256_max_ps
+#define V256_FMADD _mm256_fmadd_ps
+#define V256_FNMADD _mm256_fnmadd_ps
+#define V256_ROUND _mm256_round_ps
+#define V512 __m512
+#define V512_LANES 16
+#define V512_MASK __mmask16
+#define V512_LOAD _mm512_loadu_ps
+#define V512_STORE _mm512_storeu_ps
+#define V512_MASKZ_LOAD _mm512_maskz_loadu_ps
+#define V512_MASK_STORE _mm512_mask_storeu_ps
+#define V512_SET1 _mm512_set1_ps
+#define V512_ZERO _mm512_setzero_ps
+#define V512_ADD _mm512_add_ps
+#define V512_SUB _mm512_sub_ps
+#define V512_MUL _mm512_mul_ps
+#define V512_DIV _mm512_div_ps
+#define V512_SQRT _mm512_sqrt_ps
+#define V512_MIN _mm512_min_ps
+#define V512_MAX _mm512_max_ps
+#define V512_FMADD _mm512_fmadd_ps
+#define V512_FNMADD _mm512_fnmadd_ps
+#define V512_ROUND _mm512_roundscale_ps
+#define V512_SCALEF _mm512_scalef_ps
+#define V512_REDUCE_ADD _mm512_reduce_add_ps
+#define V512_REDUCE_MAX _mm512_reduce_max_ps
+#define V512_MASK_ADD _mm512_mask_add_ps
+#define V512_MASK_MAX _mm512_mask_max_ps
+#define V256_INDEX __m256i // V256_LANES int32 indices
+#define V256_LOAD_INDEX(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V256_GATHER(base, index) _mm256_i32gather_ps(base, index, 4)
+#define V512_INDEX __m512i
+#define V512_LOAD_INDEX(p) _mm512_loadu_si512(p)
+#define V512_GATHER(base, index) _mm512_i32gather_ps(index, base, 4)
+#define V512_MASKZ_LOAD_INDEX(m, p) _mm512_maskz_loadu_epi32(m, p)
+#define V512_MASKZ_GATHER(m, base, index) _mm512_mask_i32gather_ps(_mm512_setzero_ps(), m, index, base, 4)
+#else
+#define V256 __m256d
+#define V256_LANES 4
+#define V256_LOAD _mm256_loadu_pd
+#define V256_STORE _mm256_storeu_pd
+#define V256_SET1 _mm256_set1_pd
+#define V256_ZERO _mm256_setzero_pd
+#define V256_ADD _mm256_add_pd
+#define V256_SUB _mm256_sub_pd
+#define V256_MUL _mm256_mul_pd
+#define V256_DIV _mm256_div_pd
+#define V256_SQRT _mm256_sqrt_pd
+#define V256_MIN _mm256_min_pd
+#define V256_MAX _mm256_max_pd
+#define V256_FMADD _mm256_fmadd_pd
+#define V256_FNMADD _mm256_fnmadd_pd
+#define V256_ROUND _mm256_round_pd
+#define V512 __m512d
+#define V512_LANES 8
+#define V512_MASK __mmask8
+#define V512_LOAD _mm512_loadu_pd
+#define V512_STORE _mm512_storeu_pd
+#define V512_MASKZ_LOAD _mm512_maskz_loadu_pd
+#define V512_MASK_STORE _mm512_mask_storeu_pd
+#define V512_SET1 _mm512_set1_pd
+#define V512_ZERO _mm512_setzero_pd
+#define V512_ADD _mm512_add_pd
+#define V512_SUB _mm512_sub_pd
+#define V512_MUL _mm512_mul_pd
+#define V512_DIV _mm512_div_pd
+#define V512_SQRT _mm512_sqrt_pd
+#define V512_MIN _mm512_min_pd
+#define V512_MAX _mm512_max_pd
+#define V512_FMADD _mm512_fmadd_pd
+#define V512_FNMADD _mm512_fnmadd_pd
+#define V512_ROUND _mm512_roundscale_pd
+#define V512_SCALEF _mm512_scalef_pd
+#define V512_REDUCE_ADD _mm512_reduce_add_pd
+#define V512_REDUCE_MAX _mm512_reduce_max_pd
+#define V512_MASK_ADD _mm512_mask_add_pd
+#define V512_MASK_MAX _mm512_mask_max_pd
+#define V256_INDEX __m128i
+#define V256_LOAD_INDEX(p) _mm_loadu_si128((const __m128i *)(p))
+#define V256_GATHER(base, index) _mm256_i32gather_pd(base, index, 8)
+#define V512_INDEX __m256i
+#define V512_LOAD_INDEX(p) _mm256_loadu_si256((const __m256i *)(p))
+#define V512_GATHER(base, index) _mm512_i32gather_pd(index, base, 8)
+#define V512_MASKZ_LOAD_INDEX(m, p) _mm512_castsi512_si256(_mm512_maskz_loadu_epi32((__mmask16)(m), p)) // no AVX512VL needed
+#define V512_MASKZ_GATHER(m, base, index) _mm512_mask_i32gather_pd(_mm512_setzero_pd(), m, index, base, 8)
+#endif
+
+// AVX2 + FMA KERNELS
+
+#define NN_AVX2 __attribute__((target("avx2,fma")))
+
+NN_AVX2 static nnReal hsum_avx2(V256 v)
+{
+#ifdef NN_FLOAT32
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    return _mm_cvtss_f32(_mm_add_ss(lo, _mm_movehdup_ps(lo)));
+#else
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+#endif
+}
+
+NN_AVX2 static nnReal dot_avx2(const nnReal *a, const nnReal *b, int n)
+{
+    V256 s0 = V256_ZERO();
+    V256 s1 = V256_ZERO();
+    int i = 0;
+    for (; i + 2 * V256_LANES <= n; i += 2 * V256_LANES)
+    {
+        s0 = V256_FMADD(V256_LOAD(a + i), V256_LOAD(b + i), s0);
+        s1 = V256_FMADD(V256_LOAD(a + i + V256_LANES), V256_LOAD(b + i + V256_LANES), s1);
+    }
+    for (; i + V256_LANES <= n; i += V256_LANES)
+        s0 = V256_FMADD(V256_LOAD(a + i), V256_LOAD(b + i), s0);
+    nnReal sum = hsum_avx2(V256_ADD(s0, s1));
+    for (; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+NN_AVX2 static void dot4_avx2(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out)
+{
+    V256 s0 = V256_ZERO();
+    V256 s1 = V256_ZERO();
+    V256 s2 = V256_ZERO();
+    V256 s3 = V256_ZERO();
+    int k = 0;
+    for (; k + V256_LANES <= n; k += V256_LANES)
+    {
+        V256 va = V256_LOAD(a + k);
+        s0 = V256_FMADD(va, V256_LOAD(b0 + k), s0);
+        s1 = V256_FMADD(va, V256_LOAD(b1 + k), s1);
+        s2 = V256_FMADD(va, V256_LOAD(b2 + k), s2);
+        s3 = V256_FMADD(va, V256_LOAD(b3 + k), s3);
+    }
+    out[0] = hsum_avx2(s0);
+    out[1] = hsum_avx2(s1);
+    out[2] = hsum_avx2(s2);
+    out[3] = hsum_avx2(s3);
+
+    for (; k < n; k++)
+    {
+        out[0] += a[k] * b0[k];
+        out[1] += a[k] * b1[k];
+        out[2] += a[k] * b2[k];
+        out[3] += a[k] * b3[k];
+    }
+}
+
+NN_AVX2 static void axpy_avx2(nnReal alpha, const nnReal *x, nnReal *y, int n)
+{
+    V256 va = V256_SET1(alpha);
+    int i = 0;
+    for (; i + 2 * V256_LANES <= n; i += 2 * V256_LANES)
+    {
+        V256_STORE(y + i, V256_FMADD(va, V256_LOAD(x + i), V256_LOAD(y + i)));
+        V256_STORE(y + i + V256_LANES, V256_FMADD(va, V256_LOAD(x + i + V256_LANES), V256_LOAD(y + i + V256_LANES)));
+    }
+    for (; i + V256_LANES <= n; i += V256_LANES)
+        V256_STORE(y + i, V256_FMADD(va, V256_LOAD(x + i), V256_LOAD(y + i)));
+    for (; i < n; i++)
+        y[i] += alpha * x[i];
+}
+
+NN_AVX2 static void momentum_update_avx2(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale, nnReal momentum,
+                                         nnReal learning_rate)
+{
+    const V256 vscale = V256_SET1(scale), vmomentum = V256_SET1(momentum), vrate = V256_SET1(learning_rate);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 vel = V256_FMADD(vmomentum, V256_LOAD(velocity + i), V256_MUL(vscale, V256_LOAD(gradient + i)));
+        V256_STORE(velocity + i, vel);
+        V256_STORE(params + i, V256_FNMADD(vrate, vel, V256_LOAD(params + i)));
+    }
+    momentum_update_scalar(params + i, gradient + i, velocity + i, n - i, scale, momentum, learning_rate);
+}
+
+NN_AVX2 static void adam_update_avx2(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale, nnReal beta1,
+                                     nnReal beta2, nnReal step_size, nnReal epsilon)
+{
+    const V256 vscale = V256_SET1(scale), vbeta1 = V256_SET1(beta1), vbeta2 = V256_SET1(beta2);
+    const V256 vrest1 = V256_SET1(1 - beta1), vrest2 = V256_SET1(1 - beta2);
+    const V256 vstep = V256_SET1(step_size), veps = V256_SET1(epsilon);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 g = V256_MUL(vscale, V256_LOAD(gradient + i));
+        V256 vm = V256_FMADD(vbeta1, V256_LOAD(m + i), V256_MUL(vrest1, g));
+        V256 vv = V256_FMADD(vbeta2, V256_LOAD(v + i), V256_MUL(vrest2, V256_MUL(g, g)));
+        V256_STORE(m + i, vm);
+        V256_STORE(v + i, vv);
+        V256 update = V256_DIV(V256_MUL(vstep, vm), V256_ADD(V256_SQRT(vv), veps));
+        V256_STORE(params + i, V256_SUB(V256_LOAD(params + i), update));
+    }
+    adam_update_scalar(params + i, gradient + i, m + i, v + i, n - i, scale, beta1, beta2, step_size, epsilon);
+}
+
+// the inputs of the kept weights are gathered V256_LANES at a time, two accumulators per row
+NN_AVX2 static void csr_gemv_avx2(int rows, const int32_t *row_start, const int32_t *columns, const nnReal *values, const nnReal *x, nnReal *y)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        int32_t k = row_start[i];
+        int32_t end = row_start[i + 1];
+        V256 s0 = V256_ZERO();
+        V256 s1 = V256_ZERO();
+        for (; k + 2 * V256_LANES <= end; k += 2 * V256_LANES)
+        {
+            s0 = V256_FMADD(V256_LOAD(values + k), V256_GATHER(x, V256_LOAD_INDEX(columns + k)), s0);
+            s1 = V256_FMADD(V256_LOAD(values + k + V256_LANES), V256_GATHER(x, V256_LOAD_INDEX(columns + k + V256_LANES)), s1);
+        }
+        for (; k + V256_LANES <= end; k += V256_LANES)
+            s0 = V256_FMADD(V256_LOAD(values + k), V256_GATHER(x, V256_LOAD_INDEX(columns + k)), s0);
+        nnReal sum = hsum_avx2(V256_ADD(s0, s1));
+        for (; k < end; k++)
+            sum += values[k] * x[columns[k]];
+        y[i] = sum;
+    }
+}
+
+// the output columns are processed in blocks of 4 vectors kept in registers over all the non-zero rows
+NN_AVX2 static void sparse_gemv_avx2(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y)
+{
+    int i = 0;
+    for (; i + 4 * V256_LANES <= n; i += 4 * V256_LANES)
+    {
+        V256 s0 = accumulate ? V256_LOAD(y + i) : V256_ZERO();
+        V256 s1 = accumulate ? V256_LOAD(y + i + V256_LANES) : V256_ZERO();
+        V256 s2 = accumulate ? V256_LOAD(y + i + 2 * V256_LANES) : V256_ZERO();
+        V256 s3 = accumulate ? V256_LOAD(y + i + 3 * V256_LANES) : V256_ZERO();
+        for (int k = 0; k < nnz; k++)
+        {
+            const nnReal *row = A + (size_t)index[k] * lda + i;
+            V256 v = V256_SET1(values[k]);
+            s0 = V256_FMADD(v, V256_LOAD(row), s0);
+            s1 = V256_FMADD(v, V256_LOAD(row + V256_LANES), s1);
+            s2 = V256_FMADD(v, V256_LOAD(row + 2 * V256_LANES), s2);
+            s3 = V256_FMADD(v, V256_LOAD(row + 3 * V256_LANES), s3);
+        }
+        V256_STORE(y + i, s0);
+        V256_STORE(y + i + V256_LANES, s1);
+        V256_STORE(y + i + 2 * V256_LANES, s2);
+        V256_STORE(y + i + 3 * V256_LANES, s3);
+    }
+    for (; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 s = accumulate ? V256_LOAD(y + i) : V256_ZERO();
+        for (int k = 0; k < nnz; k++)
+            s = V256_FMADD(V256_SET1(values[k]), V256_LOAD(A + (size_t)index[k] * lda + i), s);
+        V256_STORE(y + i, s);
+    }
+    for (; i < n; i++)
+    {
+        nnReal s = accumulate ? y[i] : 0;
+        for (int k = 0; k < nnz; k++)
+            s += values[k] * A[(size_t)index[k] * lda + i];
+        y[i] = s;
+    }
+}
+
+NN_AVX2 static void backprop_row_avx2(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n)
+{
+    V256 vd = V256_SET1(delta);
+    V256 vs = V256_SET1(-step);
+    int i = 0;
+    for (; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 w = V256_LOAD(weights + i);
+        V256_STORE(inputGradient + i, V256_FMADD(vd, w, V256_LOAD(inputGradient + i)));
+        V256_STORE(weights + i, V256_FMADD(vs, V256_LOAD(input + i), w));
+    }
+    for (; i < n; i++)
+    {
+        inputGradient[i] += delta * weights[i];
+        weights[i] -= step * input[i];
+    }
+}
+
+// 2^k for a vector of integral values k, written directly in the exponent field
+NN_AVX2 static V256 exp2_int_avx2(V256 k)
+{
+#ifdef NN_FLOAT32
+    __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+#else
+    // AVX2 has no double -> int64 conversion: adding 1.5 * 2^52 leaves k in the low bits of the mantissa
+    const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+    __m256i bits = _mm256_castpd_si256(_mm256_add_pd(k, magic));
+    bits = _mm256_slli_epi64(_mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+    return _mm256_castsi256_pd(bits);
+#endif
+}
+
+NN_AVX2 static V256 exp_avx2(V256 x)
+{
+    x = V256_MIN(V256_MAX(x, V256_SET1(-NN_EXP_MAX)), V256_SET1(NN_EXP_MAX));
+    V256 k = V256_ROUND(V256_MUL(x, V256_SET1(NN_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    V256 r = V256_FNMADD(k, V256_SET1(NN_LN2_HI), x);
+    r = V256_FNMADD(k, V256_SET1(NN_LN2_LO), r);
+    V256 p = V256_SET1(exp_poly[0]);
+    for (int i = 1; i < NN_EXP_TERMS; i++)
+        p = V256_FMADD(p, r, V256_SET1(exp_poly[i]));
+    return V256_MUL(p, exp2_int_avx2(k));
+}
+
+NN_AVX2 static V256 sigmoid_avx2_vec(V256 x)
+{
+    const V256 one = V256_SET1(1);
+    V256 e = exp_avx2(V256_SUB(V256_ZERO(), x));
+    return V256_DIV(one, V256_ADD(one, e));
+}
+
+NN_AVX2 static V256 tanh_avx2_vec(V256 x)
+{
+    const V256 one = V256_SET1(1);
+    V256 e = exp_avx2(V256_ADD(x, x));
+    return V256_SUB(one, V256_DIV(V256_SET1(2), V256_ADD(e, one)));
+}
+
+// the tail goes through a zero padded register, so every element takes the same path
+#define NN_AVX2_ACTIVATION(name, vec_fn)                                                \
+    NN_AVX2 static void name(nnReal *x, const nnReal *bias, int n)                      \
+    {                                                                                   \
+        int i = 0;                                                                      \
+        for (; i + V256_LANES <= n; i += V256_LANES)                                    \
+            V256_STORE(x + i, vec_fn(V256_ADD(V256_LOAD(x + i), V256_LOAD(bias + i)))); \
+        if (i < n)                                                                      \
+        {                                                                               \
+            nnReal tail[V256_LANES] = {0};                                              \
+            for (int j = i; j < n; j++)                                                 \
+                tail[j - i] = x[j] + bias[j];                                           \
+            V256_STORE(tail, vec_fn(V256_LOAD(tail)));                                  \
+            for (int j = i; j < n; j++)                                                 \
+                x[j] = tail[j - i];                                                     \
+        }                                                                               \
+    }
+
+NN_AVX2_ACTIVATION(sigmoid_avx2, sigmoid_avx2_vec)
+NN_AVX2_ACTIVATION(tanh_avx2, tanh_avx2_vec)
+
+// max-shifted softmax (see softmax_scalar): max pass, exp and sum pass, scaling pass
+NN_AVX2 static void softmax_avx2(nnReal *x, const nnReal *bias, int n)
+{
+    int i = 0;
+    V256 vmax = V256_SET1(x[0] + bias[0]);
+    for (; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 v = V256_ADD(V256_LOAD(x + i), V256_LOAD(bias + i));
+        V256_STORE(x + i, v);
+        vmax = V256_MAX(vmax, v);
+    }
+    nnReal lanes[V256_LANES];
+    V256_STORE(lanes, vmax);
+    nnReal max = lanes[0];
+    for (int j = 1; j < V256_LANES; j++)
+        max = lanes[j] > max ? lanes[j] : max;
+    for (; i < n; i++)
+    {
+        x[i] += bias[i];
+        max = x[i] > max ? x[i] : max;
+    }
+
+    const V256 shift = V256_SET1(max);
+    V256 vsum = V256_ZERO();
+    for (i = 0; i + V256_LANES <= n; i += V256_LANES)
+    {
+        V256 e = exp_avx2(V256_SUB(V256_LOAD(x + i), shift));
+        V256_STORE(x + i, e);
+        vsum = V256_ADD(vsum, e);
+    }
+    nnReal sum = hsum_avx2(vsum);
+    if (i < n)
+    {
+        // the tail through a zero padded register, like the other activations; only its valid lanes are summed
+        nnReal tail[V256_LANES] = {0};
+        for (int j = i; j < n; j++)
+            tail[j - i] = x[j] - max;
+        V256_STORE(tail, exp_avx2(V256_LOAD(tail)));
+        for (int j = i; j < n; j++)
+        {
+            x[j] = tail[j - i];
+            sum += x[j];
+        }
+    }
+
+    const V256 inverse = V256_SET1(1 / sum);
+    for (i = 0; i + V256_LANES <= n; i += V256_LANES)
+        V256_STORE(x + i, V256_MUL(V256_LOAD(x + i), inverse));
+    for (; i < n; i++)
+        x[i] *= 1 / sum;
+}
+
+// AVX-512 KERNELS (the tails use masked loads and stores)
+
+#define NN_AVX512 __attribute__((target("avx512f")))
+
+NN_AVX512 static V512_MASK tail_mask(int remaining)
+{
+    return remaining >= V512_LANES ? (V512_MASK)-1 : (V512_MASK)((1u << remaining) - 1u);
+}
+
+NN_AVX512 static nnReal dot_avx512(const nnReal *a, const nnReal *b, int n)
+{
+    V512 s0 = V512_ZERO();
+    V512 s1 = V512_ZERO();
+    int i = 0;
+    for (; i + 2 * V512_LANES <= n; i += 2 * V512_LANES)
+    {
+        s0 = V512_FMADD(V512_LOAD(a + i), V512_LOAD(b + i), s0);
+        s1 = V512_FMADD(V512_LOAD(a + i + V512_LANES), V512_LOAD(b + i + V512_LANES), s1);
+    }
+    for (; i + V512_LANES <= n; i += V512_LANES)
+        s0 = V512_FMADD(V512_LOAD(a + i), V512_LOAD(b + i), s0);
+    if (i < n)
+    {
+        V512_MASK m = tail_mask(n - i);
+        s1 = V512_FMADD(V512_MASKZ_LOAD(m, a + i), V512_MASKZ_LOAD(m, b + i), s1);
+    }
+    return V512_REDUCE_ADD(V512_ADD(s0, s1));
+}
+
+NN_AVX512 static void dot4_avx512(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out)
+{
+    V512 s0 = V512_ZERO();
+    V512 s1 = V512_ZERO();
+    V512 s2 = V512_ZERO();
+    V512 s3 = V512_ZERO();
+    for (int k = 0; k < n; k += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - k);
+        V512 va = V512_MASKZ_LOAD(m, a + k);
+        s0 = V512_FMADD(va, V512_MASKZ_LOAD(m, b0 + k), s0);
+        s1 = V512_FMADD(va, V512_MASKZ_LOAD(m, b1 + k), s1);
+        s2 = V512_FMADD(va, V512_MASKZ_LOAD(m, b2 + k), s2);
+        s3 = V512_FMADD(va, V512_MASKZ_LOAD(m, b3 + k), s3);
+    }
+    out[0] = V512_REDUCE_ADD(s0);
+    out[1] = V512_REDUCE_ADD(s1);
+    out[2] = V512_REDUCE_ADD(s2);
+    out[3] = V512_REDUCE_ADD(s3);
+}
+
+NN_AVX512 static void axpy_avx512(nnReal alpha, const nnReal *x, nnReal *y, int n)
+{
+    V512 va = V512_SET1(alpha);
+    int i = 0;
+    for (; i + V512_LANES <= n; i += V512_LANES)
+        V512_STORE(y + i, V512_FMADD(va, V512_LOAD(x + i), V512_LOAD(y + i)));
+    if (i < n)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512_MASK_STORE(y + i, m, V512_FMADD(va, V512_MASKZ_LOAD(m, x + i), V512_MASKZ_LOAD(m, y + i)));
+    }
+}
+
+NN_AVX512 static void momentum_update_avx512(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale,
+                                             nnReal momentum, nnReal learning_rate)
+{
+    const V512 vscale = V512_SET1(scale), vmomentum = V512_SET1(momentum), vrate = V512_SET1(learning_rate);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK k = tail_mask(n - i);
+        V512 vel = V512_FMADD(vmomentum, V512_MASKZ_LOAD(k, velocity + i), V512_MUL(vscale, V512_MASKZ_LOAD(k, gradient + i)));
+        V512_MASK_STORE(velocity + i, k, vel);
+        V512_MASK_STORE(params + i, k, V512_FNMADD(vrate, vel, V512_MASKZ_LOAD(k, params + i)));
+    }
+}
+
+NN_AVX512 static void adam_update_avx512(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale,
+                                         nnReal beta1, nnReal beta2, nnReal step_size, nnReal epsilon)
+{
+    const V512 vscale = V512_SET1(scale), vbeta1 = V512_SET1(beta1), vbeta2 = V512_SET1(beta2);
+    const V512 vrest1 = V512_SET1(1 - beta1), vrest2 = V512_SET1(1 - beta2);
+    const V512 vstep = V512_SET1(step_size), veps = V512_SET1(epsilon);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK k = tail_mask(n - i);
+        V512 g = V512_MUL(vscale, V512_MASKZ_LOAD(k, gradient + i));
+        V512 vm = V512_FMADD(vbeta1, V512_MASKZ_LOAD(k, m + i), V512_MUL(vrest1, g));
+        V512 vv = V512_FMADD(vbeta2, V512_MASKZ_LOAD(k, v + i), V512_MUL(vrest2, V512_MUL(g, g)));
+        V512_MASK_STORE(m + i, k, vm);
+        V512_MASK_STORE(v + i, k, vv);
+        V512 update = V512_DIV(V512_MUL(vstep, vm), V512_ADD(V512_SQRT(vv), veps));
+        V512_MASK_STORE(params + i, k, V512_SUB(V512_MASKZ_LOAD(k, params + i), update));
+    }
+}
+
+NN_AVX512 static void csr_gemv_avx512(int rows, const int32_t *row_start, const int32_t *columns, const nnReal *values, const nnReal *x, nnReal *y)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        int32_t k = row_start[i];
+        int32_t end = row_start[i + 1];
+        V512 s0 = V512_ZERO();
+        V512 s1 = V512_ZERO();
+        for (; k + 2 * V512_LANES <= end; k += 2 * V512_LANES)
+        {
+            s0 = V512_FMADD(V512_LOAD(values + k), V512_GATHER(x, V512_LOAD_INDEX(columns + k)), s0);
+            s1 = V512_FMADD(V512_LOAD(values + k + V512_LANES), V512_GATHER(x, V512_LOAD_INDEX(columns + k + V512_LANES)), s1);
+        }
+        for (; k + V512_LANES <= end; k += V512_LANES)
+            s0 = V512_FMADD(V512_LOAD(values + k), V512_GATHER(x, V512_LOAD_INDEX(columns + k)), s0);
+        if (k < end)
+        {
+            // masked lanes neither load nor gather anything
+            V512_MASK m = tail_mask(end - k);
+            s1 = V512_FMADD(V512_MASKZ_LOAD(m, values + k), V512_MASKZ_GATHER(m, x, V512_MASKZ_LOAD_INDEX(m, columns + k)), s1);
+        }
+        y[i] = V512_REDUCE_ADD(V512_ADD(s0, s1));
+    }
+}
+
+NN_AVX512 static void sparse_gemv_avx512(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y)
+{
+    int i = 0;
+    for (; i + 4 * V512_LANES <= n; i += 4 * V512_LANES)
+    {
+        V512 s0 = accumulate ? V512_LOAD(y + i) : V512_ZERO();
+        V512 s1 = accumulate ? V512_LOAD(y + i + V512_LANES) : V512_ZERO();
+        V512 s2 = accumulate ? V512_LOAD(y + i + 2 * V512_LANES) : V512_ZERO();
+        V512 s3 = accumulate ? V512_LOAD(y + i + 3 * V512_LANES) : V512_ZERO();
+        for (int k = 0; k < nnz; k++)
+        {
+            const nnReal *row = A + (size_t)index[k] * lda + i;
+            V512 v = V512_SET1(values[k]);
+            s0 = V512_FMADD(v, V512_LOAD(row), s0);
+            s1 = V512_FMADD(v, V512_LOAD(row + V512_LANES), s1);
+            s2 = V512_FMADD(v, V512_LOAD(row + 2 * V512_LANES), s2);
+            s3 = V512_FMADD(v, V512_LOAD(row + 3 * V512_LANES), s3);
+        }
+        V512_STORE(y + i, s0);
+        V512_STORE(y + i + V512_LANES, s1);
+        V512_STORE(y + i + 2 * V512_LANES, s2);
+        V512_STORE(y + i + 3 * V512_LANES, s3);
+    }
+    for (; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 s = accumulate ? V512_MASKZ_LOAD(m, y + i) : V512_ZERO();
+        for (int k = 0; k < nnz; k++)
+            s = V512_FMADD(V512_SET1(values[k]), V512_MASKZ_LOAD(m, A + (size_t)index[k] * lda + i), s);
+        V512_MASK_STORE(y + i, m, s);
+    }
+}
+
+NN_AVX512 static void backprop_row_avx512(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n)
+{
+    V512 vd = V512_SET1(delta);
+    V512 vs = V512_SET1(-step);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 w = V512_MASKZ_LOAD(m, weights + i);
+        V512_MASK_STORE(inputGradient + i, m, V512_FMADD(vd, w, V512_MASKZ_LOAD(m, inputGradient + i)));
+        V512_MASK_STORE(weights + i, m, V512_FMADD(vs, V512_MASKZ_LOAD(m, input + i), w));
+    }
+}
+
+NN_AVX512 static V512 exp_avx512(V512 x)
+{
+    x = V512_MIN(V512_MAX(x, V512_SET1(-NN_EXP_MAX)), V512_SET1(NN_EXP_MAX));
+    V512 k = V512_ROUND(V512_MUL(x, V512_SET1(NN_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    V512 r = V512_FNMADD(k, V512_SET1(NN_LN2_HI), x);
+    r = V512_FNMADD(k, V512_SET1(NN_LN2_LO), r);
+    V512 p = V512_SET1(exp_poly[0]);
+    for (int i = 1; i < NN_EXP_TERMS; i++)
+        p = V512_FMADD(p, r, V512_SET1(exp_poly[i]));
+    return V512_SCALEF(p, k); // p * 2^k
+}
+
+NN_AVX512 static void sigmoid_avx512(nnReal *x, const nnReal *bias, int n)
+{
+    const V512 one = V512_SET1(1);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 v = V512_ADD(V512_MASKZ_LOAD(m, x + i), V512_MASKZ_LOAD(m, bias + i));
+        V512 e = exp_avx512(V512_SUB(V512_ZERO(), v));
+        V512_MASK_STORE(x + i, m, V512_DIV(one, V512_ADD(one, e)));
+    }
+}
+
+// max-shifted softmax (see softmax_scalar), the masked lanes are kept out of the max and of the sum
+NN_AVX512 static void softmax_avx512(nnReal *x, const nnReal *bias, int n)
+{
+    V512 vmax = V512_SET1(x[0] + bias[0]);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 v = V512_ADD(V512_MASKZ_LOAD(m, x + i), V512_MASKZ_LOAD(m, bias + i));
+        V512_MASK_STORE(x + i, m, v);
+        vmax = V512_MASK_MAX(vmax, m, vmax, v);
+    }
+    const V512 shift = V512_SET1(V512_REDUCE_MAX(vmax));
+
+    V512 vsum = V512_ZERO();
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 e = exp_avx512(V512_SUB(V512_MASKZ_LOAD(m, x + i), shift));
+        V512_MASK_STORE(x + i, m, e);
+        vsum = V512_MASK_ADD(vsum, m, vsum, e);
+    }
+
+    const V512 inverse = V512_SET1(1 / V512_REDUCE_ADD(vsum));
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512_MASK_STORE(x + i, m, V512_MUL(V512_MASKZ_LOAD(m, x + i), inverse));
+    }
+}
+
+NN_AVX512 static void tanh_avx512(nnReal *x, const nnReal *bias, int n)
+{
+    const V512 one = V512_SET1(1);
+    for (int i = 0; i < n; i += V512_LANES)
+    {
+        V512_MASK m = tail_mask(n - i);
+        V512 v = V512_ADD(V512_MASKZ_LOAD(m, x + i), V512_MASKZ_LOAD(m, bias + i));
+        V512 e = exp_avx512(V512_ADD(v, v));
+        V512_MASK_STORE(x + i, m, V512_SUB(one, V512_DIV(V512_SET1(2), V512_ADD(e, one))));
+    }
+}
+
+#endif // NN_HAVE_X86_KERNELS
+
+// DISPATCH
+
+static const nnKernelTable kernels_scalar = {NN_KERNEL_SCALAR, dot_scalar, dot4_scalar, axpy_scalar, momentum_update_scalar,
+                                             adam_update_scalar, backprop_row_scalar,
+                                             sparse_gemv_scalar, csr_gemv_scalar, sigmoid_scalar, tanh_scalar, softmax_scalar};
+#ifdef NN_HAVE_X86_KERNELS
+static const nnKernelTable kernels_avx2 = {NN_KERNEL_AVX2, dot_avx2, dot4_avx2, axpy_avx2, momentum_update_avx2,
+                                           adam_update_avx2, backprop_row_avx2,
+                                           sparse_gemv_avx2, csr_gemv_avx2, sigmoid_avx2, tanh_avx2, softmax_avx2};
+static const nnKernelTable kernels_avx512 = {NN_KERNEL_AVX512, dot_avx512, dot4_avx512, axpy_avx512, momentum_update_avx512,
+                                             adam_update_avx512, backprop_row_avx512,
+                                             sparse_gemv_avx512, csr_gemv_avx512, sigmoid_avx512, tanh_avx512, softmax_avx512};
+#endif
+
+static const nnKernelTable *kernels = &kernels_scalar;
+
+static int cpu_supports(nnKernelLevel level)
+{
+#ifdef NN_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    switch (level)
+    {
+    case NN_KERNEL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case NN_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    default:
+        return 1;
+    }
+#else
+    return level == NN_KERNEL_SCALAR;
+#endif
+}
+
+const char *nnKernelLevelName(nnKernelLevel level)
+{
+    switch (level)
+    {
+    case NN_KERNEL_AVX512:
+        return "avx512";
+    case NN_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+nnKernelLevel nnGetKernelLevel(void)
+{
+    return kernels->level;
+}
+
+// Selects the kernels of the given level, returns 1 (and keeps the current ones) if the CPU lacks it.
+// Not thread safe: call it before starting to train or predict.
+int nnSetKernelLevel(nnKernelLevel level)
+{
+    if (!cpu_supports(level))
+    {
+        return 1;
+    }
+#ifdef NN_HAVE_X86_KERNELS
+    if (level == NN_KERNEL_AVX512)
+    {
+        kernels = &kernels_avx512;
+        return 0;
+    }
+    if (level == NN_KERNEL_AVX2)
+    {
+        kernels = &kernels_avx2;
+        return 0;
+    }
+#endif
+    kernels = &kernels_scalar;
+    return 0;
+}
+
+// runs before main: picks the best level supported by the CPU, capped by NN_KERNEL if set
+// (NN_ACTIVATION=exact selects the libm activations for validation runs)
+__attribute__((constructor)) static void select_kernels(void)
+{
+    const char *activation = getenv("NN_ACTIVATION");
+    if (activation != NULL && strcmp(activation, "exact") == 0)
+        activation_precision = NN_ACTIVATION_EXACT;
+
+    nnKernelLevel level = NN_KERNEL_AVX512;
+    const char *requested = getenv("NN_KERNEL");
+    if (requested != NULL)
+    {
+        if (strcmp(requested, "scalar") == 0)
+            level = NN_KERNEL_SCALAR;
+        else if (strcmp(requested, "avx2") == 0)
+            level = NN_KERNEL_AVX2;
+    }
+
+    while (nnSetKernelLevel(level) != 0)
+    {
+        level = (nnKernelLevel)(level - 1);
+    }
+}
+
+nnReal nnDot(const nnReal *a, const nnReal *b, int n)
+{
+    return kernels->dot(a, b, n);
+}
+
+void nnDot4(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out)
+{
+    kernels->dot4(a, b0, b1, b2, b3, n, out);
+}
+
+void nnAxpy(nnReal alpha, const nnReal *x, nnReal *y, int n)
+{
+    kernels->axpy(alpha, x, y, n);
+}
+
+void nnMomentumUpdate(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale, nnReal momentum, nnReal learning_rate)
+{
+    kernels->momentum_update(params, gradient, velocity, n, scale, momentum, learning_rate);
+}
+
+void nnAdamUpdate(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale, nnReal beta1, nnReal beta2,
+                  nnReal step_size, nnReal epsilon)
+{
+    kernels->adam_update(params, gradient, m, v, n, scale, beta1, beta2, step_size, epsilon);
+}
+
+void nnBackpropRow(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n)
+{
+    kernels->backprop_row(weights, inputGradient, input, delta, step, n);
+}
+
+void nnSparseGemv(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y)
+{
+    kernels->sparse_gemv(n, nnz, index, values, A, lda, accumulate, y);
+}
+
+// ACTIVATION PASSES
+
+void nnSetActivationPrecision(nnActivationPrecision precision)
+{
+    activation_precision = precision;
+}
+
+nnActivationPrecision nnGetActivationPrecision(void)
+{
+    return activation_precision;
+}
+
+static void relu_pass(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        nnReal v = x[i] + bias[i];
+        x[i] = v > 0 ? v : 0;
+    }
+}
+
+static void leakyrelu_pass(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        nnReal v = x[i] + bias[i];
+        x[i] = v > 0 ? v : (nnReal)0.01 * v;
+    }
+}
+
+static void linear_pass(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+        x[i] += bias[i];
+}
+
+static void sigmoid_exact_pass(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+        x[i] = 1.0 / (1.0 + exp(-(double)(x[i] + bias[i])));
+}
+
+static void tanh_exact_pass(nnReal *x, const nnReal *bias, int n)
+{
+    for (int i = 0; i < n; i++)
+        x[i] = tanh((double)(x[i] + bias[i]));
+}
+
+static void softmax_exact_pass(nnReal *x, const nnReal *bias, int n)
+{
+    nnReal max = x[0] + bias[0];
+    for (int i = 0; i < n; i++)
+    {
+        x[i] += bias[i];
+        max = x[i] > max ? x[i] : max;
+    }
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+    {
+        x[i] = exp((double)(x[i] - max));
+        sum += x[i];
+    }
+    for (int i = 0; i < n; i++)
+        x[i] /= sum;
+}
+
+// the pass for a whole layer, chosen once instead of once per element
+nnActivationPass nnSelectActivation(nnActivationFunction func)
+{
+    switch (func)
+    {
+    case ACTIVATION_RELU:
+        return relu_pass;
+    case ACTIVATION_SIGMOID:
+        return activation_precision == NN_ACTIVATION_EXACT ? sigmoid_exact_pass : kernels->sigmoid;
+    case ACTIVATION_TANH:
+        return activation_precision == NN_ACTIVATION_EXACT ? tanh_exact_pass : kernels->tanh;
+    case ACTIVATION_LEAKYRELU:
+        return leakyrelu_pass;
+    case ACTIVATION_SOFTMAX:
+        return activation_precision == NN_ACTIVATION_EXACT ? softmax_exact_pass : kernels->softmax;
+    default:
+        return linear_pass; // Identity as default
+    }
+}
+
+void nnBiasActivate(nnActivationFunction func, nnReal *x, const nnReal *bias, int n)
+{
+    nnSelectActivation(func)(x, bias, n);
+}
+
+void nnActivationDerivativeMul(nnActivationFunction func, const nnReal *output, nnReal *delta, int n)
+{
+    switch (func)
+    {
+    case ACTIVATION_RELU:
+        for (int i = 0; i < n; i++)
+            delta[i] = output[i] > 0 ? delta[i] : 0;
+        break;
+    case ACTIVATION_SIGMOID:
+        for (int i = 0; i < n; i++)
+            delta[i] *= output[i] * (1 - output[i]);
+        break;
+    case ACTIVATION_TANH:
+        for (int i = 0; i < n; i++)
+            delta[i] *= 1 - output[i] * output[i];
+        break;
+    case ACTIVATION_LEAKYRELU:
+        for (int i = 0; i < n; i++)
+            delta[i] *= output[i] > 0 ? (nnReal)1 : (nnReal)0.01;
+        break;
+    case ACTIVATION_SOFTMAX:
+    {
+        // the outputs are coupled: the Jacobian-vector product is y_i * (delta_i - sum_j delta_j y_j)
+        nnReal dot = kernels->dot(delta, output, n);
+        for (int i = 0; i < n; i++)
+            delta[i] = output[i] * (delta[i] - dot);
+        break;
+    }
+    default:
+        break; // Derivata dell'identità
+    }
+}
+
+// MATRIX PRODUCTS
+
+static int min_int(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+// C = beta * C, with beta == 0 overwriting whatever C contains
+static void scale_matrix(int M, int N, nnReal beta, nnReal *C, int ldc)
+{
+    if (beta == 1)
+        return;
+
+    for (int i = 0; i < M; i++)
+    {
+        nnReal *c = C + (size_t)i * ldc;
+        if (beta == 0)
+        {
+            memset(c, 0, N * sizeof(nnReal));
+            continue;
+        }
+        for (int j = 0; j < N; j++)
+            c[j] *= beta;
+    }
+}
+
+// C += alpha * A * B^T, A is M x K, B is N x K (every entry of C is a dot product of two rows)
+static void gemm_nt(int M, int N, int K, nnReal alpha, const nnReal *A, int lda, const nnReal *B, int ldb, nnReal *C, int ldc)
+{
+    const nnKernelTable *k = kernels;
+    for (int k0 = 0; k0 < K; k0 += NN_BLOCK_K)
+    {
+        int kb = min_int(NN_BLOCK_K, K - k0);
+        for (int n0 = 0; n0 < N; n0 += NN_BLOCK_N)
+        {
+            int n1 = min_int(n0 + NN_BLOCK_N, N);
+            for (int i = 0; i < M; i++)
+            {
+                const nnReal *a = A + (size_t)i * lda + k0;
+                nnReal *c = C + (size_t)i * ldc;
+                int n = n0;
+
+                // four rows of B at a time, so every element of 'a' is loaded once for four sums
+                for (; n + 4 <= n1; n += 4)
+                {
+                    const nnReal *b0 = B + (size_t)n * ldb + k0;
+                    nnReal s[4];
+                    k->dot4(a, b0, b0 + ldb, b0 + 2 * (size_t)ldb, b0 + 3 * (size_t)ldb, kb, s);
+                    c[n] += alpha * s[0];
+                    c[n + 1] += alpha * s[1];
+                    c[n + 2] += alpha * s[2];
+                    c[n + 3] += alpha * s[3];
+                }
+                for (; n < n1; n++)
+                {
+                    c[n] += alpha * k->dot(a, B + (size_t)n * ldb + k0, kb);
+                }
+            }
+        }
+    }
+}
+
+// C += alpha * A * B, A is M x K, B is K x N (every row of C is a combination of rows of B)
+static void gemm_nn(int M, int N, int K, nnReal alpha, const nnReal *A, int lda, const nnReal *B, int ldb, nnReal *C, int ldc)
+{
+    const nnKernelTable *k = kernels;
+    for (int n0 = 0; n0 < N; n0 += NN_BLOCK_COLS)
+    {
+        int nb = min_int(NN_BLOCK_COLS, N - n0);
+        for (int i = 0; i < M; i++)
+        {
+            const nnReal *a = A + (size_t)i * lda;
+            nnReal *c = C + (size_t)i * ldc + n0;
+            for (int kk = 0; kk < K; kk++)
+            {
+                k->axpy(alpha * a[kk], B + (size_t)kk * ldb + n0, c, nb);
+            }
+        }
+    }
+}
+
+// C += alpha * A^T * B, A is K x M, B is K x N (a sum of K outer products)
+static void gemm_tn(int M, int N, int K, nnReal alpha, const nnReal *A, int lda, const nnReal *B, int ldb, nnReal *C, int ldc)
+{
+    const nnKernelTable *k = kernels;
+    for (int n0 = 0; n0 < N; n0 += NN_BLOCK_COLS)
+    {
+        int nb = min_int(NN_BLOCK_COLS, N - n0);
+        for (int i = 0; i < M; i++)
+        {
+            nnReal *c = C + (size_t)i * ldc + n0;
+            for (int kk = 0; kk < K; kk++)
+            {
+                k->axpy(alpha * A[(size_t)kk * lda + i], B + (size_t)kk * ldb + n0, c, nb);
+            }
+        }
+    }
+}
+
+void nnGemm(nnTranspose transA, nnTranspose transB, int M, int N, int K,
+            nnReal alpha, const nnReal *A, int lda, const nnReal *B, int ldb,
+            nnReal beta, nnReal *C, int ldc)
+{
+    scale_matrix(M, N, beta, C, ldc);
+    if (alpha == 0 || K == 0)
+        return;
+
+    if (transA == NN_NO_TRANS && transB == NN_TRANS)
+        gemm_nt(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    else if (transA == NN_NO_TRANS && transB == NN_NO_TRANS)
+        gemm_nn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    else if (transA == NN_TRANS && transB == NN_NO_TRANS)
+        gemm_tn(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    else
+        fprintf(stderr, "nnGemm: unsupported transpose combination\n");
+}
+
+// Dense forward kernels, output = pass(A * W^T + bias). Unlike gemm_nt they store the sums of the first
+// K block instead of accumulating into a zeroed C, so C needs no clearing pass (the results are the same).
+
+// W in a single block (K <= NN_BLOCK_K, N <= NN_BLOCK_N): each row of C is computed whole and activated
+// right away, softmax included
+static void dense_single_block(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw, const nnReal *bias,
+                               nnActivationPass pass, nnReal *C, int ldc)
+{
+    const nnKernelTable *k = kernels;
+    for (int i = 0; i < M; i++)
+    {
+        const nnReal *a = A + (size_t)i * lda;
+        nnReal *c = C + (size_t)i * ldc;
+        int n = 0;
+        for (; n + 4 <= N; n += 4)
+        {
+            const nnReal *w0 = W + (size_t)n * ldw;
+            k->dot4(a, w0, w0 + ldw, w0 + 2 * (size_t)ldw, w0 + 3 * (size_t)ldw, K, c + n);
+        }
+        for (; n < N; n++)
+        {
+            c[n] = k->dot(a, W + (size_t)n * ldw, K);
+        }
+        pass(c, bias, N);
+    }
+}
+
+// larger W: the blocking of gemm_nt, 'epilogue' (when given) runs on each block of a row after its last product
+static void dense_blocks(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw, const nnReal *bias,
+                         nnActivationPass epilogue, nnReal *C, int ldc)
+{
+    const nnKernelTable *k = kernels;
+    for (int k0 = 0; k0 < K; k0 += NN_BLOCK_K)
+    {
+        int kb = min_int(NN_BLOCK_K, K - k0);
+        int first_block = k0 == 0;
+        int last_block = k0 + kb >= K;
+        for (int n0 = 0; n0 < N; n0 += NN_BLOCK_N)
+        {
+            int n1 = min_int(n0 + NN_BLOCK_N, N);
+            for (int i = 0; i < M; i++)
+            {
+                const nnReal *a = A + (size_t)i * lda + k0;
+                nnReal *c = C + (size_t)i * ldc;
+                int n = n0;
+                for (; n + 4 <= n1; n += 4)
+                {
+                    const nnReal *w0 = W + (size_t)n * ldw + k0;
+                    nnReal s[4];
+                    k->dot4(a, w0, w0 + ldw, w0 + 2 * (size_t)ldw, w0 + 3 * (size_t)ldw, kb, s);
+                    if (first_block)
+                    {
+                        c[n] = s[0];
+                        c[n + 1] = s[1];
+                        c[n + 2] = s[2];
+                        c[n + 3] = s[3];
+                    }
+                    else
+                    {
+                        c[n] += s[0];
+                        c[n + 1] += s[1];
+                        c[n + 2] += s[2];
+                        c[n + 3] += s[3];
+                    }
+                }
+                for (; n < n1; n++)
+                {
+                    nnReal sum = k->dot(a, W + (size_t)n * ldw + k0, kb);
+                    c[n] = first_block ? sum : c[n] + sum;
+                }
+                if (epilogue != NULL && last_block)
+                {
+                    epilogue(c + n0, bias + n0, n1 - n0);
+                }
+            }
+        }
+    }
+}
+
+static void dense_blocked(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw, const nnReal *bias,
+                          nnActivationPass pass, nnReal *C, int ldc)
+{
+    dense_blocks(M, N, K, A, lda, W, ldw, bias, pass, C, ldc);
+}
+
+// softmax needs whole rows: the product goes without epilogue, each row is normalized at the end
+static void dense_blocked_rows(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw, const nnReal *bias,
+                               nnActivationPass pass, nnReal *C, int ldc)
+{
+    dense_blocks(M, N, K, A, lda, W, ldw, bias, NULL, C, ldc);
+    for (int i = 0; i < M; i++)
+        pass(C + (size_t)i * ldc, bias, N);
+}
+
+nnDenseKernel nnSelectDenseKernel(int N, int K, nnActivationFunction func)
+{
+    if (N <= NN_BLOCK_N && K <= NN_BLOCK_K)
+        return dense_single_block;
+    return func == ACTIVATION_SOFTMAX ? dense_blocked_rows : dense_blocked;
+}
+
+// output = activation(A * W^T + bias), the forward of a dense layer on M samples with one fused kernel
+void nnDenseForward(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw,
+                    const nnReal *bias, nnActivationFunction func, nnReal *C, int ldc)
+{
+    nnActivationPass pass = nnSelectActivation(func);
+    if (K == 0)
+    {
+        scale_matrix(M, N, 0, C, ldc);
+        for (int i = 0; i < M; i++)
+            pass(C + (size_t)i * ldc, bias, N);
+        return;
+    }
+    nnSelectDenseKernel(N, K, func)(M, N, K, A, lda, W, ldw, bias, pass, C, ldc);
+}
+
+void nnCsrForward(int M, int N, const int32_t *row_start, const int32_t *columns, const nnReal *values,
+                  const nnReal *A, int lda, const nnReal *bias, nnActivationFunction func, nnReal *C, int ldc)
+{
+    nnActivationPass pass = nnSelectActivation(func);
+    for (int i = 0; i < M; i++)
+    {
+        nnReal *c = C + (size_t)i * ldc;
+        kernels->csr_gemv(N, row_start, columns, values, A + (size_t)i * lda, c);
+        pass(c, bias, N);
+    }
+}
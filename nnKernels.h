@@ -0,0 +1,96 @@
+// include guard
+#ifndef NNKERNELS_H
+#define NNKERNELS_H
+
+#include "nnLayer.h"
+#include <stdint.h>
+
+// Dense linear algebra kernels used by the layer passes.
+// Every matrix is row-major, 'ld' is the distance in elements between two rows.
+// The vector primitives have a scalar, an AVX2/FMA and an AVX-512 implementation: the best one
+// supported by the CPU is selected once at startup (cpuid), the environment variable NN_KERNEL
+// (scalar, avx2, avx512) can lower the choice, e.g. to validate the SIMD paths against the scalar one.
+// Activations are applied as whole-vector passes, fused at the end of the dense forward kernel.
+
+typedef enum nnKernelLevel
+{
+    NN_KERNEL_SCALAR,
+    NN_KERNEL_AVX2,
+    NN_KERNEL_AVX512,
+} nnKernelLevel;
+
+// FAST uses the vectorized exp based approximations (error bounds documented in nnKernels.c),
+// EXACT the libm functions, for validation runs. NN_ACTIVATION=exact selects it at startup.
+typedef enum nnActivationPrecision
+{
+    NN_ACTIVATION_FAST,
+    NN_ACTIVATION_EXACT,
+} nnActivationPrecision;
+
+typedef enum nnTranspose
+{
+    NN_NO_TRANS,
+    NN_TRANS,
+} nnTranspose;
+
+/**
+ * C = alpha * op(A) * op(B) + beta * C
+ * op(A) is M x K, op(B) is K x N, C is M x N.
+ * The supported combinations are (NO_TRANS, NO_TRANS), (NO_TRANS, TRANS) and (TRANS, NO_TRANS),
+ * which are the three products needed by the forward and backward passes.
+ * When beta is 0.0 the previous content of C is ignored (it may be uninitialized).
+ */
+void nnGemm(nnTranspose transA, nnTranspose transB, int M, int N, int K,
+            nnReal alpha, const nnReal *A, int lda, const nnReal *B, int ldb,
+            nnReal beta, nnReal *C, int ldc);
+
+// output = activation(A * W^T + bias): A is M x K (samples), W is N x K (weights), C is M x N.
+// The bias and the activation are applied block by block at the end of the product.
+void nnDenseForward(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw,
+                    const nnReal *bias, nnActivationFunction func, nnReal *C, int ldc);
+
+// Per-layer choices, made once by nnDenseForward or frozen by an execution plan (nnPlan.h); both depend on
+// the kernel level and the activation precision in effect when they are made.
+// The activation pass: x = f(x + bias) over a whole row
+typedef void (*nnActivationPass)(nnReal *x, const nnReal *bias, int n);
+nnActivationPass nnSelectActivation(nnActivationFunction func);
+// The dense forward specialized for the shape of W (N x K) and the activation (whole rows for softmax)
+typedef void (*nnDenseKernel)(int M, int N, int K, const nnReal *A, int lda, const nnReal *W, int ldw, const nnReal *bias,
+                              nnActivationPass pass, nnReal *C, int ldc);
+nnDenseKernel nnSelectDenseKernel(int N, int K, nnActivationFunction func);
+
+// Same with W in CSR form (pruned layers, nnPrune.h): row i keeps the weights values[row_start[i] .. row_start[i + 1])
+// of the inputs 'columns'. Every sample is a sparse matrix-vector product whose inputs are gathered.
+void nnCsrForward(int M, int N, const int32_t *row_start, const int32_t *columns, const nnReal *values,
+                  const nnReal *A, int lda, const nnReal *bias, nnActivationFunction func, nnReal *C, int ldc);
+
+// whole-vector activation passes: x = f(x + bias), and delta *= f'(output)
+// (for softmax the whole Jacobian: delta = output * (delta - delta . output))
+void nnBiasActivate(nnActivationFunction func, nnReal *x, const nnReal *bias, int n);
+void nnActivationDerivativeMul(nnActivationFunction func, const nnReal *output, nnReal *delta, int n);
+void nnSetActivationPrecision(nnActivationPrecision precision);
+nnActivationPrecision nnGetActivationPrecision(void);
+
+nnKernelLevel nnGetKernelLevel(void);
+int nnSetKernelLevel(nnKernelLevel level);
+const char *nnKernelLevelName(nnKernelLevel level);
+
+// a . b
+nnReal nnDot(const nnReal *a, const nnReal *b, int n);
+// out[r] = a . b_r for four vectors at once (a is loaded only once)
+void nnDot4(const nnReal *a, const nnReal *b0, const nnReal *b1, const nnReal *b2, const nnReal *b3, int n, nnReal *out);
+// y += alpha * x
+void nnAxpy(nnReal alpha, const nnReal *x, nnReal *y, int n);
+// fused optimizer updates (nnOptimizer.h), a single pass over the parameters, the gradient (times 'scale') and the state:
+// velocity = momentum * velocity + scale * gradient, params -= learning_rate * velocity
+void nnMomentumUpdate(nnReal *params, const nnReal *gradient, nnReal *velocity, int n, nnReal scale, nnReal momentum, nnReal learning_rate);
+// Adam with g = scale * gradient: m and v are the moving averages of g and g^2, params -= step_size * m / (sqrt(v) + epsilon)
+void nnAdamUpdate(nnReal *params, const nnReal *gradient, nnReal *m, nnReal *v, int n, nnReal scale, nnReal beta1, nnReal beta2,
+                  nnReal step_size, nnReal epsilon);
+// single-sample backward of one neuron: inputGradient += delta * weights, then weights -= step * input
+void nnBackpropRow(nnReal *weights, nnReal *inputGradient, const nnReal *input, nnReal delta, nnReal step, int n);
+// y = sum_k values[k] * A[index[k]] (+ y when accumulate): combination of the 'nnz' rows of A selected by a
+// sparse vector in index/value form, each row has n elements (sparse-input layers, nnLayer.h)
+void nnSparseGemv(int n, int nnz, const int *index, const nnReal *values, const nnReal *A, int lda, int accumulate, nnReal *y);
+
+#endif // NNKERNELS_H
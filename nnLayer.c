@@ -1,12 +1,65 @@
 #include "nnLayer.h"
+#include "nnKernels.h"
+#include "nnQuant.h"
+#include "nnPrune.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
 #include <time.h>
 
-nnLayer *nnCreateLayer(int neuron_count, int input_count, nnActivationFunction activationFunction)
+// rounds count up so that count elements fill a whole number of NN_ALIGNMENT blocks
+int nnPaddedCount(int count)
 {
-    if (neuron_count <= 0 || neuron_count > MAX_NEURONS || input_count <= 0 || input_count > MAX_NEURONS)
+    const int lanes = NN_ALIGNMENT / sizeof(nnReal);
+    return (count + lanes - 1) / lanes * lanes;
+}
+
+// zero initialized allocation aligned to NN_ALIGNMENT, release it with nnAlignedFree
+void *nnAlignedAlloc(size_t size)
+{
+    void *ptr = NULL;
+    size = (size + NN_ALIGNMENT - 1) / NN_ALIGNMENT * NN_ALIGNMENT;
+    if (size == 0 || posix_memalign(&ptr, NN_ALIGNMENT, size) != 0)
+    {
+        return NULL;
+    }
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void nnAlignedFree(void *ptr)
+{
+    free(ptr);
+}
+
+double nnNowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// inputs compressed at a time by the sparse-input passes (index/value pairs on the stack)
+#define SPARSE_CHUNK 256
+
+int nnLayerWeightRows(const nnLayer *layer)
+{
+    return layer->sparse_input ? layer->input_count : layer->neuron_count;
+}
+
+// number of elements of the parameter block: the padded rows of weights, then the padded bias
+size_t nnLayerParamCount(const nnLayer *layer)
+{
+    return (size_t)nnLayerWeightRows(layer) * layer->weight_stride + nnPaddedCount(layer->neuron_count);
+}
+
+// without float_weights the block is only the padded bias and 'weights' stays NULL (int8-only layer)
+static nnLayer *create_layer(int neuron_count, int input_count, nnActivationFunction activationFunction, int sparse_input,
+                             int float_weights, nnReal *params)
+{
+    if (neuron_count <= 0 || input_count <= 0 || input_count > INT32_MAX - NN_ALIGNMENT || neuron_count > INT32_MAX - NN_ALIGNMENT)
     {
         fprintf(stderr, "Invalid neuron or input count\n");
         return NULL;
@@ -20,15 +73,121 @@ nnLayer *nnCreateLayer(int neuron_count, int input_count, nnActivationFunction a
 
     layer->neuron_count = neuron_count;
     layer->input_count = input_count;
+    layer->sparse_input = sparse_input != 0;
+    layer->weight_stride = nnPaddedCount(layer->sparse_input ? neuron_count : input_count);
     layer->activationFunction = activationFunction;
+    layer->quant = NULL;
+    layer->prune_mask = NULL;
+    layer->csr = NULL;
+
+    // Weights and bias share one zeroed block, the padding at the end of each row stays 0.0
+    size_t block_count = float_weights ? nnLayerParamCount(layer) : (size_t)nnPaddedCount(neuron_count);
+    nnReal *block = params != NULL ? params : (nnReal *)nnAlignedAlloc(block_count * sizeof(nnReal));
+    layer->owns_params = params == NULL;
+    layer->weights = float_weights ? block : NULL;
+    layer->bias = float_weights ? NULL : block;
 
     // Initialize the inputs and outputs arrays with malloc (they will be of the same size during the entire lifecycle of the layer)
-    layer->inputs = (double *)malloc(input_count * sizeof(double));
-    layer->outputs = (double *)malloc(neuron_count * sizeof(double));
+    layer->inputs = (nnReal *)malloc(input_count * sizeof(nnReal));
+    layer->outputs = (nnReal *)malloc(neuron_count * sizeof(nnReal));
+
+    if (block == NULL || layer->inputs == NULL || layer->outputs == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for a %dx%d nnLayer\n", neuron_count, input_count);
+        nnFreeLayer(layer);
+        return NULL;
+    }
+    if (float_weights)
+        layer->bias = layer->weights + (size_t)nnLayerWeightRows(layer) * layer->weight_stride;
 
     return layer;
 }
 
+nnLayer *nnCreateLayer(int neuron_count, int input_count, nnActivationFunction activationFunction)
+{
+    return create_layer(neuron_count, input_count, activationFunction, 0, 1, NULL);
+}
+
+nnLayer *nnCreateLayerView(int neuron_count, int input_count, nnActivationFunction activationFunction, int sparse_input, nnReal *params)
+{
+    if (params == NULL || ((uintptr_t)params % NN_ALIGNMENT) != 0)
+    {
+        fprintf(stderr, "The parameter block of a layer view must be aligned to %d bytes\n", NN_ALIGNMENT);
+        return NULL;
+    }
+    return create_layer(neuron_count, input_count, activationFunction, sparse_input, 1, params);
+}
+
+nnLayer *nnCreateInt8Layer(int neuron_count, int input_count, nnActivationFunction activationFunction, nnReal *bias)
+{
+    if (bias != NULL && ((uintptr_t)bias % NN_ALIGNMENT) != 0)
+    {
+        fprintf(stderr, "The bias of an int8-only layer must be aligned to %d bytes\n", NN_ALIGNMENT);
+        return NULL;
+    }
+    return create_layer(neuron_count, input_count, activationFunction, 0, 0, bias);
+}
+
+int nnSetSparseInput(nnLayer *layer, int enable)
+{
+    enable = enable != 0;
+    if (layer->sparse_input == enable)
+    {
+        return 0;
+    }
+    if (!layer->owns_params || layer->weights == NULL)
+    {
+        fprintf(stderr, "Cannot change the layout of a layer that does not own its float weights\n");
+        return 1;
+    }
+
+    // the parameters are copied (transposed) into a new block with the other layout
+    nnLayer converted = *layer;
+    converted.sparse_input = enable;
+    converted.weight_stride = nnPaddedCount(enable ? layer->neuron_count : layer->input_count);
+    converted.weights = (nnReal *)nnAlignedAlloc(nnLayerParamCount(&converted) * sizeof(nnReal));
+    if (converted.weights == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the parameters of a %dx%d nnLayer\n", layer->neuron_count, layer->input_count);
+        return 1;
+    }
+    converted.bias = converted.weights + (size_t)nnLayerWeightRows(&converted) * converted.weight_stride;
+
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        for (int j = 0; j < layer->input_count; j++)
+        {
+            NN_WEIGHT(&converted, i, j) = NN_WEIGHT(layer, i, j);
+        }
+    }
+    memcpy(converted.bias, layer->bias, layer->neuron_count * sizeof(nnReal));
+
+    // the pruning mask follows the layout of the parameter block
+    if (layer->prune_mask != NULL)
+    {
+        converted.prune_mask = (uint8_t *)nnAlignedAlloc(nnLayerParamCount(&converted));
+        if (converted.prune_mask == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed for the pruning mask of a %dx%d nnLayer\n", layer->neuron_count, layer->input_count);
+            nnAlignedFree(converted.weights);
+            return 1;
+        }
+        for (int i = 0; i < layer->neuron_count; i++)
+        {
+            for (int j = 0; j < layer->input_count; j++)
+            {
+                converted.prune_mask[&NN_WEIGHT(&converted, i, j) - converted.weights] = layer->prune_mask[&NN_WEIGHT(layer, i, j) - layer->weights];
+            }
+        }
+        memset(converted.prune_mask + (converted.bias - converted.weights), 1, layer->neuron_count);
+        nnAlignedFree(layer->prune_mask);
+    }
+
+    nnAlignedFree(layer->weights);
+    *layer = converted;
+    return 0;
+}
+
 // Init weights and biases with random values between -1.0 and 1.0
 // TODO: improve initialization method (Xavier, He, etc.)
 void init_layer_random(nnLayer *layer)
@@ -36,66 +195,268 @@ void init_layer_random(nnLayer *layer)
     for (int i = 0; i < layer->neuron_count; i++)
     {
         // Init Bias
-        layer->bias[i] = ((double)rand() / RAND_MAX) * 2.0 - 1.0;
+        layer->bias[i] = (nnReal)(((double)rand() / RAND_MAX) * 2.0 - 1.0);
 
-        // Init Pesi
+        // Init Pesi (same sequence of values in both layouts)
         for (int j = 0; j < layer->input_count; j++)
         {
-            layer->weights[i][j] = ((double)rand() / RAND_MAX) * 2.0 - 1.0;
+            NN_WEIGHT(layer, i, j) = (nnReal)(((double)rand() / RAND_MAX) * 2.0 - 1.0);
         }
     }
 }
 
-// forward takes in input an array of input of size input_count
-// the output is pointed to the output of the network (it will be available until forward is called again)
-void forward(nnLayer *layer, double *input, double **output)
+// y = func(x * weights^T + bias) for one sample of a sparse-input layer: the input is compressed
+// to its non-zero values chunk by chunk, and only the weight rows of those inputs are read
+static void sparse_forward_row(const nnLayer *layer, nnActivationFunction func, const nnReal *x, nnReal *y)
 {
-    for (int i = 0; i < layer->neuron_count; i++)
+    int index[SPARSE_CHUNK];
+    nnReal values[SPARSE_CHUNK];
+    int accumulate = 0;
+
+    for (int start = 0; start < layer->input_count; start += SPARSE_CHUNK)
     {
-        double sum = layer->bias[i];
-        for (int j = 0; j < layer->input_count; j++)
+        int end = start + SPARSE_CHUNK < layer->input_count ? start + SPARSE_CHUNK : layer->input_count;
+        int nnz = 0;
+        for (int j = start; j < end; j++)
+        {
+            // branchless: every value is stored, the count only advances past the non-zero ones
+            index[nnz] = j;
+            values[nnz] = x[j];
+            nnz += x[j] != 0;
+        }
+        // the first call also clears y, even without non-zero values
+        if (nnz > 0 || !accumulate)
         {
-            layer->inputs[j] = input[j];
-            sum += layer->weights[i][j] * input[j];
+            nnSparseGemv(layer->neuron_count, nnz, index, values, layer->weights, layer->weight_stride, accumulate, y);
+            accumulate = 1;
         }
-        layer->outputs[i] = activate(layer->activationFunction, sum);
     }
+    nnBiasActivate(func, y, layer->bias, layer->neuron_count);
+}
+
+// forward takes in input an array of input of size input_count
+// the output is pointed to the output of the network (it will be available until forward is called again)
+void forward(nnLayer *layer, nnReal *input, nnReal **output)
+{
+    // keep the input for backward, once (not inside the neuron loop)
+    memcpy(layer->inputs, input, layer->input_count * sizeof(nnReal));
+
+    if (layer->csr != NULL)
+    {
+        const nnCsrLayer *csr = layer->csr;
+        nnCsrForward(1, layer->neuron_count, csr->row_start, csr->columns, csr->values, input, layer->input_count,
+                     layer->bias, layer->activationFunction, layer->outputs, layer->neuron_count);
+        *output = layer->outputs;
+        return;
+    }
+    if (layer->sparse_input)
+    {
+        sparse_forward_row(layer, layer->activationFunction, input, layer->outputs);
+        *output = layer->outputs;
+        return;
+    }
+
+    // weights, bias and activation in a single fused pass (a batch of one sample)
+    nnDenseForward(1, layer->neuron_count, layer->input_count, input, layer->input_count,
+                   layer->weights, layer->weight_stride, layer->bias, layer->activationFunction, layer->outputs, layer->neuron_count);
     *output = layer->outputs;
 }
 
+// local gradient (Delta) of neuron j; 'shift' is outputGradient . outputs for softmax, whose outputs are coupled
+static nnReal neuron_delta(const nnLayer *layer, const nnReal *outputGradient, int j, nnReal shift)
+{
+    if (layer->activationFunction == ACTIVATION_SOFTMAX)
+        return layer->outputs[j] * (outputGradient[j] - shift);
+    return outputGradient[j] * activateDerivative(layer->activationFunction, layer->outputs[j]);
+}
+
 /**
  * layer: pointer to the current layer
  * outputGradient: gradients received from the next layer (size: neuron_count)
  * inputGradient: array WHERE TO WRITE the gradients for the previous layer (size: input_count)
  * learningRate: learning rate for weight updates
  */
-void backward(nnLayer *layer, double *outputGradient, double *inputGradient, double learningRate)
+void backward(nnLayer *layer, nnReal *outputGradient, nnReal *inputGradient, nnReal learningRate)
 {
     for (int i = 0; i < layer->input_count; i++)
     {
         inputGradient[i] = 0.0;
     }
+    nnReal shift = layer->activationFunction == ACTIVATION_SOFTMAX ? nnDot(outputGradient, layer->outputs, layer->neuron_count) : 0;
+
+    if (layer->sparse_input)
+    {
+        // neurons in chunks: the deltas of a chunk, then one pass over the weight rows (one per input),
+        // where only the rows of the non-zero inputs are updated
+        nnReal delta[SPARSE_CHUNK];
+        for (int start = 0; start < layer->neuron_count; start += SPARSE_CHUNK)
+        {
+            int count = layer->neuron_count - start < SPARSE_CHUNK ? layer->neuron_count - start : SPARSE_CHUNK;
+            for (int j = 0; j < count; j++)
+            {
+                delta[j] = neuron_delta(layer, outputGradient, start + j, shift);
+                layer->bias[start + j] -= delta[j] * learningRate;
+            }
+            for (int i = 0; i < layer->input_count; i++)
+            {
+                nnReal *row = layer->weights + (size_t)i * layer->weight_stride + start;
+                inputGradient[i] += nnDot(row, delta, count);
+                if (layer->inputs[i] != 0)
+                    nnAxpy(-layer->inputs[i] * learningRate, delta, row, count);
+            }
+        }
+    }
+    else
+    {
+        for (int j = 0; j < layer->neuron_count; j++)
+        {
+            // Calculate local gradient (Delta)
+            nnReal delta = neuron_delta(layer, outputGradient, j, shift);
+
+            // Update the bias using the gradient descent
+            layer->bias[j] -= delta * learningRate;
+
+            // 4. Calcolo gradienti per i pesi e propagazione indietro
+            // inputGradient += delta * weights (gradient to pass to the previous layer), then adjust the weights:
+            // weight_new = weight_old - (learning_rate * input * delta), a rank-1 update of the matrix
+            nnBackpropRow(NN_WEIGHT_ROW(layer, j), inputGradient, layer->inputs, delta, delta * learningRate, layer->input_count);
+        }
+    }
+
+    // pruned weights stay at zero
+    if (layer->prune_mask != NULL)
+    {
+        size_t count = nnLayerParamCount(layer);
+        for (size_t i = 0; i < count; i++)
+        {
+            layer->weights[i] = layer->prune_mask[i] ? layer->weights[i] : 0;
+        }
+    }
+}
+
+// output = func(input * weights^T + bias) for every sample of the batch
+static void forward_batch(const nnLayer *layer, nnActivationFunction func, const nnReal *input, nnReal *output, int batch_size)
+{
+    int in_stride = nnPaddedCount(layer->input_count);
+    int out_stride = nnPaddedCount(layer->neuron_count);
+
+    if (layer->csr != NULL)
+    {
+        const nnCsrLayer *csr = layer->csr;
+        nnCsrForward(batch_size, layer->neuron_count, csr->row_start, csr->columns, csr->values, input, in_stride,
+                     layer->bias, func, output, out_stride);
+        return;
+    }
+    if (layer->sparse_input)
+    {
+        for (int b = 0; b < batch_size; b++)
+        {
+            sparse_forward_row(layer, func, input + (size_t)b * in_stride, output + (size_t)b * out_stride);
+        }
+        return;
+    }
+
+    nnDenseForward(batch_size, layer->neuron_count, layer->input_count, input, in_stride,
+                   layer->weights, layer->weight_stride, layer->bias, func, output, out_stride);
+}
+
+void nnLayerForwardBatch(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size)
+{
+    forward_batch(layer, layer->activationFunction, input, output, batch_size);
+}
 
-    for (int j = 0; j < layer->neuron_count; j++)
+void nnLayerForwardBatchLinear(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size)
+{
+    forward_batch(layer, ACTIVATION_LINEAR, input, output, batch_size);
+}
+
+/**
+ * layer: pointer to the current layer (it is not modified, the update is done by the optimizer, nnOptimizerUpdate)
+ * input, output: the matrices used and produced by nnLayerForwardBatch for this batch
+ * delta: gradients received from the next layer (batch_size x neuron_count), overwritten with the local gradients
+ * inputGradient: matrix WHERE TO WRITE the gradients for the previous layer (batch_size x input_count), NULL to skip it
+ * gradient: parameter gradients, ACCUMULATED over the samples of the batch
+ */
+void nnLayerBackwardBatch(const nnLayer *layer, const nnReal *input, const nnReal *output, nnReal *delta,
+                          nnReal *inputGradient, nnReal *gradient, int batch_size)
+{
+    int out_stride = nnPaddedCount(layer->neuron_count);
+
+    // local gradient (Delta)
+    for (int b = 0; b < batch_size; b++)
     {
-        // Calculate local gradient (Delta)
-        double derivative = activateDerivative(layer->activationFunction, layer->outputs[j]);
-        double delta = outputGradient[j] * derivative;
+        nnActivationDerivativeMul(layer->activationFunction, output + (size_t)b * out_stride, delta + (size_t)b * out_stride,
+                                  layer->neuron_count);
+    }
+    nnLayerBackwardBatchDelta(layer, input, delta, inputGradient, gradient, batch_size);
+}
 
-        // Update the bias using the gradient descent
-        layer->bias[j] -= delta * learningRate;
+/**
+ * delta: local gradients (batch_size x neuron_count), the gradients of the loss with respect to the
+ * activation inputs, e.g. output - target for a softmax output layer trained with cross-entropy
+ */
+void nnLayerBackwardBatchDelta(const nnLayer *layer, const nnReal *input, const nnReal *delta,
+                               nnReal *inputGradient, nnReal *gradient, int batch_size)
+{
+    int in_stride = nnPaddedCount(layer->input_count);
+    int out_stride = nnPaddedCount(layer->neuron_count);
+    nnReal *biasGradient = gradient + (layer->bias - layer->weights);
 
-        // 4. Calcolo gradienti per i pesi e propagazione indietro
-        for (int i = 0; i < layer->input_count; i++)
+    // the bias gradient is the sum of the deltas over the batch
+    for (int b = 0; b < batch_size; b++)
+    {
+        const nnReal *d = delta + (size_t)b * out_stride;
+        for (int i = 0; i < layer->neuron_count; i++)
         {
-            // Calculate the gradient to pass to the previous layer
-            inputGradient[i] += delta * layer->weights[j][i];
+            biasGradient[i] += d[i];
+        }
+    }
 
-            // adjust the weights
-            // weight_new = weight_old - (learning_rate * input * delta)
-            double weightGradient = layer->inputs[i] * delta;
-            layer->weights[j][i] -= weightGradient * learningRate;
+    if (layer->sparse_input)
+    {
+        // weight gradient, one row per input: gradient_j += input[b][j] * delta_b for the non-zero inputs
+        // of every sample, the rows of the inputs that are zero in the whole batch are not touched
+        int index[SPARSE_CHUNK];
+        nnReal values[SPARSE_CHUNK];
+        for (int b = 0; b < batch_size; b++)
+        {
+            const nnReal *x = input + (size_t)b * in_stride;
+            const nnReal *d = delta + (size_t)b * out_stride;
+            for (int start = 0; start < layer->input_count; start += SPARSE_CHUNK)
+            {
+                int end = start + SPARSE_CHUNK < layer->input_count ? start + SPARSE_CHUNK : layer->input_count;
+                int nnz = 0;
+                for (int j = start; j < end; j++)
+                {
+                    index[nnz] = j;
+                    values[nnz] = x[j];
+                    nnz += x[j] != 0;
+                }
+                for (int k = 0; k < nnz; k++)
+                {
+                    nnAxpy(values[k], d, gradient + (size_t)index[k] * layer->weight_stride, layer->neuron_count);
+                }
+            }
         }
+
+        // gradient for the previous layer: delta * weights (the weights are stored transposed)
+        if (inputGradient != NULL)
+        {
+            nnGemm(NN_NO_TRANS, NN_TRANS, batch_size, layer->input_count, layer->neuron_count,
+                   1.0, delta, out_stride, layer->weights, layer->weight_stride, 0.0, inputGradient, in_stride);
+        }
+        return;
+    }
+
+    // weight gradient: delta^T * input (neuron_count x input_count)
+    nnGemm(NN_TRANS, NN_NO_TRANS, layer->neuron_count, layer->input_count, batch_size,
+           1.0, delta, out_stride, input, in_stride, 1.0, gradient, layer->weight_stride);
+
+    // gradient for the previous layer: delta * weights (batch_size x input_count)
+    if (inputGradient != NULL)
+    {
+        nnGemm(NN_NO_TRANS, NN_NO_TRANS, batch_size, layer->input_count, layer->neuron_count,
+               1.0, delta, out_stride, layer->weights, layer->weight_stride, 0.0, inputGradient, in_stride);
     }
 }
 
@@ -106,6 +467,11 @@ void nnFreeLayer(nnLayer *layer)
         return;
     }
 
+    if (layer->owns_params)
+        nnAlignedFree(layer->weights != NULL ? layer->weights : layer->bias);
+    nnFreeQuantLayer(layer->quant);
+    nnFreeCsrLayer(layer->csr);
+    nnAlignedFree(layer->prune_mask);
     free(layer->inputs);
     free(layer->outputs);
     free(layer);
@@ -124,13 +490,23 @@ void nnPrintLayerInfo(const nnLayer *layer)
     printf("Neurons: %d\n", layer->neuron_count);
     printf("Inputs per Neuron: %d\n", layer->input_count);
     printf("Activation Function: %d\n", layer->activationFunction);
+    if (layer->sparse_input)
+        printf("Sparse input (column-major weights)\n");
+    if (layer->weights == NULL)
+        printf("int8 weights only\n");
     // print weights and biases
     for (int i = 0; i < layer->neuron_count; i++)
     {
-        printf(" Neuron %d: Bias = %f | Weights = [", i, layer->bias[i]);
+        printf(" Neuron %d: Bias = %f", i, layer->bias[i]);
+        if (layer->weights == NULL)
+        {
+            printf("\n");
+            continue;
+        }
+        printf(" | Weights = [");
         for (int j = 0; j < layer->input_count; j++)
         {
-            printf("%f", layer->weights[i][j]);
+            printf("%f", NN_WEIGHT(layer, i, j));
             if (j < layer->input_count - 1)
                 printf(", ");
         }
@@ -140,7 +516,7 @@ void nnPrintLayerInfo(const nnLayer *layer)
 
 // ACTIVATION FUNCTION IMPLEMENTATIONS
 
-double activate(nnActivationFunction func, double x)
+nnReal activate(nnActivationFunction func, nnReal x)
 {
     switch (func)
     {
@@ -158,7 +534,7 @@ double activate(nnActivationFunction func, double x)
 }
 
 // Calcola la derivata basata sul valore di OUTPUT del neurone
-double activateDerivative(nnActivationFunction func, double outputVal)
+nnReal activateDerivative(nnActivationFunction func, nnReal outputVal)
 {
     switch (func)
     {
@@ -172,6 +548,9 @@ double activateDerivative(nnActivationFunction func, double outputVal)
         return 1.0 - (outputVal * outputVal);
     case ACTIVATION_LEAKYRELU:
         return outputVal > 0 ? 1 : 0.01;
+    case ACTIVATION_SOFTMAX:
+        // only the diagonal of the Jacobian, the passes over a whole layer use all of it
+        return outputVal * (1.0 - outputVal);
     default:
         return 1; // Derivata dell'identità
     }
@@ -2,8 +2,20 @@
 #ifndef NNLAYER_H
 #define NNLAYER_H
 
-// TODO: consider dynamic allocation for weights and biases (avoided for simplicity)
-#define MAX_NEURONS 1024
+#include <stddef.h>
+#include <stdint.h>
+
+// Alignment (in bytes) of every parameter block, equal to the widest SIMD register (AVX-512).
+// Weight rows are padded to a multiple of it so that each row starts on an aligned address.
+#define NN_ALIGNMENT 64
+
+// Precision of weights, activations and datasets: double, or float when built with
+// -DNN_FLOAT32 (make FLOAT32=1), which halves the memory traffic and doubles the SIMD lanes.
+#ifdef NN_FLOAT32
+typedef float nnReal;
+#else
+typedef double nnReal;
+#endif
 
 typedef enum ActivationFunction
 {
@@ -12,29 +24,80 @@ typedef enum ActivationFunction
     ACTIVATION_TANH,
     ACTIVATION_LEAKYRELU,
     ACTIVATION_LINEAR,
+    ACTIVATION_SOFTMAX, // normalized over the whole layer, pair it with the cross-entropy loss (nnTrain.h)
 } nnActivationFunction;
 
 typedef struct nnLayer
 {
     int neuron_count;
     int input_count;
-    double bias[MAX_NEURONS];
-    double weights[MAX_NEURONS][MAX_NEURONS];
+    int weight_stride; // distance (in elements) between two rows of weights, the row length padded to NN_ALIGNMENT
+
+    // a single aligned block holds both arrays: weights first, then the bias
+    nnReal *weights; // neuron_count rows of weight_stride elements (row i holds the weights of neuron i),
+                     // or input_count rows (row j holds the weights of input j) when sparse_input is set;
+                     // NULL in an int8-only layer, whose block is the bias alone (nnCreateInt8Layer)
+    nnReal *bias;    // neuron_count elements
+    int owns_params; // 0 when the block belongs to someone else (a mapped model file, read-only)
+
+    // Sparse-input layers (nnSetSparseInput) keep the weights column-major and compress every input to its
+    // non-zero values: the passes only touch the weights of those inputs. Meant for inputs that are mostly
+    // exact zeros, like the background pixels of MNIST; the results are the same as with the dense layout.
+    int sparse_input;
 
     // backward propagation arrays
-    double *inputs;
-    double *outputs;
+    nnReal *inputs;
+    nnReal *outputs;
 
     nnActivationFunction activationFunction;
+
+    struct nnQuantLayer *quant; // int8 copy of the parameters, NULL until nnQuantizeNetwork (nnQuant.h)
+
+    uint8_t *prune_mask;    // NULL, or 0 for every pruned weight in the layout of the parameter block (nnPrune.h)
+    struct nnCsrLayer *csr; // CSR copy of the kept weights used by the forward passes, NULL until nnCompressNetwork
 } nnLayer;
 
+// pointer to the first weight of neuron i (dense layout only)
+#define NN_WEIGHT_ROW(layer, i) ((layer)->weights + (size_t)(i) * (layer)->weight_stride)
+// weight of neuron i for input j, in either layout
+#define NN_WEIGHT(layer, i, j)                                                                   \
+    ((layer)->weights[(layer)->sparse_input ? (size_t)(j) * (layer)->weight_stride + (i)         \
+                                            : (size_t)(i) * (layer)->weight_stride + (j)])
+
+int nnPaddedCount(int count);
+void *nnAlignedAlloc(size_t size);
+void nnAlignedFree(void *ptr);
+double nnNowSeconds(void); // monotonic clock, for measuring durations
+size_t nnLayerParamCount(const nnLayer *layer);
+int nnLayerWeightRows(const nnLayer *layer); // rows of the weight matrix in its layout (neuron_count or input_count)
+
 nnLayer *nnCreateLayer(int neuron_count, int input_count, nnActivationFunction activationFunction);
+// layer using an existing parameter block (nnLayerParamCount elements, aligned), that nnFreeLayer does not free
+nnLayer *nnCreateLayerView(int neuron_count, int input_count, nnActivationFunction activationFunction, int sparse_input, nnReal *params);
+// layer of an int8-only model (nnQuant.h): no float weights, only the bias, zeroed or 'bias' used in place
+// (nnPaddedCount(neuron_count) aligned elements, not freed). Only the int8 engine can run it.
+nnLayer *nnCreateInt8Layer(int neuron_count, int input_count, nnActivationFunction activationFunction, nnReal *bias);
+// switches the layer to the column-major sparse-input layout (or back), keeping its parameters; owned blocks only
+int nnSetSparseInput(nnLayer *layer, int enable);
 void nnFreeLayer(nnLayer *layer);
 void nnPrintLayerInfo(const nnLayer *layer);
-void forward(nnLayer *layer, double *input, double **output);
-void backward(nnLayer *layer, double *outputGradient, double *inputGradient, double learningRate);
-double activate(nnActivationFunction func, double x);
-double activateDerivative(nnActivationFunction func, double outputVal);
+void forward(nnLayer *layer, nnReal *input, nnReal **output);
+void backward(nnLayer *layer, nnReal *outputGradient, nnReal *inputGradient, nnReal learningRate);
+
+// Batched passes: a batch is a matrix with one sample per row, every row padded with nnPaddedCount.
+// The input of a layer is batch_size x nnPaddedCount(input_count), the output batch_size x nnPaddedCount(neuron_count).
+// Gradients use the layout of the parameter block (weights rows followed by the bias, nnLayerParamCount elements).
+void nnLayerForwardBatch(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size);
+// same without the activation: the activation inputs (the logits of a fused cross-entropy, nnTrain.h)
+void nnLayerForwardBatchLinear(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size);
+void nnLayerBackwardBatch(const nnLayer *layer, const nnReal *input, const nnReal *output, nnReal *delta,
+                          nnReal *inputGradient, nnReal *gradient, int batch_size);
+// same, from the gradients with respect to the activation inputs (e.g. a fused softmax cross-entropy)
+void nnLayerBackwardBatchDelta(const nnLayer *layer, const nnReal *input, const nnReal *delta,
+                               nnReal *inputGradient, nnReal *gradient, int batch_size);
+
+nnReal activate(nnActivationFunction func, nnReal x);
+nnReal activateDerivative(nnActivationFunction func, nnReal outputVal);
 void init_layer_random(nnLayer *layer);
 
 #endif // NNLAYER_H
\ No newline at end of file
@@ -0,0 +1,935 @@
+#include "nnModelIO.h"
+#include "nnQuant.h"
+#include "nnPrune.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NN_HAVE_X86_KERNELS 1
+#endif
+
+// training state section: epoch, seed, learning rate, number of optimizer arrays, then the arrays
+#define NN_MODEL_STATE_SIZE 64
+#define NN_MODEL_MAX_OPTIMIZER_ARRAYS 8
+
+// layer flags (last word of a table entry)
+#define NN_MODEL_LAYER_COLUMN_MAJOR 0x1 // sparse-input layer (nnSetSparseInput)
+#define NN_MODEL_LAYER_CSR 0x2          // pruned layer stored as its bias and its CSR block (nnPrune.h)
+
+// decoded layer table entry
+typedef struct nnModelEntry
+{
+    uint32_t neuron_count;
+    uint32_t input_count;
+    uint32_t activation;
+    uint32_t weight_stride; // elements of the file type between two rows of weights
+    uint64_t params_offset;
+    uint64_t params_size;
+    uint64_t quant_offset; // 0 when the network is not quantized
+    uint64_t quant_size;
+    float input_scale;
+    uint32_t input_zero_point;
+    uint32_t quant_stride; // bytes between two rows of int8 weights
+    uint32_t layer_flags;  // NN_MODEL_LAYER_*
+} nnModelEntry;
+
+// ---------------------------------------------------------------------------
+// little-endian encoding, independent of the host
+// ---------------------------------------------------------------------------
+
+static int host_is_little_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const uint8_t *)&one == 1;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+// reverses the bytes of count 4-byte values (int8 blocks on big-endian hosts)
+static void swap32(void *data, size_t count)
+{
+    uint8_t *p = (uint8_t *)data;
+    for (size_t i = 0; i < count; i++, p += 4)
+        put_u32(p, (uint32_t)p[3] | (uint32_t)p[2] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[0] << 24);
+}
+
+// n values to the file type (float or double)
+static void encode_reals(uint8_t *dst, const nnReal *values, int n, size_t element_size)
+{
+    if (element_size == sizeof(nnReal) && host_is_little_endian())
+    {
+        memcpy(dst, values, n * sizeof(nnReal));
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (element_size == sizeof(float))
+        {
+            float v = (float)values[i];
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            put_u32(dst + i * sizeof(float), bits);
+        }
+        else
+        {
+            double v = (double)values[i];
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            put_u64(dst + i * sizeof(double), bits);
+        }
+    }
+}
+
+static void decode_reals(nnReal *values, const uint8_t *src, int n, size_t element_size)
+{
+    if (element_size == sizeof(nnReal) && host_is_little_endian())
+    {
+        memcpy(values, src, n * sizeof(nnReal));
+        return;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (element_size == sizeof(float))
+        {
+            uint32_t bits = get_u32(src + i * sizeof(float));
+            float v;
+            memcpy(&v, &bits, sizeof(v));
+            values[i] = (nnReal)v;
+        }
+        else
+        {
+            uint64_t bits = get_u64(src + i * sizeof(double));
+            double v;
+            memcpy(&v, &bits, sizeof(v));
+            values[i] = (nnReal)v;
+        }
+    }
+}
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + NN_ALIGNMENT - 1) / NN_ALIGNMENT * NN_ALIGNMENT;
+}
+
+// count rounded up to whole NN_ALIGNMENT blocks of the file type
+static uint64_t padded_elements(int count, size_t element_size)
+{
+    const uint64_t lanes = NN_ALIGNMENT / element_size;
+    return ((uint64_t)count + lanes - 1) / lanes * lanes;
+}
+
+// weight rows of a parameter block and their length: neurons x inputs, or inputs x neurons when column-major
+static int weight_rows(int neuron_count, int input_count, int sparse_input)
+{
+    return sparse_input ? input_count : neuron_count;
+}
+
+static int weight_row_length(int neuron_count, int input_count, int sparse_input)
+{
+    return sparse_input ? neuron_count : input_count;
+}
+
+// bytes of a parameter block in the file type: the padded rows of weights, then the padded bias
+static uint64_t param_block_bytes(int neuron_count, int input_count, int sparse_input, size_t element_size)
+{
+    uint64_t stride = padded_elements(weight_row_length(neuron_count, input_count, sparse_input), element_size);
+    return ((uint64_t)weight_rows(neuron_count, input_count, sparse_input) * stride + padded_elements(neuron_count, element_size)) * element_size;
+}
+
+// bytes of the block of a compressed layer: the padded bias, then the CSR block
+static uint64_t csr_params_bytes(int neuron_count, int nnz, size_t element_size)
+{
+    return padded_elements(neuron_count, element_size) * element_size + nnCsrBlockBytes(neuron_count, nnz, element_size);
+}
+
+// ---------------------------------------------------------------------------
+// CRC-32C (Castagnoli): the SSE4.2 crc32 instruction when available, a table otherwise
+// ---------------------------------------------------------------------------
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t *p, size_t size)
+{
+    pthread_once(&crc_table_once, init_crc_table);
+    while (size--)
+        crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef NN_HAVE_X86_KERNELS
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t))
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+#else
+    for (; size >= sizeof(uint32_t); size -= sizeof(uint32_t), p += sizeof(uint32_t))
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+    }
+#endif
+    while (size--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+// running checksum: start with crc = 0 and pass back the previous result for the following bytes
+uint32_t nnCrc32c(uint32_t crc, const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+#ifdef NN_HAVE_X86_KERNELS
+    crc = __builtin_cpu_supports("sse4.2") ? crc32c_sse42(crc, p, size) : crc32c_table(crc, p, size);
+#else
+    crc = crc32c_table(crc, p, size);
+#endif
+    return ~crc;
+}
+
+// ---------------------------------------------------------------------------
+// writer
+// ---------------------------------------------------------------------------
+
+typedef struct nnModelWriter
+{
+    FILE *f;
+    uint64_t position;
+    uint32_t crc;
+} nnModelWriter;
+
+static int write_bytes(nnModelWriter *writer, const void *data, size_t size)
+{
+    writer->crc = nnCrc32c(writer->crc, data, size);
+    writer->position += size;
+    return fwrite(data, 1, size, writer->f) == size ? 0 : 1;
+}
+
+// zeros up to 'offset' (the start of the next block)
+static int write_padding(nnModelWriter *writer, uint64_t offset)
+{
+    static const uint8_t zeros[NN_ALIGNMENT];
+    int result = 0;
+    while (writer->position < offset)
+    {
+        size_t size = offset - writer->position < sizeof(zeros) ? (size_t)(offset - writer->position) : sizeof(zeros);
+        result |= write_bytes(writer, zeros, size);
+    }
+    return result;
+}
+
+// an array with the layout of the parameter block of 'layer' (weights or optimizer state), in the file type
+static int write_param_block(nnModelWriter *writer, const nnLayer *layer, const nnReal *block, uint64_t params_size,
+                             size_t element_size, uint8_t *staging)
+{
+    if (staging == NULL)
+    {
+        // the in-memory block is the file block
+        return write_bytes(writer, block, params_size);
+    }
+
+    int rows = nnLayerWeightRows(layer);
+    int length = weight_row_length(layer->neuron_count, layer->input_count, layer->sparse_input);
+    uint64_t stride = padded_elements(length, element_size);
+    memset(staging, 0, params_size);
+    for (int n = 0; n < rows; n++)
+    {
+        encode_reals(staging + n * stride * element_size, block + (size_t)n * layer->weight_stride, length, element_size);
+    }
+    encode_reals(staging + rows * stride * element_size, block + (size_t)rows * layer->weight_stride,
+                 layer->neuron_count, element_size);
+    return write_bytes(writer, staging, params_size);
+}
+
+// bias and CSR block of a compressed layer, in the file type
+static int write_csr_block(nnModelWriter *writer, const nnLayer *layer, uint64_t params_size, size_t element_size, uint8_t *staging)
+{
+    const nnCsrLayer *csr = layer->csr;
+    uint64_t bias_size = padded_elements(layer->neuron_count, element_size) * element_size;
+    if (staging == NULL)
+    {
+        return write_bytes(writer, layer->bias, bias_size) |
+               write_bytes(writer, csr->row_start, nnCsrBlockBytes(layer->neuron_count, csr->nnz, sizeof(nnReal)));
+    }
+
+    // same layout as nnCsrBlockBytes: row starts, columns, values, each array aligned
+    uint8_t *p = staging;
+    memset(staging, 0, params_size);
+    encode_reals(p, layer->bias, layer->neuron_count, element_size);
+    p += bias_size;
+    for (int i = 0; i <= layer->neuron_count; i++)
+        put_u32(p + (size_t)i * 4, (uint32_t)csr->row_start[i]);
+    p += align_offset(((uint64_t)layer->neuron_count + 1) * 4);
+    for (int k = 0; k < csr->nnz; k++)
+        put_u32(p + (size_t)k * 4, (uint32_t)csr->columns[k]);
+    p += align_offset((uint64_t)csr->nnz * 4);
+    encode_reals(p, csr->values, csr->nnz, element_size);
+    return write_bytes(writer, staging, params_size);
+}
+
+// padded bias of an int8-only layer, in the file type
+static int write_bias_block(nnModelWriter *writer, const nnLayer *layer, uint64_t params_size, size_t element_size, uint8_t *staging)
+{
+    if (staging == NULL)
+    {
+        return write_bytes(writer, layer->bias, params_size);
+    }
+    memset(staging, 0, params_size);
+    encode_reals(staging, layer->bias, layer->neuron_count, element_size);
+    return write_bytes(writer, staging, params_size);
+}
+
+// int8_only leaves out the float weights: every layer gets its bias and its int8 block (nnWriteModelInt8)
+static int write_model(const nnNetwork *network, const char *filename, size_t element_size, const nnTrainState *state, int int8_only)
+{
+    if (element_size != sizeof(float) && element_size != sizeof(double))
+    {
+        fprintf(stderr, "Unsupported element size %zu\n", element_size);
+        return 1;
+    }
+    if (network->layer_count <= 0)
+    {
+        fprintf(stderr, "Cannot export an empty network\n");
+        return 1;
+    }
+    if (state != NULL && (state->optimizer_arrays < 0 || state->optimizer_arrays > NN_MODEL_MAX_OPTIMIZER_ARRAYS))
+    {
+        fprintf(stderr, "Unsupported optimizer state (%d arrays)\n", state->optimizer_arrays);
+        return 1;
+    }
+
+    const int quantized = nnIsQuantized(network);
+    if (int8_only && (!quantized || state != NULL))
+    {
+        fprintf(stderr, "An int8-only model file needs a quantized network and no training state\n");
+        return 1;
+    }
+    const int native = element_size == sizeof(nnReal) && host_is_little_endian();
+    size_t table_size = (size_t)network->layer_count * NN_MODEL_ENTRY_SIZE;
+    uint8_t *table = (uint8_t *)calloc(1, table_size);
+    if (table == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the model table\n");
+        return 1;
+    }
+
+    // 1. Layout: the table, then the blocks of every layer
+    uint64_t offset = align_offset(NN_MODEL_HEADER_SIZE + table_size);
+    size_t staging_size = 0;
+    for (int i = 0; i < network->layer_count; i++)
+    {
+        const nnLayer *layer = network->layers[i];
+        uint8_t *entry = table + (size_t)i * NN_MODEL_ENTRY_SIZE;
+        uint64_t stride = padded_elements(weight_row_length(layer->neuron_count, layer->input_count, layer->sparse_input), element_size);
+        uint64_t dense_size = param_block_bytes(layer->neuron_count, layer->input_count, layer->sparse_input, element_size);
+        uint64_t params_size = layer->csr != NULL ? csr_params_bytes(layer->neuron_count, layer->csr->nnz, element_size) : dense_size;
+        uint32_t layer_flags = (layer->sparse_input ? NN_MODEL_LAYER_COLUMN_MAJOR : 0) | (layer->csr != NULL ? NN_MODEL_LAYER_CSR : 0);
+        if (int8_only)
+        {
+            // the int8 rows are per neuron whatever the float layout, there is no weight row to describe
+            params_size = padded_elements(layer->neuron_count, element_size) * element_size;
+            layer_flags = 0;
+            stride = 0;
+            dense_size = 0;
+        }
+
+        put_u32(entry + 0, layer->neuron_count);
+        put_u32(entry + 4, layer->input_count);
+        put_u32(entry + 8, (uint32_t)layer->activationFunction);
+        put_u32(entry + 12, (uint32_t)stride);
+        put_u64(entry + 16, offset);
+        put_u64(entry + 24, params_size);
+        put_u32(entry + 60, layer_flags);
+        offset = align_offset(offset + params_size);
+        // the optimizer arrays of a checkpoint are dense even for a compressed layer
+        if (params_size > staging_size)
+            staging_size = params_size;
+        if (dense_size > staging_size)
+            staging_size = dense_size;
+
+        if (quantized)
+        {
+            const nnQuantLayer *quant = layer->quant;
+            uint64_t quant_size = nnQuantLayerBytes(layer);
+            uint32_t scale_bits;
+            memcpy(&scale_bits, &quant->input_scale, sizeof(scale_bits));
+            put_u64(entry + 32, offset);
+            put_u64(entry + 40, quant_size);
+            put_u32(entry + 48, scale_bits);
+            put_u32(entry + 52, (uint32_t)quant->input_zero_point);
+            put_u32(entry + 56, (uint32_t)quant->input_stride);
+            offset = align_offset(offset + quant_size);
+            if (quant_size > staging_size)
+                staging_size = quant_size;
+        }
+    }
+    // training state after the layers, its arrays use the layout of the parameter blocks
+    const uint64_t state_offset = state != NULL ? offset : 0;
+    if (state != NULL)
+    {
+        offset += NN_MODEL_STATE_SIZE;
+        for (int a = 0; a < state->optimizer_arrays; a++)
+        {
+            for (int i = 0; i < network->layer_count; i++)
+            {
+                const nnLayer *layer = network->layers[i];
+                offset = align_offset(offset + param_block_bytes(layer->neuron_count, layer->input_count, layer->sparse_input, element_size));
+            }
+        }
+    }
+    const uint64_t file_size = offset;
+
+    // conversion buffer, the padding of the rows stays zero
+    uint8_t *staging = native ? NULL : (uint8_t *)nnAlignedAlloc(staging_size);
+    if (!native && staging == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the model export\n");
+        free(table);
+        return 1;
+    }
+
+    // written next to the destination and renamed over it: a reader mapping the old file keeps it intact
+    size_t name_length = strlen(filename);
+    char *temporary = (char *)malloc(name_length + 5);
+    FILE *f = NULL;
+    if (temporary != NULL)
+    {
+        memcpy(temporary, filename, name_length);
+        memcpy(temporary + name_length, ".tmp", 5);
+        f = fopen(temporary, "wb");
+    }
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error opening file %s for writing\n", temporary != NULL ? temporary : filename);
+        nnAlignedFree(staging);
+        free(temporary);
+        free(table);
+        return 1;
+    }
+
+    // 2. Header placeholder (its checksum is only known at the end), table and blocks
+    uint8_t header[NN_MODEL_HEADER_SIZE] = {0};
+    uint32_t flags = (quantized ? NN_MODEL_QUANTIZED : 0) | (int8_only ? NN_MODEL_INT8_ONLY : 0) |
+                     (state != NULL ? NN_MODEL_TRAINING_STATE : 0);
+    int result = fwrite(header, 1, sizeof(header), f) != sizeof(header);
+    nnModelWriter writer = {f, NN_MODEL_HEADER_SIZE, 0};
+    result |= write_bytes(&writer, table, table_size);
+    for (int i = 0; i < network->layer_count && result == 0; i++)
+    {
+        const nnLayer *layer = network->layers[i];
+        const uint8_t *entry = table + (size_t)i * NN_MODEL_ENTRY_SIZE;
+        uint64_t params_size = get_u64(entry + 24);
+
+        result |= write_padding(&writer, get_u64(entry + 16));
+        if (int8_only)
+            result |= write_bias_block(&writer, layer, params_size, element_size, staging);
+        else if (layer->csr != NULL)
+            result |= write_csr_block(&writer, layer, params_size, element_size, staging);
+        else
+            result |= write_param_block(&writer, layer, layer->weights, params_size, element_size, staging);
+
+        if (quantized)
+        {
+            uint64_t quant_size = get_u64(entry + 40);
+            result |= write_padding(&writer, get_u64(entry + 32));
+            if (host_is_little_endian())
+            {
+                result |= write_bytes(&writer, layer->quant->weights, quant_size);
+            }
+            else
+            {
+                memcpy(staging, layer->quant->weights, quant_size);
+                swap32(staging + (size_t)layer->neuron_count * layer->quant->input_stride, 2 * (size_t)layer->neuron_count);
+                result |= write_bytes(&writer, staging, quant_size);
+            }
+        }
+    }
+    if (state != NULL && result == 0)
+    {
+        uint8_t section[NN_MODEL_STATE_SIZE] = {0};
+        uint64_t rate_bits;
+        memcpy(&rate_bits, &state->learning_rate, sizeof(rate_bits));
+        put_u32(section + 0, (uint32_t)state->epoch);
+        put_u32(section + 4, state->seed);
+        put_u64(section + 8, rate_bits);
+        put_u32(section + 16, (uint32_t)state->optimizer_arrays);
+        result |= write_padding(&writer, state_offset);
+        result |= write_bytes(&writer, section, sizeof(section));
+        for (int a = 0; a < state->optimizer_arrays && result == 0; a++)
+        {
+            for (int i = 0; i < network->layer_count; i++)
+            {
+                result |= write_padding(&writer, align_offset(writer.position));
+                const nnLayer *layer = network->layers[i];
+                result |= write_param_block(&writer, layer, state->optimizer_state[a * network->layer_count + i],
+                                            param_block_bytes(layer->neuron_count, layer->input_count, layer->sparse_input, element_size),
+                                            element_size, staging);
+            }
+        }
+    }
+    result |= write_padding(&writer, file_size);
+
+    // 3. Header
+    memcpy(header, NN_MODEL_MAGIC, 4);
+    put_u32(header + 4, NN_MODEL_VERSION);
+    // bytes 8-11 are reserved (zero): every field has a fixed byte order, there is nothing to detect
+    put_u32(header + 12, (uint32_t)element_size);
+    put_u32(header + 16, (uint32_t)network->layer_count);
+    put_u32(header + 20, flags);
+    put_u64(header + 24, file_size);
+    put_u32(header + 32, writer.crc);
+    put_u64(header + 40, state_offset);
+    if (result == 0)
+        result = fseek(f, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), f) != sizeof(header);
+    // on disk before the rename, so that the name always refers to a complete file
+    if (result == 0)
+        result = fflush(f) != 0 || fsync(fileno(f)) != 0;
+    if (fclose(f) != 0)
+        result = 1;
+    if (result == 0 && rename(temporary, filename) != 0)
+        result = 1;
+    if (result != 0)
+    {
+        fprintf(stderr, "Failed to write %s\n", filename);
+        remove(temporary);
+    }
+
+    nnAlignedFree(staging);
+    free(temporary);
+    free(table);
+    return result;
+}
+
+int nnWriteModel(const nnNetwork *network, const char *filename, size_t element_size)
+{
+    int int8_only = nnIsInt8Only(network);
+    int result = write_model(network, filename, element_size, NULL, int8_only);
+    if (result == 0)
+    {
+        printf("Network exported to %s (v2, %s%s)\n", filename, element_size == sizeof(float) ? "float32" : "double",
+               int8_only ? " bias + int8 only" : (nnIsQuantized(network) ? " + int8" : ""));
+    }
+    return result;
+}
+
+int nnWriteModelInt8(const nnNetwork *network, const char *filename, size_t element_size)
+{
+    int result = write_model(network, filename, element_size, NULL, 1);
+    if (result == 0)
+    {
+        printf("Network exported to %s (v2, %s bias + int8 only)\n", filename, element_size == sizeof(float) ? "float32" : "double");
+    }
+    return result;
+}
+
+int nnWriteModelState(const nnNetwork *network, const char *filename, size_t element_size, const nnTrainState *state)
+{
+    return write_model(network, filename, element_size, state, nnIsInt8Only(network));
+}
+
+// ---------------------------------------------------------------------------
+// reader
+// ---------------------------------------------------------------------------
+
+int nnIsModelFile(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    char magic[4];
+    int result = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, NN_MODEL_MAGIC, 4) == 0;
+    fclose(f);
+    return result;
+}
+
+static void decode_entry(const uint8_t *p, nnModelEntry *entry)
+{
+    uint32_t scale_bits = get_u32(p + 48);
+    entry->neuron_count = get_u32(p + 0);
+    entry->input_count = get_u32(p + 4);
+    entry->activation = get_u32(p + 8);
+    entry->weight_stride = get_u32(p + 12);
+    entry->params_offset = get_u64(p + 16);
+    entry->params_size = get_u64(p + 24);
+    entry->quant_offset = get_u64(p + 32);
+    entry->quant_size = get_u64(p + 40);
+    memcpy(&entry->input_scale, &scale_bits, sizeof(scale_bits));
+    entry->input_zero_point = get_u32(p + 52);
+    entry->quant_stride = get_u32(p + 56);
+    entry->layer_flags = get_u32(p + 60);
+}
+
+// the block [offset, offset + size) is aligned, after the table and inside the file
+static int valid_block(uint64_t offset, uint64_t size, uint64_t data_start, uint64_t file_size)
+{
+    return offset % NN_ALIGNMENT == 0 && offset >= data_start && offset <= file_size && size <= file_size - offset;
+}
+
+// file array with the layout of the parameter block of 'layer' to the in-memory layout (the row padding stays untouched)
+static void decode_param_block(const nnLayer *layer, nnReal *block, const uint8_t *src, size_t element_size)
+{
+    int rows = nnLayerWeightRows(layer);
+    int length = weight_row_length(layer->neuron_count, layer->input_count, layer->sparse_input);
+    uint64_t stride = padded_elements(length, element_size);
+    for (int n = 0; n < rows; n++)
+    {
+        decode_reals(block + (size_t)n * layer->weight_stride, src + n * stride * element_size, length, element_size);
+    }
+    decode_reals(block + (size_t)rows * layer->weight_stride, src + rows * stride * element_size,
+                 layer->neuron_count, element_size);
+}
+
+// bias and CSR block of a compressed layer. The CSR arrays are used in place when possible, the dense
+// weights are rebuilt from them so that the layer can still be trained, quantized or saved in any format.
+static int read_csr_block(nnLayer *layer, const uint8_t *src, int nnz, size_t element_size, int in_place)
+{
+    int neuron_count = layer->neuron_count;
+    decode_reals(layer->bias, src, neuron_count, element_size);
+    const uint8_t *block = src + padded_elements(neuron_count, element_size) * element_size;
+
+    int result;
+    if (in_place)
+    {
+        result = nnAttachCsrLayer(layer, (void *)block, nnz, 0);
+    }
+    else
+    {
+        // converted into the in-memory layout (same offsets for the two int32 arrays)
+        uint8_t *copy = (uint8_t *)nnAlignedAlloc(nnCsrBlockBytes(neuron_count, nnz, sizeof(nnReal)));
+        if (copy == NULL)
+            return 1;
+        uint64_t columns_offset = align_offset(((uint64_t)neuron_count + 1) * 4);
+        uint64_t values_offset = columns_offset + align_offset((uint64_t)nnz * 4);
+        for (int i = 0; i <= neuron_count; i++)
+            ((int32_t *)copy)[i] = (int32_t)get_u32(block + (size_t)i * 4);
+        for (int k = 0; k < nnz; k++)
+            ((int32_t *)(copy + columns_offset))[k] = (int32_t)get_u32(block + columns_offset + (size_t)k * 4);
+        decode_reals((nnReal *)(copy + values_offset), block + values_offset, nnz, element_size);
+        result = nnAttachCsrLayer(layer, copy, nnz, 1);
+        nnAlignedFree(copy);
+    }
+    if (result)
+        return 1;
+
+    const nnCsrLayer *csr = layer->csr;
+    for (int i = 0; i < neuron_count; i++)
+    {
+        for (int32_t k = csr->row_start[i]; k < csr->row_start[i + 1]; k++)
+            NN_WEIGHT(layer, i, csr->columns[k]) = csr->values[k];
+    }
+    return 0;
+}
+
+// rebuilds layer i, in place (a view of the mapping) or as a converted copy
+static nnLayer *read_layer(const uint8_t *base, const nnModelEntry *entry, uint64_t data_start, uint64_t file_size,
+                           size_t element_size, int quantized, int int8_only, int in_place)
+{
+    if (entry->neuron_count == 0 || entry->neuron_count > INT32_MAX || entry->input_count == 0 ||
+        entry->input_count > INT32_MAX - NN_ALIGNMENT || entry->activation > ACTIVATION_SOFTMAX ||
+        (entry->layer_flags & ~(NN_MODEL_LAYER_COLUMN_MAJOR | NN_MODEL_LAYER_CSR)) != 0 || (int8_only && entry->layer_flags != 0))
+    {
+        return NULL;
+    }
+    int neuron_count = (int)entry->neuron_count;
+    int input_count = (int)entry->input_count;
+    int sparse_input = (entry->layer_flags & NN_MODEL_LAYER_COLUMN_MAJOR) != 0;
+    int compressed = (entry->layer_flags & NN_MODEL_LAYER_CSR) != 0;
+    uint64_t stride = int8_only ? 0 : padded_elements(weight_row_length(neuron_count, input_count, sparse_input), element_size);
+    if (entry->weight_stride != stride || !valid_block(entry->params_offset, entry->params_size, data_start, file_size))
+    {
+        return NULL;
+    }
+
+    // the size of a CSR block depends on its number of weights, the last row start
+    const uint8_t *params = base + entry->params_offset;
+    uint64_t nnz = 0;
+    if (compressed)
+    {
+        uint64_t bias_size = padded_elements(neuron_count, element_size) * element_size;
+        if (entry->params_size < bias_size + ((uint64_t)neuron_count + 1) * 4)
+            return NULL;
+        nnz = get_u32(params + bias_size + (uint64_t)neuron_count * 4);
+        if (nnz > (uint64_t)neuron_count * input_count || nnz > INT32_MAX)
+            return NULL;
+    }
+    uint64_t params_size = compressed ? csr_params_bytes(neuron_count, (int)nnz, element_size)
+                                      : param_block_bytes(neuron_count, input_count, sparse_input, element_size);
+    if (int8_only)
+        params_size = padded_elements(neuron_count, element_size) * element_size;
+    if (entry->params_size != params_size)
+    {
+        return NULL;
+    }
+
+    nnActivationFunction activation = (nnActivationFunction)entry->activation;
+    nnLayer *layer;
+    if (int8_only)
+    {
+        layer = nnCreateInt8Layer(neuron_count, input_count, activation, in_place ? (nnReal *)params : NULL);
+        if (layer != NULL && !in_place)
+            decode_reals(layer->bias, params, neuron_count, element_size);
+    }
+    else if (compressed)
+    {
+        layer = nnCreateLayer(neuron_count, input_count, activation);
+        if (layer != NULL && (nnSetSparseInput(layer, sparse_input) != 0 || read_csr_block(layer, params, (int)nnz, element_size, in_place) != 0))
+        {
+            nnFreeLayer(layer);
+            layer = NULL;
+        }
+    }
+    else if (in_place)
+    {
+        layer = nnCreateLayerView(neuron_count, input_count, activation, sparse_input, (nnReal *)params);
+    }
+    else
+    {
+        layer = nnCreateLayer(neuron_count, input_count, activation);
+        if (layer != NULL && nnSetSparseInput(layer, sparse_input) != 0)
+        {
+            nnFreeLayer(layer);
+            layer = NULL;
+        }
+        if (layer != NULL)
+            decode_param_block(layer, layer->weights, params, element_size);
+    }
+    if (layer == NULL || !quantized)
+    {
+        return layer;
+    }
+
+    if (entry->quant_stride != (uint32_t)nnQuantInputStride(layer) || entry->quant_size != nnQuantLayerBytes(layer) ||
+        !valid_block(entry->quant_offset, entry->quant_size, data_start, file_size) ||
+        nnAttachQuantLayer(layer, (void *)(base + entry->quant_offset), entry->input_scale, (int)entry->input_zero_point,
+                           !in_place || !host_is_little_endian()))
+    {
+        nnFreeLayer(layer);
+        return NULL;
+    }
+    if (!host_is_little_endian())
+    {
+        swap32(layer->quant->row_sums, 2 * (size_t)neuron_count);
+    }
+    return layer;
+}
+
+// training state section, the optimizer arrays are copied into a block owned by 'state'
+static int read_state(const uint8_t *base, uint64_t offset, uint64_t data_start, uint64_t file_size, size_t element_size,
+                      const nnNetwork *network, nnTrainState *state)
+{
+    if (!valid_block(offset, NN_MODEL_STATE_SIZE, data_start, file_size))
+        return 1;
+
+    const uint8_t *section = base + offset;
+    uint64_t rate_bits = get_u64(section + 8);
+    state->epoch = (int)get_u32(section + 0);
+    state->seed = get_u32(section + 4);
+    memcpy(&state->learning_rate, &rate_bits, sizeof(rate_bits));
+    state->optimizer_arrays = (int)get_u32(section + 16);
+    if (state->epoch < 0 || state->optimizer_arrays < 0 || state->optimizer_arrays > NN_MODEL_MAX_OPTIMIZER_ARRAYS)
+        return 1;
+    if (state->optimizer_arrays == 0)
+        return 0;
+
+    size_t total = 0;
+    for (int l = 0; l < network->layer_count; l++)
+        total += nnLayerParamCount(network->layers[l]);
+    size_t array_count = (size_t)state->optimizer_arrays * network->layer_count;
+    state->optimizer_state = (nnReal **)malloc(array_count * sizeof(nnReal *));
+    state->buffer = nnAlignedAlloc(state->optimizer_arrays * total * sizeof(nnReal));
+    if (state->optimizer_state == NULL || state->buffer == NULL)
+        return 1;
+
+    nnReal *next = (nnReal *)state->buffer;
+    offset += NN_MODEL_STATE_SIZE;
+    for (int a = 0; a < state->optimizer_arrays; a++)
+    {
+        for (int l = 0; l < network->layer_count; l++)
+        {
+            const nnLayer *layer = network->layers[l];
+            uint64_t size = param_block_bytes(layer->neuron_count, layer->input_count, layer->sparse_input, element_size);
+            offset = align_offset(offset);
+            if (!valid_block(offset, size, data_start, file_size))
+                return 1;
+            decode_param_block(layer, next, base + offset, element_size);
+            state->optimizer_state[a * network->layer_count + l] = next;
+            next += nnLayerParamCount(layer);
+            offset += size;
+        }
+    }
+    return 0;
+}
+
+void nnFreeTrainState(nnTrainState *state)
+{
+    free(state->optimizer_state);
+    nnAlignedFree(state->buffer);
+    state->optimizer_state = NULL;
+    state->buffer = NULL;
+    state->optimizer_arrays = 0;
+}
+
+nnNetwork *nnReadModel(const char *filename, int zero_copy)
+{
+    return nnReadModelState(filename, zero_copy, NULL);
+}
+
+nnNetwork *nnReadModelState(const char *filename, int zero_copy, nnTrainState *state)
+{
+    if (state != NULL)
+        memset(state, 0, sizeof(*state));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening file %s for reading\n", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < NN_MODEL_HEADER_SIZE)
+    {
+        fprintf(stderr, "Invalid model file %s\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    // shared and read-only: every process mapping the file uses the same page-cache pages
+    const size_t mapping_size = (size_t)st.st_size;
+    uint8_t *base = (uint8_t *)mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map %s\n", filename);
+        return NULL;
+    }
+
+    // 1. Header
+    uint32_t element_size = get_u32(base + 12);
+    uint32_t layer_count = get_u32(base + 16);
+    uint32_t flags = get_u32(base + 20);
+    uint64_t file_size = get_u64(base + 24);
+    uint64_t data_start = NN_MODEL_HEADER_SIZE + (uint64_t)layer_count * NN_MODEL_ENTRY_SIZE;
+    if (memcmp(base, NN_MODEL_MAGIC, 4) != 0 || get_u32(base + 4) != NN_MODEL_VERSION)
+    {
+        fprintf(stderr, "%s is not a v%d model file\n", filename, NN_MODEL_VERSION);
+        munmap(base, mapping_size);
+        return NULL;
+    }
+    const int int8_only = (flags & NN_MODEL_INT8_ONLY) != 0;
+    if ((element_size != sizeof(float) && element_size != sizeof(double)) || layer_count == 0 || layer_count > MAX_LAYERS ||
+        (flags & ~(NN_MODEL_QUANTIZED | NN_MODEL_TRAINING_STATE | NN_MODEL_INT8_ONLY)) != 0 ||
+        (int8_only && (flags & (NN_MODEL_QUANTIZED | NN_MODEL_TRAINING_STATE)) != NN_MODEL_QUANTIZED) ||
+        file_size != (uint64_t)st.st_size || data_start > file_size)
+    {
+        fprintf(stderr, "Invalid header in model file %s\n", filename);
+        munmap(base, mapping_size);
+        return NULL;
+    }
+    if (nnCrc32c(0, base + NN_MODEL_HEADER_SIZE, file_size - NN_MODEL_HEADER_SIZE) != get_u32(base + 32))
+    {
+        fprintf(stderr, "Checksum mismatch in model file %s (corrupt or truncated)\n", filename);
+        munmap(base, mapping_size);
+        return NULL;
+    }
+
+    // 2. Layers, in place when the file holds nnReal values in the byte order of the host
+    const int quantized = (flags & NN_MODEL_QUANTIZED) != 0;
+    const int in_place = zero_copy && element_size == sizeof(nnReal) && host_is_little_endian();
+    nnNetwork *network = nnCreateNetwork();
+    if (network == NULL)
+    {
+        munmap(base, mapping_size);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < layer_count; i++)
+    {
+        nnModelEntry entry;
+        decode_entry(base + NN_MODEL_HEADER_SIZE + (size_t)i * NN_MODEL_ENTRY_SIZE, &entry);
+        nnLayer *layer = NULL;
+        if (i == 0 || entry.input_count == (uint32_t)network->layers[i - 1]->neuron_count)
+            layer = read_layer(base, &entry, data_start, file_size, element_size, quantized, int8_only, in_place);
+        if (layer == NULL)
+        {
+            fprintf(stderr, "Invalid layer %u in model file %s\n", i, filename);
+            nnFreeNetwork(network);
+            munmap(base, mapping_size);
+            return NULL;
+        }
+        addLayerToNetwork(network, layer);
+    }
+
+    // 3. Training state, when asked for (checkpoints)
+    if (state != NULL && (flags & NN_MODEL_TRAINING_STATE) != 0 &&
+        read_state(base, get_u64(base + 40), data_start, file_size, element_size, network, state))
+    {
+        fprintf(stderr, "Invalid training state in model file %s\n", filename);
+        nnFreeTrainState(state);
+        nnFreeNetwork(network);
+        munmap(base, mapping_size);
+        return NULL;
+    }
+
+    if (in_place)
+    {
+        network->mapping = base;
+        network->mapping_size = mapping_size;
+    }
+    else
+    {
+        munmap(base, mapping_size);
+    }
+
+    printf("Network imported from %s (v2, %s%s, %s).\n", filename, element_size == sizeof(float) ? "float32" : "double",
+           int8_only ? " bias + int8 only" : (quantized ? " + int8" : ""), in_place ? "mapped in place" : "copied");
+    return network;
+}
@@ -0,0 +1,66 @@
+// include guard
+#ifndef NNMODELIO_H
+#define NNMODELIO_H
+
+#include "nnNetwork.h"
+#include <stdint.h>
+
+// v2 model file. Every field and value is little-endian whatever the host (a big-endian host swaps them
+// while loading and cannot map the file in place), every offset counts from the start of the file:
+//   header, 64 bytes: magic "NNMF", version, 4 reserved bytes, element size (4: float32, 8: double),
+//                     layer count, flags, file size (u64), CRC-32C of everything after the header,
+//                     offset of the training state (u64, 0 when absent)
+//   layer table, 64 bytes per layer: shape, activation, weight stride, offset and size of the blocks,
+//                     input scale and zero point of the int8 copy, layer flags (column-major weights of a
+//                     sparse-input layer, compressed layer)
+//   blocks, each aligned to 64 bytes: per layer the parameter block exactly as nnLayer keeps it in memory
+//                     (rows padded to 64 bytes, then the padded bias), then the int8 block (nnQuant.h) if any.
+//                     A compressed (pruned) layer stores its padded bias and its CSR block (nnPrune.h) instead.
+//                     An int8-only file (nnWriteModelInt8) stores the padded bias and the int8 block alone.
+//   training state (checkpoints only, offset in the header): epoch, seed, learning rate and the optimizer
+//                     arrays, every one with the layout of the parameter block of its layer
+// Because the blocks have the in-memory layout, a file with the element size of the build can be mapped and
+// used in place: the layers point into the read-only mapping, loading costs no copy, and every process
+// mapping the same file shares one page-cache copy of the weights.
+#define NN_MODEL_MAGIC "NNMF"
+#define NN_MODEL_VERSION 2
+#define NN_MODEL_HEADER_SIZE 64
+#define NN_MODEL_ENTRY_SIZE 64
+#define NN_MODEL_QUANTIZED 0x1      // flags: every layer has an int8 block
+#define NN_MODEL_TRAINING_STATE 0x2 // flags: the file ends with a training state section
+#define NN_MODEL_INT8_ONLY 0x4      // flags: no float weights (weight stride 0), with NN_MODEL_QUANTIZED only
+
+// Training progress stored with the weights by a checkpoint
+typedef struct nnTrainState
+{
+    int epoch;                // completed epochs
+    unsigned int seed;        // seed of the input pipeline (sample order and augmentation)
+    double learning_rate;
+    int optimizer_arrays;     // per-layer arrays of optimizer state, 0 for plain SGD
+    nnReal **optimizer_state; // optimizer_arrays x layer_count arrays, [a * layer_count + l] has the layout of the parameter block of layer l
+    void *buffer;             // holds the arrays read by nnReadModelState (nnFreeTrainState)
+} nnTrainState;
+
+// Writes the network to a temporary file renamed over 'filename' once complete, so processes that
+// still map the previous version keep a valid file. element_size is sizeof(float) or sizeof(double).
+int nnWriteModel(const nnNetwork *network, const char *filename, size_t element_size);
+// int8-only file of a quantized network: the float weights are left out, every layer keeps its bias and its int8
+// block (about 8x smaller than double). Only the int8 engine can run the network read back (nnIsInt8Only).
+int nnWriteModelInt8(const nnNetwork *network, const char *filename, size_t element_size);
+// same file with a training state section (no message on success, checkpoints are written in background)
+int nnWriteModelState(const nnNetwork *network, const char *filename, size_t element_size, const nnTrainState *state);
+
+// Reads a v2 file after checking its header, its table and its checksum. With zero_copy the layers
+// use the mapping directly (read-only: inference only) when the element size matches the build,
+// otherwise the parameters are copied (and converted) into memory owned by the layers.
+nnNetwork *nnReadModel(const char *filename, int zero_copy);
+// also fills 'state' (all zero when the file has no training state), release it with nnFreeTrainState
+nnNetwork *nnReadModelState(const char *filename, int zero_copy, nnTrainState *state);
+void nnFreeTrainState(nnTrainState *state);
+
+// 1 when the file starts with the v2 magic
+int nnIsModelFile(const char *filename);
+
+uint32_t nnCrc32c(uint32_t crc, const void *data, size_t size);
+
+#endif // NNMODELIO_H
@@ -1,8 +1,11 @@
 #include "nnNetwork.h"
+#include "nnModelIO.h"
+#include "nnQuant.h"
+#include "nnProfile.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
+#include <sys/mman.h>
 
 nnNetwork *nnCreateNetwork()
 {
@@ -13,6 +16,8 @@ nnNetwork *nnCreateNetwork()
         return NULL;
     }
     network->layer_count = 0;
+    network->mapping = NULL;
+    network->mapping_size = 0;
     return network;
 }
 
@@ -28,10 +33,97 @@ int addLayerToNetwork(nnNetwork *network, nnLayer *layer)
     return 0;
 }
 
-// Binary Export (Deep Copy to File)
-// WARNING: This function is architecture dependent
+// Legacy formats, still loaded (new files use the v2 format of nnModelIO.c).
+// The float32 variant of the binary format starts with this tag ("NNF4" on disk), the original
+// double one starts directly with the layer count (a small positive int, never equal to the tag)
+#define NN_FLOAT_MODEL_TAG 0x34464E4E
+
+// Optional section after the last layer with the int8 parameters of a quantized network ("NNQ8" on disk),
+// readers that stop after the layers (the original loader) simply ignore it
+#define NN_QUANT_MODEL_TAG 0x38514E4E
+
+// writes n values converting them to the on-disk element type (float or double)
+static size_t write_reals(FILE *f, const nnReal *values, int n, size_t element_size)
+{
+    if (element_size == sizeof(nnReal))
+        return fwrite(values, sizeof(nnReal), n, f);
+
+    size_t written = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (element_size == sizeof(float))
+        {
+            float v = (float)values[i];
+            written += fwrite(&v, sizeof(float), 1, f);
+        }
+        else
+        {
+            double v = (double)values[i];
+            written += fwrite(&v, sizeof(double), 1, f);
+        }
+    }
+    return written;
+}
+
+// reads n values stored with the given element type (float or double)
+static size_t read_reals(FILE *f, nnReal *values, int n, size_t element_size)
+{
+    if (element_size == sizeof(nnReal))
+        return fread(values, sizeof(nnReal), n, f);
+
+    size_t read = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (element_size == sizeof(float))
+        {
+            float v = 0.0f;
+            read += fread(&v, sizeof(float), 1, f);
+            values[i] = (nnReal)v;
+        }
+        else
+        {
+            double v = 0.0;
+            read += fread(&v, sizeof(double), 1, f);
+            values[i] = (nnReal)v;
+        }
+    }
+    return read;
+}
+
+// Binary Export (v2 format, see nnModelIO.h), in the precision of the build
 int nnDumpNetwork(nnNetwork *network, const char *filename)
 {
+    return nnWriteModel(network, filename, sizeof(nnReal));
+}
+
+// int8-only v2 export of a quantized network (see nnWriteModelInt8), the bias in the precision of the build
+int nnDumpNetworkInt8(nnNetwork *network, const char *filename)
+{
+    return nnWriteModelInt8(network, filename, sizeof(nnReal));
+}
+
+// v2 export with an explicit element size (sizeof(float) or sizeof(double)), whatever the precision of the build
+int nnDumpNetworkAs(nnNetwork *network, const char *filename, size_t element_size)
+{
+    return nnWriteModel(network, filename, element_size);
+}
+
+// Export in the legacy format, for readers that predate v2: sizeof(double) writes the original format,
+// sizeof(float) the float32 variant
+// WARNING: This function is architecture dependent
+int nnDumpNetworkLegacy(nnNetwork *network, const char *filename, size_t element_size)
+{
+    if (element_size != sizeof(float) && element_size != sizeof(double))
+    {
+        fprintf(stderr, "Unsupported element size %zu\n", element_size);
+        return 1;
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "The legacy format needs the float weights, an int8-only network is only written as v2\n");
+        return 1;
+    }
+
     FILE *f = fopen(filename, "wb");
     if (f == NULL)
     {
@@ -40,6 +132,11 @@ int nnDumpNetwork(nnNetwork *network, const char *filename)
     }
 
     // 1. Write Network Metadata
+    if (element_size == sizeof(float))
+    {
+        int tag = NN_FLOAT_MODEL_TAG;
+        fwrite(&tag, sizeof(int), 1, f);
+    }
     fwrite(&network->layer_count, sizeof(int), 1, f);
 
     // 2. Loop through layers and write Deep Data
@@ -54,23 +151,44 @@ int nnDumpNetwork(nnNetwork *network, const char *filename)
         fwrite(&activation, sizeof(int), 1, f);
 
         // B. Write Biases (Contiguous memory, single write)
-        fwrite(layer->bias, sizeof(double), layer->neuron_count, f);
+        write_reals(f, layer->bias, layer->neuron_count, element_size);
 
-        // C. Write Weights (2D array, write row by row)
+        // C. Write Weights (row by row, the row padding is not stored; the legacy format is always
+        // row-major, the column-major weights of a sparse-input layer are written one at a time)
         for (int n = 0; n < layer->neuron_count; n++)
         {
-            fwrite(layer->weights[n], sizeof(double), layer->input_count, f);
+            if (!layer->sparse_input)
+            {
+                write_reals(f, NN_WEIGHT_ROW(layer, n), layer->input_count, element_size);
+                continue;
+            }
+            for (int j = 0; j < layer->input_count; j++)
+            {
+                write_reals(f, &NN_WEIGHT(layer, n, j), 1, element_size);
+            }
+        }
+    }
+
+    // 3. Quantized parameters, when present
+    int quantized = nnIsQuantized(network);
+    if (quantized)
+    {
+        int tag = NN_QUANT_MODEL_TAG;
+        fwrite(&tag, sizeof(int), 1, f);
+        for (int i = 0; i < network->layer_count; i++)
+        {
+            nnWriteQuantLayer(f, network->layers[i]);
         }
     }
 
     fclose(f);
-    printf("Network exported to %s (Binary)\n", filename);
+    printf("Network exported to %s (legacy binary, %s%s)\n", filename, element_size == sizeof(float) ? "float32" : "double", quantized ? " + int8" : "");
     return 0;
 }
 
-// Binary Import (Rebuild from File)
+// reads the legacy formats: both the double and the float32 variant are accepted and converted to the precision of the build
 // WARNING: This function is architecture dependent
-nnNetwork *nnLoadNetwork(const char *filename)
+static nnNetwork *load_legacy(const char *filename)
 {
     FILE *f = fopen(filename, "rb");
     if (f == NULL)
@@ -88,11 +206,19 @@ nnNetwork *nnLoadNetwork(const char *filename)
 
     // 1. Read Network Metadata
     int layer_count = 0;
-    if (fread(&layer_count, sizeof(int), 1, f) != 1)
+    size_t element_size = sizeof(double);
+    int ok = fread(&layer_count, sizeof(int), 1, f) == 1;
+    if (ok && layer_count == NN_FLOAT_MODEL_TAG)
+    {
+        element_size = sizeof(float);
+        ok = fread(&layer_count, sizeof(int), 1, f) == 1;
+    }
+    if (!ok || layer_count <= 0 || layer_count > MAX_LAYERS)
     {
-        fprintf(stderr, "Failed to read layer count\n");
+        fprintf(stderr, "Invalid layer count in %s\n", filename);
+        nnFreeNetwork(network);
         fclose(f);
-        return NULL; // Should probably free network here
+        return NULL;
     }
 
     // 2. Rebuild Layers
@@ -101,148 +227,117 @@ nnNetwork *nnLoadNetwork(const char *filename)
         int neuron_count, input_count, activation_val;
 
         // A. Read Layer Metadata
-        fread(&neuron_count, sizeof(int), 1, f);
-        fread(&input_count, sizeof(int), 1, f);
-        fread(&activation_val, sizeof(int), 1, f);
+        ok = fread(&neuron_count, sizeof(int), 1, f) == 1 &&
+             fread(&input_count, sizeof(int), 1, f) == 1 &&
+             fread(&activation_val, sizeof(int), 1, f) == 1;
+        if (!ok || activation_val < 0 || activation_val > ACTIVATION_SOFTMAX)
+        {
+            fprintf(stderr, "Invalid metadata for layer %d in %s\n", i, filename);
+            nnFreeNetwork(network);
+            fclose(f);
+            return NULL;
+        }
 
         // B. Create the layer structure in memory
         nnLayer *layer = nnCreateLayer(neuron_count, input_count, (nnActivationFunction)activation_val);
         if (!layer)
         {
+            nnFreeNetwork(network);
             fclose(f);
-            return NULL; // Should handle cleanup
+            return NULL;
         }
 
         // C. Read Biases
-        fread(layer->bias, sizeof(double), neuron_count, f);
+        size_t read = read_reals(f, layer->bias, neuron_count, element_size);
 
         // D. Read Weights
         for (int n = 0; n < neuron_count; n++)
         {
-            fread(layer->weights[n], sizeof(double), input_count, f);
+            read += read_reals(f, NN_WEIGHT_ROW(layer, n), input_count, element_size);
+        }
+        if (read != (size_t)neuron_count * (input_count + 1))
+        {
+            fprintf(stderr, "Truncated parameters for layer %d in %s\n", i, filename);
+            nnFreeLayer(layer);
+            nnFreeNetwork(network);
+            fclose(f);
+            return NULL;
         }
 
         // Add reconstructed layer to network
         addLayerToNetwork(network, layer);
     }
 
-    fclose(f);
-    printf("Network imported from %s successfully (Binary).\n", filename);
-    return network;
-}
-
-void train(nnNetwork *network, double **target_input, double **target_output, int target_count, double learning_rate, int epochs)
-{
-    int layer_count = network->layer_count;
-    nnLayer **layers = network->layers;
-    int output_count = layers[layer_count - 1]->neuron_count;
-    // 'next_layer_grads' has the gradients from the next layer produced by the back propagation.
-    // 'prev_layer_grads' will contain the gradients calculated to pass to the previous layer.
-    double grad_buffer_1[MAX_NEURONS];
-    double grad_buffer_2[MAX_NEURONS];
-
-    double *next_layer_grads = grad_buffer_1;
-    double *prev_layer_grads = grad_buffer_2;
-
-    printf("Starting training %d epochs on %d samples...\n", epochs, target_count);
-    clock_t total_start_time = clock();
-    for (int epoch = 0; epoch < epochs; epoch++)
+    // 3. Optional quantized section
+    int tag = 0;
+    if (fread(&tag, sizeof(int), 1, f) == 1 && tag == NN_QUANT_MODEL_TAG)
     {
-        clock_t epoch_start_time = clock();
-
-        double total_loss = 0.0;
-
-        // loop for each example given
-        for (int i = 0; i < target_count; i++)
+        for (int i = 0; i < network->layer_count; i++)
         {
-            double *current_input = target_input[i];
-            double *current_target = target_output[i];
-
-            // Forward propagation, getting the prediction from the network
-            for (int l = 0; l < layer_count; l++)
+            if (nnReadQuantLayer(f, network->layers[i]))
             {
-                forward(layers[l], current_input, &current_input);
-            }
-
-            // the last value is stored in current_input
-            double *final_output = current_input;
-
-            // Initial gradient using MSE derivative
-            for (int j = 0; j < output_count; j++)
-            {
-                double error = final_output[j] - current_target[j];
-                total_loss += error * error; // Accumulate for statistics (Loss = sum((y-t)^2))
-
-                // Write the initial gradient to the buffer
-                next_layer_grads[j] = 2.0 * error;
-            }
-
-            // backward propagation through layers
-            for (int l = layer_count - 1; l >= 0; l--)
-            {
-                nnLayer *curr_layer = layers[l];
-
-                // Update weights and calculate gradients for the previous layer
-                backward(curr_layer, next_layer_grads, prev_layer_grads, learning_rate);
-
-                // swap buffers for the next iteration (backward)
-                double *temp = next_layer_grads;
-                next_layer_grads = prev_layer_grads;
-                prev_layer_grads = temp;
+                fprintf(stderr, "Truncated int8 parameters for layer %d in %s\n", i, filename);
+                nnFreeNetwork(network);
+                fclose(f);
+                return NULL;
             }
         }
-        // --- Calcoli Statistiche Epoca ---
-
-        // 1. Loss Media
-        double average_loss = total_loss / target_count;
-
-        // 2. Tempo trascorso in questa epoca
-        clock_t now = clock();
-        double epoch_duration = (double)(now - epoch_start_time) / CLOCKS_PER_SEC;
-
-        // 3. Tempo totale trascorso dall'inizio
-        double total_elapsed = (double)(now - total_start_time) / CLOCKS_PER_SEC;
+    }
 
-        // 4. Stima ETA (basata sulla media del tempo per epoca finora)
-        double avg_time_per_epoch = total_elapsed / (epoch + 1);
-        int remaining_epochs = epochs - (epoch + 1);
-        double eta_seconds = avg_time_per_epoch * remaining_epochs;
+    fclose(f);
+    printf("Network imported from %s successfully (legacy binary).\n", filename);
+    return network;
+}
 
-        // Formattazione ETA in ore/min/sec per leggibilità
-        int eta_h = (int)eta_seconds / 3600;
-        int eta_m = ((int)eta_seconds % 3600) / 60;
-        int eta_s = (int)eta_seconds % 60;
+// Binary Import (Rebuild from File) into memory owned by the layers (training can continue), any format
+nnNetwork *nnLoadNetwork(const char *filename)
+{
+    return nnIsModelFile(filename) ? nnReadModel(filename, 0) : load_legacy(filename);
+}
 
-        // 5. Percentuale completamento
-        double progress = ((double)(epoch + 1) / epochs) * 100.0;
+// Zero-copy import for read-only inference: the layers point into the mapped v2 file.
+// Files that cannot be used in place (legacy formats, other element size) are loaded as a copy.
+nnNetwork *nnMapNetwork(const char *filename)
+{
+    return nnIsModelFile(filename) ? nnReadModel(filename, 1) : load_legacy(filename);
+}
 
-        // Stampa (puoi cambiare la condizione % 1 per stampare meno frequentemente)
-        if ((epoch + 1) % 1 == 0 || epoch == 0)
-        {
-            printf("Epoch %d/%d [%.1f%%] | Loss: %.6f | Time: %.2fs | ETA: %02d:%02d:%02d\n",
-                   epoch + 1,
-                   epochs,
-                   progress,
-                   average_loss,
-                   epoch_duration,
-                   eta_h, eta_m, eta_s);
-        }
+// Rewrites a model file (any format) as a v2 file with the given element size, e.g. sizeof(float)
+// turns a double trained_network.bin into a float32 one
+int nnConvertNetworkFile(const char *source, const char *destination, size_t element_size)
+{
+    nnNetwork *network = nnLoadNetwork(source);
+    if (network == NULL)
+    {
+        return 1;
     }
-    printf("Training completed\n");
+    int result = nnDumpNetworkAs(network, destination, element_size);
+    nnFreeNetwork(network);
+    return result;
 }
 
 // forwards the whole network and copy the output to the specified output array that must be allocated from the caller
-void predict(nnNetwork *network, double *input, double *output)
+void predict(nnNetwork *network, nnReal *input, nnReal *output)
 {
-    double *current_input = input;
+    int output_count = network->layers[network->layer_count - 1]->neuron_count;
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "The network only has int8 weights, run it with the int8 engine\n");
+        memset(output, 0, output_count * sizeof(nnReal));
+        return;
+    }
+    nnReal *current_input = input;
 
     for (int l = 0; l < network->layer_count; l++)
     {
+        nnProfileMark mark;
+        nnProfileBegin(&mark);
         forward(network->layers[l], current_input, &current_input);
+        nnProfileLayerEnd(&mark, l, network->layers[l], NN_PROFILE_FORWARD, 1, sizeof(nnReal));
     }
 
     // copy the final output to the output given by the user
-    memcpy(output, current_input, network->layers[network->layer_count - 1]->neuron_count * sizeof(double));
+    memcpy(output, current_input, output_count * sizeof(nnReal));
 }
 
 void nnFreeNetwork(nnNetwork *network)
@@ -256,6 +351,10 @@ void nnFreeNetwork(nnNetwork *network)
     {
         nnFreeLayer(network->layers[i]);
     }
+    if (network->mapping != NULL)
+    {
+        munmap(network->mapping, network->mapping_size);
+    }
 
     free(network);
 }
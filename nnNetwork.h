@@ -11,13 +11,20 @@ typedef struct nnNetwork
 {
     int layer_count;
     nnLayer *layers[MAX_LAYERS]; // a list of pointers to layers
+
+    void *mapping; // model file the layers point into (nnMapNetwork), NULL when they own their parameters
+    size_t mapping_size;
 } nnNetwork;
 
-void train(nnNetwork *network, double **target_input, double **target_output, int target_count, double learning_rate, int epochs);
-void predict(nnNetwork *network, double *input, double *output);
+void predict(nnNetwork *network, nnReal *input, nnReal *output);
 nnNetwork *nnCreateNetwork();
 int addLayerToNetwork(nnNetwork *network, nnLayer *layer);
 int nnDumpNetwork(nnNetwork *network, const char *filename);
+int nnDumpNetworkAs(nnNetwork *network, const char *filename, size_t element_size);
+int nnDumpNetworkInt8(nnNetwork *network, const char *filename); // quantized networks, no float weights
+int nnDumpNetworkLegacy(nnNetwork *network, const char *filename, size_t element_size);
+int nnConvertNetworkFile(const char *source, const char *destination, size_t element_size);
 nnNetwork *nnLoadNetwork(const char *filename);
+nnNetwork *nnMapNetwork(const char *filename);
 void nnFreeNetwork(nnNetwork *network);
 #endif // NNNETWORK_H
\ No newline at end of file
@@ -0,0 +1,157 @@
+#include "nnOptimizer.h"
+#include "nnKernels.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+nnOptimizerConfig nnDefaultOptimizerConfig(nnOptimizerType type)
+{
+    nnOptimizerConfig config;
+    config.type = type;
+    config.momentum = 0.9;
+    config.beta1 = 0.9;
+    config.beta2 = 0.999;
+    config.epsilon = 1e-8;
+    return config;
+}
+
+const char *nnOptimizerName(nnOptimizerType type)
+{
+    switch (type)
+    {
+    case NN_OPTIMIZER_MOMENTUM:
+        return "momentum";
+    case NN_OPTIMIZER_ADAM:
+        return "adam";
+    default:
+        return "sgd";
+    }
+}
+
+int nnOptimizerArrays(nnOptimizerType type)
+{
+    switch (type)
+    {
+    case NN_OPTIMIZER_MOMENTUM:
+        return 1;
+    case NN_OPTIMIZER_ADAM:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+nnOptimizer *nnCreateOptimizer(const nnNetwork *network, const nnOptimizerConfig *config)
+{
+    nnOptimizer *optimizer = (nnOptimizer *)calloc(1, sizeof(nnOptimizer));
+    if (optimizer == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnOptimizer\n");
+        return NULL;
+    }
+    optimizer->config = *config;
+    optimizer->layer_count = network->layer_count;
+    optimizer->arrays = nnOptimizerArrays(config->type);
+    if (optimizer->arrays == 0)
+    {
+        return optimizer;
+    }
+
+    int layer_count = network->layer_count;
+    optimizer->state = (nnReal **)calloc((size_t)optimizer->arrays * layer_count, sizeof(nnReal *));
+    if (optimizer->state == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the optimizer state\n");
+        free(optimizer);
+        return NULL;
+    }
+    // one block per layer, its arrays back to back (each a multiple of NN_ALIGNMENT, like the parameter block),
+    // zeroed by nnAlignedAlloc: the moments start at 0
+    for (int l = 0; l < layer_count; l++)
+    {
+        size_t count = nnLayerParamCount(network->layers[l]);
+        nnReal *block = (nnReal *)nnAlignedAlloc((size_t)optimizer->arrays * count * sizeof(nnReal));
+        if (block == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed for the optimizer state of layer %d\n", l);
+            nnFreeOptimizer(optimizer);
+            return NULL;
+        }
+        for (int a = 0; a < optimizer->arrays; a++)
+            optimizer->state[a * layer_count + l] = block + (size_t)a * count;
+    }
+    return optimizer;
+}
+
+void nnFreeOptimizer(nnOptimizer *optimizer)
+{
+    if (!optimizer)
+    {
+        return;
+    }
+
+    if (optimizer->state != NULL)
+    {
+        // the first array of a layer is the start of its block
+        for (int l = 0; l < optimizer->layer_count; l++)
+            nnAlignedFree(optimizer->state[l]);
+        free(optimizer->state);
+    }
+    free(optimizer);
+}
+
+void nnOptimizerRestore(nnOptimizer *optimizer, const nnNetwork *network, nnReal *const *state)
+{
+    int layer_count = optimizer->layer_count;
+    for (int l = 0; l < layer_count; l++)
+    {
+        size_t bytes = nnLayerParamCount(network->layers[l]) * sizeof(nnReal);
+        for (int a = 0; a < optimizer->arrays; a++)
+            memcpy(optimizer->state[a * layer_count + l], state[a * layer_count + l], bytes);
+    }
+}
+
+void nnOptimizerUpdate(const nnOptimizer *optimizer, nnLayer *layer, int l, const nnReal *gradient, double learning_rate,
+                       nnReal scale, long step, size_t begin, size_t end)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    const nnOptimizerConfig *config = &optimizer->config;
+    int n = (int)(end - begin);
+    nnReal *params = layer->weights + begin;
+    gradient += begin;
+    switch (config->type)
+    {
+    case NN_OPTIMIZER_MOMENTUM:
+    {
+        nnReal *velocity = optimizer->state[l] + begin;
+        nnMomentumUpdate(params, gradient, velocity, n, scale, (nnReal)config->momentum, (nnReal)learning_rate);
+        break;
+    }
+    case NN_OPTIMIZER_ADAM:
+    {
+        nnReal *m = optimizer->state[l] + begin;
+        nnReal *v = optimizer->state[optimizer->layer_count + l] + begin;
+        // bias correction of both moving averages folded into the step size
+        double step_size = learning_rate * sqrt(1.0 - pow(config->beta2, (double)step)) / (1.0 - pow(config->beta1, (double)step));
+        nnAdamUpdate(params, gradient, m, v, n, scale, (nnReal)config->beta1, (nnReal)config->beta2, (nnReal)step_size,
+                     (nnReal)config->epsilon);
+        break;
+    }
+    default:
+        nnAxpy((nnReal)-learning_rate * scale, gradient, params, n);
+        break;
+    }
+
+    // pruned weights stay at zero
+    const uint8_t *mask = layer->prune_mask;
+    if (mask != NULL)
+    {
+        for (int i = 0; i < n; i++)
+            params[i] = mask[begin + i] ? params[i] : 0;
+    }
+}
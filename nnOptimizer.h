@@ -0,0 +1,51 @@
+// include guard
+#ifndef NNOPTIMIZER_H
+#define NNOPTIMIZER_H
+
+#include "nnNetwork.h"
+
+// Optimizers applied by the training loop to the gradients summed over a batch (nnTrain.h). The state of
+// every layer is one aligned block holding its arrays back to back, each with the layout of the parameter
+// block of the layer, and every update is a single fused pass over parameters, gradient and state (nnKernels.h).
+typedef enum nnOptimizerType
+{
+    NN_OPTIMIZER_SGD,      // params -= learning_rate * g, no state
+    NN_OPTIMIZER_MOMENTUM, // heavy ball: one velocity array
+    NN_OPTIMIZER_ADAM,     // moving averages of g and g^2, with the bias correction
+} nnOptimizerType;
+
+typedef struct nnOptimizerConfig
+{
+    nnOptimizerType type;
+    double momentum; // NN_OPTIMIZER_MOMENTUM
+    double beta1;    // NN_OPTIMIZER_ADAM
+    double beta2;
+    double epsilon;
+} nnOptimizerConfig;
+
+typedef struct nnOptimizer
+{
+    nnOptimizerConfig config;
+    int layer_count;
+    int arrays;     // state arrays per layer, see nnOptimizerArrays
+    nnReal **state; // arrays x layer_count, [a * layer_count + l] (same order as nnTrainState.optimizer_state)
+} nnOptimizer;
+
+nnOptimizerConfig nnDefaultOptimizerConfig(nnOptimizerType type);
+const char *nnOptimizerName(nnOptimizerType type);
+// per-layer state arrays of an optimizer: 0 for SGD, 1 for momentum, 2 for Adam
+int nnOptimizerArrays(nnOptimizerType type);
+
+// the state starts at zero
+nnOptimizer *nnCreateOptimizer(const nnNetwork *network, const nnOptimizerConfig *config);
+void nnFreeOptimizer(nnOptimizer *optimizer);
+// copies the state arrays saved by a checkpoint, they must have the layout of the optimizer
+void nnOptimizerRestore(nnOptimizer *optimizer, const nnNetwork *network, nnReal *const *state);
+
+// Updates the parameters [begin, end) of layer l with 'gradient' (the same layout) times 'scale', usually
+// 1 / batch size. 'step' counts the updates from the start of the training, 1 for the first one (Adam bias
+// correction). Disjoint ranges of a layer can be updated by different threads. Pruned weights stay at zero.
+void nnOptimizerUpdate(const nnOptimizer *optimizer, nnLayer *layer, int l, const nnReal *gradient, double learning_rate,
+                       nnReal scale, long step, size_t begin, size_t end);
+
+#endif // NNOPTIMIZER_H
@@ -0,0 +1,294 @@
+#include "nnPipeline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+    NN_SLOT_FREE,    // waiting for its next batch
+    NN_SLOT_FILLING, // a producer is assembling it
+    NN_SLOT_READY,   // waiting for the trainer
+    NN_SLOT_IN_USE,  // held by the trainer
+};
+
+// splitmix64: small, and every (seed, stream position) pair gives an independent generator
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Fisher-Yates shuffle, called with the mutex held by the producer that claims the first batch of the epoch
+static void shuffle_epoch(nnPipeline *pipeline, int epoch)
+{
+    int *order = pipeline->order[epoch % 2];
+    uint64_t state = ((uint64_t)pipeline->config.seed << 32) ^ (uint64_t)epoch;
+    for (int i = 0; i < pipeline->dataset->count; i++)
+        order[i] = i;
+    for (int i = pipeline->dataset->count - 1; i > 0; i--)
+    {
+        int j = (int)(next_random(&state) % (uint64_t)(i + 1));
+        int temp = order[i];
+        order[i] = order[j];
+        order[j] = temp;
+    }
+}
+
+// normalized image translated by (dx, dy), the uncovered pixels are 0
+static void gather_shifted(const nnDataset *dataset, int sample, int dx, int dy, nnReal *dst)
+{
+    const uint8_t *src = dataset->pixels + (size_t)sample * dataset->input_count;
+    for (int y = 0; y < dataset->rows; y++)
+    {
+        int sy = y - dy;
+        for (int x = 0; x < dataset->cols; x++)
+        {
+            int sx = x - dx;
+            int inside = sy >= 0 && sy < dataset->rows && sx >= 0 && sx < dataset->cols;
+            dst[y * dataset->cols + x] = inside ? (nnReal)(src[sy * dataset->cols + sx] / 255.0) : 0.0;
+        }
+    }
+}
+
+static void fill_batch(nnPipeline *pipeline, nnPipelineBatch *batch, long sequence)
+{
+    const nnDataset *dataset = pipeline->dataset;
+    const nnPipelineConfig *config = &pipeline->config;
+    int index = (int)(sequence % pipeline->batches_per_epoch);
+    int first = index * config->batch_size;
+    const int *order = config->shuffle ? pipeline->order[batch->epoch % 2] : NULL;
+    uint64_t state = ((uint64_t)config->seed << 32) ^ ((uint64_t)sequence * 0x2545F4914F6CDD1DULL);
+
+    for (int b = 0; b < batch->count; b++)
+    {
+        int sample = order != NULL ? order[first + b] : first + b;
+        nnReal *input = batch->inputs + (size_t)b * pipeline->input_stride;
+        if (config->max_shift > 0)
+        {
+            int span = 2 * config->max_shift + 1;
+            int dx = (int)(next_random(&state) % span) - config->max_shift;
+            int dy = (int)(next_random(&state) % span) - config->max_shift;
+            gather_shifted(dataset, sample, dx, dy, input);
+        }
+        else
+        {
+            nnDatasetGatherInputs(dataset, sample, 1, input, pipeline->input_stride);
+        }
+        nnDatasetGatherTargets(dataset, sample, 1, batch->targets + (size_t)b * pipeline->target_stride, pipeline->target_stride);
+    }
+}
+
+static void *producer(void *arg)
+{
+    nnPipeline *pipeline = (nnPipeline *)arg;
+    const int depth = pipeline->config.depth;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    for (;;)
+    {
+        // the next batch can only be claimed once its slot has been given back
+        double wait_start = 0.0;
+        while (!pipeline->stop && pipeline->next_produce < pipeline->total_batches &&
+               pipeline->slots[pipeline->next_produce % depth].state != NN_SLOT_FREE)
+        {
+            if (wait_start == 0.0)
+            {
+                wait_start = nnNowSeconds();
+                pipeline->stats.producer_stalls++;
+            }
+            pthread_cond_wait(&pipeline->slot_free, &pipeline->mutex);
+        }
+        if (wait_start != 0.0)
+            pipeline->stats.producer_wait_seconds += nnNowSeconds() - wait_start;
+        if (pipeline->stop || pipeline->next_produce >= pipeline->total_batches)
+            break;
+
+        long sequence = pipeline->next_produce++;
+        nnPipelineBatch *batch = &pipeline->slots[sequence % depth];
+        int index = (int)(sequence % pipeline->batches_per_epoch);
+        batch->sequence = sequence;
+        batch->state = NN_SLOT_FILLING;
+        batch->epoch = (int)(sequence / pipeline->batches_per_epoch);
+        batch->count = pipeline->dataset->count - index * pipeline->config.batch_size;
+        if (batch->count > pipeline->config.batch_size)
+            batch->count = pipeline->config.batch_size;
+
+        // the ring never spans more than one epoch, so nobody still reads the order being replaced
+        if (index == 0 && pipeline->config.shuffle)
+            shuffle_epoch(pipeline, batch->epoch);
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        double fill_start = nnNowSeconds();
+        fill_batch(pipeline, batch, sequence);
+        double fill_time = nnNowSeconds() - fill_start;
+
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->stats.produce_seconds += fill_time;
+        pipeline->stats.batches++;
+        batch->state = NN_SLOT_READY;
+        pthread_cond_broadcast(&pipeline->batch_ready);
+    }
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+}
+
+nnPipeline *nnCreatePipeline(const nnDataset *dataset, int input_stride, int target_stride, int epochs, const nnPipelineConfig *config)
+{
+    if (dataset == NULL || dataset->count == 0 || epochs <= config->first_epoch || config->first_epoch < 0 || config->batch_size <= 0)
+    {
+        fprintf(stderr, "Nothing to feed to the input pipeline\n");
+        return NULL;
+    }
+
+    nnPipeline *pipeline = (nnPipeline *)calloc(1, sizeof(nnPipeline));
+    if (pipeline == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnPipeline\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->slot_free, NULL);
+    pthread_cond_init(&pipeline->batch_ready, NULL);
+    pipeline->dataset = dataset;
+    pipeline->config = *config;
+    pipeline->input_stride = input_stride;
+    pipeline->target_stride = target_stride;
+    pipeline->batches_per_epoch = (dataset->count + config->batch_size - 1) / config->batch_size;
+    pipeline->total_batches = (long)pipeline->batches_per_epoch * epochs;
+    pipeline->next_produce = (long)pipeline->batches_per_epoch * config->first_epoch;
+    pipeline->next_consume = pipeline->next_produce;
+    if (pipeline->config.producers <= 0)
+        pipeline->config.producers = 1;
+    if (pipeline->config.depth < 2)
+        pipeline->config.depth = 2;
+    if (pipeline->config.depth > pipeline->batches_per_epoch)
+        pipeline->config.depth = pipeline->batches_per_epoch;
+    const int depth = pipeline->config.depth;
+
+    // every slot: batch_size input rows then batch_size target rows, all aligned
+    size_t slot_elements = (size_t)config->batch_size * (input_stride + target_stride);
+    pipeline->slots = (nnPipelineBatch *)calloc(depth, sizeof(nnPipelineBatch));
+    pipeline->buffer = nnAlignedAlloc(depth * slot_elements * sizeof(nnReal));
+    pipeline->threads = (pthread_t *)calloc(pipeline->config.producers, sizeof(pthread_t));
+    int ok = pipeline->slots != NULL && pipeline->buffer != NULL && pipeline->threads != NULL;
+    if (ok && config->shuffle)
+    {
+        pipeline->order[0] = (int *)malloc(dataset->count * sizeof(int));
+        pipeline->order[1] = (int *)malloc(dataset->count * sizeof(int));
+        ok = pipeline->order[0] != NULL && pipeline->order[1] != NULL;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Memory allocation failed for nnPipeline\n");
+        nnFreePipeline(pipeline);
+        return NULL;
+    }
+
+    for (int s = 0; s < depth; s++)
+    {
+        nnPipelineBatch *batch = &pipeline->slots[s];
+        batch->inputs = (nnReal *)pipeline->buffer + s * slot_elements;
+        batch->targets = batch->inputs + (size_t)config->batch_size * input_stride;
+        batch->sequence = -1;
+        batch->state = NN_SLOT_FREE;
+    }
+
+    for (; pipeline->thread_count < pipeline->config.producers; pipeline->thread_count++)
+    {
+        if (pthread_create(&pipeline->threads[pipeline->thread_count], NULL, producer, pipeline) != 0)
+            break;
+    }
+    if (pipeline->thread_count == 0)
+    {
+        fprintf(stderr, "Unable to start the input pipeline threads\n");
+        nnFreePipeline(pipeline);
+        return NULL;
+    }
+    return pipeline;
+}
+
+void nnFreePipeline(nnPipeline *pipeline)
+{
+    if (!pipeline)
+    {
+        return;
+    }
+
+    if (pipeline->thread_count > 0)
+    {
+        pthread_mutex_lock(&pipeline->mutex);
+        pipeline->stop = 1;
+        pthread_cond_broadcast(&pipeline->slot_free);
+        pthread_mutex_unlock(&pipeline->mutex);
+        for (int t = 0; t < pipeline->thread_count; t++)
+            pthread_join(pipeline->threads[t], NULL);
+    }
+    pthread_mutex_destroy(&pipeline->mutex);
+    pthread_cond_destroy(&pipeline->slot_free);
+    pthread_cond_destroy(&pipeline->batch_ready);
+
+    free(pipeline->order[0]);
+    free(pipeline->order[1]);
+    free(pipeline->threads);
+    free(pipeline->slots);
+    nnAlignedFree(pipeline->buffer);
+    free(pipeline);
+}
+
+const nnPipelineBatch *nnPipelineAcquire(nnPipeline *pipeline, int epoch)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    long sequence = pipeline->next_consume;
+    if (sequence >= pipeline->total_batches || sequence / pipeline->batches_per_epoch != epoch)
+    {
+        pthread_mutex_unlock(&pipeline->mutex);
+        return NULL;
+    }
+    pipeline->next_consume++;
+
+    nnPipelineBatch *batch = &pipeline->slots[sequence % pipeline->config.depth];
+    double wait_start = 0.0;
+    while (batch->sequence != sequence || batch->state != NN_SLOT_READY)
+    {
+        if (wait_start == 0.0)
+        {
+            wait_start = nnNowSeconds();
+            pipeline->stats.consumer_stalls++;
+        }
+        pthread_cond_wait(&pipeline->batch_ready, &pipeline->mutex);
+    }
+    if (wait_start != 0.0)
+        pipeline->stats.consumer_wait_seconds += nnNowSeconds() - wait_start;
+    batch->state = NN_SLOT_IN_USE;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return batch;
+}
+
+void nnPipelineRelease(nnPipeline *pipeline, const nnPipelineBatch *batch)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->slots[batch->sequence % pipeline->config.depth].state = NN_SLOT_FREE;
+    pthread_cond_broadcast(&pipeline->slot_free);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+nnPipelineStats nnPipelineGetStats(nnPipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    nnPipelineStats stats = pipeline->stats;
+    pthread_mutex_unlock(&pipeline->mutex);
+    return stats;
+}
+
+void nnPipelinePrintStats(nnPipeline *pipeline)
+{
+    nnPipelineStats stats = nnPipelineGetStats(pipeline);
+    printf("Input pipeline: %ld batches built in %.2fs | trainer stalls: %ld (%.2fs) | producer stalls: %ld (%.2fs) -> %s-bound\n",
+           stats.batches, stats.produce_seconds,
+           stats.consumer_stalls, stats.consumer_wait_seconds,
+           stats.producer_stalls, stats.producer_wait_seconds,
+           stats.consumer_wait_seconds > stats.producer_wait_seconds ? "input" : "compute");
+}
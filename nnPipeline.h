@@ -0,0 +1,83 @@
+// include guard
+#ifndef NNPIPELINE_H
+#define NNPIPELINE_H
+
+#include "nnDataset.h"
+#include <pthread.h>
+
+// Asynchronous input pipeline: background producer threads assemble the next mini-batches of a dataset
+// (normalized, optionally shuffled and augmented) into a ring of preallocated aligned buffers while the
+// trainer consumes the current one. Batches are handed out in stream order, so a run only depends on
+// the seed, not on which producer built which batch.
+
+typedef struct nnPipelineConfig
+{
+    int batch_size;
+    int producers;     // background threads building batches
+    int depth;         // batches in the ring (at most one epoch)
+    int shuffle;       // a new sample order every epoch
+    int max_shift;     // random translation of every image by up to max_shift pixels (0 disables it)
+    unsigned int seed; // order and shifts are a function of the seed only
+    int first_epoch;   // epochs already done (resumed training), the stream starts with the first batch of this one
+} nnPipelineConfig;
+
+// Stage counters: consumer stalls mean the training is input-bound, producer stalls that it is compute-bound
+typedef struct nnPipelineStats
+{
+    long batches;
+    long consumer_stalls;
+    double consumer_wait_seconds;
+    long producer_stalls;
+    double producer_wait_seconds;
+    double produce_seconds; // time spent assembling batches, summed over the producers
+} nnPipelineStats;
+
+typedef struct nnPipelineBatch
+{
+    int epoch;
+    int count;       // samples in the batch, the last one of an epoch can be smaller
+    nnReal *inputs;  // count rows of input_stride elements
+    nnReal *targets; // count rows of target_stride elements
+
+    // ring bookkeeping
+    long sequence;
+    int state;
+} nnPipelineBatch;
+
+typedef struct nnPipeline
+{
+    const nnDataset *dataset;
+    nnPipelineConfig config;
+    int input_stride;
+    int target_stride;
+    int batches_per_epoch;
+    long total_batches;
+
+    nnPipelineBatch *slots; // config.depth buffers, batch s lives in slot s % depth
+    void *buffer;           // one aligned block with the inputs and targets of every slot
+    int *order[2];          // sample order of the even and the odd epochs (shuffle only)
+
+    pthread_mutex_t mutex;
+    pthread_cond_t slot_free;
+    pthread_cond_t batch_ready;
+    long next_produce; // next batch claimed by a producer
+    long next_consume; // next batch handed to the trainer
+    int stop;
+
+    pthread_t *threads;
+    int thread_count;
+    nnPipelineStats stats;
+} nnPipeline;
+
+// the rows of the batches are padded to input_stride and target_stride elements
+nnPipeline *nnCreatePipeline(const nnDataset *dataset, int input_stride, int target_stride, int epochs, const nnPipelineConfig *config);
+void nnFreePipeline(nnPipeline *pipeline);
+
+// Next batch of 'epoch' (blocking until it is ready), NULL once every batch of the epoch has been handed out.
+// Several threads can consume at the same time, each batch must be given back with nnPipelineRelease.
+const nnPipelineBatch *nnPipelineAcquire(nnPipeline *pipeline, int epoch);
+void nnPipelineRelease(nnPipeline *pipeline, const nnPipelineBatch *batch);
+nnPipelineStats nnPipelineGetStats(nnPipeline *pipeline);
+void nnPipelinePrintStats(nnPipeline *pipeline);
+
+#endif // NNPIPELINE_H
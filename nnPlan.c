@@ -0,0 +1,202 @@
+#include "nnPlan.h"
+#include "nnProfile.h"
+#include "nnQuant.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Offsets (in elements) of the 'count' activation regions in the workspace. Region 0 is the input tile,
+// region l + 1 the output of layer l; region i is written by step i - 1 and read by step i (the last one
+// by the final copy), so two regions conflict only when they are neighbours. Greedy first fit, largest
+// region first. Sizes are multiples of NN_ALIGNMENT bytes, so are the offsets. Returns the workspace size.
+static size_t assign_regions(int count, const size_t *sizes, size_t *offsets, int *order)
+{
+    for (int i = 0; i < count; i++)
+    {
+        // insertion sort by decreasing size
+        int j = i;
+        for (; j > 0 && sizes[order[j - 1]] < sizes[i]; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    size_t total = 0;
+    for (int r = 0; r < count; r++)
+    {
+        int i = order[r];
+        size_t offset = 0;
+        int moved = 1;
+        while (moved)
+        {
+            moved = 0;
+            for (int p = 0; p < r; p++)
+            {
+                int j = order[p];
+                int live_together = j == i - 1 || j == i + 1;
+                if (live_together && offset < offsets[j] + sizes[j] && offsets[j] < offset + sizes[i])
+                {
+                    offset = offsets[j] + sizes[j];
+                    moved = 1;
+                }
+            }
+        }
+        offsets[i] = offset;
+        if (offset + sizes[i] > total)
+            total = offset + sizes[i];
+    }
+    return total;
+}
+
+static void carve_plan(nnPlan *plan)
+{
+    plan->steps = (nnPlanStep *)nnArenaAlloc(&plan->arena, (size_t)plan->step_count * sizeof(nnPlanStep));
+    plan->workspace = (nnReal *)nnArenaAlloc(&plan->arena, plan->workspace_size * sizeof(nnReal));
+}
+
+nnPlan *nnCompilePlan(const nnNetwork *network, int max_batch)
+{
+    if (network == NULL || network->layer_count == 0 || max_batch <= 0)
+    {
+        fprintf(stderr, "Cannot compile a plan for an empty network\n");
+        return NULL;
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "The network only has int8 weights, a float plan cannot run it\n");
+        return NULL;
+    }
+
+    int layer_count = network->layer_count;
+    nnPlan *plan = (nnPlan *)calloc(1, sizeof(nnPlan));
+    size_t *sizes = (size_t *)malloc((size_t)(layer_count + 1) * sizeof(size_t));
+    size_t *offsets = (size_t *)malloc((size_t)(layer_count + 1) * sizeof(size_t));
+    int *order = (int *)malloc((size_t)(layer_count + 1) * sizeof(int));
+    if (plan == NULL || sizes == NULL || offsets == NULL || order == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnPlan\n");
+        free(plan);
+        free(sizes);
+        free(offsets);
+        free(order);
+        return NULL;
+    }
+
+    plan->max_batch = max_batch;
+    plan->step_count = layer_count;
+    plan->input_count = network->layers[0]->input_count;
+    plan->output_count = network->layers[layer_count - 1]->neuron_count;
+    sizes[0] = (size_t)max_batch * nnPaddedCount(plan->input_count);
+    for (int l = 0; l < layer_count; l++)
+        sizes[l + 1] = (size_t)max_batch * nnPaddedCount(network->layers[l]->neuron_count);
+    plan->workspace_size = assign_regions(layer_count + 1, sizes, offsets, order);
+    plan->input_offset = offsets[0];
+
+    nnArenaMeasure(&plan->arena);
+    carve_plan(plan);
+    if (nnArenaCreate(&plan->arena, plan->arena.used))
+    {
+        free(plan);
+        free(sizes);
+        free(offsets);
+        free(order);
+        return NULL;
+    }
+    carve_plan(plan);
+
+    for (int l = 0; l < layer_count; l++)
+    {
+        const nnLayer *layer = network->layers[l];
+        nnPlanStep *step = &plan->steps[l];
+        step->kind = layer->csr != NULL || layer->sparse_input ? NN_PLAN_LAYER : NN_PLAN_DENSE;
+        step->layer = layer;
+        step->neuron_count = layer->neuron_count;
+        step->input_count = layer->input_count;
+        step->input_stride = nnPaddedCount(layer->input_count);
+        step->output_stride = nnPaddedCount(layer->neuron_count);
+        step->weights = layer->weights;
+        step->weight_stride = layer->weight_stride;
+        step->bias = layer->bias;
+        step->kernel = nnSelectDenseKernel(layer->neuron_count, layer->input_count, layer->activationFunction);
+        step->pass = nnSelectActivation(layer->activationFunction);
+        step->output_offset = offsets[l + 1];
+    }
+    free(sizes);
+    free(offsets);
+    free(order);
+    return plan;
+}
+
+void nnFreePlan(nnPlan *plan)
+{
+    if (!plan)
+    {
+        return;
+    }
+
+    nnArenaFree(&plan->arena);
+    free(plan);
+}
+
+// runs 'count' samples stored (with padded rows) in 'input', returns the matrix holding the outputs
+static const nnReal *run_tile(nnPlan *plan, const nnReal *input, int count)
+{
+    const nnReal *current_input = input;
+    for (int s = 0; s < plan->step_count; s++)
+    {
+        const nnPlanStep *step = &plan->steps[s];
+        nnReal *current_output = plan->workspace + step->output_offset;
+        nnProfileMark mark;
+        nnProfileBegin(&mark);
+        if (step->kind == NN_PLAN_DENSE)
+            step->kernel(count, step->neuron_count, step->input_count, current_input, step->input_stride, step->weights,
+                         step->weight_stride, step->bias, step->pass, current_output, step->output_stride);
+        else
+            nnLayerForwardBatch(step->layer, current_input, current_output, count);
+        nnProfileLayerEnd(&mark, s, step->layer, NN_PROFILE_FORWARD, count, sizeof(nnReal));
+        current_input = current_output;
+    }
+    return current_input;
+}
+
+void nnPlanPredict(nnPlan *plan, const nnReal *input, nnReal *output)
+{
+    // a single row needs no padding, the input is used as it is
+    const nnReal *final_output = run_tile(plan, input, 1);
+    memcpy(output, final_output, plan->output_count * sizeof(nnReal));
+}
+
+// one of 'matrix' (contiguous rows) and 'rows' (row pointers) gives the inputs
+static void plan_batch(nnPlan *plan, const nnReal *matrix, const nnReal *const *rows, int n, nnReal *outputs)
+{
+    int input_count = plan->input_count;
+    int output_count = plan->output_count;
+    int input_stride = nnPaddedCount(input_count);
+    int output_stride = nnPaddedCount(output_count);
+    nnReal *tile = plan->workspace + plan->input_offset;
+
+    for (int first = 0; first < n; first += plan->max_batch)
+    {
+        int count = n - first < plan->max_batch ? n - first : plan->max_batch;
+        for (int b = 0; b < count; b++)
+        {
+            const nnReal *src = rows != NULL ? rows[first + b] : matrix + (size_t)(first + b) * input_count;
+            memcpy(tile + (size_t)b * input_stride, src, input_count * sizeof(nnReal));
+        }
+
+        const nnReal *final_output = run_tile(plan, tile, count);
+        for (int b = 0; b < count; b++)
+        {
+            memcpy(outputs + (size_t)(first + b) * output_count, final_output + (size_t)b * output_stride, output_count * sizeof(nnReal));
+        }
+    }
+}
+
+void nnPlanPredictBatch(nnPlan *plan, const nnReal *inputs, int n, nnReal *outputs)
+{
+    plan_batch(plan, inputs, NULL, n, outputs);
+}
+
+void nnPlanPredictBatchRows(nnPlan *plan, const nnReal *const *inputs, int n, nnReal *outputs)
+{
+    plan_batch(plan, NULL, inputs, n, outputs);
+}
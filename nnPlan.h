@@ -0,0 +1,61 @@
+// include guard
+#ifndef NNPLAN_H
+#define NNPLAN_H
+
+#include "nnNetwork.h"
+#include "nnKernels.h"
+#include "nnArena.h"
+
+// Execution plan: a network frozen for inference. Compiling resolves once what every predict otherwise
+// rediscovers: the shapes and strides of each layer, the dense kernel specialized for its shape and
+// activation (bias and activation fused, nnSelectDenseKernel) and where its output lives. All the
+// activations share one workspace whose regions are assigned by liveness: the output of a layer only
+// has to survive until the next layer has read it, so a region is reused as soon as it is dead.
+// Running a plan allocates nothing. A plan has its own workspace, so it serves one thread at a time
+// (compile one per thread, the network is only read). It keeps pointers into the network: recompile it
+// after changing the topology, pruning or loading new weights (training in place is fine), or after
+// changing the kernel level or the activation precision.
+typedef enum nnPlanStepKind
+{
+    NN_PLAN_DENSE, // specialized dense kernel
+    NN_PLAN_LAYER, // sparse-input and pruned (CSR) layers, run by nnLayerForwardBatch
+} nnPlanStepKind;
+
+typedef struct nnPlanStep
+{
+    nnPlanStepKind kind;
+    const nnLayer *layer;
+    int neuron_count;
+    int input_count;
+    int input_stride; // padded row lengths of the input and the output
+    int output_stride;
+    const nnReal *weights;
+    int weight_stride;
+    const nnReal *bias;
+    nnDenseKernel kernel;
+    nnActivationPass pass;
+    size_t output_offset; // elements from the start of the workspace
+} nnPlanStep;
+
+typedef struct nnPlan
+{
+    int max_batch; // samples per tile
+    int step_count;
+    int input_count;
+    int output_count;
+    nnPlanStep *steps;
+    nnReal *workspace;
+    size_t workspace_size; // elements, max_batch rows of every live activation
+    size_t input_offset;   // region of the input tile
+    nnArena arena;         // steps and workspace
+} nnPlan;
+
+nnPlan *nnCompilePlan(const nnNetwork *network, int max_batch);
+void nnFreePlan(nnPlan *plan);
+
+// same contracts as predictWithContext and predictBatchWithContext / predictBatchRowsWithContext
+void nnPlanPredict(nnPlan *plan, const nnReal *input, nnReal *output);
+void nnPlanPredictBatch(nnPlan *plan, const nnReal *inputs, int n, nnReal *outputs);
+void nnPlanPredictBatchRows(nnPlan *plan, const nnReal *const *inputs, int n, nnReal *outputs);
+
+#endif // NNPLAN_H
@@ -0,0 +1,367 @@
+#include "nnProfile.h"
+#include "nnPrune.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+typedef struct nnProfileEntry
+{
+    long calls;
+    double seconds; // summed over the threads
+    double flops;
+    double bytes;
+    uint64_t cycles;
+    uint64_t cache_misses;
+} nnProfileEntry;
+
+static const char *phase_names[NN_PROFILE_PHASES] = {"forward", "backward", "update"};
+
+// written only by nnProfileStart and nnProfileStop, while no instrumented code runs
+static int profile_active = 0;
+static int profile_counters = 0;
+static int profile_generation = 0;
+static FILE *json_file = NULL;
+static FILE *csv_file = NULL;
+static int json_records = 0;
+
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+static nnProfileEntry entries[MAX_LAYERS][NN_PROFILE_PHASES];
+static int counters_failed = 0; // some thread could not open or read its counters
+static int *counter_fds = NULL; // every descriptor opened by any thread, closed by nnProfileStop
+static int counter_fd_count = 0;
+
+// counters of the current thread (a group: cycles, then cache misses), opened on first use in each profile
+static __thread int thread_leader = -1;
+static __thread int thread_generation = 0;
+
+#ifdef __linux__
+static void keep_fd(int fd)
+{
+    int *fds = (int *)realloc(counter_fds, (size_t)(counter_fd_count + 1) * sizeof(int));
+    if (fds == NULL)
+    {
+        close(fd); // not counted, nor leaked
+        return;
+    }
+    counter_fds = fds;
+    counter_fds[counter_fd_count++] = fd;
+}
+
+static int open_counter(uint64_t config, int group)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // this thread only, on any CPU
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void open_thread_counters(void)
+{
+    thread_generation = profile_generation;
+    thread_leader = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    int member = thread_leader >= 0 ? open_counter(PERF_COUNT_HW_CACHE_MISSES, thread_leader) : -1;
+
+    pthread_mutex_lock(&profile_mutex);
+    if (thread_leader >= 0)
+        keep_fd(thread_leader);
+    if (member >= 0)
+        keep_fd(member);
+    if (member < 0)
+    {
+        if (!counters_failed)
+            fprintf(stderr, "Hardware counters unavailable (perf_event_open), profiling without them\n");
+        counters_failed = 1;
+        thread_leader = -1;
+    }
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+static int read_counters(uint64_t *counters)
+{
+    if (thread_generation != profile_generation)
+        open_thread_counters();
+    if (thread_leader < 0)
+        return 1;
+
+    struct
+    {
+        uint64_t count;
+        uint64_t values[2];
+    } group;
+    if (read(thread_leader, &group, sizeof(group)) != (ssize_t)sizeof(group) || group.count != 2)
+        return 1;
+    counters[0] = group.values[0];
+    counters[1] = group.values[1];
+    return 0;
+}
+#else
+static int read_counters(uint64_t *counters)
+{
+    counters[0] = counters[1] = 0;
+    if (!counters_failed)
+        fprintf(stderr, "Hardware counters are only available on Linux, profiling without them\n");
+    counters_failed = 1;
+    return 1;
+}
+#endif
+
+int nnProfileStart(const nnProfileConfig *config)
+{
+    nnProfileStop();
+    if (config->json_path != NULL)
+    {
+        json_file = fopen(config->json_path, "w");
+        if (json_file == NULL)
+        {
+            fprintf(stderr, "Unable to create the profile %s\n", config->json_path);
+            return 1;
+        }
+        fprintf(json_file, "[");
+        json_records = 0;
+    }
+    if (config->csv_path != NULL)
+    {
+        csv_file = fopen(config->csv_path, "w");
+        if (csv_file == NULL)
+        {
+            fprintf(stderr, "Unable to create the profile %s\n", config->csv_path);
+            nnProfileStop();
+            return 1;
+        }
+        fprintf(csv_file, "run,epoch,samples,seconds,samples_per_second,gflops_per_second,layer,phase,calls,layer_seconds,"
+                          "gflop,gbytes,layer_gflops_per_second,layer_gbytes_per_second,cycles,cache_misses\n");
+    }
+
+    memset(entries, 0, sizeof(entries));
+    counters_failed = 0;
+    profile_counters = config->hardware_counters;
+    profile_generation++;
+    profile_active = 1;
+    return 0;
+}
+
+void nnProfileStop(void)
+{
+    profile_active = 0;
+    if (json_file != NULL)
+    {
+        fprintf(json_file, "\n]\n");
+        fclose(json_file);
+        json_file = NULL;
+    }
+    if (csv_file != NULL)
+    {
+        fclose(csv_file);
+        csv_file = NULL;
+    }
+
+    // the threads that opened them may be gone, a new profile opens new ones
+    for (int i = 0; i < counter_fd_count; i++)
+        close(counter_fds[i]);
+    free(counter_fds);
+    counter_fds = NULL;
+    counter_fd_count = 0;
+}
+
+int nnProfileActive(void)
+{
+    return profile_active;
+}
+
+void nnProfileBegin(nnProfileMark *mark)
+{
+    mark->active = profile_active;
+    if (!mark->active)
+    {
+        return;
+    }
+
+    if (profile_counters && read_counters(mark->counters) != 0)
+        mark->counters[0] = mark->counters[1] = 0;
+    mark->start = nnNowSeconds();
+}
+
+static void accumulate(const nnProfileMark *mark, int l, nnProfilePhase phase, double flops, double bytes)
+{
+    double seconds = nnNowSeconds() - mark->start;
+    uint64_t counters[2] = {0, 0};
+    int counted = profile_counters && read_counters(counters) == 0;
+    if (l < 0 || l >= MAX_LAYERS)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&profile_mutex);
+    nnProfileEntry *entry = &entries[l][phase];
+    entry->calls++;
+    entry->seconds += seconds;
+    entry->flops += flops;
+    entry->bytes += bytes;
+    if (counted)
+    {
+        entry->cycles += counters[0] - mark->counters[0];
+        entry->cache_misses += counters[1] - mark->counters[1];
+    }
+    pthread_mutex_unlock(&profile_mutex);
+}
+
+// Work models: 2 FLOPs per weight and sample for every product, the bias and activation once per output;
+// bytes are the weights, gradients and activations read or written once (what a cache-less pass moves).
+// Sparse-input layers count the dense work, pruned (CSR) layers only their kept weights.
+void nnProfileLayerWork(const nnLayer *layer, int l, nnProfilePhase phase, int batch, size_t weight_size, double *work_flops,
+                        double *work_bytes)
+{
+    double n = layer->neuron_count;
+    double k = layer->input_count;
+    double b = batch;
+    double element = sizeof(nnReal);
+    double flops, bytes;
+    if (phase == NN_PROFILE_FORWARD)
+    {
+        double weights = n * k;
+        double weight_bytes = weights * (double)weight_size;
+        if (layer->csr != NULL)
+        {
+            weights = layer->csr->nnz;
+            weight_bytes = weights * (element + sizeof(int32_t)) + (n + 1) * sizeof(int32_t);
+        }
+        flops = 2 * b * weights + 2 * b * n;
+        bytes = weight_bytes + n * element + b * (k + n) * element;
+    }
+    else
+    {
+        // local gradient, weight and bias gradients, then the gradient of the previous layer except for the first one
+        double weights = n * k;
+        flops = 2 * b * n + 2 * b * weights + b * n;
+        bytes = 2 * (weights + n) * element + b * (k + n) * element;
+        if (l > 0)
+        {
+            flops += 2 * b * weights;
+            bytes += weights * element + b * k * element;
+        }
+    }
+    *work_flops = flops;
+    *work_bytes = bytes;
+}
+
+void nnProfileUpdateWork(size_t count, int arrays, int sources, double *work_flops, double *work_bytes)
+{
+    // SGD is one multiply-add per parameter, momentum two, Adam about eleven operations (square root and division included)
+    static const double update_flops[3] = {2, 4, 11};
+    double c = (double)count;
+    *work_flops = c * (update_flops[arrays < 2 ? arrays : 2] + (sources - 1));
+    *work_bytes = c * sizeof(nnReal) * (2 + 1 + 2 * arrays + (sources - 1));
+}
+
+void nnProfileLayerEnd(const nnProfileMark *mark, int l, const nnLayer *layer, nnProfilePhase phase, int batch, size_t weight_size)
+{
+    if (!mark->active)
+    {
+        return;
+    }
+
+    double flops, bytes;
+    nnProfileLayerWork(layer, l, phase, batch, weight_size, &flops, &bytes);
+    accumulate(mark, l, phase, flops, bytes);
+}
+
+void nnProfileUpdateEnd(const nnProfileMark *mark, int l, size_t count, int arrays, int sources)
+{
+    if (!mark->active)
+    {
+        return;
+    }
+
+    double flops, bytes;
+    nnProfileUpdateWork(count, arrays, sources, &flops, &bytes);
+    accumulate(mark, l, NN_PROFILE_UPDATE, flops, bytes);
+}
+
+static void print_counter(FILE *file, uint64_t value, const char *none)
+{
+    if (profile_counters && !counters_failed)
+        fprintf(file, "%llu", (unsigned long long)value);
+    else
+        fprintf(file, "%s", none);
+}
+
+void nnProfileReport(const char *run, int epoch, long samples, double seconds)
+{
+    if (!profile_active)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&profile_mutex);
+    double total_flops = 0.0;
+    for (int l = 0; l < MAX_LAYERS; l++)
+        for (int p = 0; p < NN_PROFILE_PHASES; p++)
+            total_flops += entries[l][p].flops;
+    double rate = seconds > 0 ? (double)samples / seconds : 0.0;
+    double gflops = seconds > 0 ? total_flops / seconds * 1e-9 : 0.0;
+
+    if (json_file != NULL)
+    {
+        fprintf(json_file, "%s\n  {\"run\": \"%s\", \"epoch\": %d, \"samples\": %ld, \"seconds\": %.6f, \"samples_per_second\": %.1f, "
+                           "\"gflops_per_second\": %.3f, \"layers\": [",
+                json_records++ > 0 ? "," : "", run, epoch, samples, seconds, rate, gflops);
+        int first = 1;
+        for (int l = 0; l < MAX_LAYERS; l++)
+        {
+            for (int p = 0; p < NN_PROFILE_PHASES; p++)
+            {
+                const nnProfileEntry *e = &entries[l][p];
+                if (e->calls == 0)
+                    continue;
+                fprintf(json_file, "%s\n    {\"layer\": %d, \"phase\": \"%s\", \"calls\": %ld, \"seconds\": %.6f, \"gflop\": %.6f, "
+                                   "\"gbytes\": %.6f, \"gflops_per_second\": %.3f, \"gbytes_per_second\": %.3f, \"cycles\": ",
+                        first ? "" : ",", l, phase_names[p], e->calls, e->seconds, e->flops * 1e-9, e->bytes * 1e-9,
+                        e->seconds > 0 ? e->flops / e->seconds * 1e-9 : 0.0, e->seconds > 0 ? e->bytes / e->seconds * 1e-9 : 0.0);
+                print_counter(json_file, e->cycles, "null");
+                fprintf(json_file, ", \"cache_misses\": ");
+                print_counter(json_file, e->cache_misses, "null");
+                fprintf(json_file, "}");
+                first = 0;
+            }
+        }
+        fprintf(json_file, "\n  ]}");
+        fflush(json_file);
+    }
+
+    if (csv_file != NULL)
+    {
+        for (int l = 0; l < MAX_LAYERS; l++)
+        {
+            for (int p = 0; p < NN_PROFILE_PHASES; p++)
+            {
+                const nnProfileEntry *e = &entries[l][p];
+                if (e->calls == 0)
+                    continue;
+                fprintf(csv_file, "%s,%d,%ld,%.6f,%.1f,%.3f,%d,%s,%ld,%.6f,%.6f,%.6f,%.3f,%.3f,", run, epoch, samples, seconds, rate, gflops,
+                        l, phase_names[p], e->calls, e->seconds, e->flops * 1e-9, e->bytes * 1e-9,
+                        e->seconds > 0 ? e->flops / e->seconds * 1e-9 : 0.0, e->seconds > 0 ? e->bytes / e->seconds * 1e-9 : 0.0);
+                print_counter(csv_file, e->cycles, "");
+                fprintf(csv_file, ",");
+                print_counter(csv_file, e->cache_misses, "");
+                fprintf(csv_file, "\n");
+            }
+        }
+        fflush(csv_file);
+    }
+
+    // the next record starts from zero
+    memset(entries, 0, sizeof(entries));
+    pthread_mutex_unlock(&profile_mutex);
+}
@@ -0,0 +1,57 @@
+// include guard
+#ifndef NNPROFILE_H
+#define NNPROFILE_H
+
+#include "nnNetwork.h"
+#include <stdint.h>
+
+// Opt-in instrumentation of training and inference. While a profile runs, every layer accumulates
+// the wall time (monotonic clock, summed over the threads), an estimate of the FLOPs and bytes moved
+// and, optionally, the cycles and cache misses of the calling thread (perf_event_open, Linux), for
+// the forward, backward and update phases separately. nnProfileReport appends one record with
+// everything accumulated since the previous one to a JSON and/or CSV file: training writes one per
+// epoch. When no profile runs, an instrumented region costs a function call and a test.
+typedef enum nnProfilePhase
+{
+    NN_PROFILE_FORWARD,
+    NN_PROFILE_BACKWARD,
+    NN_PROFILE_UPDATE,
+} nnProfilePhase;
+
+#define NN_PROFILE_PHASES 3
+
+typedef struct nnProfileConfig
+{
+    const char *json_path; // JSON array with one object per record, NULL for none
+    const char *csv_path;  // one row per record, layer and phase, NULL for none
+    int hardware_counters; // cycles and cache misses, left out (null) when the system refuses them
+} nnProfileConfig;
+
+// start of an instrumented region, on the stack of the thread running it
+typedef struct nnProfileMark
+{
+    int active;
+    double start;
+    uint64_t counters[2]; // cycles, cache misses
+} nnProfileMark;
+
+int nnProfileStart(const nnProfileConfig *config);
+void nnProfileStop(void); // closes the reports
+int nnProfileActive(void);
+
+void nnProfileBegin(nnProfileMark *mark);
+// end of a forward or backward pass of layer l over 'batch' samples, weights of weight_size bytes
+// (sizeof(nnReal), or 1 for the int8 engine); the first layer propagates no gradient
+void nnProfileLayerEnd(const nnProfileMark *mark, int l, const nnLayer *layer, nnProfilePhase phase, int batch, size_t weight_size);
+// end of the update of 'count' parameters of layer l by an optimizer with 'arrays' state arrays,
+// after summing the gradients of 'sources' threads
+void nnProfileUpdateEnd(const nnProfileMark *mark, int l, size_t count, int arrays, int sources);
+
+// the work estimates used by the two functions above (also for benchmarks)
+void nnProfileLayerWork(const nnLayer *layer, int l, nnProfilePhase phase, int batch, size_t weight_size, double *flops, double *bytes);
+void nnProfileUpdateWork(size_t count, int arrays, int sources, double *flops, double *bytes);
+
+// 'run' names the record ("train", "predict"...), 'seconds' is its wall time
+void nnProfileReport(const char *run, int epoch, long samples, double seconds);
+
+#endif // NNPROFILE_H
@@ -0,0 +1,290 @@
+#include "nnPrune.h"
+#include "nnQuant.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t align_bytes(size_t size)
+{
+    return (size + NN_ALIGNMENT - 1) / NN_ALIGNMENT * NN_ALIGNMENT;
+}
+
+size_t nnCsrBlockBytes(int neuron_count, int nnz, size_t element_size)
+{
+    return align_bytes(((size_t)neuron_count + 1) * sizeof(int32_t)) + align_bytes((size_t)nnz * sizeof(int32_t)) +
+           align_bytes((size_t)nnz * element_size);
+}
+
+// points the arrays of 'csr' into 'block' (in-memory layout)
+static void set_csr_arrays(nnCsrLayer *csr, uint8_t *block, int neuron_count, int nnz)
+{
+    csr->nnz = nnz;
+    csr->row_start = (int32_t *)block;
+    csr->columns = (int32_t *)(block + align_bytes(((size_t)neuron_count + 1) * sizeof(int32_t)));
+    csr->values = (nnReal *)((uint8_t *)csr->columns + align_bytes((size_t)nnz * sizeof(int32_t)));
+}
+
+static nnCsrLayer *create_csr_layer(const nnLayer *layer, int nnz)
+{
+    nnCsrLayer *csr = (nnCsrLayer *)malloc(sizeof(nnCsrLayer));
+    if (csr == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnCsrLayer\n");
+        return NULL;
+    }
+    uint8_t *block = (uint8_t *)nnAlignedAlloc(nnCsrBlockBytes(layer->neuron_count, nnz, sizeof(nnReal)));
+    if (block == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for a %dx%d nnCsrLayer\n", layer->neuron_count, layer->input_count);
+        free(csr);
+        return NULL;
+    }
+    set_csr_arrays(csr, block, layer->neuron_count, nnz);
+    csr->mapped = 0;
+    return csr;
+}
+
+void nnFreeCsrLayer(nnCsrLayer *csr)
+{
+    if (!csr)
+    {
+        return;
+    }
+
+    if (!csr->mapped)
+        nnAlignedFree(csr->row_start);
+    free(csr);
+}
+
+static int compare_reals(const void *a, const void *b)
+{
+    nnReal x = *(const nnReal *)a;
+    nnReal y = *(const nnReal *)b;
+    return (x > y) - (x < y);
+}
+
+// zeroes the 'sparsity' fraction of smallest weights, ties at the threshold are broken in row order
+static int prune_layer(nnLayer *layer, double sparsity)
+{
+    size_t count = (size_t)layer->neuron_count * layer->input_count;
+    size_t target = (size_t)(sparsity * (double)count);
+    nnReal *magnitudes = (nnReal *)malloc(count * sizeof(nnReal));
+    uint8_t *mask = (uint8_t *)nnAlignedAlloc(nnLayerParamCount(layer));
+    if (magnitudes == NULL || mask == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the pruning of a %dx%d nnLayer\n", layer->neuron_count, layer->input_count);
+        free(magnitudes);
+        nnAlignedFree(mask);
+        return 1;
+    }
+
+    size_t k = 0;
+    for (int i = 0; i < layer->neuron_count; i++)
+        for (int j = 0; j < layer->input_count; j++)
+            magnitudes[k++] = (nnReal)fabs((double)NN_WEIGHT(layer, i, j));
+    qsort(magnitudes, count, sizeof(nnReal), compare_reals);
+    nnReal threshold = target > 0 ? magnitudes[target - 1] : (nnReal)-1;
+    size_t below = 0;
+    for (size_t n = 0; n < target && magnitudes[n] < threshold; n++)
+        below++;
+    free(magnitudes);
+
+    // the mask has the layout of the parameter block: 1 for the kept weights and the bias, 0 elsewhere
+    size_t ties = target - below;
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        for (int j = 0; j < layer->input_count; j++)
+        {
+            nnReal *w = &NN_WEIGHT(layer, i, j);
+            nnReal magnitude = (nnReal)fabs((double)*w);
+            int pruned = magnitude < threshold || (magnitude == threshold && ties > 0);
+            if (pruned && magnitude == threshold)
+                ties--;
+            if (pruned)
+                *w = 0;
+            mask[w - layer->weights] = !pruned;
+        }
+    }
+    memset(mask + (layer->bias - layer->weights), 1, layer->neuron_count);
+
+    nnAlignedFree(layer->prune_mask);
+    layer->prune_mask = mask;
+    return 0;
+}
+
+int nnPruneNetwork(nnNetwork *network, double sparsity)
+{
+    if (!(sparsity >= 0.0 && sparsity < 1.0))
+    {
+        fprintf(stderr, "Invalid sparsity %f, expected a value in [0, 1)\n", sparsity);
+        return 1;
+    }
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        if (!network->layers[l]->owns_params)
+        {
+            fprintf(stderr, "Cannot prune a mapped (read-only) network, load it with nnLoadNetwork\n");
+            return 1;
+        }
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "Cannot prune an int8-only network, it has no float weights\n");
+        return 1;
+    }
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnLayer *layer = network->layers[l];
+        if (prune_layer(layer, sparsity))
+        {
+            return 1;
+        }
+        // the weights changed
+        nnFreeCsrLayer(layer->csr);
+        layer->csr = NULL;
+    }
+    return 0;
+}
+
+// CSR copy of the weights kept by the mask of the layer
+static nnCsrLayer *compress_layer(const nnLayer *layer)
+{
+    const uint8_t *mask = layer->prune_mask;
+    int nnz = 0;
+    for (int i = 0; i < layer->neuron_count; i++)
+        for (int j = 0; j < layer->input_count; j++)
+            nnz += mask[&NN_WEIGHT(layer, i, j) - layer->weights];
+
+    nnCsrLayer *csr = create_csr_layer(layer, nnz);
+    if (csr == NULL)
+    {
+        return NULL;
+    }
+    int k = 0;
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        csr->row_start[i] = k;
+        for (int j = 0; j < layer->input_count; j++)
+        {
+            const nnReal *w = &NN_WEIGHT(layer, i, j);
+            if (mask[w - layer->weights])
+            {
+                csr->columns[k] = j;
+                csr->values[k++] = *w;
+            }
+        }
+    }
+    csr->row_start[layer->neuron_count] = k;
+    return csr;
+}
+
+int nnCompressNetwork(nnNetwork *network)
+{
+    int compressed = 0;
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnLayer *layer = network->layers[l];
+        if (layer->prune_mask == NULL)
+            continue;
+
+        nnCsrLayer *csr = compress_layer(layer);
+        if (csr == NULL)
+        {
+            return 1;
+        }
+        nnFreeCsrLayer(layer->csr);
+        layer->csr = csr;
+        compressed++;
+    }
+    if (compressed == 0)
+    {
+        fprintf(stderr, "No pruned layer to compress, call nnPruneNetwork first\n");
+        return 1;
+    }
+    return 0;
+}
+
+int nnIsCompressed(const nnNetwork *network)
+{
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        if (network->layers[l]->csr != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+void nnPrintPruneStats(const nnNetwork *network)
+{
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        const nnLayer *layer = network->layers[l];
+        size_t count = (size_t)layer->neuron_count * layer->input_count;
+        size_t dense = (size_t)nnLayerWeightRows(layer) * layer->weight_stride * sizeof(nnReal);
+        if (layer->csr != NULL)
+        {
+            printf("Layer %d: %d/%zu weights kept (%.1f%% sparse), CSR %.1f KB instead of %.1f KB\n", l, layer->csr->nnz, count,
+                   100.0 * (1.0 - (double)layer->csr->nnz / count), nnCsrBlockBytes(layer->neuron_count, layer->csr->nnz, sizeof(nnReal)) / 1024.0,
+                   dense / 1024.0);
+        }
+        else
+        {
+            printf("Layer %d: dense (%.1f KB)%s\n", l, dense / 1024.0, layer->prune_mask != NULL ? ", pruned but not compressed" : "");
+        }
+    }
+}
+
+int nnAttachCsrLayer(nnLayer *layer, void *block, int nnz, int copy)
+{
+    // the structure is checked before anything reads the arrays through it
+    nnCsrLayer view;
+    set_csr_arrays(&view, (uint8_t *)block, layer->neuron_count, nnz);
+    if (nnz < 0 || view.row_start[0] != 0 || view.row_start[layer->neuron_count] != nnz)
+    {
+        return 1;
+    }
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        int32_t begin = view.row_start[i];
+        int32_t end = view.row_start[i + 1];
+        if (end < begin || end > nnz)
+        {
+            return 1;
+        }
+        for (int32_t k = begin; k < end; k++)
+        {
+            if (view.columns[k] < 0 || view.columns[k] >= layer->input_count || (k > begin && view.columns[k] <= view.columns[k - 1]))
+            {
+                return 1;
+            }
+        }
+    }
+
+    nnCsrLayer *csr;
+    if (copy)
+    {
+        csr = create_csr_layer(layer, nnz);
+        if (csr == NULL)
+        {
+            return 1;
+        }
+        memcpy(csr->row_start, block, nnCsrBlockBytes(layer->neuron_count, nnz, sizeof(nnReal)));
+    }
+    else
+    {
+        csr = (nnCsrLayer *)malloc(sizeof(nnCsrLayer));
+        if (csr == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed for nnCsrLayer\n");
+            return 1;
+        }
+        *csr = view;
+        csr->mapped = 1;
+    }
+
+    nnFreeCsrLayer(layer->csr);
+    layer->csr = csr;
+    return 0;
+}
@@ -0,0 +1,38 @@
+// include guard
+#ifndef NNPRUNE_H
+#define NNPRUNE_H
+
+#include "nnNetwork.h"
+#include <stdint.h>
+
+// Magnitude pruning.
+// nnPruneNetwork zeroes the smallest weights (in absolute value) of every layer until 'sparsity' of them
+// are zero, and gives every layer a mask (nnLayer.prune_mask) that keeps them at zero while training
+// continues, so the network can be fine-tuned with the usual train functions.
+// nnCompressNetwork then gives every pruned layer a CSR copy of its weights, used by forward, predict and
+// the batched inference instead of the dense rows. Training drops the CSR copies (they would become stale):
+// compress again after fine-tuning. The v2 model file stores a compressed layer as its CSR block only.
+typedef struct nnCsrLayer
+{
+    int nnz;            // kept weights
+    int32_t *row_start; // neuron_count + 1 offsets: row i is [row_start[i], row_start[i + 1])
+    int32_t *columns;   // input of every kept weight, increasing within a row
+    nnReal *values;
+    int mapped; // the arrays point into a mapped model file and are not freed
+} nnCsrLayer;
+
+// sparsity in [0, 1): fraction of the weights of each layer set to zero (the bias is not pruned)
+int nnPruneNetwork(nnNetwork *network, double sparsity);
+int nnCompressNetwork(nnNetwork *network);
+int nnIsCompressed(const nnNetwork *network);
+void nnPrintPruneStats(const nnNetwork *network);
+void nnFreeCsrLayer(nnCsrLayer *csr);
+
+// The arrays of a CSR layer form one block: row starts, columns, then values, each array aligned to
+// NN_ALIGNMENT. The v2 model file stores that block with values of element_size bytes; nnAttachCsrLayer
+// checks a block in the in-memory layout and gives the layer a copy of it (copy != 0) or uses it in place
+// (copy == 0, the block must outlive the layer).
+size_t nnCsrBlockBytes(int neuron_count, int nnz, size_t element_size);
+int nnAttachCsrLayer(nnLayer *layer, void *block, int nnz, int copy);
+
+#endif // NNPRUNE_H
@@ -0,0 +1,523 @@
+#include "nnQuant.h"
+#include "nnKernels.h"
+#include "nnInference.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NN_HAVE_X86_KERNELS 1
+#endif
+
+// largest code of the quantized inputs (7 bits, see nnQuant.h) and of the weights
+#define NN_QUANT_INPUT_MAX 127
+#define NN_QUANT_WEIGHT_MAX 127
+
+// ---------------------------------------------------------------------------
+// int8 dot products: sum of x[j] * w[j] over n codes, n multiple of NN_ALIGNMENT.
+// The 4-way variant reuses each block of weights for four inputs.
+// ---------------------------------------------------------------------------
+
+typedef struct nnQuantKernel
+{
+    const char *name;
+    int32_t (*dot)(const uint8_t *x, const int8_t *w, int n);
+    void (*dot4)(const uint8_t *x0, const uint8_t *x1, const uint8_t *x2, const uint8_t *x3, const int8_t *w, int n, int32_t *out);
+} nnQuantKernel;
+
+static int32_t dot_scalar(const uint8_t *x, const int8_t *w, int n)
+{
+    int32_t sum = 0;
+    for (int j = 0; j < n; j++)
+        sum += (int32_t)x[j] * w[j];
+    return sum;
+}
+
+static void dot4_scalar(const uint8_t *x0, const uint8_t *x1, const uint8_t *x2, const uint8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    int32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    for (int j = 0; j < n; j++)
+    {
+        s0 += (int32_t)x0[j] * w[j];
+        s1 += (int32_t)x1[j] * w[j];
+        s2 += (int32_t)x2[j] * w[j];
+        s3 += (int32_t)x3[j] * w[j];
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+#ifdef NN_HAVE_X86_KERNELS
+
+// AVX2: vpmaddubsw (u8 x s8 -> pairs summed in int16) then vpmaddwd by 1 (pairs summed in int32)
+__attribute__((target("avx2"))) static inline __m256i madd_u8s8_avx2(__m256i x, __m256i w)
+{
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), _mm256_set1_epi16(1));
+}
+
+__attribute__((target("avx2"))) static inline int32_t hsum_epi32_avx2(__m256i v)
+{
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_hadd_epi32(s, s);
+    s = _mm_hadd_epi32(s, s);
+    return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2"))) static int32_t dot_avx2(const uint8_t *x, const int8_t *w, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    for (int j = 0; j < n; j += 32)
+    {
+        __m256i wv = _mm256_load_si256((const __m256i *)(w + j));
+        acc = _mm256_add_epi32(acc, madd_u8s8_avx2(_mm256_load_si256((const __m256i *)(x + j)), wv));
+    }
+    return hsum_epi32_avx2(acc);
+}
+
+__attribute__((target("avx2"))) static void dot4_avx2(const uint8_t *x0, const uint8_t *x1, const uint8_t *x2, const uint8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    __m256i a0 = _mm256_setzero_si256(), a1 = _mm256_setzero_si256();
+    __m256i a2 = _mm256_setzero_si256(), a3 = _mm256_setzero_si256();
+    for (int j = 0; j < n; j += 32)
+    {
+        __m256i wv = _mm256_load_si256((const __m256i *)(w + j));
+        a0 = _mm256_add_epi32(a0, madd_u8s8_avx2(_mm256_load_si256((const __m256i *)(x0 + j)), wv));
+        a1 = _mm256_add_epi32(a1, madd_u8s8_avx2(_mm256_load_si256((const __m256i *)(x1 + j)), wv));
+        a2 = _mm256_add_epi32(a2, madd_u8s8_avx2(_mm256_load_si256((const __m256i *)(x2 + j)), wv));
+        a3 = _mm256_add_epi32(a3, madd_u8s8_avx2(_mm256_load_si256((const __m256i *)(x3 + j)), wv));
+    }
+    out[0] = hsum_epi32_avx2(a0);
+    out[1] = hsum_epi32_avx2(a1);
+    out[2] = hsum_epi32_avx2(a2);
+    out[3] = hsum_epi32_avx2(a3);
+}
+
+// AVX-512 VNNI: vpdpbusd multiplies and accumulates the groups of four u8 x s8 products directly in int32
+#define NN_VNNI_TARGET __attribute__((target("avx512f,avx512bw,avx512vnni")))
+
+NN_VNNI_TARGET static int32_t dot_vnni(const uint8_t *x, const int8_t *w, int n)
+{
+    __m512i acc = _mm512_setzero_si512();
+    for (int j = 0; j < n; j += 64)
+    {
+        acc = _mm512_dpbusd_epi32(acc, _mm512_load_si512(x + j), _mm512_load_si512(w + j));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+NN_VNNI_TARGET static void dot4_vnni(const uint8_t *x0, const uint8_t *x1, const uint8_t *x2, const uint8_t *x3, const int8_t *w, int n, int32_t *out)
+{
+    __m512i a0 = _mm512_setzero_si512(), a1 = _mm512_setzero_si512();
+    __m512i a2 = _mm512_setzero_si512(), a3 = _mm512_setzero_si512();
+    for (int j = 0; j < n; j += 64)
+    {
+        __m512i wv = _mm512_load_si512(w + j);
+        a0 = _mm512_dpbusd_epi32(a0, _mm512_load_si512(x0 + j), wv);
+        a1 = _mm512_dpbusd_epi32(a1, _mm512_load_si512(x1 + j), wv);
+        a2 = _mm512_dpbusd_epi32(a2, _mm512_load_si512(x2 + j), wv);
+        a3 = _mm512_dpbusd_epi32(a3, _mm512_load_si512(x3 + j), wv);
+    }
+    out[0] = _mm512_reduce_add_epi32(a0);
+    out[1] = _mm512_reduce_add_epi32(a1);
+    out[2] = _mm512_reduce_add_epi32(a2);
+    out[3] = _mm512_reduce_add_epi32(a3);
+}
+
+#endif // NN_HAVE_X86_KERNELS
+
+static const nnQuantKernel quant_kernels[] = {
+    {"scalar", dot_scalar, dot4_scalar},
+#ifdef NN_HAVE_X86_KERNELS
+    {"avx2", dot_avx2, dot4_avx2},
+    {"avx512-vnni", dot_vnni, dot4_vnni},
+#endif
+};
+
+// follows the level of the float kernels (so NN_KERNEL caps this choice too), VNNI needs its own cpuid bit;
+// other architectures run the scalar kernel
+static const nnQuantKernel *select_kernel(void)
+{
+#ifdef NN_HAVE_X86_KERNELS
+    nnKernelLevel level = nnGetKernelLevel();
+    if (level == NN_KERNEL_AVX512 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni"))
+        return &quant_kernels[2];
+    if (level >= NN_KERNEL_AVX2)
+        return &quant_kernels[1];
+#endif
+    return &quant_kernels[0];
+}
+
+const char *nnQuantKernelName(void)
+{
+    return select_kernel()->name;
+}
+
+// ---------------------------------------------------------------------------
+// quantized layers
+// ---------------------------------------------------------------------------
+
+int nnQuantInputStride(const nnLayer *layer)
+{
+    return (layer->input_count + NN_ALIGNMENT - 1) / NN_ALIGNMENT * NN_ALIGNMENT;
+}
+
+// one aligned block: weights rows, then row sums and scales (like the weights and bias of nnLayer)
+static nnQuantLayer *create_quant_layer(const nnLayer *layer)
+{
+    nnQuantLayer *quant = (nnQuantLayer *)malloc(sizeof(nnQuantLayer));
+    if (quant == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnQuantLayer\n");
+        return NULL;
+    }
+
+    quant->input_stride = nnQuantInputStride(layer);
+    quant->weights = (int8_t *)nnAlignedAlloc(nnQuantLayerBytes(layer));
+    if (quant->weights == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for a %dx%d nnQuantLayer\n", layer->neuron_count, layer->input_count);
+        free(quant);
+        return NULL;
+    }
+    quant->row_sums = (int32_t *)(quant->weights + (size_t)layer->neuron_count * quant->input_stride);
+    quant->scales = (float *)(quant->row_sums + layer->neuron_count);
+    quant->input_scale = 1.0f;
+    quant->input_zero_point = 0;
+    quant->mapped = 0;
+    return quant;
+}
+
+size_t nnQuantLayerBytes(const nnLayer *layer)
+{
+    return (size_t)layer->neuron_count * (nnQuantInputStride(layer) + sizeof(int32_t) + sizeof(float));
+}
+
+void nnFreeQuantLayer(nnQuantLayer *quant)
+{
+    if (!quant)
+    {
+        return;
+    }
+
+    if (!quant->mapped)
+        nnAlignedFree(quant->weights);
+    free(quant);
+}
+
+static void compute_row_sums(const nnLayer *layer, nnQuantLayer *quant)
+{
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        const int8_t *row = quant->weights + (size_t)i * quant->input_stride;
+        int32_t sum = 0;
+        for (int j = 0; j < layer->input_count; j++)
+            sum += row[j];
+        quant->row_sums[i] = sum;
+    }
+}
+
+// symmetric per-row quantization of the float weights
+static void quantize_weights(const nnLayer *layer, nnQuantLayer *quant)
+{
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        int8_t *codes = quant->weights + (size_t)i * quant->input_stride;
+
+        // the int8 rows are always per neuron, whatever the layout of the float weights
+        double max_abs = 0.0;
+        for (int j = 0; j < layer->input_count; j++)
+        {
+            if (fabs((double)NN_WEIGHT(layer, i, j)) > max_abs)
+                max_abs = fabs((double)NN_WEIGHT(layer, i, j));
+        }
+        double scale = max_abs > 0.0 ? max_abs / NN_QUANT_WEIGHT_MAX : 1.0;
+
+        for (int j = 0; j < layer->input_count; j++)
+        {
+            codes[j] = (int8_t)lrint(NN_WEIGHT(layer, i, j) / scale);
+        }
+        quant->scales[i] = (float)scale;
+    }
+    compute_row_sums(layer, quant);
+}
+
+// asymmetric input range [min, max], widened to include 0.0 so that zero maps to an exact code
+static void set_input_range(nnQuantLayer *quant, double min, double max)
+{
+    if (min > 0.0)
+        min = 0.0;
+    if (max < 0.0)
+        max = 0.0;
+    if (max - min <= 0.0)
+    {
+        quant->input_scale = 1.0f;
+        quant->input_zero_point = 0;
+        return;
+    }
+
+    double scale = (max - min) / NN_QUANT_INPUT_MAX;
+    long zero_point = lrint(-min / scale);
+    if (zero_point > NN_QUANT_INPUT_MAX)
+        zero_point = NN_QUANT_INPUT_MAX;
+    quant->input_scale = (float)scale;
+    quant->input_zero_point = (int)zero_point;
+}
+
+// clamp first, then round half up with a truncating conversion: plain float ops that the compiler vectorizes
+static void quantize_input_row(const nnQuantLayer *quant, const nnReal *input, uint8_t *codes, int n)
+{
+    const float inverse = 1.0f / quant->input_scale;
+    const float zero_point = (float)quant->input_zero_point;
+    for (int j = 0; j < n; j++)
+    {
+        float code = (float)input[j] * inverse + zero_point;
+        code = code < 0.0f ? 0.0f : code;
+        code = code > NN_QUANT_INPUT_MAX ? NN_QUANT_INPUT_MAX : code;
+        codes[j] = (uint8_t)(int)(code + 0.5f);
+    }
+}
+
+void nnQuantLayerForwardBatch(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size, uint8_t *scratch)
+{
+    const nnQuantLayer *quant = layer->quant;
+    const nnQuantKernel *kernel = select_kernel();
+    const int input_stride = nnPaddedCount(layer->input_count);
+    const int output_stride = nnPaddedCount(layer->neuron_count);
+    const int code_stride = quant->input_stride;
+    const int32_t zero_point = quant->input_zero_point;
+
+    for (int b = 0; b < batch_size; b++)
+    {
+        quantize_input_row(quant, input + (size_t)b * input_stride, scratch + (size_t)b * code_stride, layer->input_count);
+    }
+
+    // real value of neuron i for sample b: (dot - zero_point * row_sum) * weight_scale * input_scale
+    int b = 0;
+    for (; b + 4 <= batch_size; b += 4)
+    {
+        const uint8_t *x = scratch + (size_t)b * code_stride;
+        for (int i = 0; i < layer->neuron_count; i++)
+        {
+            int32_t sums[4];
+            kernel->dot4(x, x + code_stride, x + 2 * code_stride, x + 3 * code_stride,
+                         quant->weights + (size_t)i * code_stride, code_stride, sums);
+            float scale = quant->scales[i] * quant->input_scale;
+            int32_t offset = zero_point * quant->row_sums[i];
+            for (int s = 0; s < 4; s++)
+            {
+                output[(size_t)(b + s) * output_stride + i] = (nnReal)((float)(sums[s] - offset) * scale);
+            }
+        }
+    }
+    for (; b < batch_size; b++)
+    {
+        const uint8_t *x = scratch + (size_t)b * code_stride;
+        for (int i = 0; i < layer->neuron_count; i++)
+        {
+            int32_t sum = kernel->dot(x, quant->weights + (size_t)i * code_stride, code_stride);
+            float scale = quant->scales[i] * quant->input_scale;
+            output[(size_t)b * output_stride + i] = (nnReal)((float)(sum - zero_point * quant->row_sums[i]) * scale);
+        }
+    }
+
+    for (b = 0; b < batch_size; b++)
+    {
+        nnBiasActivate(layer->activationFunction, output + (size_t)b * output_stride, layer->bias, layer->neuron_count);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// calibration
+// ---------------------------------------------------------------------------
+
+int nnQuantizeNetwork(nnNetwork *network, const nnReal *const *samples, int count)
+{
+    if (network == NULL || network->layer_count == 0 || samples == NULL || count <= 0)
+    {
+        fprintf(stderr, "Cannot quantize without a network and calibration samples\n");
+        return 1;
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "Cannot quantize an int8-only network again, it has no float weights\n");
+        return 1;
+    }
+
+    double min[MAX_LAYERS], max[MAX_LAYERS];
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        min[l] = INFINITY;
+        max[l] = -INFINITY;
+    }
+
+    // the float network runs over the calibration samples, the range of the input of every layer is recorded
+    nnInferenceContext *context = nnCreateBatchInferenceContext(network, nnDefaultBatchTile(network));
+    if (context == NULL)
+    {
+        return 1;
+    }
+    for (int first = 0; first < count; first += context->max_batch)
+    {
+        int tile = count - first < context->max_batch ? count - first : context->max_batch;
+        int input_stride = nnPaddedCount(network->layers[0]->input_count);
+        for (int b = 0; b < tile; b++)
+        {
+            memcpy(context->input + (size_t)b * input_stride, samples[first + b], network->layers[0]->input_count * sizeof(nnReal));
+        }
+
+        const nnReal *current_input = context->input;
+        for (int l = 0; l < network->layer_count; l++)
+        {
+            nnLayer *layer = network->layers[l];
+            int stride = nnPaddedCount(layer->input_count);
+            for (int b = 0; b < tile; b++)
+            {
+                const nnReal *row = current_input + (size_t)b * stride;
+                for (int j = 0; j < layer->input_count; j++)
+                {
+                    if (row[j] < min[l])
+                        min[l] = row[j];
+                    if (row[j] > max[l])
+                        max[l] = row[j];
+                }
+            }
+
+            nnReal *current_output = context->buffers[l % 2];
+            nnLayerForwardBatch(layer, current_input, current_output, tile);
+            current_input = current_output;
+        }
+    }
+    nnFreeInferenceContext(context);
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnLayer *layer = network->layers[l];
+        if (layer->quant == NULL || layer->quant->mapped)
+        {
+            nnFreeQuantLayer(layer->quant);
+            layer->quant = create_quant_layer(layer);
+            if (layer->quant == NULL)
+            {
+                return 1;
+            }
+        }
+        quantize_weights(layer, layer->quant);
+        set_input_range(layer->quant, min[l], max[l]);
+    }
+
+    printf("Network quantized to int8 (%d calibration samples, %s kernel)\n", count, nnQuantKernelName());
+    return 0;
+}
+
+int nnIsQuantized(const nnNetwork *network)
+{
+    if (network == NULL || network->layer_count == 0)
+        return 0;
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        if (network->layers[l]->quant == NULL)
+            return 0;
+    }
+    return 1;
+}
+
+int nnIsInt8Only(const nnNetwork *network)
+{
+    if (network == NULL)
+        return 0;
+
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        if (network->layers[l]->weights == NULL)
+            return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// model file: input scale, input zero point, the row scales, then the codes row by row (no padding)
+// ---------------------------------------------------------------------------
+
+int nnWriteQuantLayer(FILE *f, const nnLayer *layer)
+{
+    const nnQuantLayer *quant = layer->quant;
+    size_t written = fwrite(&quant->input_scale, sizeof(float), 1, f);
+    written += fwrite(&quant->input_zero_point, sizeof(int), 1, f);
+    written += fwrite(quant->scales, sizeof(float), layer->neuron_count, f);
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        written += fwrite(quant->weights + (size_t)i * quant->input_stride, sizeof(int8_t), layer->input_count, f);
+    }
+    return written == (size_t)2 + layer->neuron_count + (size_t)layer->neuron_count * layer->input_count ? 0 : 1;
+}
+
+int nnReadQuantLayer(FILE *f, nnLayer *layer)
+{
+    nnQuantLayer *quant = create_quant_layer(layer);
+    if (quant == NULL)
+    {
+        return 1;
+    }
+
+    size_t read = fread(&quant->input_scale, sizeof(float), 1, f);
+    read += fread(&quant->input_zero_point, sizeof(int), 1, f);
+    read += fread(quant->scales, sizeof(float), layer->neuron_count, f);
+    for (int i = 0; i < layer->neuron_count; i++)
+    {
+        read += fread(quant->weights + (size_t)i * quant->input_stride, sizeof(int8_t), layer->input_count, f);
+    }
+    if (read != (size_t)2 + layer->neuron_count + (size_t)layer->neuron_count * layer->input_count ||
+        quant->input_zero_point < 0 || quant->input_zero_point > NN_QUANT_INPUT_MAX)
+    {
+        nnFreeQuantLayer(quant);
+        return 1;
+    }
+
+    compute_row_sums(layer, quant);
+    nnFreeQuantLayer(layer->quant);
+    layer->quant = quant;
+    return 0;
+}
+
+int nnAttachQuantLayer(nnLayer *layer, void *block, float input_scale, int input_zero_point, int copy)
+{
+    if (input_zero_point < 0 || input_zero_point > NN_QUANT_INPUT_MAX || !(input_scale > 0.0f))
+    {
+        return 1;
+    }
+
+    nnQuantLayer *quant;
+    if (copy)
+    {
+        quant = create_quant_layer(layer);
+        if (quant == NULL)
+        {
+            return 1;
+        }
+        memcpy(quant->weights, block, nnQuantLayerBytes(layer));
+    }
+    else
+    {
+        quant = (nnQuantLayer *)malloc(sizeof(nnQuantLayer));
+        if (quant == NULL)
+        {
+            fprintf(stderr, "Memory allocation failed for nnQuantLayer\n");
+            return 1;
+        }
+        quant->input_stride = nnQuantInputStride(layer);
+        quant->weights = (int8_t *)block;
+        quant->row_sums = (int32_t *)(quant->weights + (size_t)layer->neuron_count * quant->input_stride);
+        quant->scales = (float *)(quant->row_sums + layer->neuron_count);
+        quant->mapped = 1;
+    }
+    quant->input_scale = input_scale;
+    quant->input_zero_point = input_zero_point;
+
+    nnFreeQuantLayer(layer->quant);
+    layer->quant = quant;
+    return 0;
+}
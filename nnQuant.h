@@ -0,0 +1,51 @@
+// include guard
+#ifndef NNQUANT_H
+#define NNQUANT_H
+
+#include "nnNetwork.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Post-training int8 quantization.
+// Weights: symmetric, one scale per row (neuron), codes in [-127, 127].
+// Inputs of each layer: asymmetric 7-bit unsigned codes [0, 127] with a range chosen by calibration.
+// 7 bits keep the u8 x s8 pair sums of vpmaddubsw below the int16 saturation, so the AVX2 and the
+// VNNI kernels return exactly the same int32 sums as the scalar one.
+// Bias and activation stay in nnReal, every layer outputs nnReal values like the float path.
+typedef struct nnQuantLayer
+{
+    int input_stride;     // bytes between two rows of weights, input_count padded to NN_ALIGNMENT
+    int8_t *weights;      // neuron_count rows of input_stride codes, the padding is 0
+    int32_t *row_sums;    // sum of the codes of each row, removes the input zero point from the dot products
+    float *scales;        // per row: weight = code * scale
+    float input_scale;    // input = (code - input_zero_point) * input_scale
+    int input_zero_point; // code of 0.0, inputs equal to zero are exact
+    int mapped;           // the arrays point into a mapped model file and are not freed
+} nnQuantLayer;
+
+// Quantizes every layer of the network. The float parameters are kept (training can continue and
+// predict still works), the activation ranges come from running 'count' calibration samples.
+int nnQuantizeNetwork(nnNetwork *network, const nnReal *const *samples, int count);
+int nnIsQuantized(const nnNetwork *network);
+// 1 for a network read from an int8-only model file (nnWriteModelInt8): its layers have the bias and the int8
+// block but no float weights, so the float passes (predict, plans, training, pruning) refuse it
+int nnIsInt8Only(const nnNetwork *network);
+void nnFreeQuantLayer(nnQuantLayer *quant);
+
+// int8 counterpart of nnLayerForwardBatch (same padded layouts), 'scratch' holds batch_size rows of
+// nnQuantInputStride(layer) bytes for the quantized inputs
+void nnQuantLayerForwardBatch(const nnLayer *layer, const nnReal *input, nnReal *output, int batch_size, uint8_t *scratch);
+int nnQuantInputStride(const nnLayer *layer);
+const char *nnQuantKernelName(void);
+
+// legacy model file section (see nnNetwork.c), the layer must already have its shape
+int nnWriteQuantLayer(FILE *f, const nnLayer *layer);
+int nnReadQuantLayer(FILE *f, nnLayer *layer);
+
+// The arrays of a quantized layer form one block: the weight rows, the row sums, then the scales.
+// The v2 model file (nnModelIO.c) stores that block as it is; nnAttachQuantLayer gives the layer a copy
+// of 'block' (copy != 0) or uses it in place (copy == 0, the block must outlive the layer).
+size_t nnQuantLayerBytes(const nnLayer *layer);
+int nnAttachQuantLayer(nnLayer *layer, void *block, float input_scale, int input_zero_point, int copy);
+
+#endif // NNQUANT_H
@@ -0,0 +1,715 @@
+#include "nnServer.h"
+#include "nnQuant.h"
+#include "nnPlan.h"
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define LISTEN_BACKLOG 64
+#define STATS_CAPACITY 16384 // bytes of the JSON answer to a stats request
+
+// a client connection, served by its own thread
+typedef struct nnServerConnection
+{
+    nnServer *server;
+    int fd;
+    int slot; // in server->connections
+} nnServerConnection;
+
+static int send_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    while (size > 0)
+    {
+        // MSG_NOSIGNAL: a client gone away is an error, not a SIGPIPE
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return -1;
+        p += sent;
+        size -= (size_t)sent;
+    }
+    return 0;
+}
+
+// 1 when the peer closed the connection before the first byte, -1 on an error or a truncated message
+static int recv_all(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    size_t received = 0;
+    while (received < size)
+    {
+        ssize_t n = recv(fd, p + received, size - received, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 && received == 0)
+            return 1;
+        if (n <= 0)
+            return -1;
+        received += (size_t)n;
+    }
+    return 0;
+}
+
+static int send_message(int fd, uint32_t type, uint32_t id, const void *payload, uint32_t length)
+{
+    nnServerHeader header = {NN_SERVER_MAGIC, type, id, length};
+    if (send_all(fd, &header, sizeof(header)) != 0)
+        return -1;
+    return length > 0 ? send_all(fd, payload, length) : 0;
+}
+
+static int send_error(int fd, uint32_t id, const char *message)
+{
+    return send_message(fd, NN_SERVER_ERROR, id, message, (uint32_t)strlen(message));
+}
+
+// answers an invalid or refused request, counted in the stats
+static int reject(nnServer *server, int fd, uint32_t id, const char *message)
+{
+    pthread_mutex_lock(&server->stats_mutex);
+    server->stats.errors++;
+    pthread_mutex_unlock(&server->stats_mutex);
+    return send_error(fd, id, message);
+}
+
+// latency histogram: bucket 0 below 1 us, then 4 buckets per doubling
+static int histogram_bucket(double seconds)
+{
+    double us = seconds * 1e6;
+    if (us < 1.0)
+    {
+        return 0;
+    }
+    int bucket = 1 + (int)(4.0 * log2(us));
+    return bucket < NN_SERVER_HISTOGRAM_BUCKETS ? bucket : NN_SERVER_HISTOGRAM_BUCKETS - 1;
+}
+
+static double bucket_upper_us(int bucket)
+{
+    return pow(2.0, bucket / 4.0);
+}
+
+// upper bound of the bucket holding the requested quantile
+static double histogram_quantile(const long *histogram, long total, double quantile)
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    long rank = (long)ceil(quantile * (double)total);
+    long seen = 0;
+    for (int b = 0; b < NN_SERVER_HISTOGRAM_BUCKETS; b++)
+    {
+        seen += histogram[b];
+        if (seen >= rank)
+            return bucket_upper_us(b);
+    }
+    return bucket_upper_us(NN_SERVER_HISTOGRAM_BUCKETS - 1);
+}
+
+static int append(char *text, size_t capacity, int length, const char *format, ...)
+{
+    if (length < 0 || (size_t)length >= capacity)
+    {
+        return length;
+    }
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(text + length, capacity - (size_t)length, format, args);
+    va_end(args);
+    return written < 0 ? -1 : length + written;
+}
+
+static int append_histogram(char *text, size_t capacity, int length, const char *name, const long *histogram, long total)
+{
+    length = append(text, capacity, length, "\"%s\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"buckets\": [", name,
+                    histogram_quantile(histogram, total, 0.50), histogram_quantile(histogram, total, 0.90),
+                    histogram_quantile(histogram, total, 0.99));
+    int first = 1;
+    for (int b = 0; b < NN_SERVER_HISTOGRAM_BUCKETS; b++)
+    {
+        if (histogram[b] == 0)
+            continue;
+        length = append(text, capacity, length, "%s[%.1f, %ld]", first ? "" : ", ", bucket_upper_us(b), histogram[b]);
+        first = 0;
+    }
+    return append(text, capacity, length, "]}");
+}
+
+// JSON answer to a stats request, latencies in microseconds (upper bounds of the histogram buckets)
+static int format_stats(nnServer *server, char *text, size_t capacity)
+{
+    pthread_mutex_lock(&server->stats_mutex);
+    nnServerStats *stats = &server->stats;
+    double now = nnNowSeconds();
+    double uptime = now - stats->start;
+    double window = now - stats->last_report;
+    long recent = stats->requests - stats->last_requests;
+    stats->last_report = now;
+    stats->last_requests = stats->requests;
+
+    int length = append(text, capacity, 0,
+                        "{\"uptime_seconds\": %.3f, \"requests\": %ld, \"batches\": %ld, \"errors\": %ld, "
+                        "\"requests_per_second\": %.1f, \"recent_requests_per_second\": %.1f, \"mean_batch\": %.2f, "
+                        "\"max_batch\": %d, \"max_latency_us\": %d, \"workers\": %d, \"latency_us\": {",
+                        uptime, stats->requests, stats->batches, stats->errors, uptime > 0 ? stats->requests / uptime : 0.0,
+                        window > 0 ? recent / window : 0.0, stats->batches > 0 ? (double)stats->requests / stats->batches : 0.0,
+                        server->config.max_batch, server->config.max_latency_us, server->config.workers);
+    length = append_histogram(text, capacity, length, "total", stats->latency, stats->requests);
+    length = append(text, capacity, length, ", ");
+    length = append_histogram(text, capacity, length, "queued", stats->queued, stats->requests);
+    length = append(text, capacity, length, "}, \"batch_sizes\": [");
+    int first = 1;
+    for (int size = 1; size <= server->config.max_batch; size++)
+    {
+        if (stats->batch_sizes[size] == 0)
+            continue;
+        length = append(text, capacity, length, "%s[%d, %ld]", first ? "" : ", ", size, stats->batch_sizes[size]);
+        first = 0;
+    }
+    length = append(text, capacity, length, "]}");
+    pthread_mutex_unlock(&server->stats_mutex);
+
+    if (length < 0 || (size_t)length >= capacity)
+    {
+        return -1;
+    }
+    return length;
+}
+
+nnServerConfig nnDefaultServerConfig(void)
+{
+    nnServerConfig config;
+    config.socket_path = "/tmp/simple_nn.sock";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    config.workers = cpus > 0 ? (int)cpus : 1;
+    config.max_batch = 64;
+    config.max_latency_us = 1000;
+    config.quantized = 0;
+    return config;
+}
+
+nnServer *nnCreateServer(const nnNetwork *network, const nnServerConfig *config)
+{
+    if (config->workers < 1 || config->max_batch < 1 || config->max_latency_us < 0)
+    {
+        fprintf(stderr, "Invalid server configuration: %d workers, batches of %d, %d us of latency\n", config->workers,
+                config->max_batch, config->max_latency_us);
+        return NULL;
+    }
+    if (config->quantized && !nnIsQuantized(network))
+    {
+        fprintf(stderr, "The int8 engine needs a quantized network\n");
+        return NULL;
+    }
+    if (!config->quantized && nnIsInt8Only(network))
+    {
+        fprintf(stderr, "The network only has int8 weights, serve it with the int8 engine\n");
+        return NULL;
+    }
+    if (strlen(config->socket_path) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", config->socket_path);
+        return NULL;
+    }
+
+    nnServer *server = (nnServer *)calloc(1, sizeof(nnServer));
+    if (server == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnServer\n");
+        return NULL;
+    }
+    server->stats.batch_sizes = (long *)calloc((size_t)config->max_batch + 1, sizeof(long));
+    server->workers = (pthread_t *)calloc((size_t)config->workers, sizeof(pthread_t));
+    if (server->stats.batch_sizes == NULL || server->workers == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for nnServer\n");
+        free(server->stats.batch_sizes);
+        free(server->workers);
+        free(server);
+        return NULL;
+    }
+    server->network = network;
+    server->config = *config;
+    server->input_count = network->layers[0]->input_count;
+    server->output_count = network->layers[network->layer_count - 1]->neuron_count;
+    server->listen_fd = -1;
+    for (int i = 0; i < NN_SERVER_MAX_CONNECTIONS; i++)
+        server->connections[i] = -1;
+
+    // the batch deadlines are taken on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&server->queued, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&server->closed, NULL);
+    pthread_mutex_init(&server->mutex, NULL);
+    pthread_mutex_init(&server->stats_mutex, NULL);
+    return server;
+}
+
+void nnFreeServer(nnServer *server)
+{
+    if (!server)
+    {
+        return;
+    }
+
+    pthread_mutex_destroy(&server->mutex);
+    pthread_mutex_destroy(&server->stats_mutex);
+    pthread_cond_destroy(&server->queued);
+    pthread_cond_destroy(&server->closed);
+    free(server->stats.batch_sizes);
+    free(server->workers);
+    free(server);
+}
+
+// runs one batch (through the plan of the worker, or its context for the int8 engine) and hands every
+// result back to its connection
+static void run_batch(nnServer *server, nnPlan *plan, nnInferenceContext *context, nnServerRequest **batch, const nnReal **rows,
+                      nnReal *outputs, int n)
+{
+    double start = nnNowSeconds();
+    for (int i = 0; i < n; i++)
+        rows[i] = batch[i]->input;
+    if (plan != NULL)
+    {
+        nnPlanPredictBatchRows(plan, rows, n, outputs);
+    }
+    else
+    {
+        predictQuantizedBatchRowsWithContext(server->network, context, rows, n, outputs);
+    }
+    double end = nnNowSeconds();
+
+    pthread_mutex_lock(&server->stats_mutex);
+    server->stats.requests += n;
+    server->stats.batches++;
+    server->stats.batch_sizes[n]++;
+    for (int i = 0; i < n; i++)
+    {
+        server->stats.latency[histogram_bucket(end - batch[i]->arrival)]++;
+        server->stats.queued[histogram_bucket(start - batch[i]->arrival)]++;
+    }
+    pthread_mutex_unlock(&server->stats_mutex);
+
+    for (int i = 0; i < n; i++)
+    {
+        nnServerRequest *request = batch[i];
+        memcpy(request->output, outputs + (size_t)i * server->output_count, (size_t)server->output_count * sizeof(nnReal));
+        pthread_mutex_lock(request->mutex);
+        request->done = 1;
+        pthread_cond_signal(request->finished);
+        pthread_mutex_unlock(request->mutex);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    nnServer *server = (nnServer *)arg;
+    int max_batch = server->config.max_batch;
+    int quantized = server->config.quantized;
+    nnPlan *plan = quantized ? NULL : nnCompilePlan(server->network, max_batch);
+    nnInferenceContext *context = quantized ? nnCreateBatchInferenceContext(server->network, max_batch) : NULL;
+    nnServerRequest **batch = (nnServerRequest **)malloc((size_t)max_batch * sizeof(nnServerRequest *));
+    const nnReal **rows = (const nnReal **)malloc((size_t)max_batch * sizeof(nnReal *));
+    nnReal *outputs = (nnReal *)malloc((size_t)max_batch * server->output_count * sizeof(nnReal));
+    if ((plan == NULL && context == NULL) || batch == NULL || rows == NULL || outputs == NULL)
+    {
+        // the other workers serve the queue
+        fprintf(stderr, "Memory allocation failed for a server worker\n");
+        nnFreePlan(plan);
+        nnFreeInferenceContext(context);
+        free(batch);
+        free(rows);
+        free(outputs);
+        return NULL;
+    }
+
+    double max_latency = server->config.max_latency_us * 1e-6;
+    pthread_mutex_lock(&server->mutex);
+    while (!server->stop_workers || server->queue_length > 0)
+    {
+        if (server->queue_length == 0)
+        {
+            pthread_cond_wait(&server->queued, &server->mutex);
+            continue;
+        }
+        // a partial batch waits for more requests until the deadline of its oldest one, unless no more can come:
+        // a connection sends its next request after the answer to the previous one
+        int can_arrive = server->connection_count - server->queue_length - server->in_flight;
+        if (server->queue_length < max_batch && can_arrive > 0 && !server->stop_workers)
+        {
+            double deadline = server->head->arrival + max_latency;
+            if (nnNowSeconds() < deadline)
+            {
+                struct timespec ts;
+                ts.tv_sec = (time_t)deadline;
+                ts.tv_nsec = (long)((deadline - (double)ts.tv_sec) * 1e9);
+                pthread_cond_timedwait(&server->queued, &server->mutex, &ts);
+                continue;
+            }
+        }
+
+        int n = 0;
+        while (n < max_batch && server->head != NULL)
+        {
+            batch[n++] = server->head;
+            server->head = server->head->next;
+        }
+        if (server->head == NULL)
+            server->tail = NULL;
+        server->queue_length -= n;
+        server->in_flight += n;
+        if (server->queue_length > 0)
+            pthread_cond_signal(&server->queued); // the rest goes to another worker
+        pthread_mutex_unlock(&server->mutex);
+
+        run_batch(server, plan, context, batch, rows, outputs, n);
+
+        pthread_mutex_lock(&server->mutex);
+        server->in_flight -= n;
+    }
+    pthread_mutex_unlock(&server->mutex);
+
+    nnFreePlan(plan);
+    nnFreeInferenceContext(context);
+    free(batch);
+    free(rows);
+    free(outputs);
+    return NULL;
+}
+
+// queues a request and waits for its result
+static void submit(nnServer *server, nnServerRequest *request)
+{
+    request->done = 0;
+    request->next = NULL;
+    request->arrival = nnNowSeconds();
+
+    pthread_mutex_lock(&server->mutex);
+    if (server->tail != NULL)
+    {
+        server->tail->next = request;
+    }
+    else
+    {
+        server->head = request;
+    }
+    server->tail = request;
+    server->queue_length++;
+    pthread_cond_signal(&server->queued);
+    pthread_mutex_unlock(&server->mutex);
+
+    pthread_mutex_lock(request->mutex);
+    while (!request->done)
+        pthread_cond_wait(request->finished, request->mutex);
+    pthread_mutex_unlock(request->mutex);
+}
+
+// answers the requests of one connection until it closes or sends something invalid
+static void serve_connection(nnServer *server, int fd)
+{
+    int input_count = server->input_count;
+    int output_count = server->output_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&finished, NULL);
+    nnServerRequest request;
+    request.mutex = &mutex;
+    request.finished = &finished;
+    request.input = (nnReal *)malloc((size_t)input_count * sizeof(nnReal));
+    request.output = (nnReal *)malloc((size_t)output_count * sizeof(nnReal));
+    float *values = (float *)malloc((size_t)(input_count > output_count ? input_count : output_count) * sizeof(float));
+    char *text = (char *)malloc(STATS_CAPACITY);
+    if (request.input == NULL || request.output == NULL || values == NULL || text == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for a server connection\n");
+        reject(server, fd, 0, "out of memory");
+        goto done;
+    }
+
+    for (;;)
+    {
+        nnServerHeader header;
+        if (recv_all(fd, &header, sizeof(header)) != 0)
+            break;
+        if (header.magic != NN_SERVER_MAGIC)
+        {
+            reject(server, fd, header.id, "bad magic");
+            break;
+        }
+
+        if (header.type == NN_SERVER_PREDICT)
+        {
+            if (header.length != (uint32_t)input_count * sizeof(float))
+            {
+                char message[96];
+                snprintf(message, sizeof(message), "expected %d input values, got %u bytes", input_count, header.length);
+                reject(server, fd, header.id, message);
+                break;
+            }
+            if (recv_all(fd, values, header.length) != 0)
+                break;
+            for (int i = 0; i < input_count; i++)
+                request.input[i] = (nnReal)values[i];
+
+            submit(server, &request);
+
+            for (int i = 0; i < output_count; i++)
+                values[i] = (float)request.output[i];
+            if (send_message(fd, NN_SERVER_PREDICT, header.id, values, (uint32_t)(output_count * sizeof(float))) != 0)
+                break;
+            continue;
+        }
+
+        if (header.length != 0)
+        {
+            reject(server, fd, header.id, "unexpected payload");
+            break;
+        }
+        if (header.type == NN_SERVER_STATS)
+        {
+            int length = format_stats(server, text, STATS_CAPACITY);
+            if (length < 0)
+            {
+                reject(server, fd, header.id, "stats too large");
+                break;
+            }
+            if (send_message(fd, NN_SERVER_STATS, header.id, text, (uint32_t)length) != 0)
+                break;
+        }
+        else if (header.type == NN_SERVER_INFO)
+        {
+            nnServerInfo info = {(uint32_t)input_count, (uint32_t)output_count, (uint32_t)server->config.max_batch,
+                                 (uint32_t)server->config.workers};
+            if (send_message(fd, NN_SERVER_INFO, header.id, &info, sizeof(info)) != 0)
+                break;
+        }
+        else
+        {
+            reject(server, fd, header.id, "unknown request type");
+            break;
+        }
+    }
+
+done:
+    free(request.input);
+    free(request.output);
+    free(values);
+    free(text);
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&finished);
+}
+
+static void *connection_main(void *arg)
+{
+    nnServerConnection *connection = (nnServerConnection *)arg;
+    nnServer *server = connection->server;
+    serve_connection(server, connection->fd);
+
+    pthread_mutex_lock(&server->mutex);
+    server->connections[connection->slot] = -1;
+    server->connection_count--;
+    pthread_cond_signal(&server->closed);
+    pthread_mutex_unlock(&server->mutex);
+    close(connection->fd);
+    free(connection);
+    return NULL;
+}
+
+// starts the thread of a new connection, or refuses it when every slot is taken
+static void accept_connection(nnServer *server, int fd)
+{
+    nnServerConnection *connection = (nnServerConnection *)malloc(sizeof(nnServerConnection));
+    if (connection == NULL)
+    {
+        close(fd);
+        return;
+    }
+    connection->server = server;
+    connection->fd = fd;
+    connection->slot = -1;
+
+    pthread_mutex_lock(&server->mutex);
+    for (int i = 0; i < NN_SERVER_MAX_CONNECTIONS && connection->slot < 0; i++)
+    {
+        if (server->connections[i] < 0)
+            connection->slot = i;
+    }
+    if (connection->slot >= 0)
+    {
+        server->connections[connection->slot] = fd;
+        server->connection_count++;
+    }
+    pthread_mutex_unlock(&server->mutex);
+    if (connection->slot < 0)
+    {
+        reject(server, fd, 0, "too many connections");
+        close(fd);
+        free(connection);
+        return;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int status = pthread_create(&thread, &attr, connection_main, connection);
+    pthread_attr_destroy(&attr);
+    if (status != 0)
+    {
+        fprintf(stderr, "Failed to start a connection thread\n");
+        pthread_mutex_lock(&server->mutex);
+        server->connections[connection->slot] = -1;
+        server->connection_count--;
+        pthread_mutex_unlock(&server->mutex);
+        close(fd);
+        free(connection);
+    }
+}
+
+int nnServerRun(nnServer *server)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, server->config.socket_path);
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->listen_fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    unlink(server->config.socket_path); // left behind by a previous run
+    if (bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server->listen_fd, LISTEN_BACKLOG) != 0)
+    {
+        fprintf(stderr, "Cannot listen on %s: %s\n", server->config.socket_path, strerror(errno));
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return 1;
+    }
+
+    server->stats.start = nnNowSeconds();
+    server->stats.last_report = server->stats.start;
+    int started = 0;
+    for (; started < server->config.workers; started++)
+    {
+        if (pthread_create(&server->workers[started], NULL, worker_main, server) != 0)
+            break;
+    }
+    int status = 0;
+    if (started == 0)
+    {
+        fprintf(stderr, "Failed to start the server workers\n");
+        status = 1;
+        server->stopping = 1;
+    }
+
+    while (!server->stopping)
+    {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || server->stopping)
+                continue;
+            perror("accept");
+            status = 1;
+            break;
+        }
+        accept_connection(server, fd);
+    }
+
+    // stop reading from the clients, let the requests in flight finish, then stop the workers
+    pthread_mutex_lock(&server->mutex);
+    for (int i = 0; i < NN_SERVER_MAX_CONNECTIONS; i++)
+    {
+        if (server->connections[i] >= 0)
+            shutdown(server->connections[i], SHUT_RD);
+    }
+    while (server->connection_count > 0)
+        pthread_cond_wait(&server->closed, &server->mutex);
+    server->stop_workers = 1;
+    pthread_cond_broadcast(&server->queued);
+    pthread_mutex_unlock(&server->mutex);
+    for (int i = 0; i < started; i++)
+        pthread_join(server->workers[i], NULL);
+
+    close(server->listen_fd);
+    server->listen_fd = -1;
+    unlink(server->config.socket_path);
+    return status;
+}
+
+void nnServerStop(nnServer *server)
+{
+    server->stopping = 1;
+    // wakes up accept()
+    if (server->listen_fd >= 0)
+        shutdown(server->listen_fd, SHUT_RDWR);
+}
+
+int nnServerConnect(const char *socket_path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "Cannot connect to %s: %s\n", socket_path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int nnServerCall(int fd, uint32_t type, uint32_t id, const void *payload, uint32_t length, nnServerHeader *answer, void *answer_payload,
+                 uint32_t capacity)
+{
+    if (send_message(fd, type, id, payload, length) != 0 || recv_all(fd, answer, sizeof(*answer)) != 0)
+    {
+        fprintf(stderr, "Connection to the server lost\n");
+        return -1;
+    }
+    if (answer->magic != NN_SERVER_MAGIC || answer->length > capacity)
+    {
+        fprintf(stderr, "Invalid answer from the server\n");
+        return -1;
+    }
+    if (answer->length > 0 && recv_all(fd, answer_payload, answer->length) != 0)
+    {
+        fprintf(stderr, "Connection to the server lost\n");
+        return -1;
+    }
+    if (answer->type == NN_SERVER_ERROR)
+    {
+        fprintf(stderr, "Server error: %.*s\n", (int)answer->length, (const char *)answer_payload);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+// include guard
+#ifndef NNSERVER_H
+#define NNSERVER_H
+
+#include "nnInference.h"
+#include <pthread.h>
+#include <stdint.h>
+
+// Inference server on a Unix domain socket. Every connection sends requests and waits for each answer;
+// the requests of all the connections are queued and coalesced into micro-batches: a worker thread takes
+// up to max_batch requests at once, or fewer when the oldest one has waited max_latency_us or when every
+// connection already has its request queued or running (none can arrive), and runs them as one batch
+// through its own execution plan (nnPlan.h). The workers run different batches at the same time.
+//
+// Protocol (native endianness, the socket is local): every message is a header followed by 'length'
+// payload bytes. Requests and answers carry the same id.
+//   NN_SERVER_PREDICT  request: input_count float32 values, answer: output_count float32 values
+//   NN_SERVER_STATS    request: empty, answer: JSON text (throughput, latency and batch size histograms)
+//   NN_SERVER_INFO     request: empty, answer: nnServerInfo
+//   NN_SERVER_ERROR    answer only: error message text, the server closes the connection afterwards
+#define NN_SERVER_MAGIC 0x314e4e53 // "SNN1"
+#define NN_SERVER_MAX_CONNECTIONS 256
+#define NN_SERVER_HISTOGRAM_BUCKETS 100 // latencies in microseconds, 4 buckets per doubling (up to ~30 s)
+
+typedef enum nnServerMessage
+{
+    NN_SERVER_PREDICT = 1,
+    NN_SERVER_STATS = 2,
+    NN_SERVER_INFO = 3,
+    NN_SERVER_ERROR = 4,
+} nnServerMessage;
+
+typedef struct nnServerHeader
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t id;
+    uint32_t length;
+} nnServerHeader;
+
+typedef struct nnServerInfo
+{
+    uint32_t input_count;
+    uint32_t output_count;
+    uint32_t max_batch;
+    uint32_t workers;
+} nnServerInfo;
+
+typedef struct nnServerConfig
+{
+    const char *socket_path;
+    int workers;        // threads running the batches
+    int max_batch;      // requests per batch at most
+    int max_latency_us; // longest wait of a request for its batch to fill up
+    int quantized;      // run the int8 engine (the network must be quantized, an int8-only one needs it)
+} nnServerConfig;
+
+// a queued request, owned by its connection
+typedef struct nnServerRequest
+{
+    nnReal *input;
+    nnReal *output;
+    double arrival; // monotonic seconds
+    int done;
+    pthread_mutex_t *mutex; // of the connection, with 'finished' to wake it up
+    pthread_cond_t *finished;
+    struct nnServerRequest *next;
+} nnServerRequest;
+
+typedef struct nnServerStats
+{
+    long requests;
+    long batches;
+    long errors;
+    long latency[NN_SERVER_HISTOGRAM_BUCKETS]; // arrival to result ready
+    long queued[NN_SERVER_HISTOGRAM_BUCKETS];  // arrival to start of its batch
+    long *batch_sizes;                         // max_batch + 1 counters
+    double start;
+    double last_report; // time and request count of the previous stats request
+    long last_requests;
+} nnServerStats;
+
+typedef struct nnServer
+{
+    const nnNetwork *network;
+    nnServerConfig config;
+    int input_count;
+    int output_count;
+    int listen_fd;
+    volatile int stopping;
+
+    pthread_mutex_t mutex; // queue, connections and the stop of the workers
+    pthread_cond_t queued; // a request arrived (monotonic clock, for the deadlines)
+    pthread_cond_t closed; // a connection ended
+    nnServerRequest *head;
+    nnServerRequest *tail;
+    int queue_length;
+    int in_flight; // requests taken by a worker and not answered yet
+    int stop_workers;
+    int connections[NN_SERVER_MAX_CONNECTIONS]; // descriptors of the open connections, -1 for a free slot
+    int connection_count;
+    pthread_t *workers;
+
+    pthread_mutex_t stats_mutex;
+    nnServerStats stats;
+} nnServer;
+
+nnServerConfig nnDefaultServerConfig(void);
+// the network is only read and must outlive the server
+nnServer *nnCreateServer(const nnNetwork *network, const nnServerConfig *config);
+// listens and serves until nnServerStop, then waits for the connections and the workers; 0 on a clean stop
+int nnServerRun(nnServer *server);
+// async-signal-safe: can be called from a signal handler
+void nnServerStop(nnServer *server);
+void nnFreeServer(nnServer *server);
+
+// client side
+int nnServerConnect(const char *socket_path);
+// sends a request and reads its answer (at most 'capacity' payload bytes); 0 on success
+int nnServerCall(int fd, uint32_t type, uint32_t id, const void *payload, uint32_t length, nnServerHeader *answer, void *answer_payload,
+                 uint32_t capacity);
+
+#endif // NNSERVER_H
@@ -0,0 +1,742 @@
+#include "nnTrain.h"
+#include "nnArena.h"
+#include "nnPrune.h"
+#include "nnProfile.h"
+#include "nnQuant.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+
+// Scratch memory of a training step, every matrix has batch_size rows padded with nnPaddedCount
+typedef struct nnTrainWorkspace
+{
+    int batch_size;
+    nnReal *activations[MAX_LAYERS + 1]; // [0] is the input batch, [l + 1] is the output of layer l
+    nnReal *delta;                       // gradients received by the layer being processed
+    nnReal *delta_prev;                  // gradients produced for the previous layer
+    nnReal *gradients[MAX_LAYERS];       // parameter gradients, same layout as the layer parameter block
+    nnReal *targets;                     // expected outputs of the batch
+} nnTrainWorkspace;
+
+// Where the samples come from: rows of nnReal, or a uint8 dataset normalized during batch assembly
+typedef struct nnTrainSource
+{
+    nnReal **target_input;
+    nnReal **target_output;
+    const nnDataset *dataset;
+} nnTrainSource;
+
+// State shared by the training threads
+typedef struct nnTrainShared
+{
+    nnNetwork *network;
+    nnTrainSource source;
+    nnPipeline *pipeline;         // background batch assembly (dataset training), NULL assembles on the training threads
+    const nnPipelineBatch *batch; // batch shared by the threads in sync mode
+    int failed;                   // the pipeline had no batch for a sync step, every thread stops after the epoch
+    int target_count;
+    const nnTrainConfig *config;
+    nnOptimizer *optimizer;
+    int batch_size;
+    int batches; // per epoch, the optimizer steps are numbered from the start of the training
+    int threads;
+    nnTrainWorkspace *workspaces; // one per thread
+    double *losses;               // loss of the current epoch, one per thread
+    pthread_barrier_t barrier;
+
+    // the threads wait for every other one to be started: the barrier counts all of them
+    pthread_mutex_t start_mutex;
+    pthread_cond_t start_cond;
+    int start_state; // 0 while starting, 1 to train, -1 when a thread could not be started
+
+    int first_epoch;              // epochs already done by the checkpoint the training resumed from
+    unsigned int seed;            // seed of the input pipeline, saved with the checkpoints
+    nnCheckpointer *checkpointer; // NULL without checkpoints
+    double last_checkpoint;       // time of the last snapshot
+} nnTrainShared;
+
+typedef struct nnTrainWorker
+{
+    nnTrainShared *shared;
+    int id;
+    pthread_t thread;
+} nnTrainWorker;
+
+nnTrainConfig nnDefaultTrainConfig(void)
+{
+    nnTrainConfig config;
+    config.learning_rate = 0.2;
+    config.optimizer = nnDefaultOptimizerConfig(NN_OPTIMIZER_SGD);
+    config.epochs = 100;
+    config.batch_size = 1;
+    config.threads = 1;
+    config.parallel_mode = NN_PARALLEL_SYNC;
+    config.loss = NN_LOSS_MSE;
+    config.shuffle = 0;
+    config.augment_shift = 0;
+    config.input_threads = 0;
+    config.checkpoint_path = NULL;
+    config.checkpoint_epochs = 0;
+    config.checkpoint_seconds = 0.0;
+    config.resume = 0;
+    return config;
+}
+
+// Carves the workspace of one thread out of the training arena (see nnArena.h for the measuring pass)
+static void carve_workspace(nnTrainWorkspace *ws, const nnNetwork *network, int batch_size, nnArena *arena)
+{
+    int layer_count = network->layer_count;
+    int max_width = 0;
+
+    memset(ws, 0, sizeof(*ws));
+    ws->batch_size = batch_size;
+
+    // activations first, in the order the forward pass walks them
+    for (int l = 0; l <= layer_count; l++)
+    {
+        // the width of activations[l] is the input of layer l (or the network output for the last one)
+        int width = l < layer_count ? network->layers[l]->input_count : network->layers[l - 1]->neuron_count;
+        int padded = nnPaddedCount(width);
+        if (padded > max_width)
+            max_width = padded;
+
+        ws->activations[l] = (nnReal *)nnArenaAlloc(arena, (size_t)batch_size * padded * sizeof(nnReal));
+    }
+    ws->targets = (nnReal *)nnArenaAlloc(arena, (size_t)batch_size * nnPaddedCount(network->layers[layer_count - 1]->neuron_count) * sizeof(nnReal));
+    ws->delta = (nnReal *)nnArenaAlloc(arena, (size_t)batch_size * max_width * sizeof(nnReal));
+    ws->delta_prev = (nnReal *)nnArenaAlloc(arena, (size_t)batch_size * max_width * sizeof(nnReal));
+    for (int l = 0; l < layer_count; l++)
+    {
+        ws->gradients[l] = (nnReal *)nnArenaAlloc(arena, nnLayerParamCount(network->layers[l]) * sizeof(nnReal));
+    }
+}
+
+// batch assembly: samples [first, first + count) as one contiguous row per sample in ws->activations[0] and ws->targets
+static void assemble_batch(const nnNetwork *network, nnTrainWorkspace *ws, const nnTrainSource *source, int first, int count)
+{
+    int input_count = network->layers[0]->input_count;
+    int output_count = network->layers[network->layer_count - 1]->neuron_count;
+    int in_stride = nnPaddedCount(input_count);
+    int out_stride = nnPaddedCount(output_count);
+
+    if (source->dataset != NULL)
+    {
+        nnDatasetGatherInputs(source->dataset, first, count, ws->activations[0], in_stride);
+        nnDatasetGatherTargets(source->dataset, first, count, ws->targets, out_stride);
+        return;
+    }
+    for (int b = 0; b < count; b++)
+    {
+        memcpy(ws->activations[0] + (size_t)b * in_stride, source->target_input[first + b], input_count * sizeof(nnReal));
+        memcpy(ws->targets + (size_t)b * out_stride, source->target_output[first + b], output_count * sizeof(nnReal));
+    }
+}
+
+// Loss of one sample and its gradient: with respect to the outputs for MSE, with respect to the inputs of the
+// output activation for cross-entropy (softmax or sigmoid), where the Jacobian of the activation cancels out.
+// For cross-entropy 'out' holds those inputs z, the logits: -log y_t is taken as logsumexp(z) - z_t, which stays
+// exact when y_t underflows, and the binary one of a sigmoid as softplus(z) - t * z.
+static double output_loss(nnLoss loss, nnActivationFunction func, const nnReal *out, const nnReal *target, nnReal *grad, int n)
+{
+    double sum = 0.0;
+    if (loss == NN_LOSS_CROSS_ENTROPY && func == ACTIVATION_SOFTMAX)
+    {
+        // max-shifted like the softmax kernels: every exponent is <= 0 and the sum is >= 1
+        double max = out[0];
+        for (int j = 1; j < n; j++)
+            max = out[j] > max ? out[j] : max;
+        double exp_sum = 0.0;
+        for (int j = 0; j < n; j++)
+            exp_sum += exp(out[j] - max);
+        double log_sum = max + log(exp_sum);
+        for (int j = 0; j < n; j++)
+        {
+            grad[j] = (nnReal)(exp(out[j] - max) / exp_sum - target[j]);
+            if (target[j] != 0)
+                sum += target[j] * (log_sum - out[j]);
+        }
+        return sum;
+    }
+    if (loss == NN_LOSS_CROSS_ENTROPY)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            // softplus(z) = max(z, 0) + log(1 + exp(-|z|)), and the sigmoid from the same exponential
+            double z = out[j];
+            double e = exp(-fabs(z));
+            grad[j] = (nnReal)((z >= 0 ? 1.0 / (1.0 + e) : e / (1.0 + e)) - target[j]);
+            sum += fmax(z, 0.0) + log1p(e) - target[j] * z;
+        }
+        return sum;
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        nnReal error = out[j] - target[j];
+        sum += (double)error * error; // Accumulate for statistics (Loss = sum((y-t)^2))
+        grad[j] = 2.0 * error;
+    }
+    return sum;
+}
+
+// Runs forward and backward on 'count' samples (padded rows of 'inputs' and 'targets'), leaving the parameter
+// gradients (summed over the samples) in ws->gradients. The network is only read.
+// Returns the loss summed over the samples, in double whatever nnReal is.
+static double compute_gradients(const nnNetwork *network, nnTrainWorkspace *ws, const nnReal *inputs, const nnReal *targets, int count,
+                                nnLoss loss_function)
+{
+    int layer_count = network->layer_count;
+    nnLayer *const *layers = network->layers;
+    int output_count = layers[layer_count - 1]->neuron_count;
+    int out_stride = nnPaddedCount(output_count);
+    double loss = 0.0;
+
+    if (count <= 0)
+    {
+        for (int l = 0; l < layer_count; l++)
+            memset(ws->gradients[l], 0, nnLayerParamCount(layers[l]) * sizeof(nnReal));
+        return 0.0;
+    }
+
+    // Forward propagation, getting the prediction from the network (the logits of the last layer for cross-entropy,
+    // whose activation is folded into the loss)
+    nnProfileMark mark;
+    for (int l = 0; l < layer_count; l++)
+    {
+        nnProfileBegin(&mark);
+        if (l == layer_count - 1 && loss_function == NN_LOSS_CROSS_ENTROPY)
+            nnLayerForwardBatchLinear(layers[l], l == 0 ? inputs : ws->activations[l], ws->activations[l + 1], count);
+        else
+            nnLayerForwardBatch(layers[l], l == 0 ? inputs : ws->activations[l], ws->activations[l + 1], count);
+        nnProfileLayerEnd(&mark, l, layers[l], NN_PROFILE_FORWARD, count, sizeof(nnReal));
+    }
+
+    // Initial gradient from the derivative of the loss
+    const nnReal *final_output = ws->activations[layer_count];
+    nnActivationFunction output_function = layers[layer_count - 1]->activationFunction;
+    for (int b = 0; b < count; b++)
+    {
+        size_t offset = (size_t)b * out_stride;
+        loss += output_loss(loss_function, output_function, final_output + offset, targets + offset, ws->delta + offset, output_count);
+    }
+
+    // backward propagation through layers, the gradients are accumulated over the whole batch
+    for (int l = layer_count - 1; l >= 0; l--)
+    {
+        nnProfileBegin(&mark);
+        memset(ws->gradients[l], 0, nnLayerParamCount(layers[l]) * sizeof(nnReal));
+
+        // the first layer does not need to propagate anything
+        nnReal *input_grad = l > 0 ? ws->delta_prev : NULL;
+        const nnReal *layer_input = l == 0 ? inputs : ws->activations[l];
+        if (l == layer_count - 1 && loss_function == NN_LOSS_CROSS_ENTROPY)
+            nnLayerBackwardBatchDelta(layers[l], layer_input, ws->delta, input_grad, ws->gradients[l], count);
+        else
+            nnLayerBackwardBatch(layers[l], layer_input, ws->activations[l + 1], ws->delta, input_grad, ws->gradients[l], count);
+        nnProfileLayerEnd(&mark, l, layers[l], NN_PROFILE_BACKWARD, count, sizeof(nnReal));
+
+        // swap buffers for the next iteration (backward)
+        nnReal *temp = ws->delta;
+        ws->delta = ws->delta_prev;
+        ws->delta_prev = temp;
+    }
+
+    return loss;
+}
+
+static int min_int(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+// Synchronous data parallelism: every thread walks the same sequence of batches and takes its own
+// slice of each one. The gradients are then reduced in thread order (so the result does not depend
+// on the scheduling), every thread reducing and applying its own range of the parameters.
+static double run_sync_epoch(nnTrainShared *shared, int id, int epoch)
+{
+    nnNetwork *network = shared->network;
+    nnTrainWorkspace *ws = &shared->workspaces[id];
+    int threads = shared->threads;
+    int chunk = ws->batch_size;
+    int in_stride = nnPaddedCount(network->layers[0]->input_count);
+    int out_stride = nnPaddedCount(network->layers[network->layer_count - 1]->neuron_count);
+    double loss = 0.0;
+
+    for (int first = 0; first < shared->target_count; first += shared->batch_size)
+    {
+        int count = min_int(shared->batch_size, shared->target_count - first);
+        int my_first = first + id * chunk;
+        int my_count = min_int(chunk, first + count - my_first);
+        if (shared->pipeline != NULL)
+        {
+            // thread 0 takes the batch from the pipeline, every thread reads its own rows in place
+            if (id == 0)
+            {
+                shared->batch = nnPipelineAcquire(shared->pipeline, epoch);
+                if (shared->batch == NULL)
+                    shared->failed = 1;
+            }
+            pthread_barrier_wait(&shared->barrier);
+            const nnPipelineBatch *batch = shared->batch;
+            if (batch == NULL)
+                break; // seen by every thread after the barrier
+            size_t offset = (size_t)(my_first - first);
+            loss += compute_gradients(network, ws, batch->inputs + offset * in_stride, batch->targets + offset * out_stride, my_count,
+                                      shared->config->loss);
+        }
+        else
+        {
+            assemble_batch(network, ws, &shared->source, my_first, my_count);
+            loss += compute_gradients(network, ws, ws->activations[0], ws->targets, my_count, shared->config->loss);
+        }
+
+        pthread_barrier_wait(&shared->barrier);
+        if (shared->pipeline != NULL && id == 0)
+            nnPipelineRelease(shared->pipeline, shared->batch);
+
+        long step = (long)epoch * shared->batches + first / shared->batch_size + 1;
+        for (int l = 0; l < network->layer_count; l++)
+        {
+            nnProfileMark mark;
+            nnProfileBegin(&mark);
+            nnLayer *layer = network->layers[l];
+            size_t param_count = nnLayerParamCount(layer);
+            // ranges are multiples of NN_ALIGNMENT so that two threads never write the same cache line
+            size_t lanes = NN_ALIGNMENT / sizeof(nnReal);
+            size_t slice = ((param_count + threads - 1) / threads + lanes - 1) / lanes * lanes;
+            size_t begin = slice * id;
+            size_t end = begin + slice < param_count ? begin + slice : param_count;
+
+            nnReal *sum = ws->gradients[l];
+            for (int t = 0; t < threads; t++)
+            {
+                if (t == id)
+                    continue;
+                const nnReal *other = shared->workspaces[t].gradients[l];
+                for (size_t i = begin; i < end; i++)
+                    sum[i] += other[i];
+            }
+            nnOptimizerUpdate(shared->optimizer, layer, l, sum, shared->config->learning_rate, (nnReal)1 / count, step, begin, end);
+            nnProfileUpdateEnd(&mark, l, end > begin ? end - begin : 0, shared->optimizer->arrays, threads);
+        }
+
+        // nobody may start the next batch before every range is updated
+        pthread_barrier_wait(&shared->barrier);
+    }
+    return loss;
+}
+
+// updates the whole network with the gradients of a batch of 'count' samples
+static void apply_batch(nnTrainShared *shared, const nnTrainWorkspace *ws, int count, long step)
+{
+    nnNetwork *network = shared->network;
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnLayer *layer = network->layers[l];
+        nnProfileMark mark;
+        nnProfileBegin(&mark);
+        nnOptimizerUpdate(shared->optimizer, layer, l, ws->gradients[l], shared->config->learning_rate, (nnReal)1 / count, step, 0,
+                          nnLayerParamCount(layer));
+        nnProfileUpdateEnd(&mark, l, nnLayerParamCount(layer), shared->optimizer->arrays, 1);
+    }
+}
+
+// Hogwild: every thread trains on its own batches and updates the shared weights without any lock.
+// The races on the weights are accepted by design, the updates are sparse enough in practice.
+static double run_hogwild_epoch(nnTrainShared *shared, int id, int epoch)
+{
+    nnNetwork *network = shared->network;
+    nnTrainWorkspace *ws = &shared->workspaces[id];
+    int batch_size = shared->batch_size;
+    double loss = 0.0;
+    // the updates of the threads interleave, the step of the k-th batch of this thread assumes a round robin
+    long step = (long)epoch * shared->batches + id + 1;
+
+    // with a pipeline every thread takes the next ready batch, whichever it is
+    if (shared->pipeline != NULL)
+    {
+        const nnPipelineBatch *batch;
+        while ((batch = nnPipelineAcquire(shared->pipeline, epoch)) != NULL)
+        {
+            loss += compute_gradients(network, ws, batch->inputs, batch->targets, batch->count, shared->config->loss);
+            int count = batch->count;
+            nnPipelineRelease(shared->pipeline, batch);
+            apply_batch(shared, ws, count, step);
+            step += shared->threads;
+        }
+        return loss;
+    }
+
+    for (int first = id * batch_size; first < shared->target_count; first += shared->threads * batch_size)
+    {
+        int count = min_int(batch_size, shared->target_count - first);
+        assemble_batch(network, ws, &shared->source, first, count);
+        loss += compute_gradients(network, ws, ws->activations[0], ws->targets, count, shared->config->loss);
+        apply_batch(shared, ws, count, step);
+        step += shared->threads;
+    }
+    return loss;
+}
+
+static void print_epoch_stats(int epoch, int first_epoch, int epochs, double average_loss, double epoch_duration, double total_elapsed)
+{
+    // 4. Stima ETA (basata sulla media del tempo per epoca finora, in questa esecuzione)
+    double avg_time_per_epoch = total_elapsed / (epoch + 1 - first_epoch);
+    int remaining_epochs = epochs - (epoch + 1);
+    double eta_seconds = avg_time_per_epoch * remaining_epochs;
+
+    // Formattazione ETA in ore/min/sec per leggibilità
+    int eta_h = (int)eta_seconds / 3600;
+    int eta_m = ((int)eta_seconds % 3600) / 60;
+    int eta_s = (int)eta_seconds % 60;
+
+    // 5. Percentuale completamento
+    double progress = ((double)(epoch + 1) / epochs) * 100.0;
+
+    // Stampa (puoi cambiare la condizione % 1 per stampare meno frequentemente)
+    if ((epoch + 1) % 1 == 0 || epoch == 0)
+    {
+        printf("Epoch %d/%d [%.1f%%] | Loss: %.6f | Time: %.2fs | ETA: %02d:%02d:%02d\n",
+               epoch + 1,
+               epochs,
+               progress,
+               average_loss,
+               epoch_duration,
+               eta_h, eta_m, eta_s);
+    }
+}
+
+static int checkpoint_due(const nnTrainShared *shared, int epoch, double now)
+{
+    const nnTrainConfig *config = shared->config;
+    return epoch == config->epochs - 1 ||
+           (config->checkpoint_epochs > 0 && (epoch + 1) % config->checkpoint_epochs == 0) ||
+           (config->checkpoint_seconds > 0.0 && now - shared->last_checkpoint >= config->checkpoint_seconds);
+}
+
+// blocks until the start of every thread has been decided, returns 1 when the training goes ahead
+static int wait_start(nnTrainShared *shared)
+{
+    pthread_mutex_lock(&shared->start_mutex);
+    while (shared->start_state == 0)
+        pthread_cond_wait(&shared->start_cond, &shared->start_mutex);
+    int state = shared->start_state;
+    pthread_mutex_unlock(&shared->start_mutex);
+    return state > 0;
+}
+
+static void open_start(nnTrainShared *shared, int state)
+{
+    pthread_mutex_lock(&shared->start_mutex);
+    shared->start_state = state;
+    pthread_cond_broadcast(&shared->start_cond);
+    pthread_mutex_unlock(&shared->start_mutex);
+}
+
+// body of every training thread (thread 0 is the caller and also prints the statistics)
+static void *train_worker(void *arg)
+{
+    nnTrainWorker *worker = (nnTrainWorker *)arg;
+    nnTrainShared *shared = worker->shared;
+    int epochs = shared->config->epochs;
+    if (!wait_start(shared))
+        return NULL;
+
+    double total_start_time = nnNowSeconds();
+    for (int epoch = shared->first_epoch; epoch < epochs; epoch++)
+    {
+        double epoch_start_time = nnNowSeconds();
+
+        if (shared->config->parallel_mode == NN_PARALLEL_HOGWILD)
+            shared->losses[worker->id] = run_hogwild_epoch(shared, worker->id, epoch);
+        else
+            shared->losses[worker->id] = run_sync_epoch(shared, worker->id, epoch);
+
+        pthread_barrier_wait(&shared->barrier);
+        if (shared->failed)
+            break;
+        if (worker->id == 0)
+        {
+            // --- Calcoli Statistiche Epoca ---
+
+            // 1. Loss Media (summed in thread order)
+            double total_loss = 0.0;
+            for (int t = 0; t < shared->threads; t++)
+                total_loss += shared->losses[t];
+            double average_loss = total_loss / shared->target_count;
+
+            // 2. Tempo trascorso in questa epoca, 3. Tempo totale trascorso dall'inizio
+            double now = nnNowSeconds();
+            print_epoch_stats(epoch, shared->first_epoch, epochs, average_loss, now - epoch_start_time, now - total_start_time);
+            nnProfileReport("train", epoch + 1, shared->target_count, now - epoch_start_time);
+
+            // the other threads wait at the barrier, the weights are stable: copy them for the writer thread
+            if (shared->checkpointer != NULL && checkpoint_due(shared, epoch, now))
+            {
+                nnTrainState state = {epoch + 1, shared->seed, shared->config->learning_rate, shared->optimizer->arrays,
+                                      shared->optimizer->state, NULL};
+                nnCheckpointSnapshot(shared->checkpointer, shared->network, &state);
+                shared->last_checkpoint = now;
+            }
+        }
+        // the losses are overwritten by the next epoch
+        pthread_barrier_wait(&shared->barrier);
+    }
+    return NULL;
+}
+
+static int train_source(nnNetwork *network, const nnTrainSource *source, int target_count, const nnTrainConfig *config)
+{
+    int batch_size = config->batch_size > 0 ? config->batch_size : 1;
+    int threads = config->threads > 0 ? config->threads : 1;
+    if (network->layer_count == 0 || target_count <= 0)
+    {
+        fprintf(stderr, "Nothing to train: %d layers, %d samples\n", network->layer_count, target_count);
+        return 1;
+    }
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        if (!network->layers[l]->owns_params)
+        {
+            fprintf(stderr, "Cannot train a mapped (read-only) network, load it with nnLoadNetwork\n");
+            return 1;
+        }
+    }
+    if (nnIsInt8Only(network))
+    {
+        fprintf(stderr, "Cannot train an int8-only network, it has no float weights\n");
+        return 1;
+    }
+    nnActivationFunction output_function = network->layers[network->layer_count - 1]->activationFunction;
+    if (config->loss == NN_LOSS_CROSS_ENTROPY && output_function != ACTIVATION_SOFTMAX && output_function != ACTIVATION_SIGMOID)
+    {
+        fprintf(stderr, "The cross-entropy loss needs a softmax or sigmoid output layer\n");
+        return 1;
+    }
+    // the CSR copies of a pruned network would not follow the new weights (nnCompressNetwork again afterwards)
+    for (int l = 0; l < network->layer_count; l++)
+    {
+        nnFreeCsrLayer(network->layers[l]->csr);
+        network->layers[l]->csr = NULL;
+    }
+    if (batch_size > target_count)
+        batch_size = target_count;
+    nnOptimizer *optimizer = nnCreateOptimizer(network, &config->optimizer);
+    if (optimizer == NULL)
+    {
+        return 1;
+    }
+
+    // shuffling and augmentation are done by the input pipeline, for datasets only
+    int use_pipeline = source->dataset != NULL && (config->input_threads > 0 || config->shuffle || config->augment_shift > 0);
+
+    // a resumed run continues the interrupted one: same weights, next epoch, same sample order
+    int first_epoch = 0;
+    unsigned int seed = 0;
+    if (config->resume && config->checkpoint_path != NULL)
+    {
+        nnTrainState state;
+        int status = nnLoadCheckpoint(network, config->checkpoint_path, &state);
+        if (status > 0)
+        {
+            nnFreeOptimizer(optimizer);
+            return 1;
+        }
+        if (status == 0)
+        {
+            first_epoch = state.epoch;
+            seed = state.seed;
+            if (state.optimizer_arrays == optimizer->arrays)
+                nnOptimizerRestore(optimizer, network, state.optimizer_state);
+            else
+                printf("The checkpoint has no %s state, it starts from zero\n", nnOptimizerName(config->optimizer.type));
+            nnFreeTrainState(&state);
+        }
+        else if (use_pipeline)
+        {
+            seed = (unsigned int)rand();
+        }
+    }
+    else if (use_pipeline)
+    {
+        seed = (unsigned int)rand();
+    }
+    if (first_epoch >= config->epochs)
+    {
+        printf("Training already completed (%d epochs)\n", first_epoch);
+        nnFreeOptimizer(optimizer);
+        return 0;
+    }
+
+    nnTrainShared shared;
+    shared.network = network;
+    shared.source = *source;
+    shared.pipeline = NULL;
+    shared.batch = NULL;
+    shared.failed = 0;
+    shared.target_count = target_count;
+    shared.config = config;
+    shared.optimizer = optimizer;
+    shared.batch_size = batch_size;
+    shared.batches = (target_count + batch_size - 1) / batch_size;
+    shared.threads = threads;
+    shared.first_epoch = first_epoch;
+    shared.seed = seed;
+    shared.checkpointer = NULL;
+    shared.last_checkpoint = nnNowSeconds();
+    shared.workspaces = (nnTrainWorkspace *)calloc(threads, sizeof(nnTrainWorkspace));
+    shared.losses = (double *)calloc(threads, sizeof(double));
+    nnTrainWorker *workers = (nnTrainWorker *)calloc(threads, sizeof(nnTrainWorker));
+    if (shared.workspaces == NULL || shared.losses == NULL || workers == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for the training threads\n");
+        free(shared.workspaces);
+        free(shared.losses);
+        free(workers);
+        nnFreeOptimizer(optimizer);
+        return 1;
+    }
+
+    // in sync mode a thread only sees its slice of the batch, in hogwild mode whole batches
+    // every workspace lives in a single arena, released at once at the end
+    int worker_batch = config->parallel_mode == NN_PARALLEL_HOGWILD ? batch_size : (batch_size + threads - 1) / threads;
+    nnArena arena;
+    nnArenaMeasure(&arena);
+    for (int t = 0; t < threads; t++)
+        carve_workspace(&shared.workspaces[t], network, worker_batch, &arena);
+    int result = nnArenaCreate(&arena, arena.used);
+    if (result == 0)
+    {
+        for (int t = 0; t < threads; t++)
+            carve_workspace(&shared.workspaces[t], network, worker_batch, &arena);
+    }
+
+    if (result == 0 && use_pipeline)
+    {
+        nnPipelineConfig pipeline_config;
+        pipeline_config.batch_size = batch_size;
+        pipeline_config.producers = config->input_threads > 0 ? config->input_threads : 1;
+        pipeline_config.depth = 2 * (threads + pipeline_config.producers);
+        pipeline_config.shuffle = config->shuffle;
+        pipeline_config.max_shift = config->augment_shift;
+        pipeline_config.seed = seed;
+        pipeline_config.first_epoch = first_epoch;
+        shared.pipeline = nnCreatePipeline(source->dataset, nnPaddedCount(network->layers[0]->input_count),
+                                           nnPaddedCount(network->layers[network->layer_count - 1]->neuron_count),
+                                           config->epochs, &pipeline_config);
+        if (shared.pipeline == NULL)
+            result = 1;
+    }
+    if (result == 0 && config->checkpoint_path != NULL)
+    {
+        shared.checkpointer = nnCreateCheckpointer(network, optimizer->arrays, config->checkpoint_path);
+        if (shared.checkpointer == NULL)
+            result = 1;
+    }
+
+    if (result == 0)
+    {
+        printf("Starting training %d epochs on %d samples (batch size %d, %s, %d %s threads)...\n",
+               config->epochs - first_epoch, target_count, batch_size, nnOptimizerName(config->optimizer.type), threads,
+               config->parallel_mode == NN_PARALLEL_HOGWILD ? "hogwild" : "sync");
+
+        for (int t = 0; t < threads; t++)
+        {
+            workers[t].shared = &shared;
+            workers[t].id = t;
+        }
+        pthread_mutex_init(&shared.start_mutex, NULL);
+        pthread_cond_init(&shared.start_cond, NULL);
+        shared.start_state = 0;
+        int started = 1;
+        for (; started < threads; started++)
+        {
+            if (pthread_create(&workers[started].thread, NULL, train_worker, &workers[started]) != 0)
+            {
+                fprintf(stderr, "Unable to create training thread %d\n", started);
+                result = 1;
+                break;
+            }
+        }
+        // the barrier is only created once every thread runs, the started ones give up otherwise
+        int barrier_ready = 0;
+        if (result == 0)
+        {
+            barrier_ready = pthread_barrier_init(&shared.barrier, NULL, threads) == 0;
+            if (!barrier_ready)
+            {
+                fprintf(stderr, "Unable to create the barrier of the training threads\n");
+                result = 1;
+            }
+        }
+        open_start(&shared, result == 0 ? 1 : -1);
+        if (result == 0)
+            train_worker(&workers[0]);
+        for (int t = 1; t < started; t++)
+        {
+            pthread_join(workers[t].thread, NULL);
+        }
+        if (barrier_ready)
+            pthread_barrier_destroy(&shared.barrier);
+        pthread_cond_destroy(&shared.start_cond);
+        pthread_mutex_destroy(&shared.start_mutex);
+
+        if (result == 0 && shared.failed)
+        {
+            fprintf(stderr, "The input pipeline ran out of batches in the middle of an epoch\n");
+            result = 1;
+        }
+        if (result == 0)
+        {
+            printf("Training completed\n");
+            if (shared.pipeline != NULL)
+                nnPipelinePrintStats(shared.pipeline);
+        }
+    }
+    nnFreePipeline(shared.pipeline);
+    if (shared.checkpointer != NULL)
+    {
+        // waits for the last checkpoint to be on disk
+        nnCheckpointFinish(shared.checkpointer);
+        if (result == 0)
+            nnCheckpointPrintStats(shared.checkpointer);
+        nnFreeCheckpointer(shared.checkpointer);
+    }
+
+    nnArenaFree(&arena);
+    nnFreeOptimizer(optimizer);
+    free(shared.workspaces);
+    free(shared.losses);
+    free(workers);
+    return result;
+}
+
+int trainWithConfig(nnNetwork *network, nnReal **target_input, nnReal **target_output, int target_count, const nnTrainConfig *config)
+{
+    nnTrainSource source = {target_input, target_output, NULL};
+    return train_source(network, &source, target_count, config);
+}
+
+int trainDatasetWithConfig(nnNetwork *network, const nnDataset *dataset, const nnTrainConfig *config)
+{
+    if (network->layer_count == 0 || dataset->input_count != network->layers[0]->input_count ||
+        dataset->label_count != network->layers[network->layer_count - 1]->neuron_count)
+    {
+        fprintf(stderr, "The dataset (%d inputs, %d labels) does not match the network\n", dataset->input_count, dataset->label_count);
+        return 1;
+    }
+    nnTrainSource source = {NULL, NULL, dataset};
+    return train_source(network, &source, dataset->count, config);
+}
+
+// per-sample SGD, kept for compatibility with the original interface
+void train(nnNetwork *network, nnReal **target_input, nnReal **target_output, int target_count, double learning_rate, int epochs)
+{
+    nnTrainConfig config = nnDefaultTrainConfig();
+    config.learning_rate = learning_rate;
+    config.epochs = epochs;
+    config.batch_size = 1;
+    trainWithConfig(network, target_input, target_output, target_count, &config);
+}
@@ -0,0 +1,54 @@
+// include guard
+#ifndef NNTRAIN_H
+#define NNTRAIN_H
+
+#include "nnNetwork.h"
+#include "nnDataset.h"
+#include "nnPipeline.h"
+#include "nnCheckpoint.h"
+#include "nnOptimizer.h"
+
+typedef enum nnParallelMode
+{
+    NN_PARALLEL_SYNC,    // the batch is split across the threads, gradients are reduced before the update
+    NN_PARALLEL_HOGWILD, // every thread updates the shared weights asynchronously, without locks
+} nnParallelMode;
+
+typedef enum nnLoss
+{
+    NN_LOSS_MSE, // sum of the squared errors
+    // -sum t * log(y), for a softmax output layer (binary cross-entropy per output for a sigmoid one): fused
+    // with the output activation, the gradient at its input is just y - t
+    NN_LOSS_CROSS_ENTROPY,
+} nnLoss;
+
+typedef struct nnTrainConfig
+{
+    double learning_rate; // applied to the gradient averaged over the batch
+    nnOptimizerConfig optimizer;
+    int epochs;
+    int batch_size; // samples per weight update, 1 is plain per-sample SGD
+    int threads;    // worker threads, 1 trains on the calling thread only
+    nnParallelMode parallel_mode;
+    nnLoss loss; // cross-entropy needs a softmax or sigmoid output layer
+
+    // dataset training only (trainDatasetWithConfig): any of them moves the batch assembly to the input pipeline
+    int shuffle;       // a new sample order every epoch
+    int augment_shift; // random shift of every image by up to this many pixels, 0 disables it
+    int input_threads; // background threads assembling the batches (1 when only shuffle/augment_shift are set)
+
+    // checkpoints (nnCheckpoint.h), written in background after the last epoch and, when enabled, every
+    // checkpoint_epochs epochs or checkpoint_seconds seconds; a NULL path disables them
+    const char *checkpoint_path;
+    int checkpoint_epochs;
+    double checkpoint_seconds;
+    int resume; // continue from checkpoint_path when it exists: weights, epoch counter, seed and optimizer state
+} nnTrainConfig;
+
+nnTrainConfig nnDefaultTrainConfig(void);
+int trainWithConfig(nnNetwork *network, nnReal **target_input, nnReal **target_output, int target_count, const nnTrainConfig *config);
+// same training, the batches are assembled straight from the uint8 samples of the dataset
+int trainDatasetWithConfig(nnNetwork *network, const nnDataset *dataset, const nnTrainConfig *config);
+void train(nnNetwork *network, nnReal **target_input, nnReal **target_output, int target_count, double learning_rate, int epochs);
+
+#endif // NNTRAIN_H
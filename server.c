@@ -0,0 +1,99 @@
+// Inference server: loads a trained network once and answers predictions over a Unix domain socket,
+// coalescing the concurrent requests into micro-batches (nnServer.h).
+//   ./nn_server [<model>] [--socket <path>] [--workers <n>] [--max-batch <n>] [--max-latency-us <n>] [--int8]
+// The model defaults to the one written by simple_nn; --int8 serves its int8 engine (the model must be quantized),
+// which also runs the smaller int8-only model (trained_network.int8.bin).
+// SIGINT/SIGTERM stop the server once the requests in flight are answered.
+#include "nnNetwork.h"
+#include "nnServer.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODEL_BAK "trained_network.bin"
+
+static nnServer *running_server = NULL;
+
+static void handle_signal(int signal_number)
+{
+    (void)signal_number;
+    if (running_server != NULL)
+        nnServerStop(running_server);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [<model>] [--socket <path>] [--workers <n>] [--max-batch <n>] [--max-latency-us <n>] [--int8]\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    const char *model = MODEL_BAK;
+    nnServerConfig config = nnDefaultServerConfig();
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+        {
+            config.socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+        {
+            config.workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-batch") == 0 && i + 1 < argc)
+        {
+            config.max_batch = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-latency-us") == 0 && i + 1 < argc)
+        {
+            config.max_latency_us = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--int8") == 0)
+        {
+            config.quantized = 1;
+        }
+        else if (argv[i][0] != '-')
+        {
+            model = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    nnNetwork *network = nnLoadNetwork(model);
+    if (network == NULL)
+    {
+        fprintf(stderr, "Cannot load the model %s, train one with simple_nn first\n", model);
+        return 1;
+    }
+    nnServer *server = nnCreateServer(network, &config);
+    if (server == NULL)
+    {
+        nnFreeNetwork(network);
+        return 1;
+    }
+
+    // no SA_RESTART: a signal interrupts accept()
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigemptyset(&action.sa_mask);
+    running_server = server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("serving %s on %s: %d workers, batches of up to %d, %d us max latency%s\n", model, config.socket_path, config.workers,
+           config.max_batch, config.max_latency_us, config.quantized ? ", int8" : "");
+    fflush(stdout);
+    int status = nnServerRun(server);
+
+    running_server = NULL;
+    nnFreeServer(server);
+    nnFreeNetwork(network);
+    return status;
+}